@@ -0,0 +1,278 @@
+// Recognizes a long list of recordings in one process, loading the model once, and spreading the files over
+// worker threads, each recognizing one file at a time on a context of its own bound to the shared model.
+// The list comes one path per line, from a file or standard input, and each file is raw 16-bit little endian
+// mono audio, recognized in one shot mode, as a single utterance, or with --free-running, as any number of
+// utterances found by their energy, the same as full_reco, but ending any utterance still going at the end of
+// the file. Results go to standard output in the order of the list, as tab separated lines: the path, the
+// word, its score, and the times of the first frame matched and of the frame after the last, in seconds, one
+// line per result, or just the path and a dash if nothing was recognized. Only a few files per thread are
+// ever in flight or waiting their turn to be printed, so memory stays bounded however long the list is.
+// A summary of throughput goes to standard error at the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tinysr.h"
+
+#define READ_SAMPS 4096
+// How many files each thread may have in flight or finished ahead of the next one to be printed.
+#define FILES_PER_THREAD 4
+
+typedef struct {
+	char* path;
+	// Once done, the lines to print for the file, or the errno it failed with, and how much audio it held.
+	char* output;
+	int error;
+	double audio_seconds;
+	int done;
+} slot_t;
+
+typedef struct {
+	tinysr_model_t* model;
+	tinysr_frontend_plan_t* plan;
+	int free_running, pruned, sample_rate;
+	// A ring of window slots, holding file number n in slots[n % window]. Files are numbered in list order:
+	// read is how many have been read from the list, claimed how many a worker has taken, and printed how
+	// many have been written out, so claimed files up to printed + window are all that's ever held.
+	slot_t* slots;
+	int window;
+	long long read, claimed, printed;
+	int end_of_list;
+	// The time workers have spent on files, summed over every worker.
+	double busy_seconds;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready, file_done;
+} batch_t;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Prints every result waiting on the context.
+static void print_results(batch_t* batch, tinysr_ctx_t* ctx, FILE* out, const char* path, int* results) {
+	int word_index;
+	tinysr_score_t score;
+	long long first_frame, end_frame;
+	double frame_seconds = batch->plan->shift_interval / (double) batch->plan->sample_rate;
+	while (tinysr_get_result_span(ctx, &word_index, &score, &first_frame, &end_frame)) {
+		fprintf(out, "%s\t%s\t%.3f\t%.2f\t%.2f\n", path, ctx->word_names[word_index], TINYSR_SCORE_TO_FLOAT(score),
+			(first_frame - 1) * frame_seconds, (end_frame - 1) * frame_seconds);
+		(*results)++;
+	}
+}
+
+// Recognizes one file into its slot, streaming it through a fresh context a block at a time.
+static void recognize_file(batch_t* batch, slot_t* slot) {
+	FILE* fp = fopen(slot->path, "rb");
+	if (fp == NULL) {
+		slot->error = errno;
+		return;
+	}
+	tinysr_ctx_t* ctx = tinysr_allocate_context_with_plan(batch->plan);
+	if (ctx == NULL || tinysr_bind_model(ctx, batch->model)) {
+		slot->error = ENOMEM;
+		tinysr_free_context(ctx);
+		fclose(fp);
+		return;
+	}
+	ctx->input_sample_rate = batch->sample_rate;
+	ctx->utterance_mode = batch->free_running ? TINYSR_MODE_FREE_RUNNING : TINYSR_MODE_ONE_SHOT;
+	ctx->dtw_mode = batch->pruned ? TINYSR_DTW_PRUNED : TINYSR_DTW_EXACT;
+	size_t output_length;
+	FILE* out = open_memstream(&slot->output, &output_length);
+	samp_t samples[READ_SAMPS];
+	long long total = 0;
+	int results = 0;
+	for (;;) {
+		size_t samples_read = fread(samples, sizeof(samp_t), READ_SAMPS, fp);
+		if (samples_read == 0)
+			break;
+		total += samples_read;
+		// In one shot mode, everything fed in before detection makes one utterance, so only feed until the end.
+		if (batch->free_running) {
+			tinysr_recognize(ctx, samples, (int) samples_read);
+			print_results(batch, ctx, out, slot->path, &results);
+		} else {
+			tinysr_feed_input(ctx, samples, (int) samples_read);
+		}
+	}
+	if (ferror(fp))
+		slot->error = EIO;
+	if (batch->free_running) {
+		// Recordings often stop right after the last word, so follow each with silence, to end any utterance still going.
+		int silence = batch->sample_rate / 2;
+		memset(samples, 0, sizeof(samples));
+		for (; silence > 0; silence -= READ_SAMPS) {
+			tinysr_recognize(ctx, samples, silence < READ_SAMPS ? silence : READ_SAMPS);
+			print_results(batch, ctx, out, slot->path, &results);
+		}
+	} else {
+		tinysr_detect_utterances(ctx);
+		tinysr_recognize_utterances(ctx);
+		print_results(batch, ctx, out, slot->path, &results);
+	}
+	if (results == 0)
+		fprintf(out, "%s\t-\n", slot->path);
+	fclose(out);
+	slot->audio_seconds = total / (double) batch->sample_rate;
+	tinysr_free_context(ctx);
+	fclose(fp);
+}
+
+static void* worker(void* arg) {
+	batch_t* batch = arg;
+	pthread_mutex_lock(&batch->lock);
+	for (;;) {
+		while (batch->claimed == batch->read && !batch->end_of_list)
+			pthread_cond_wait(&batch->work_ready, &batch->lock);
+		if (batch->claimed == batch->read)
+			break;
+		slot_t* slot = &batch->slots[batch->claimed++ % batch->window];
+		pthread_mutex_unlock(&batch->lock);
+		double start = now();
+		recognize_file(batch, slot);
+		double elapsed = now() - start;
+		pthread_mutex_lock(&batch->lock);
+		batch->busy_seconds += elapsed;
+		slot->done = 1;
+		pthread_cond_signal(&batch->file_done);
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+// Reads the next path from the list, without its line ending, skipping blank lines. Returns NULL at the end.
+static char* read_path(FILE* list) {
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &capacity, list)) >= 0) {
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+			line[--length] = 0;
+		if (length > 0)
+			return line;
+	}
+	free(line);
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	batch_t batch = {0};
+	int thread_count = sysconf(_SC_NPROCESSORS_ONLN), first = 1, i;
+	batch.sample_rate = 16000;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--free-running") == 0) {
+			batch.free_running = 1;
+			first++;
+		} else if (strcmp(argv[first], "--pruned") == 0) {
+			batch.pruned = 1;
+			first++;
+		} else if (strcmp(argv[first], "--threads") == 0 && first + 1 < argc) {
+			thread_count = atoi(argv[first + 1]);
+			first += 2;
+		} else if (strcmp(argv[first], "--rate") == 0 && first + 1 < argc) {
+			batch.sample_rate = atoi(argv[first + 1]);
+			first += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc - first != 2 || batch.sample_rate <= 0) {
+		printf("Usage: batch_reco [--free-running] [--pruned] [--threads n] [--rate hz] <speech_model> <file list|->\n");
+		printf("Recognizes every file in the list, one path per line, or from standard input for -, on n threads (by default, one per core).\n");
+		printf("Each file is mono 16-bit signed little endian raw audio, at 16000 Hz unless given --rate, recognized as one utterance,\n");
+		printf("or with --free-running, as any number of utterances. Prints, in list order, a line per result:\n");
+		printf("path, word, score, start and end in seconds, separated by tabs, or the path and - when nothing is recognized.\n");
+		return 1;
+	}
+	thread_count = thread_count < 1 ? 1 : thread_count;
+	FILE* list = strcmp(argv[first + 1], "-") == 0 ? stdin : fopen(argv[first + 1], "r");
+	if (list == NULL) {
+		perror(argv[first + 1]);
+		return 1;
+	}
+	batch.model = tinysr_model_create(NULL);
+	int word_count = tinysr_model_load(batch.model, argv[first]);
+	if (word_count <= 0) {
+		fprintf(stderr, "Couldn't load a model from %s.\n", argv[first]);
+		return 1;
+	}
+	batch.plan = tinysr_frontend_plan_create_default();
+	batch.window = thread_count * FILES_PER_THREAD;
+	batch.slots = calloc(batch.window, sizeof(slot_t));
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.work_ready, NULL);
+	pthread_cond_init(&batch.file_done, NULL);
+	fprintf(stderr, "Recognizing with %i words, on %i threads.\n", word_count, thread_count);
+
+	double start = now(), audio_seconds = 0;
+	pthread_t* threads = malloc(sizeof(pthread_t) * thread_count);
+	for (i = 0; i < thread_count; i++)
+		pthread_create(&threads[i], NULL, worker, &batch);
+	// This thread reads the list, keeping the window full, and prints each file's results once every file
+	// before it has been printed.
+	long long failed = 0;
+	pthread_mutex_lock(&batch.lock);
+	for (;;) {
+		slot_t* slot = &batch.slots[batch.printed % batch.window];
+		if (batch.printed < batch.read && slot->done) {
+			pthread_mutex_unlock(&batch.lock);
+			if (slot->error != 0) {
+				fprintf(stderr, "%s: %s\n", slot->path, strerror(slot->error));
+				failed++;
+			} else {
+				fputs(slot->output, stdout);
+			}
+			audio_seconds += slot->audio_seconds;
+			free(slot->path);
+			free(slot->output);
+			memset(slot, 0, sizeof(slot_t));
+			pthread_mutex_lock(&batch.lock);
+			batch.printed++;
+			continue;
+		}
+		if (!batch.end_of_list && batch.read < batch.printed + batch.window) {
+			pthread_mutex_unlock(&batch.lock);
+			char* path = read_path(list);
+			pthread_mutex_lock(&batch.lock);
+			if (path == NULL) {
+				batch.end_of_list = 1;
+				pthread_cond_broadcast(&batch.work_ready);
+			} else {
+				batch.slots[batch.read++ % batch.window].path = path;
+				pthread_cond_signal(&batch.work_ready);
+			}
+			continue;
+		}
+		if (batch.end_of_list && batch.printed == batch.read)
+			break;
+		pthread_cond_wait(&batch.file_done, &batch.lock);
+	}
+	pthread_mutex_unlock(&batch.lock);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = now() - start;
+
+	fflush(stdout);
+	fprintf(stderr, "=== %lld files (%lld failed), %.1f s of audio, in %.2f s on %i threads.\n", batch.read, failed, audio_seconds, elapsed, thread_count);
+	fprintf(stderr, "Throughput: %.1f files/s, %.1fx real time.\n", batch.read / elapsed, audio_seconds / elapsed);
+	fprintf(stderr, "Real-time factor per thread: %.4f, with threads busy %.0f%% of the time.\n",
+		audio_seconds > 0 ? batch.busy_seconds / audio_seconds : 0, 100 * batch.busy_seconds / (elapsed * thread_count));
+
+	if (list != stdin)
+		fclose(list);
+	free(threads);
+	free(batch.slots);
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.work_ready);
+	pthread_cond_destroy(&batch.file_done);
+	tinysr_frontend_plan_free(batch.plan);
+	tinysr_model_release(batch.model);
+	return failed > 0;
+}
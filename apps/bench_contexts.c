@@ -0,0 +1,108 @@
+// Measures the memory and set up time of many contexts recognizing with the same vocabulary, first with each
+// loading its own copy of the model, and then with all of them bound to one shared model. Every context
+// shares one front-end plan, and is fed the same two seconds of audio, so that its buffers reach their
+// steady state sizes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "tinysr.h"
+
+#define DEFAULT_CONTEXTS 500
+#define AUDIO_LENGTH 32000
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// An allocator that keeps track of how many bytes are live, by stashing each block's size in front of it.
+typedef struct {
+	long long live;
+} tracking_t;
+
+static void* tracking_allocate(void* user, size_t size) {
+	long long* block = malloc(sizeof(long long) * 2 + size);
+	if (block == NULL)
+		return NULL;
+	block[0] = size;
+	((tracking_t*) user)->live += size;
+	return block + 2;
+}
+
+static void tracking_release(void* user, void* ptr) {
+	if (ptr == NULL)
+		return;
+	long long* block = (long long*) ptr - 2;
+	((tracking_t*) user)->live -= block[0];
+	free(block);
+}
+
+// Feeds every context the audio, then reports the memory per context, not counting any shared model.
+static void run(const char* name, tinysr_ctx_t** ctxs, int count, samp_t* audio, tracking_t* tracking, long long model_bytes, double setup) {
+	int i;
+	for (i = 0; i < count; i++) {
+		tinysr_recognize(ctxs[i], audio, AUDIO_LENGTH);
+		while (tinysr_get_result(ctxs[i], NULL, NULL));
+	}
+	printf("%-8s %10.1f ", name, (tracking->live - model_bytes) / 1024.0 / count);
+	if (model_bytes > 0)
+		printf("%12.1f", model_bytes / 1024.0);
+	else
+		printf("%12s", "-");
+	printf(" %12.1f %10.3f\n", tracking->live / 1024.0 / 1024.0, setup * 1e3 / count);
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2 && argc != 3) {
+		printf("Usage: bench_contexts <speech_model> [contexts]\n");
+		return 1;
+	}
+	int count = argc == 3 ? atoi(argv[2]) : DEFAULT_CONTEXTS, i;
+	tinysr_frontend_plan_t* plan = tinysr_frontend_plan_create_default();
+	tracking_t tracking = {0};
+	tinysr_allocator_t allocator = {tracking_allocate, tracking_release, &tracking};
+	tinysr_ctx_t** ctxs = malloc(sizeof(tinysr_ctx_t*) * count);
+	static samp_t audio[AUDIO_LENGTH];
+	for (i = 0; i < AUDIO_LENGTH; i++) {
+		float envelope = i > 8000 && i < 20000 ? sinf((i - 8000) * 6.2831853f / 24000) : 0.0f;
+		audio[i] = (samp_t) (8000 * envelope * (sinf(i * 0.03f) + 0.5f * sinf(i * 0.11f)) + rand() % 60);
+	}
+	printf("%i contexts.\n", count);
+	printf("%-8s %10s %12s %12s %10s\n", "model", "KiB/ctx", "model KiB", "total MiB", "ms/ctx");
+
+	// Each context with its own copy.
+	double start = now();
+	for (i = 0; i < count; i++) {
+		ctxs[i] = tinysr_allocate_context_with_allocator(plan, &allocator, 0);
+		ctxs[i]->input_sample_rate = 16000;
+		if (tinysr_load_model(ctxs[i], argv[1]) <= 0) {
+			printf("Couldn't load model: %s\n", argv[1]);
+			return 1;
+		}
+	}
+	run("copied", ctxs, count, audio, &tracking, 0, now() - start);
+	for (i = 0; i < count; i++)
+		tinysr_free_context(ctxs[i]);
+
+	// All of them bound to one model.
+	start = now();
+	tinysr_model_t* model = tinysr_model_create(&allocator);
+	tinysr_model_load(model, argv[1]);
+	long long model_bytes = tracking.live;
+	for (i = 0; i < count; i++) {
+		ctxs[i] = tinysr_allocate_context_with_allocator(plan, &allocator, 0);
+		ctxs[i]->input_sample_rate = 16000;
+		tinysr_bind_model(ctxs[i], model);
+	}
+	tinysr_model_release(model);
+	run("shared", ctxs, count, audio, &tracking, model_bytes, now() - start);
+	for (i = 0; i < count; i++)
+		tinysr_free_context(ctxs[i]);
+
+	free(ctxs);
+	tinysr_frontend_plan_free(plan);
+	return 0;
+}
@@ -0,0 +1,501 @@
+// Micro-benchmarks for the hot paths: the FFT, the front-end for one frame, feeding input at each common
+// sample rate, Gaussian scoring, and dynamic time warping, from the reference implementation up to
+// recognition's batched and pruned matching, across utterance lengths and vocabulary sizes.
+// Everything runs on synthetic data from a fixed seed, including the models, so no training data is needed,
+// and every build measures exactly the same work. Each benchmark is warmed up, then timed as a number of
+// samples, each long enough to time accurately, and reported as the minimum, median, 90th percentile, mean
+// and standard deviation of the time per operation. With --json, the results go to a file as well, one
+// benchmark per line, and --compare reads such a file back, to show how each median has changed since.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "tinysr.h"
+
+#define MAX_SAMPLES 21
+#define MAX_BENCHMARKS 128
+#define STATES_PER_WORD 30
+#define UTTERANCE_NOISE 1.5f
+
+typedef struct {
+	char name[80];
+	const char* unit;
+	int samples;
+	long long iterations;
+	double min, median, p90, mean, stddev;
+	// From --compare, or negative if the baseline didn't have this benchmark.
+	double baseline, baseline_stddev;
+} bench_result_t;
+
+static bench_result_t results[MAX_BENCHMARKS];
+static int result_count;
+// Each sample runs for about this long, and each benchmark for at most about budget, once it has three samples.
+static double sample_seconds = 2e-3, budget_seconds = 1.0;
+static int max_samples = MAX_SAMPLES;
+static const char* filter;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// A fixed sequence of pseudorandom numbers (xorshift), the same on every platform. Each benchmark's data
+// starts from a seed of its own, so that it's the same whichever others run.
+static uint32_t random_state;
+
+static void random_seed(uint32_t seed) {
+	random_state = 2463534242u ^ (seed * 2654435761u);
+	random_state += random_state == 0;
+}
+
+static uint32_t random_next(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static float random_uniform(void) {
+	return (random_next() >> 8) / 16777216.0f;
+}
+
+// Whether --filter picked a benchmark.
+static int selected(const char* name) {
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Times run(arg, iterations), which does ops_per_iteration operations per iteration. The iteration count is
+// doubled until a sample takes sample_seconds, which also warms up, and then one more sample is thrown away.
+static void bench(const char* name, const char* unit, void (*run)(void* arg, int iterations), void* arg, int ops_per_iteration) {
+	if (!selected(name) || result_count == MAX_BENCHMARKS)
+		return;
+	bench_result_t* result = &results[result_count++];
+	memset(result, 0, sizeof(bench_result_t));
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->unit = unit;
+	result->baseline = -1;
+	int iterations = 1, i;
+	double elapsed, start;
+	for (;;) {
+		start = now();
+		run(arg, iterations);
+		elapsed = now() - start;
+		if (elapsed >= sample_seconds || iterations >= 1 << 24)
+			break;
+		iterations *= 2;
+	}
+	run(arg, iterations);
+	double per_op[MAX_SAMPLES], total = 0, started = now();
+	for (i = 0; i < max_samples && (i < 3 || now() - started < budget_seconds); i++) {
+		start = now();
+		run(arg, iterations);
+		per_op[i] = (now() - start) * 1e9 / ((double) iterations * ops_per_iteration);
+		total += per_op[i];
+	}
+	result->samples = i;
+	result->iterations = (long long) iterations * ops_per_iteration;
+	result->mean = total / result->samples;
+	for (i = 0; i < result->samples; i++)
+		result->stddev += (per_op[i] - result->mean) * (per_op[i] - result->mean);
+	result->stddev = sqrt(result->stddev / (result->samples > 1 ? result->samples - 1 : 1));
+	qsort(per_op, result->samples, sizeof(double), compare_doubles);
+	result->min = per_op[0];
+	result->median = per_op[result->samples / 2];
+	result->p90 = per_op[(result->samples * 9 + 9) / 10 - 1];
+	printf("%-44s %12.1f ns/%-7s (min %.1f, p90 %.1f, +-%.1f%%)\n", result->name, result->median, result->unit,
+		result->min, result->p90, 100 * result->stddev / (result->mean > 0 ? result->mean : 1));
+	fflush(stdout);
+}
+
+// The FFT, on fft_length samples of noise, copied in fresh for each transform, as the front-end does.
+typedef struct {
+	tinysr_fft_plan_t* plan;
+	int length;
+	float* input, * work, * out;
+} fft_bench_t;
+
+static void run_reference_fft(void* arg, int iterations) {
+	fft_bench_t* b = arg;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		memcpy(b->work, b->input, sizeof(float) * b->length);
+		tinysr_abs_fft(b->work, b->length);
+	}
+}
+
+static void run_planned_fft(void* arg, int iterations) {
+	fft_bench_t* b = arg;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		memcpy(b->work, b->input, sizeof(float) * b->length);
+		tinysr_fft_real_abs(b->plan, b->work, b->out);
+	}
+}
+
+static void bench_fft(void) {
+	int lengths[] = {256, 512, 1024}, k, i;
+	char name[80];
+	for (k = 0; k < 3; k++) {
+		fft_bench_t b;
+		random_seed(lengths[k]);
+		b.length = lengths[k];
+		b.plan = tinysr_fft_plan_create(b.length);
+		// The reference FFT works on interleaved complex data, with room for the real input's imaginary parts.
+		b.input = calloc(2 * b.length, sizeof(float));
+		b.work = calloc(2 * b.length, sizeof(float));
+		b.out = calloc(b.length + 1, sizeof(float));
+		for (i = 0; i < b.length; i++)
+			b.input[i] = 2 * random_uniform() - 1;
+		snprintf(name, sizeof(name), "fft/reference/%i", b.length);
+		bench(name, "fft", run_reference_fft, &b, 1);
+		snprintf(name, sizeof(name), "fft/planned/%i", b.length);
+		bench(name, "fft", run_planned_fft, &b, 1);
+		tinysr_fft_plan_free(b.plan);
+		free(b.input);
+		free(b.work);
+		free(b.out);
+	}
+}
+
+// Drops every feature vector waiting on the context, so that its ring doesn't grow.
+static void drain(tinysr_ctx_t* ctx) {
+	ctx->fv_oldest = ctx->fv_checked = ctx->next_fv_number;
+}
+
+// The front-end, one frame at a time, on whatever is in the input buffer.
+static void run_process_frame(void* arg, int iterations) {
+	tinysr_ctx_t* ctx = arg;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		tinysr_process_frame(ctx);
+		if ((i & 255) == 255)
+			drain(ctx);
+	}
+	drain(ctx);
+}
+
+// Feeding a second of audio, from resampling through the front-end, in blocks of 10 ms.
+typedef struct {
+	tinysr_ctx_t* ctx;
+	samp_t* audio;
+	int rate;
+} feed_bench_t;
+
+static void run_feed(void* arg, int iterations) {
+	feed_bench_t* b = arg;
+	int i, block = b->rate / 100, first;
+	for (i = 0; i < iterations; i++) {
+		for (first = 0; first + block <= b->rate; first += block)
+			tinysr_feed_input(b->ctx, b->audio + first, block);
+		drain(b->ctx);
+	}
+}
+
+static void bench_frontend(void) {
+	char name[80];
+	int i, r;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	samp_t* audio = malloc(sizeof(samp_t) * 48000);
+	random_seed(48000);
+	for (i = 0; i < 48000; i++)
+		audio[i] = (samp_t) (4000 * sinf(i * 0.03f) * sinf(i * 0.0007f) + 2000 * (random_uniform() - 0.5f));
+	// Fill the input buffer with a frame of audio.
+	tinysr_feed_input(ctx, audio, ctx->frontend_plan->frame_length);
+	drain(ctx);
+#ifndef TINYSR_FIXED_POINT
+	tinysr_kernel_level_t level;
+	for (level = TINYSR_KERNELS_SCALAR; level <= TINYSR_KERNELS_AVX2; level++) {
+		const tinysr_kernels_t* kernels = tinysr_get_kernels(level);
+		if (kernels == NULL)
+			continue;
+		ctx->kernels = kernels;
+		snprintf(name, sizeof(name), "process_frame/%s", kernels->name);
+		bench(name, "frame", run_process_frame, ctx, 1);
+	}
+	ctx->kernels = tinysr_select_kernels();
+#else
+	bench("process_frame/fixed", "frame", run_process_frame, ctx, 1);
+#endif
+	tinysr_free_context(ctx);
+	int rates[] = {16000, 44100, 48000};
+	for (r = 0; r < 3; r++) {
+		feed_bench_t b = {tinysr_allocate_context(), audio, rates[r]};
+		b.ctx->input_sample_rate = rates[r];
+		snprintf(name, sizeof(name), "feed_input/%i", rates[r]);
+		bench(name, "second", run_feed, &b, 1);
+		tinysr_free_context(b.ctx);
+	}
+	free(audio);
+}
+
+// A synthetic model of the given number of words, each STATES_PER_WORD states long, with random means, and
+// random inverse covariances, made positive definite by building them as A A^T plus a diagonal.
+static tinysr_model_t* synthesize_model(int words, int diagonal) {
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	int w, s, i, j, k;
+	for (w = 0; w < words; w++) {
+		char name[32];
+		// Each state's log likelihood offset, mean and inverse covariance.
+		float ll_offsets[STATES_PER_WORD], means[STATES_PER_WORD * 13], inverse_covariances[STATES_PER_WORD * 169], a[169];
+		snprintf(name, sizeof(name), "word%i", w);
+		for (s = 0; s < STATES_PER_WORD; s++) {
+			float* p = inverse_covariances + s * 169;
+			ll_offsets[s] = -20 - 10 * random_uniform();
+			for (i = 0; i < 13; i++)
+				means[s * 13 + i] = 10 * random_uniform() - 5;
+			for (i = 0; i < 169; i++)
+				a[i] = diagonal ? 0 : 0.3f * (random_uniform() - 0.5f);
+			for (i = 0; i < 13; i++) {
+				for (j = 0; j <= i; j++) {
+					float sum = i == j ? 0.2f + 0.5f * random_uniform() : 0;
+					for (k = 0; k < 13; k++)
+						sum += a[i * 13 + k] * a[j * 13 + k];
+					p[i * 13 + j] = p[j * 13 + i] = sum;
+				}
+			}
+		}
+		if (tinysr_model_add_word(model, name, 0, 1, STATES_PER_WORD, ll_offsets, means, inverse_covariances) != w) {
+			printf("Couldn't make a synthetic model of %i words\n", words);
+			exit(1);
+		}
+	}
+	return model;
+}
+
+// An utterance of the given length, walking evenly through a word's states, with noise on every coefficient.
+static void synthesize_utterance(recog_entry_t* entry, int length, utterance_t* utterance) {
+	int f, j;
+	utterance->length = length;
+	utterance->feature_vectors = calloc(length, sizeof(feature_vector_t));
+	for (f = 0; f < length; f++) {
+		gaussian_t* state = &entry->model_template[(long long) f * entry->model_template_length / length];
+		feature_vector_t* fv = &utterance->feature_vectors[f];
+		fv->number = f;
+		for (j = 0; j < 13; j++)
+			fv->cepstrum[j] = TINYSR_FEATURE(TINYSR_FEATURE_TO_FLOAT(state->cepstrum_mean[j]) + UTTERANCE_NOISE * (2 * random_uniform() - 1));
+	}
+}
+
+// Gaussian scoring, one Gaussian against one frame at a time, cycling through some of each.
+typedef struct {
+	gaussian_t* gaussians;
+	utterance_t utterance;
+	tinysr_score_t sink;
+} gaussian_bench_t;
+
+static void run_gaussian(void* arg, int iterations) {
+	gaussian_bench_t* b = arg;
+	int i;
+	for (i = 0; i < iterations; i++)
+		b->sink += gaussian_log_likelihood(&b->gaussians[i % STATES_PER_WORD], &b->utterance.feature_vectors[i % b->utterance.length]);
+}
+
+static void bench_gaussians(void) {
+	int diagonal;
+	for (diagonal = 0; diagonal < 2; diagonal++) {
+		random_seed(1 + diagonal);
+		tinysr_model_t* model = synthesize_model(1, diagonal);
+		tinysr_ctx_t* ctx = tinysr_allocate_context();
+		tinysr_bind_model(ctx, model);
+		recog_entry_t* entry = ctx->recog_entry_list.head->datum;
+		gaussian_bench_t b = {entry->model_template};
+		synthesize_utterance(entry, 97, &b.utterance);
+		bench(diagonal ? "gaussian_log_likelihood/diagonal" : "gaussian_log_likelihood/full", "call", run_gaussian, &b, 1);
+		free(b.utterance.feature_vectors);
+		tinysr_free_context(ctx);
+		tinysr_model_release(model);
+	}
+}
+
+// Matching one utterance against the whole vocabulary: cell by cell with the reference implementation, or
+// the way recognition does, exactly or pruned.
+typedef struct {
+	tinysr_ctx_t* ctx;
+	utterance_t utterance;
+	tinysr_score_t* dp_row;
+	tinysr_score_t sink;
+} dtw_bench_t;
+
+static void run_reference_dtw(void* arg, int iterations) {
+	dtw_bench_t* b = arg;
+	list_node_t* re;
+	int i;
+	for (i = 0; i < iterations; i++)
+		for (re = b->ctx->recog_entry_list.head; re != NULL; re = re->next)
+			b->sink += compute_dynamic_time_warping(re->datum, &b->utterance, b->dp_row);
+}
+
+static void run_recognize(void* arg, int iterations) {
+	dtw_bench_t* b = arg;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		tinysr_recognize_utterance(b->ctx, &b->utterance);
+		tinysr_get_result(b->ctx, NULL, NULL);
+	}
+}
+
+static void bench_dtw(void) {
+	int vocabularies[] = {10, 100, 1000}, lengths[] = {50, 100, 200, 400}, v, l;
+	const char* methods[] = {"reference", "exact", "pruned"};
+	char name[80];
+	for (v = 0; v < 3; v++) {
+		// The largest vocabulary takes a while to make, so only make what's needed.
+		int wanted[4], any = 0, k;
+		for (l = 0; l < 4; l++) {
+			wanted[l] = 0;
+			for (k = 0; k < 3; k++) {
+				snprintf(name, sizeof(name), "dtw/%s/words=%i/frames=%i", methods[k], vocabularies[v], lengths[l]);
+				wanted[l] |= selected(name);
+			}
+			any |= wanted[l];
+		}
+		if (!any)
+			continue;
+		random_seed(vocabularies[v]);
+		tinysr_model_t* model = synthesize_model(vocabularies[v], 0);
+		for (l = 0; l < 4; l++) {
+			if (!wanted[l])
+				continue;
+			random_seed(vocabularies[v] * 1000 + lengths[l]);
+			dtw_bench_t b = {tinysr_allocate_context()};
+			tinysr_bind_model(b.ctx, model);
+			b.dp_row = malloc(sizeof(tinysr_score_t) * STATES_PER_WORD);
+			// An utterance of a word from the middle of the vocabulary.
+			list_node_t* re = b.ctx->recog_entry_list.head;
+			int w;
+			for (w = 0; w < vocabularies[v] / 2; w++)
+				re = re->next;
+			synthesize_utterance(re->datum, lengths[l], &b.utterance);
+			// The reference implementation takes seconds per utterance against the largest vocabularies.
+			if (vocabularies[v] * lengths[l] <= 100 * 200) {
+				snprintf(name, sizeof(name), "dtw/reference/words=%i/frames=%i", vocabularies[v], lengths[l]);
+				bench(name, "utter", run_reference_dtw, &b, 1);
+			}
+			snprintf(name, sizeof(name), "dtw/exact/words=%i/frames=%i", vocabularies[v], lengths[l]);
+			bench(name, "utter", run_recognize, &b, 1);
+			b.ctx->dtw_mode = TINYSR_DTW_PRUNED;
+			snprintf(name, sizeof(name), "dtw/pruned/words=%i/frames=%i", vocabularies[v], lengths[l]);
+			bench(name, "utter", run_recognize, &b, 1);
+			free(b.utterance.feature_vectors);
+			free(b.dp_row);
+			tinysr_free_context(b.ctx);
+		}
+		tinysr_model_release(model);
+	}
+}
+
+// Reads the medians and their spread out of a file written with --json, returning non-zero if it can't be read.
+static int read_baseline(const char* path) {
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL)
+		return 1;
+	char line[512], name[80];
+	double median, stddev;
+	int i;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		const char* field = strstr(line, "\"median_ns\": ");
+		const char* spread = strstr(line, "\"stddev_ns\": ");
+		if (sscanf(line, " {\"name\": \"%79[^\"]\"", name) != 1 || field == NULL || sscanf(field, "\"median_ns\": %lf", &median) != 1)
+			continue;
+		if (spread == NULL || sscanf(spread, "\"stddev_ns\": %lf", &stddev) != 1)
+			stddev = 0;
+		for (i = 0; i < result_count; i++)
+			if (strcmp(results[i].name, name) == 0) {
+				results[i].baseline = median;
+				results[i].baseline_stddev = stddev;
+			}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int write_json(const char* path) {
+	FILE* fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if (fp == NULL)
+		return 1;
+	int i;
+#ifdef TINYSR_FIXED_POINT
+	fprintf(fp, "{\n  \"build\": \"fixed\",\n  \"benchmarks\": [\n");
+#else
+	fprintf(fp, "{\n  \"build\": \"float\",\n  \"kernels\": \"%s\",\n  \"benchmarks\": [\n", tinysr_select_kernels()->name);
+#endif
+	for (i = 0; i < result_count; i++) {
+		bench_result_t* r = &results[i];
+		fprintf(fp, "    {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %i, \"iterations\": %lld, \"min_ns\": %.3f, \"median_ns\": %.3f, "
+			"\"p90_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f}%s\n", r->name, r->unit, r->samples, r->iterations,
+			r->min, r->median, r->p90, r->mean, r->stddev, i < result_count - 1 ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	return fp == stdout ? fflush(fp) != 0 : fclose(fp) != 0;
+}
+
+int main(int argc, char** argv) {
+	const char* json_path = NULL, * baseline_path = NULL;
+	int first = 1, i;
+	while (first < argc) {
+		if (strcmp(argv[first], "--quick") == 0) {
+			sample_seconds = 5e-4;
+			budget_seconds = 0.1;
+			max_samples = 7;
+			first++;
+		} else if (strcmp(argv[first], "--json") == 0 && first + 1 < argc) {
+			json_path = argv[first + 1];
+			first += 2;
+		} else if (strcmp(argv[first], "--compare") == 0 && first + 1 < argc) {
+			baseline_path = argv[first + 1];
+			first += 2;
+		} else if (strcmp(argv[first], "--filter") == 0 && first + 1 < argc) {
+			filter = argv[first + 1];
+			first += 2;
+		} else {
+			printf("Usage: bench_kernels [--quick] [--filter substring] [--json output.json|-] [--compare baseline.json]\n");
+			printf("Runs every micro-benchmark whose name contains the filter, on synthetic data.\n");
+			printf("--quick takes fewer, shorter samples, --json writes the results as JSON, one benchmark per line,\n");
+			printf("and --compare shows how each median has changed since a file --json wrote.\n");
+			return 1;
+		}
+	}
+#ifndef TINYSR_FIXED_POINT
+	printf("Floating point build, with %s kernels.\n", tinysr_select_kernels()->name);
+#else
+	printf("Fixed point build.\n");
+#endif
+	bench_fft();
+	bench_frontend();
+	bench_gaussians();
+	bench_dtw();
+
+	if (baseline_path != NULL) {
+		if (read_baseline(baseline_path)) {
+			perror(baseline_path);
+			return 1;
+		}
+		printf("\nAgainst %s (median, and change in median):\n", baseline_path);
+		for (i = 0; i < result_count; i++) {
+			bench_result_t* r = &results[i];
+			if (r->baseline <= 0) {
+				printf("%-44s %12.1f ns/%-7s (new)\n", r->name, r->median, r->unit);
+				continue;
+			}
+			double change = r->median / r->baseline - 1;
+			// Changes within a few standard deviations of either run could just be noise.
+			double noise = 3 * fmax(r->stddev, r->baseline_stddev);
+			int significant = fabs(r->median - r->baseline) > noise && fabs(change) > 0.05;
+			printf("%-44s %12.1f ns/%-7s %+7.1f%%%s\n", r->name, r->median, r->unit, 100 * change,
+				significant ? change > 0 ? "  slower" : "  faster" : "");
+		}
+	}
+	if (json_path != NULL && write_json(json_path)) {
+		perror(json_path);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,428 @@
+// Measures recognition accuracy and speed over a labeled set of utterances, for telling whether a change to a
+// model, or to TinySR, made recognition better or worse, or faster or slower.
+// Each input is a corpus file, whose utterances are labeled with the words spoken, or a directory named after
+// the word spoken in every file in it: raw 16-bit little endian mono audio if the file name ends in .raw, and
+// otherwise feature vectors in CSV format. Audio goes through the whole pipeline in one shot mode, on a fresh
+// context bound to the shared model; feature vectors go straight to matching.
+// It reports the accuracy, word error rate and confusions, the real-time factor (time spent in TinySR over
+// the length of the audio), and percentiles of the time spent on each utterance, which is the best of several
+// runs, to keep out noise. With --json, the same goes to a file as JSON.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "tinysr.h"
+
+#define DEFAULT_REPEATS 3
+#define MAX_PRINTED_WORDS 16
+#define MAX_PRINTED_CONFUSIONS 20
+
+typedef struct {
+	char* label;
+	char* path;
+	// Audio, or feature vectors, but not both.
+	samp_t* samples;
+	int sample_count;
+	utterance_t utterance;
+	// Whether the utterance's feature vectors point into a corpus.
+	int in_corpus;
+	// The word recognized, or -1 for none, and the best time spent recognizing it.
+	int word_index;
+	double seconds;
+} item_t;
+
+typedef struct {
+	item_t* items;
+	int count, capacity;
+	tinysr_corpus_t** corpora;
+	int corpus_count;
+} item_set_t;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+static item_t* add_item(item_set_t* set, const char* label, const char* path) {
+	if (set->count == set->capacity) {
+		set->capacity = set->capacity < 64 ? 64 : set->capacity * 2;
+		set->items = realloc(set->items, sizeof(item_t) * set->capacity);
+	}
+	item_t* item = &set->items[set->count++];
+	memset(item, 0, sizeof(item_t));
+	item->label = strdup(label);
+	item->path = strdup(path);
+	return item;
+}
+
+// Reads a whole file of raw audio. Returns non-zero on failure.
+static int read_audio(item_t* item) {
+	FILE* fp = fopen(item->path, "rb");
+	if (fp == NULL)
+		return 1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	item->sample_count = size < 0 ? 0 : size / sizeof(samp_t);
+	item->samples = malloc(sizeof(samp_t) * (item->sample_count > 0 ? item->sample_count : 1));
+	int failed = size < 0 || fread(item->samples, sizeof(samp_t), item->sample_count, fp) != (size_t) item->sample_count;
+	fclose(fp);
+	return failed;
+}
+
+// Adds every file in a directory, in order of file name, labeled with the directory's name. Returns non-zero on failure.
+static int read_directory(item_set_t* set, const char* path) {
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return 1;
+	}
+	char* label = strdup(path);
+	while (strlen(label) > 1 && label[strlen(label) - 1] == '/')
+		label[strlen(label) - 1] = '\0';
+	const char* name = strrchr(label, '/') != NULL ? strrchr(label, '/') + 1 : label;
+	char** files = NULL;
+	int file_count = 0, failed = 0, i;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		files = realloc(files, sizeof(char*) * (file_count + 1));
+		files[file_count] = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		sprintf(files[file_count++], "%s/%s", path, entry->d_name);
+	}
+	closedir(dir);
+	qsort(files, file_count, sizeof(char*), compare_names);
+	for (i = 0; i < file_count; i++) {
+		if (!failed) {
+			size_t length = strlen(files[i]);
+			item_t* item = add_item(set, name, files[i]);
+			if (length > 4 && strcmp(files[i] + length - 4, ".raw") == 0) {
+				failed = read_audio(item);
+			} else {
+				utterance_t* utterance = read_feature_vector_csv(files[i]);
+				failed = utterance == NULL;
+				if (utterance != NULL) {
+					item->utterance = *utterance;
+					free(utterance);
+				}
+			}
+			if (failed)
+				printf("Couldn't read: %s\n", files[i]);
+		}
+		free(files[i]);
+	}
+	free(files);
+	free(label);
+	return failed;
+}
+
+// Adds every utterance in a corpus, which stays open for them to point into. Returns non-zero on failure.
+static int read_corpus(item_set_t* set, const char* path) {
+	tinysr_corpus_t* corpus = tinysr_corpus_open(path);
+	if (corpus == NULL) {
+		printf("Couldn't open corpus: %s\n", path);
+		return 1;
+	}
+	set->corpora = realloc(set->corpora, sizeof(tinysr_corpus_t*) * (set->corpus_count + 1));
+	set->corpora[set->corpus_count++] = corpus;
+	int i;
+	for (i = 0; i < tinysr_corpus_count(corpus); i++) {
+		item_t* item = add_item(set, tinysr_corpus_label(corpus, i), path);
+		tinysr_corpus_utterance(corpus, i, &item->utterance);
+		item->in_corpus = 1;
+	}
+	return 0;
+}
+
+static const char* stage_names[TINYSR_STAGE_COUNT] = {"feed", "frontend", "detect", "match"};
+
+// Adds one context's stats into the totals over every run, returning non-zero if there are none.
+static int add_stats(tinysr_ctx_t* ctx, tinysr_stats_t* totals) {
+	tinysr_stats_t stats;
+	int stage, bucket;
+	if (tinysr_get_stats(ctx, &stats))
+		return 1;
+	for (stage = 0; stage < TINYSR_STAGE_COUNT; stage++) {
+		tinysr_stage_stats_t* from = &stats.stages[stage], * to = &totals->stages[stage];
+		to->calls += from->calls;
+		to->total_ns += from->total_ns;
+		to->max_ns = from->max_ns > to->max_ns ? from->max_ns : to->max_ns;
+		for (bucket = 0; bucket < TINYSR_STATS_BUCKETS; bucket++)
+			to->histogram[bucket] += from->histogram[bucket];
+	}
+	totals->frames += stats.frames;
+	totals->utterances += stats.utterances;
+	totals->dtw_cells += stats.dtw_cells;
+	return 0;
+}
+
+// Recognizes one item, returning the seconds spent in TinySR, setting its word, and adding to the stats.
+static double recognize(item_t* item, tinysr_model_t* model, tinysr_thread_pool_t* pool, int pruned, int sample_rate, tinysr_stats_t* totals) {
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	tinysr_bind_model(ctx, model);
+	ctx->input_sample_rate = sample_rate;
+	ctx->thread_pool = pool;
+	ctx->dtw_mode = pruned ? TINYSR_DTW_PRUNED : TINYSR_DTW_EXACT;
+	// What binding the model allocated doesn't count.
+	tinysr_reset_stats(ctx);
+	double start = now();
+	if (item->samples != NULL)
+		tinysr_recognize(ctx, item->samples, item->sample_count);
+	else if (item->utterance.length > 0)
+		tinysr_recognize_utterance(ctx, &item->utterance);
+	double elapsed = now() - start;
+	item->word_index = -1;
+	while (tinysr_get_result(ctx, &item->word_index, NULL));
+	add_stats(ctx, totals);
+	tinysr_free_context(ctx);
+	return elapsed;
+}
+
+// The smallest latency at least the given fraction of utterances come in under.
+static double percentile(const double* sorted, int count, double fraction) {
+	int rank = (int) (fraction * count + 0.999999);
+	return count == 0 ? 0 : sorted[rank < 1 ? 0 : rank > count ? count - 1 : rank - 1];
+}
+
+// Writes a string as a JSON string.
+static void json_string(FILE* fp, const char* s) {
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+int main(int argc, char** argv) {
+	int repeats = DEFAULT_REPEATS, threads = 0, pruned = 0, sample_rate = 16000, first = 1, i, j, k;
+	const char* json_path = NULL;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--pruned") == 0) {
+			pruned = 1;
+			first++;
+		} else if (strcmp(argv[first], "--json") == 0 && first + 1 < argc) {
+			json_path = argv[first + 1];
+			first += 2;
+		} else if (strcmp(argv[first], "--repeats") == 0 && first + 1 < argc) {
+			repeats = atoi(argv[first + 1]);
+			first += 2;
+		} else if (strcmp(argv[first], "--threads") == 0 && first + 1 < argc) {
+			threads = atoi(argv[first + 1]);
+			first += 2;
+		} else if (strcmp(argv[first], "--rate") == 0 && first + 1 < argc) {
+			sample_rate = atoi(argv[first + 1]);
+			first += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc - first < 2) {
+		printf("Usage: bench_reco [--pruned] [--threads n] [--repeats n] [--rate hz] [--json output.json|-] <speech_model> <corpus or dir> [...]\n");
+		printf("Each directory is named after the word spoken in every file in it: raw 16-bit audio if it ends in .raw, or CSV feature vectors.\n");
+		printf("Corpus files label each utterance with the word spoken.\n");
+		printf("--pruned uses pruned matching, --threads matches on a pool of n more threads, --rate is the audio's sample rate, and --json - writes the JSON to standard output.\n");
+		return 1;
+	}
+	repeats = repeats < 1 ? 1 : repeats;
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	int word_count = tinysr_model_load(model, argv[first]);
+	if (word_count <= 0) {
+		printf("Couldn't load model: %s\n", argv[first]);
+		return 1;
+	}
+	item_set_t set = {0};
+	for (i = first + 1; i < argc; i++) {
+		struct stat info;
+		if (stat(argv[i], &info) == 0 && !S_ISDIR(info.st_mode) ? read_corpus(&set, argv[i]) : read_directory(&set, argv[i]))
+			return 1;
+	}
+	if (set.count <= 0) {
+		printf("No utterances.\n");
+		return 1;
+	}
+	tinysr_thread_pool_t* pool = threads > 0 ? tinysr_thread_pool_create(threads) : NULL;
+	// A context to look up the word names with.
+	tinysr_ctx_t* names = tinysr_allocate_context();
+	tinysr_bind_model(names, model);
+
+	// Each utterance's best time over every run.
+	int repeat;
+	double audio_seconds = 0, total_seconds = 0;
+	tinysr_stats_t totals = {0};
+	// Built with TINYSR_NO_STATS, there's no breakdown by stage.
+	int have_stats = !add_stats(names, &(tinysr_stats_t) {0});
+	for (repeat = 0; repeat < repeats; repeat++) {
+		for (i = 0; i < set.count; i++) {
+			double elapsed = recognize(&set.items[i], model, pool, pruned, sample_rate, &totals);
+			set.items[i].seconds = repeat == 0 || elapsed < set.items[i].seconds ? elapsed : set.items[i].seconds;
+		}
+	}
+	// Feature vectors are SHIFT_INTERVAL samples apart, at the front-end's sample rate.
+	double* latencies = malloc(sizeof(double) * set.count);
+	for (i = 0; i < set.count; i++) {
+		item_t* item = &set.items[i];
+		audio_seconds += item->samples != NULL ? item->sample_count / (double) sample_rate : item->utterance.length * SHIFT_INTERVAL / (double) FRONTEND_SAMPLE_RATE;
+		total_seconds += item->seconds;
+		latencies[i] = item->seconds;
+	}
+	qsort(latencies, set.count, sizeof(double), compare_doubles);
+
+	// Tally up the confusions between each label, and each word recognized, or none.
+	char** labels = malloc(sizeof(char*) * set.count);
+	int label_count = 0, correct = 0, deletions = 0;
+	int* item_labels = malloc(sizeof(int) * set.count);
+	for (i = 0; i < set.count; i++) {
+		for (j = 0; j < label_count && strcmp(labels[j], set.items[i].label) != 0; j++);
+		if (j == label_count)
+			labels[label_count++] = set.items[i].label;
+		item_labels[i] = j;
+	}
+	// confusions[label * (word_count + 1) + word], with the last column for no word at all.
+	int* confusions = calloc((size_t) label_count * (word_count + 1), sizeof(int));
+	for (i = 0; i < set.count; i++) {
+		int word = set.items[i].word_index;
+		confusions[item_labels[i] * (word_count + 1) + (word < 0 ? word_count : word)]++;
+		if (word < 0)
+			deletions++;
+		else if (strcmp(names->word_names[word], set.items[i].label) == 0)
+			correct++;
+	}
+	int substitutions = set.count - correct - deletions;
+	double accuracy = correct / (double) set.count, word_error_rate = (substitutions + deletions) / (double) set.count;
+	double real_time_factor = audio_seconds > 0 ? total_seconds / audio_seconds : 0;
+	double p50 = percentile(latencies, set.count, 0.5), p99 = percentile(latencies, set.count, 0.99), max = latencies[set.count - 1];
+
+	printf("%i utterances, %.1f seconds of speech, against %i words, %s matching%s, best of %i runs.\n", set.count, audio_seconds, word_count,
+		pruned ? "pruned" : "exact", pool != NULL ? " on a thread pool" : "", repeats);
+	printf("accuracy:         %.2f%% (%i correct)\n", 100 * accuracy, correct);
+	printf("word error rate:  %.2f%% (%i substitutions, %i deletions)\n", 100 * word_error_rate, substitutions, deletions);
+	printf("real-time factor: %.5f (%.3f s in TinySR)\n", real_time_factor, total_seconds);
+	printf("latency:          p50 %.1f us, p99 %.1f us, max %.1f us\n", p50 * 1e6, p99 * 1e6, max * 1e6);
+	// Over every run, where the time went.
+	long long stage_ns = 0;
+	int stage;
+	for (stage = 0; stage < TINYSR_STAGE_COUNT; stage++)
+		stage_ns += totals.stages[stage].total_ns;
+	if (have_stats && stage_ns > 0) {
+		printf("time by stage:   ");
+		for (stage = 0; stage < TINYSR_STAGE_COUNT; stage++)
+			printf(" %s %.1f%% (max %.1f us)%s", stage_names[stage], 100.0 * totals.stages[stage].total_ns / stage_ns,
+				totals.stages[stage].max_ns * 1e-3, stage < TINYSR_STAGE_COUNT - 1 ? "," : "\n");
+		printf("DTW cells:        %.0f per utterance\n", totals.dtw_cells / ((double) set.count * repeats));
+	}
+	// A small vocabulary gets the whole matrix, and a large one just its most common confusions.
+	if (word_count <= MAX_PRINTED_WORDS) {
+		printf("\n%-12s", "said \\ heard");
+		for (j = 0; j < word_count; j++)
+			printf(" %6.6s", names->word_names[j]);
+		printf(" %6s\n", "(none)");
+		for (i = 0; i < label_count; i++) {
+			printf("%-12.12s", labels[i]);
+			for (j = 0; j <= word_count; j++)
+				printf(" %6i", confusions[i * (word_count + 1) + j]);
+			printf("\n");
+		}
+	} else {
+		printf("\nMost common confusions:\n");
+		for (k = 0; k < MAX_PRINTED_CONFUSIONS; k++) {
+			int best = -1;
+			for (i = 0; i < label_count * (word_count + 1); i++) {
+				int word = i % (word_count + 1);
+				if (confusions[i] > 0 && (word == word_count || strcmp(names->word_names[word], labels[i / (word_count + 1)]) != 0) &&
+						(best < 0 || confusions[i] > confusions[best]))
+					best = i;
+			}
+			if (best < 0)
+				break;
+			printf("%6i  %s heard as %s\n", confusions[best], labels[best / (word_count + 1)],
+				best % (word_count + 1) == word_count ? "(none)" : names->word_names[best % (word_count + 1)]);
+			// Only to find the next most common; the JSON gets the counts as they were.
+			confusions[best] = -confusions[best];
+		}
+		for (i = 0; i < label_count * (word_count + 1); i++)
+			confusions[i] = confusions[i] < 0 ? -confusions[i] : confusions[i];
+	}
+
+	if (json_path != NULL) {
+		FILE* fp = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+		if (fp == NULL) {
+			perror(json_path);
+			return 1;
+		}
+		fprintf(fp, "{\n  \"model\": ");
+		json_string(fp, argv[first]);
+		fprintf(fp, ",\n  \"matching\": \"%s\",\n  \"threads\": %i,\n  \"repeats\": %i,\n", pruned ? "pruned" : "exact", pool != NULL ? threads : 0, repeats);
+		fprintf(fp, "  \"utterances\": %i,\n  \"words\": %i,\n  \"audio_seconds\": %.6f,\n", set.count, word_count, audio_seconds);
+		fprintf(fp, "  \"correct\": %i,\n  \"substitutions\": %i,\n  \"deletions\": %i,\n", correct, substitutions, deletions);
+		fprintf(fp, "  \"accuracy\": %.6f,\n  \"word_error_rate\": %.6f,\n", accuracy, word_error_rate);
+		fprintf(fp, "  \"seconds\": %.9f,\n  \"real_time_factor\": %.9f,\n", total_seconds, real_time_factor);
+		fprintf(fp, "  \"latency_us\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n", p50 * 1e6, p99 * 1e6, max * 1e6);
+		// Totals over every run.
+		if (have_stats) {
+			fprintf(fp, "  \"stages\": {");
+			for (stage = 0; stage < TINYSR_STAGE_COUNT; stage++)
+				fprintf(fp, "%s\n    \"%s\": {\"calls\": %lld, \"total_ns\": %lld, \"max_ns\": %lld}", stage > 0 ? "," : "", stage_names[stage],
+					totals.stages[stage].calls, totals.stages[stage].total_ns, totals.stages[stage].max_ns);
+			fprintf(fp, "\n  },\n  \"dtw_cells\": %lld,\n", totals.dtw_cells);
+		}
+		// Every non-zero cell of the confusion matrix, with null for no word at all.
+		fprintf(fp, "  \"confusions\": [");
+		for (i = 0, k = 0; i < label_count * (word_count + 1); i++) {
+			if (confusions[i] == 0)
+				continue;
+			fprintf(fp, "%s\n    {\"said\": ", k++ > 0 ? "," : "");
+			json_string(fp, labels[i / (word_count + 1)]);
+			fprintf(fp, ", \"heard\": ");
+			if (i % (word_count + 1) == word_count)
+				fprintf(fp, "null");
+			else
+				json_string(fp, names->word_names[i % (word_count + 1)]);
+			fprintf(fp, ", \"count\": %i}", confusions[i]);
+		}
+		fprintf(fp, "\n  ]\n}\n");
+		if (fp == stdout ? fflush(fp) != 0 : fclose(fp) != 0) {
+			perror(json_path);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < set.count; i++) {
+		free(set.items[i].label);
+		free(set.items[i].path);
+		free(set.items[i].samples);
+		if (!set.items[i].in_corpus)
+			free(set.items[i].utterance.feature_vectors);
+	}
+	for (i = 0; i < set.corpus_count; i++)
+		tinysr_corpus_close(set.corpora[i]);
+	free(set.items);
+	free(set.corpora);
+	free(latencies);
+	free(labels);
+	free(item_labels);
+	free(confusions);
+	tinysr_free_context(names);
+	if (pool != NULL)
+		tinysr_thread_pool_free(pool);
+	tinysr_model_release(model);
+	return 0;
+}
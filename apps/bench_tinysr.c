@@ -0,0 +1,210 @@
+// Benchmarks pruned against exact dynamic time warping, each on one thread, and on a thread pool.
+// Each configuration recognizes the same set of utterances, and is timed, and compared against exact
+// mode, both for agreement with its decisions, and for accuracy. The utterances are CSV files if any are
+// given (for which accuracy isn't known), or otherwise synthesized from the model's own templates: each
+// template walked through at a randomly varying speed, with noise added to every coefficient.
+// For models with mixture states, it then compares exact matching with each size of shortlist of components
+// scored in full against scoring every component.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinysr.h"
+
+#define SYNTHETIC_PER_WORD 20
+#define SYNTHETIC_NOISE 1.5f
+#define REPEATS 5
+#define POOL_WORKERS 3
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static float random_uniform(void) {
+	return rand() / (float) RAND_MAX;
+}
+
+// Each state lasts zero to three frames, averaging one and a half.
+static utterance_t* synthesize_utterance(recog_entry_t* entry) {
+	utterance_t* utterance = malloc(sizeof(utterance_t));
+	utterance->feature_vectors = malloc(sizeof(feature_vector_t) * 3 * entry->model_template_length);
+	utterance->length = 0;
+	int i, j, repeat;
+	for (i = 0; i < entry->model_template_length; i++) {
+		int repeats = rand() % 4;
+		if (i == 0 || i == entry->model_template_length - 1)
+			repeats += repeats == 0;
+		for (repeat = 0; repeat < repeats; repeat++) {
+			feature_vector_t* fv = &utterance->feature_vectors[utterance->length++];
+			memset(fv, 0, sizeof(feature_vector_t));
+			for (j = 0; j < 13; j++)
+				fv->cepstrum[j] = TINYSR_FEATURE(TINYSR_FEATURE_TO_FLOAT(entry->model_template[i].cepstrum_mean[j]) + SYNTHETIC_NOISE * (2 * random_uniform() - 1));
+		}
+	}
+	return utterance;
+}
+
+// Recognizes every utterance REPEATS times, recording the decisions, and returning the seconds per utterance.
+static double run(tinysr_ctx_t* ctx, utterance_t** utterances, int count, int* decisions) {
+	int i, repeat;
+	double start = now();
+	for (repeat = 0; repeat < REPEATS; repeat++) {
+		for (i = 0; i < count; i++) {
+			tinysr_recognize_utterance(ctx, utterances[i]);
+			tinysr_get_result(ctx, &decisions[i], NULL);
+		}
+	}
+	return (now() - start) / (REPEATS * count);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		printf("Usage: bench_tinysr <speech_model> [utterance.csv ...]\n");
+		printf("Compares pruned against exact matching, on the given utterances, or synthetic ones.\n");
+		return 1;
+	}
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	int words = tinysr_load_model(ctx, argv[1]);
+	if (words <= 0) {
+		printf("Couldn't load model: %s\n", argv[1]);
+		return 1;
+	}
+
+	// Gather up the utterances, along with the word each came from, if known.
+	int count = argc > 2 ? argc - 2 : words * SYNTHETIC_PER_WORD, i;
+	utterance_t** utterances = malloc(sizeof(utterance_t*) * count);
+	int* sources = malloc(sizeof(int) * count);
+	if (argc > 2) {
+		for (i = 0; i < count; i++) {
+			utterances[i] = read_feature_vector_csv(argv[i + 2]);
+			sources[i] = -1;
+			if (utterances[i] == NULL) {
+				printf("Couldn't read utterance: %s\n", argv[i + 2]);
+				return 1;
+			}
+		}
+	} else {
+		srand(1234);
+		list_node_t* re;
+		i = 0;
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			int k;
+			for (k = 0; k < SYNTHETIC_PER_WORD; k++) {
+				sources[i] = ((recog_entry_t*) re->datum)->index;
+				utterances[i++] = synthesize_utterance(re->datum);
+			}
+		}
+	}
+	printf("%i words, %i utterances%s.\n", words, count, argc > 2 ? "" : " synthesized from the templates");
+
+	int* exact = malloc(sizeof(int) * count);
+	int* decisions = malloc(sizeof(int) * count);
+	ctx->dtw_mode = TINYSR_DTW_EXACT;
+	double exact_time = run(ctx, utterances, count, exact);
+	int correct = 0;
+	for (i = 0; i < count; i++)
+		correct += exact[i] == sources[i];
+	printf("%-8s %5s %7s %10s %8s %9s %9s\n", "mode", "band", "beam", "us/utter", "speedup", "agreement", "accuracy");
+	printf("%-8s %5s %7s %10.1f %7.2fx %8.1f%%", "exact", "-", "-", exact_time * 1e6, 1.0, 100.0);
+	if (argc > 2)
+		printf(" %9s\n", "-");
+	else
+		printf(" %8.1f%%\n", 100.0 * correct / count);
+
+	// The same, with the calling thread and POOL_WORKERS workers matching; decisions must be identical.
+	tinysr_thread_pool_t* pool = tinysr_thread_pool_create(POOL_WORKERS);
+	if (pool != NULL) {
+		ctx->thread_pool = pool;
+		double threaded_time = run(ctx, utterances, count, decisions);
+		int agree = 0;
+		for (i = 0; i < count; i++)
+			agree += decisions[i] == exact[i];
+		char name[16];
+		snprintf(name, sizeof(name), "exact/%it", POOL_WORKERS + 1);
+		printf("%-8s %5s %7s %10.1f %7.2fx %8.1f%%", name, "-", "-", threaded_time * 1e6, exact_time / threaded_time, 100.0 * agree / count);
+		if (argc > 2)
+			printf(" %9s\n", "-");
+		else
+			printf(" %8.1f%%\n", 100.0 * correct / count);
+		ctx->thread_pool = NULL;
+	}
+
+	int bands[] = {20, 30, 40, 60, 100};
+	float beams[] = {100, 300, 1000};
+	int b, k;
+	ctx->dtw_mode = TINYSR_DTW_PRUNED;
+	for (b = 0; b < sizeof(bands) / sizeof(bands[0]); b++) {
+		for (k = 0; k < sizeof(beams) / sizeof(beams[0]); k++) {
+			ctx->dtw_band_percent = bands[b];
+			ctx->dtw_beam = TINYSR_SCORE(beams[k]);
+			double pruned_time = run(ctx, utterances, count, decisions);
+			int agree = 0;
+			correct = 0;
+			for (i = 0; i < count; i++) {
+				agree += decisions[i] == exact[i];
+				correct += decisions[i] == sources[i];
+			}
+			printf("%-8s %4i%% %7.0f %10.1f %7.2fx %8.1f%%", "pruned", bands[b], beams[k],
+				pruned_time * 1e6, exact_time / pruned_time, 100.0 * agree / count);
+			if (argc > 2)
+				printf(" %9s\n", "-");
+			else
+				printf(" %8.1f%%\n", 100.0 * correct / count);
+		}
+	}
+
+	// Mixtures, scoring every component, and then only a shortlist of them.
+	int has_mixtures = 0;
+	list_node_t* re;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next)
+		has_mixtures |= ((recog_entry_t*) re->datum)->mixture_starts != NULL;
+	if (has_mixtures) {
+		int* every = malloc(sizeof(int) * count);
+		int shortlists[] = {0, 1, 2};
+		ctx->dtw_mode = TINYSR_DTW_EXACT;
+		ctx->mixture_shortlist = TINYSR_MIXTURE_EXACT;
+		double every_time = run(ctx, utterances, count, every);
+		printf("mixtures, scoring every component: %.1f us/utter.\n", every_time * 1e6);
+		for (k = 0; k < sizeof(shortlists) / sizeof(shortlists[0]); k++) {
+			ctx->mixture_shortlist = shortlists[k];
+			double shortlist_time = run(ctx, utterances, count, decisions);
+			int agree = 0;
+			for (i = 0; i < count; i++)
+				agree += decisions[i] == every[i];
+			printf("shortlist of %i: %.1f us/utter, %.2fx faster, %.1f%% agreement.\n",
+				shortlists[k], shortlist_time * 1e6, every_time / shortlist_time, 100.0 * agree / count);
+		}
+		free(every);
+		ctx->mixture_shortlist = 1;
+		ctx->dtw_mode = TINYSR_DTW_PRUNED;
+	}
+
+	if (pool != NULL) {
+		ctx->dtw_band_percent = 40;
+		ctx->dtw_beam = TINYSR_SCORE(300);
+		double pruned_time = run(ctx, utterances, count, exact);
+		ctx->thread_pool = pool;
+		double threaded_time = run(ctx, utterances, count, decisions);
+		int agree = 0;
+		for (i = 0; i < count; i++)
+			agree += decisions[i] == exact[i];
+		printf("pruned at 40%% and 300 on %i threads: %.1f us/utter, %.2fx over one thread, %.1f%% agreement.\n",
+			POOL_WORKERS + 1, threaded_time * 1e6, pruned_time / threaded_time, 100.0 * agree / count);
+		ctx->thread_pool = NULL;
+		tinysr_thread_pool_free(pool);
+	}
+
+	for (i = 0; i < count; i++) {
+		free(utterances[i]->feature_vectors);
+		free(utterances[i]);
+	}
+	free(utterances);
+	free(sources);
+	free(exact);
+	free(decisions);
+	tinysr_free_context(ctx);
+	return 0;
+}
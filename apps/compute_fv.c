@@ -2,50 +2,127 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "tinysr.h"
 
-#define READ_SAMPS 512
+#define READ_SAMPS 65536
 
-int main(int argc, char** argv) {
-	if (argc != 3) {
-		printf("Usage: compute_fv <sample rate> <input file>\n");
-		printf("Expects the input to be raw 16-bit signed little endian audio at the sample rate.\n");
-		printf("Computes feature vectors, and prints them out as CSV.\n");
-		printf("Format is: \"log energy,cepstrum0,cepstrum1,...cepstrum12\\n\"\n");
+// Computes the feature vectors of a whole input file, into a fresh utterance. Returns non-zero if the file can't be read.
+static int compute_features(int sample_rate, const char* path, utterance_t* utterance) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL)
 		return 1;
-	}
-
 	// Allocate a context.
 	fprintf(stderr, "Allocating context.\n");
 	tinysr_ctx_t* ctx = tinysr_allocate_context();
-	ctx->input_sample_rate = atoi(argv[1]);
-	fprintf(stderr, "Reading as sample rate: %i\n", ctx->input_sample_rate);
-	// Open the input file for reading.
-	FILE* fp = fopen(argv[2], "rb");
-	samp_t array[READ_SAMPS];
+	ctx->input_sample_rate = sample_rate;
+	fprintf(stderr, "Reading %s as sample rate: %i\n", path, ctx->input_sample_rate);
+	static samp_t array[READ_SAMPS];
+	// Features come out in bulk, straight into our own array. Leave room for a partial frame carried over between reads.
+	int capacity = tinysr_extract_capacity(ctx, READ_SAMPS + FRAME_LENGTH);
+	feature_vector_t* features = malloc(sizeof(feature_vector_t) * capacity);
+	utterance->length = 0;
+	utterance->feature_vectors = NULL;
 	while (1) {
 		// Try to read in samples.
 		size_t samples_read = fread(array, sizeof(samp_t), READ_SAMPS, fp);
 		if (samples_read == 0) break;
-		// Feed in the samples to our recognizer.
+		int count = tinysr_extract_features(ctx, array, (int)samples_read, features, capacity);
+		utterance->feature_vectors = realloc(utterance->feature_vectors, sizeof(feature_vector_t) * (utterance->length + count + 1));
+		memcpy(utterance->feature_vectors + utterance->length, features, sizeof(feature_vector_t) * count);
+		utterance->length += count;
+	}
+	free(features);
+	fclose(fp);
+	fprintf(stderr, "Freeing context. Processed %i samples.\n", ctx->processed_samples);
+	tinysr_free_context(ctx);
+	return 0;
+}
+
+// Appends a recording to a corpus the way recognition would see it: detected as one utterance, in one
+// shot mode, so with its cepstral mean normalized. Returns non-zero if the file
+// can't be read, or the corpus can't be written, and sets *found to whether any speech was detected.
+static int append_recording(tinysr_corpus_writer_t* writer, const char* label, int sample_rate, const char* path, int* found) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL)
+		return 1;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	ctx->input_sample_rate = sample_rate;
+	ctx->utterance_mode = TINYSR_MODE_ONE_SHOT;
+	static samp_t array[READ_SAMPS];
+	size_t samples_read;
+	while ((samples_read = fread(array, sizeof(samp_t), READ_SAMPS, fp)) > 0)
 		tinysr_feed_input(ctx, array, (int)samples_read);
-		// Reach into the context internals to pull out the feature vector.
-		while (ctx->fv_list.length) {
+	int failed = ferror(fp);
+	fclose(fp);
+	tinysr_detect_utterances(ctx);
+	*found = ctx->utterance_list.length > 0;
+	while (ctx->utterance_list.length) {
+		utterance_t* utterance = list_pop_front(&ctx->utterance_list);
+		fprintf(stderr, "Appending %i feature vectors from %s\n", utterance->length, path);
+		if (!failed)
+			failed = tinysr_corpus_append(writer, label, utterance);
+		tinysr_free_utterance(ctx, utterance);
+	}
+	tinysr_free_context(ctx);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	// With --corpus, each input is appended to a corpus file as an utterance, with the given label, all
+	// through one writer, so the corpus index is only written out once.
+	const char *label = NULL, *corpus_path = NULL;
+	if (argc >= 6 && strcmp(argv[1], "--corpus") == 0) {
+		label = argv[2];
+		corpus_path = argv[3];
+		argv += 3;
+		argc -= 3;
+	}
+	if (argc < 3 || (corpus_path == NULL && argc != 3)) {
+		printf("Usage: compute_fv [--corpus <label> <output corpus>] <sample rate> <input file> [<input file> ...]\n");
+		printf("Expects the input to be raw 16-bit signed little endian audio at the sample rate.\n");
+		printf("Computes feature vectors, and prints them out as CSV.\n");
+		printf("Format is: \"log energy,cepstrum0,cepstrum1,...cepstrum12\\n\"\n");
+		printf("With --corpus, detects each input file as one utterance, as recognition does in one shot mode, and\n");
+		printf("appends it to the corpus instead, with its cepstral mean normalized.\n");
+		return 1;
+	}
+	int sample_rate = atoi(argv[1]), i, j;
+	utterance_t utterance;
+
+	if (corpus_path == NULL) {
+		if (compute_features(sample_rate, argv[2], &utterance)) {
+			perror(argv[2]);
+			return 1;
+		}
+		for (j = 0; j < utterance.length; j++) {
 			// Write the feature vector to stdout as CSV.
-			feature_vector_t* fv = list_pop_front(&ctx->fv_list);
+			feature_vector_t* fv = &utterance.feature_vectors[j];
 			printf("%f", fv->log_energy);
-			int i;
 			for (i = 0; i < 13; i++)
 				printf(",%f", fv->cepstrum[i]);
 			printf("\n");
-			free(fv);
 		}
+		free(utterance.feature_vectors);
+		return 0;
 	}
-	fclose(fp);
-	fprintf(stderr, "Freeing context. Processed %i samples.\n", ctx->processed_samples);
-	tinysr_free_context(ctx);
 
+	tinysr_corpus_writer_t* writer = tinysr_corpus_writer_open(corpus_path);
+	int failed = writer == NULL;
+	for (i = 2; i < argc && !failed; i++) {
+		int found;
+		failed = append_recording(writer, label, sample_rate, argv[i], &found);
+		if (failed)
+			perror(argv[i]);
+		else if (!found)
+			fprintf(stderr, "No utterance detected in %s\n", argv[i]);
+	}
+	// Whatever was appended before a failure still goes in.
+	failed |= writer != NULL && tinysr_corpus_writer_close(writer);
+	if (failed) {
+		printf("Couldn't write corpus: %s\n", corpus_path);
+		return 1;
+	}
 	return 0;
 }
-
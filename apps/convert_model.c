@@ -0,0 +1,70 @@
+// Converts model files between formats, merging any number of them into one, in order.
+// By default it writes a version 3 file, which loads by mapping it into memory, rather than factoring every
+// Gaussian. With --v2, it writes a version 2 file, which can't hold mixture states, and with --legacy, the
+// format model_gen.py does, for older builds of TinySR.
+// It then reports how long loading takes from each format.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "tinysr.h"
+
+#define TIMING_RUNS 20
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The best of several loads into a fresh model, in microseconds, or -1 if the file doesn't load.
+static double time_load(const char* path) {
+	double best = -1;
+	int run;
+	for (run = 0; run < TIMING_RUNS; run++) {
+		double start = now();
+		tinysr_model_t* model = tinysr_model_create(NULL);
+		int loaded = tinysr_model_load(model, path);
+		double elapsed = now() - start;
+		tinysr_model_release(model);
+		if (loaded < 0)
+			return -1;
+		best = best < 0 || elapsed < best ? elapsed : best;
+	}
+	return best * 1e6;
+}
+
+int main(int argc, char** argv) {
+	tinysr_model_format_t format = TINYSR_MODEL_V3;
+	int first = 1, i;
+	if (argc > 1 && (strcmp(argv[1], "--legacy") == 0 || strcmp(argv[1], "--v2") == 0)) {
+		format = strcmp(argv[1], "--legacy") == 0 ? TINYSR_MODEL_LEGACY : TINYSR_MODEL_V2;
+		first++;
+	}
+	if (argc - first < 2) {
+		printf("Usage: convert_model [--legacy | --v2] <output> <input> [input ...]\n");
+		return 1;
+	}
+	const char* output = argv[first];
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	for (i = first + 1; i < argc; i++) {
+		int words = tinysr_model_load(model, argv[i]);
+		if (words < 0) {
+			printf("Couldn't load model: %s\n", argv[i]);
+			return 1;
+		}
+		printf("%s: %i words, %.1f us to load.\n", argv[i], words, time_load(argv[i]));
+	}
+	if (tinysr_model_save(model, output, format)) {
+		printf("Couldn't write model: %s\n", output);
+		return 1;
+	}
+	tinysr_model_release(model);
+	double elapsed = time_load(output);
+	if (elapsed < 0) {
+		printf("Couldn't load the model written: %s\n", output);
+		return 1;
+	}
+	printf("%s: written in %s format, %.1f us to load.\n", output, format == TINYSR_MODEL_V3 ? "version 3" : format == TINYSR_MODEL_V2 ? "version 2" : "legacy", elapsed);
+	return 0;
+}
@@ -0,0 +1,171 @@
+// Converts between corpus files and directories of utterances in CSV format, as store_utters writes them.
+// import appends every file in each directory, in order of file name, to the corpus, labeled with the
+// directory's name, as train_model names words. export writes each utterance of the corpus back out, to
+// utter_NNNN.csv under a directory named after its label. list counts the utterances under each label.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "tinysr.h"
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Appends every utterance in a directory to the corpus. Returns the number appended, or -1 on error.
+static int import_directory(tinysr_corpus_writer_t* writer, const char* path) {
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return -1;
+	}
+	char* name = strdup(path);
+	while (strlen(name) > 1 && name[strlen(name) - 1] == '/')
+		name[strlen(name) - 1] = '\0';
+	const char* label = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+	char** files = NULL;
+	int file_count = 0, appended = 0, i;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		files = realloc(files, sizeof(char*) * (file_count + 1));
+		files[file_count] = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		sprintf(files[file_count++], "%s/%s", path, entry->d_name);
+	}
+	closedir(dir);
+	qsort(files, file_count, sizeof(char*), compare_names);
+	for (i = 0; i < file_count; i++) {
+		utterance_t* utterance = read_feature_vector_csv(files[i]);
+		if (utterance != NULL && appended >= 0) {
+			if (tinysr_corpus_append(writer, label, utterance))
+				appended = -1;
+			else
+				appended++;
+		}
+		if (utterance != NULL) {
+			free(utterance->feature_vectors);
+			free(utterance);
+		}
+		free(files[i]);
+	}
+	free(files);
+	free(name);
+	return appended;
+}
+
+// Makes a directory, unless it's there already. Returns non-zero on error.
+static int make_directory(const char* path) {
+	if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
+
+// Writes each utterance out under its label's directory, numbered within the label.
+static int export_corpus(const tinysr_corpus_t* corpus, const char* path) {
+	int count = tinysr_corpus_count(corpus), i, j;
+	// How many utterances of each label have gone out so far, by the index of the label's first utterance.
+	int* numbers = calloc(count > 0 ? count : 1, sizeof(int));
+	char* file = malloc(strlen(path) + 64 + 1024);
+	int failed = make_directory(path);
+	for (i = 0; i < count && !failed; i++) {
+		const char* label = tinysr_corpus_label(corpus, i);
+		for (j = 0; strcmp(tinysr_corpus_label(corpus, j), label) != 0; j++);
+		if (strlen(label) > 1000 || strchr(label, '/') != NULL) {
+			printf("Can't name a directory after label: %s\n", label);
+			failed = 1;
+			break;
+		}
+		sprintf(file, "%s/%s", path, label);
+		if (numbers[j] == 0 && make_directory(file)) {
+			failed = 1;
+			break;
+		}
+		sprintf(file, "%s/%s/utter_%04i.csv", path, label, numbers[j]++);
+		utterance_t utterance;
+		tinysr_corpus_utterance(corpus, i, &utterance);
+		if (write_feature_vector_csv(file, &utterance)) {
+			perror(file);
+			failed = 1;
+		}
+	}
+	free(numbers);
+	free(file);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	int i, j;
+	if (argc < 3 || (strcmp(argv[1], "import") == 0 ? argc < 4 : strcmp(argv[1], "export") == 0 ? argc != 4 : strcmp(argv[1], "list") != 0 || argc != 3)) {
+		printf("Usage: corpus_csv import <corpus> <dir0> [dir1 ...]\n");
+		printf("       corpus_csv export <corpus> <output dir>\n");
+		printf("       corpus_csv list <corpus>\n");
+		printf("import appends the CSV utterances in each directory to the corpus, labeled with the directory's name.\n");
+		printf("export writes each utterance in the corpus to <output dir>/<label>/utter_NNNN.csv.\n");
+		return 1;
+	}
+	if (strcmp(argv[1], "import") == 0) {
+		tinysr_corpus_writer_t* writer = tinysr_corpus_writer_open(argv[2]);
+		if (writer == NULL) {
+			printf("Couldn't open corpus: %s\n", argv[2]);
+			return 1;
+		}
+		int failed = 0;
+		for (i = 3; i < argc && !failed; i++) {
+			int appended = import_directory(writer, argv[i]);
+			failed = appended < 0;
+			if (!failed)
+				printf("%s: %i utterances.\n", argv[i], appended);
+		}
+		if (tinysr_corpus_writer_close(writer) || failed) {
+			printf("Couldn't write corpus: %s\n", argv[2]);
+			return 1;
+		}
+		return 0;
+	}
+	double start = now();
+	tinysr_corpus_t* corpus = tinysr_corpus_open(argv[2]);
+	double elapsed = now() - start;
+	if (corpus == NULL) {
+		printf("Couldn't open corpus: %s\n", argv[2]);
+		return 1;
+	}
+	int count = tinysr_corpus_count(corpus), failed = 0;
+	if (strcmp(argv[1], "export") == 0) {
+		failed = export_corpus(corpus, argv[3]);
+	} else {
+		// Each label, in order of its first utterance.
+		long long frames = 0;
+		for (i = 0; i < count; i++) {
+			const char* label = tinysr_corpus_label(corpus, i);
+			for (j = 0; strcmp(tinysr_corpus_label(corpus, j), label) != 0; j++);
+			if (j < i)
+				continue;
+			int utterances = 0;
+			for (j = i; j < count; j++) {
+				if (strcmp(tinysr_corpus_label(corpus, j), label) == 0) {
+					utterance_t utterance;
+					tinysr_corpus_utterance(corpus, j, &utterance);
+					frames += utterance.length;
+					utterances++;
+				}
+			}
+			printf("%s: %i utterances.\n", label, utterances);
+		}
+		printf("%i utterances, %lld feature vectors, %.1f us to open.\n", count, frames, elapsed * 1e6);
+	}
+	tinysr_corpus_close(corpus);
+	return failed;
+}
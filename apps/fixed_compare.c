@@ -0,0 +1,213 @@
+// Compares the fixed point build of TinySR against the floating point build.
+// This app gets built twice: as apps/fixed_compare against tinysr.o, and as apps/fixed_compare_fixed
+// against tinysr_fixed.o, which is tinysr.c built with TINYSR_FIXED_POINT. Both builds run the same
+// deterministic synthetic audio and feature sequences through the pipeline. The float build prints what
+// it gets, and the fixed build reads that back in and checks that it gets the same answers.
+// Run as: apps/fixed_compare model | apps/fixed_compare_fixed model -
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tinysr.h"
+
+#define SAMPLE_RATE 16000
+#define UTTERANCE_COUNT 6
+#define PI2_F 6.2831853f
+
+// Features may differ by this much, scaled up for larger features.
+#define FEATURE_TOLERANCE 0.02
+// Scores, which sum up many log likelihoods, may differ by this much relative to their size.
+#define SCORE_TOLERANCE 1e-3
+
+// The same pseudo-random numbers in both builds.
+static unsigned int random_state = 12345;
+static float random_uniform(void) {
+	random_state = random_state * 1103515245 + 12345;
+	return ((random_state >> 8) & 0xffff) / 65536.0f;
+}
+
+// Makes a vowel-like sound: a harmonic series on a pitch glide, shaped by two formants that sweep
+// between the given frequencies, with silence on either side. Returns the number of samples.
+static int synthesize_utterance(int which, samp_t* out) {
+	int silence = 6000, voiced = 7000 + 1000 * which, i, h;
+	float f0 = 110 + 15 * which;
+	float formant1_start = 300 + 80 * which, formant1_end = 800 - 60 * which;
+	float formant2_start = 2200 - 150 * which, formant2_end = 1000 + 200 * which;
+	float phase = 0.0;
+	for (i = 0; i < silence + voiced + silence; i++) {
+		float x = 40 * (random_uniform() - 0.5f);
+		int t = i - silence;
+		if (t >= 0 && t < voiced) {
+			float progress = t / (float) voiced;
+			float envelope = sinf(progress * PI2_F / 2);
+			float formant1 = formant1_start + (formant1_end - formant1_start) * progress;
+			float formant2 = formant2_start + (formant2_end - formant2_start) * progress;
+			float pitch = f0 * (1.0f + 0.2f * progress);
+			phase += PI2_F * pitch / SAMPLE_RATE;
+			for (h = 1; pitch * h < 7000; h++) {
+				float f = pitch * h;
+				float gain = 1.0f / (1.0f + powf((f - formant1) / 150, 2)) + 0.5f / (1.0f + powf((f - formant2) / 250, 2));
+				x += 6000 * envelope * gain * sinf(h * phase) / h;
+			}
+		}
+		out[i] = (samp_t) x;
+	}
+	return i;
+}
+
+// A word's template, walked through with two noisy frames per state, as a cepstral mean normalized utterance.
+static utterance_t* synthesize_features(recog_entry_t* entry) {
+	utterance_t* utterance = malloc(sizeof(utterance_t));
+	utterance->length = 2 * entry->model_template_length;
+	utterance->feature_vectors = calloc(utterance->length, sizeof(feature_vector_t));
+	int i, j;
+	for (i = 0; i < utterance->length; i++) {
+		gaussian_t* gauss = &entry->model_template[i / 2];
+		for (j = 0; j < 13; j++) {
+			float value = TINYSR_FEATURE_TO_FLOAT(gauss->cepstrum_mean[j]) + 2 * (random_uniform() - 0.5f);
+			utterance->feature_vectors[i].cepstrum[j] = TINYSR_FEATURE(value);
+		}
+	}
+	return utterance;
+}
+
+static FILE* reference;
+static int failures = 0, compared_features = 0, compared_results = 0;
+static double worst_feature = 0.0, worst_score = 0.0;
+
+// In dump mode, prints a line of values. In compare mode, reads the matching line and compares.
+static void report(const char* kind, int index, const float* values, int count, double tolerance) {
+	int i;
+	if (reference == NULL) {
+		printf("%s %i", kind, index);
+		for (i = 0; i < count; i++)
+			printf(" %.6f", values[i]);
+		printf("\n");
+		return;
+	}
+	char expected_kind[32];
+	int expected_index;
+	if (fscanf(reference, "%31s %i", expected_kind, &expected_index) != 2 || strcmp(expected_kind, kind) || expected_index != index) {
+		printf("FAILED: reference is missing %s %i\n", kind, index);
+		failures++;
+		exit(1);
+	}
+	for (i = 0; i < count; i++) {
+		float expected;
+		fscanf(reference, "%f", &expected);
+		double difference = fabs(values[i] - expected), scale = fabs(expected) > 1 ? fabs(expected) : 1;
+		if (!strcmp(kind, "result") && i == 0) {
+			// The word index must match exactly.
+			if (values[0] != expected) {
+				printf("FAILED: result %i recognized word %.0f, float build recognized %.0f\n", index, values[0], expected);
+				failures++;
+			}
+			continue;
+		}
+		if (difference / scale > (strcmp(kind, "result") ? worst_feature : worst_score)) {
+			if (strcmp(kind, "result"))
+				worst_feature = difference / scale;
+			else
+				worst_score = difference / scale;
+		}
+		if (difference > tolerance * scale) {
+			printf("FAILED: %s %i value %i is %f, float build has %f\n", kind, index, i, values[i], expected);
+			failures++;
+		}
+	}
+	if (strcmp(kind, "result"))
+		compared_features++;
+	else
+		compared_results++;
+}
+
+static void report_features(tinysr_ctx_t* ctx, int* index) {
+	feature_vector_t fv;
+	while (tinysr_pop_feature_vector(ctx, &fv)) {
+		float values[14];
+		int i;
+		values[0] = TINYSR_FEATURE_TO_FLOAT(fv.log_energy);
+		for (i = 0; i < 13; i++)
+			values[i+1] = TINYSR_FEATURE_TO_FLOAT(fv.cepstrum[i]);
+		report("feature", (*index)++, values, 14, FEATURE_TOLERANCE);
+	}
+}
+
+static void report_results(tinysr_ctx_t* ctx, int* index) {
+	int word_index;
+	tinysr_score_t score;
+	while (tinysr_get_result(ctx, &word_index, &score)) {
+		float values[2] = {word_index, TINYSR_SCORE_TO_FLOAT(score)};
+		report("result", (*index)++, values, 2, SCORE_TOLERANCE);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2 && argc != 3) {
+		printf("Usage: fixed_compare <model> [reference]\n");
+		printf("With just a model, prints features and recognition results on synthetic input.\n");
+		printf("With a reference, as printed by the other build (or - for stdin), compares against it.\n");
+		return 1;
+	}
+	reference = NULL;
+	if (argc == 3) {
+		reference = strcmp(argv[2], "-") ? fopen(argv[2], "r") : stdin;
+		if (reference == NULL) {
+			perror(argv[2]);
+			return 1;
+		}
+	}
+	static samp_t audio[UTTERANCE_COUNT][32000];
+	int lengths[UTTERANCE_COUNT];
+	int i, feature_index = 0, result_index = 0;
+	for (i = 0; i < UTTERANCE_COUNT; i++)
+		lengths[i] = synthesize_utterance(i, audio[i]);
+
+	// Features of all the utterances back to back, and the utterances found in them in free running mode.
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	if (tinysr_load_model(ctx, argv[1]) <= 0) {
+		printf("Couldn't load model: %s\n", argv[1]);
+		return 1;
+	}
+	ctx->input_sample_rate = SAMPLE_RATE;
+	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	tinysr_ctx_t* features_ctx = tinysr_allocate_context();
+	features_ctx->input_sample_rate = SAMPLE_RATE;
+	for (i = 0; i < UTTERANCE_COUNT; i++) {
+		tinysr_feed_input(features_ctx, audio[i], lengths[i]);
+		report_features(features_ctx, &feature_index);
+		tinysr_recognize(ctx, audio[i], lengths[i]);
+		report_results(ctx, &result_index);
+	}
+	tinysr_free_context(features_ctx);
+
+	// Each utterance on its own, in one shot mode.
+	ctx->utterance_mode = TINYSR_MODE_ONE_SHOT;
+	for (i = 0; i < UTTERANCE_COUNT; i++) {
+		tinysr_recognize(ctx, audio[i], lengths[i]);
+		report_results(ctx, &result_index);
+	}
+
+	// Feature sequences drawn from each word's own template, scored directly.
+	list_node_t* node;
+	for (node = ctx->recog_entry_list.head; node != NULL; node = node->next) {
+		utterance_t* utterance = synthesize_features(node->datum);
+		tinysr_recognize_utterance(ctx, utterance);
+		report_results(ctx, &result_index);
+		free(utterance->feature_vectors);
+		free(utterance);
+	}
+	tinysr_free_context(ctx);
+
+	if (reference != NULL) {
+		printf("Compared %i features (worst relative error %g) and %i results (worst relative score error %g).\n",
+			compared_features, worst_feature, compared_results, worst_score);
+		if (failures) {
+			printf("%i comparisons failed.\n", failures);
+			return 1;
+		}
+		printf("Fixed point build matches floating point build.\n");
+	}
+	return 0;
+}
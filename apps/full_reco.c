@@ -17,9 +17,9 @@ void sig_handler(int signo) {
 }
 
 int main(int argc, char** argv) {
-	if (argc != 2) {
+	if (argc != 2 && !(argc == 3 && !strcmp(argv[2], "--streaming"))) {
 		printf("Usage:\n");
-		printf("<command to produce audio> | full_reco <speech_model>\n");
+		printf("<command to produce audio> | full_reco <speech_model> [--streaming]\n");
 		printf("Expects the input to be 16000 Hz mono 16-bit signed little endian raw audio.\n");
 		printf("Expects a file called speech_model in the same directory.\n");
 		return 1;
@@ -30,6 +30,7 @@ int main(int argc, char** argv) {
 	tinysr_ctx_t* ctx = tinysr_allocate_context();
 	ctx->input_sample_rate = 16000;
 	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	ctx->streaming = argc == 3;
 	printf("Loaded up %i words.\n", tinysr_load_model(ctx, argv[1]));
 	samp_t array[READ_SAMPS];
 	keep_reading = 1;
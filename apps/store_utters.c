@@ -18,10 +18,23 @@ void sig_handler(int signo) {
 }
 
 int main(int argc, char** argv) {
+	// With --corpus, utterances are appended to a corpus file, with the given label, rather than each written to a CSV file.
+	const char* label = NULL;
+	if (argc == 4 && strcmp(argv[1], "--corpus") == 0) {
+		label = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
 	if (argc != 2) {
 		printf("Usage:\n");
 		printf("<command to produce audio> | store_utters <output directory>\n");
-		printf("Does utterance detection, and saves each utterance to the output directory.\n");
+		printf("<command to produce audio> | store_utters --corpus <label> <output corpus>\n");
+		printf("Does utterance detection, and saves each utterance to the output directory, or appends it to the corpus.\n");
+		return 1;
+	}
+	tinysr_corpus_writer_t* writer = NULL;
+	if (label != NULL && (writer = tinysr_corpus_writer_open(argv[1])) == NULL) {
+		printf("Couldn't open corpus: %s\n", argv[1]);
 		return 1;
 	}
 
@@ -33,6 +46,7 @@ int main(int argc, char** argv) {
 	samp_t array[READ_SAMPS];
 	keep_reading = 1;
 	signal(SIGINT, sig_handler);
+	int failed = 0;
 	while (keep_reading) {
 		// Try to read in samples.
 		size_t samples_read = fread(array, sizeof(samp_t), READ_SAMPS, stdin);
@@ -41,6 +55,13 @@ int main(int argc, char** argv) {
 		tinysr_feed_input(ctx, array, (int)samples_read);
 		tinysr_detect_utterances(ctx);
 		while (ctx->utterance_list.length) {
+			utterance_t* utterance = list_pop_front(&ctx->utterance_list);
+			if (writer != NULL) {
+				fprintf(stderr, "Appending %i feature vectors to: '%s'\n", utterance->length, argv[1]);
+				failed |= tinysr_corpus_append(writer, label, utterance);
+				tinysr_free_utterance(ctx, utterance);
+				continue;
+			}
 			// Try to find a free filename.
 			int number = 0;
 			char path[512];
@@ -48,16 +69,18 @@ int main(int argc, char** argv) {
 				snprintf(path, sizeof(path), "%s/utter_%04i.csv", argv[1], number++);
 			} while (access(path, F_OK) != -1);
 			fprintf(stderr, "Writing feature vectors to: '%s'\n", path);
-			utterance_t* utterance = list_pop_front(&ctx->utterance_list);
 			if (write_feature_vector_csv(path, utterance))
 				perror(path);
-			free(utterance->feature_vectors);
-			free(utterance);
+			tinysr_free_utterance(ctx, utterance);
 		}
 	}
 	fprintf(stderr, "Freeing context. Processed %i samples.\n", ctx->processed_samples);
 	tinysr_free_context(ctx);
+	// The utterances only become part of the corpus once it's closed.
+	if (writer != NULL && (tinysr_corpus_writer_close(writer) || failed)) {
+		printf("Couldn't write corpus: %s\n", argv[1]);
+		return 1;
+	}
 
 	return 0;
 }
-
@@ -0,0 +1,133 @@
+// Stress tests background recognition, by pushing hours of synthetic audio through it as fast as it goes.
+// The audio is bursts of tones, at random pitches and lengths, in low noise, fed 10 ms at a time the way
+// a capture callback would. Every so often background recognition is stopped and started again, switching
+// between delivering results through the callback and polling for them. At the end, every utterance
+// detected must have been either recognized exactly once, in order, or counted as dropped.
+// Run it under ThreadSanitizer with `make tsan`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "tinysr.h"
+
+#define SAMPLE_RATE 16000
+#define CHUNK 160
+#define MAX_PENDING 8
+#define RESTART_SECONDS 600
+
+// CPU time of the calling thread, so that time the background thread takes the core doesn't count.
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Results come in on the background thread in callback mode, and on the main thread when polled, but
+// never both at once, since the thread is stopped in between.
+typedef struct {
+	atomic_long count;
+	long long last_end;
+	int out_of_order;
+} tally_t;
+
+static void tally_result(tally_t* tally, long long first_frame, long long end_frame) {
+	if (first_frame < tally->last_end || end_frame < first_frame)
+		tally->out_of_order++;
+	tally->last_end = end_frame;
+	atomic_fetch_add(&tally->count, 1);
+}
+
+static void on_result(void* user, int word_index, tinysr_score_t score, long long first_frame, long long end_frame) {
+	tally_result(user, first_frame, end_frame);
+}
+
+static void poll_results(tinysr_ctx_t* ctx, tally_t* tally) {
+	long long first_frame, end_frame;
+	while (tinysr_get_result_span(ctx, NULL, NULL, &first_frame, &end_frame))
+		tally_result(tally, first_frame, end_frame);
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2 && argc != 3) {
+		printf("Usage: stress_async <speech_model> [hours]\n");
+		return 1;
+	}
+	double hours = argc == 3 ? atof(argv[2]) : 1.0;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	if (tinysr_load_model(ctx, argv[1]) <= 0) {
+		printf("Couldn't load model: %s\n", argv[1]);
+		return 1;
+	}
+	tally_t tally;
+	atomic_init(&tally.count, 0);
+	tally.last_end = 0;
+	tally.out_of_order = 0;
+	int callback_mode = 1;
+	if (tinysr_start_async(ctx, MAX_PENDING, on_result, &tally)) {
+		printf("Couldn't start background recognition.\n");
+		return 1;
+	}
+
+	long long chunks = (long long) (hours * 3600 * SAMPLE_RATE / CHUNK), c;
+	long utterances = 0, dropped = 0;
+	int i, state = 0, burst_left = 0, silence_left = SAMPLE_RATE;
+	float phase = 0, step = 0, level = 0;
+	double worst = 0, total = 0;
+	samp_t chunk[CHUNK];
+	srand(1234);
+	for (c = 0; c < chunks; c++) {
+		for (i = 0; i < CHUNK; i++) {
+			// Alternate between bursts of 0.2 to 0.8 seconds, and silences of 0.5 to 1.5 seconds.
+			if (burst_left == 0 && silence_left == 0) {
+				burst_left = SAMPLE_RATE / 5 + rand() % (SAMPLE_RATE * 3 / 5);
+				step = (100 + rand() % 300) * 6.2831853f / SAMPLE_RATE;
+				level = 2000 + rand() % 8000;
+			}
+			float x = rand() % 60 - 30;
+			if (burst_left > 0) {
+				x += level * (sinf(phase) + 0.5f * sinf(3 * phase));
+				phase += step;
+				if (--burst_left == 0)
+					silence_left = SAMPLE_RATE / 2 + rand() % SAMPLE_RATE;
+			} else {
+				silence_left--;
+			}
+			chunk[i] = (samp_t) x;
+		}
+		double start = now();
+		tinysr_recognize(ctx, chunk, CHUNK);
+		double elapsed = now() - start;
+		total += elapsed;
+		worst = elapsed > worst ? elapsed : worst;
+		// Each 10 ms chunk is one frame, so no utterance can start and end within one call.
+		utterances += state == 1 && ctx->utterance_state == 0;
+		state = ctx->utterance_state;
+		if (!callback_mode)
+			poll_results(ctx, &tally);
+		if ((c + 1) % (RESTART_SECONDS * SAMPLE_RATE / CHUNK) == 0) {
+			dropped += tinysr_async_dropped(ctx);
+			tinysr_stop_async(ctx);
+			poll_results(ctx, &tally);
+			callback_mode = !callback_mode;
+			tinysr_start_async(ctx, MAX_PENDING, callback_mode ? on_result : NULL, &tally);
+		}
+	}
+	dropped += tinysr_async_dropped(ctx);
+	tinysr_stop_async(ctx);
+	poll_results(ctx, &tally);
+	long results = atomic_load(&tally.count);
+
+	printf("%.2f hours of audio, %li utterances, %li results, %li dropped, %i out of order.\n",
+		hours, utterances, results, dropped, tally.out_of_order);
+	printf("Feeding input took %.2f us of CPU per 10 ms on average, and %.1f us at worst.\n", total / chunks * 1e6, worst * 1e6);
+	tinysr_free_context(ctx);
+	if (results + dropped != utterances || tally.out_of_order) {
+		printf("FAILED: every utterance must be recognized once, in order, or dropped.\n");
+		return 1;
+	}
+	printf("All checks passed.\n");
+	return 0;
+}
@@ -1,21 +1,1486 @@
 // Test TinySR.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "tinysr.h"
 
 #define COUNT 100
+#define PI2_F 6.2831853f
 #define SIZE 512
 
-int main(int argc, char** argv) {
-	int i, j;
-	float v[SIZE];
-	printf("Running %i FFTs of size %i.\n", COUNT, SIZE);
-	for (i = 0; i < COUNT; i++) {
-		for (j = 0; j < SIZE; j++)
-			v[j] = j;
-		tinysr_abs_fft(v, SIZE);
+int failures = 0;
+
+// This app is linked with --wrap=malloc, so every call to malloc from TinySR (or from here) lands here first.
+long malloc_calls = 0;
+void* __real_malloc(size_t size);
+void* __wrap_malloc(size_t size) {
+	malloc_calls++;
+	return __real_malloc(size);
+}
+
+// An allocator hook that counts what goes through it, and if fail_after is set, fails every allocation
+// after that many.
+typedef struct {
+	long allocations, releases, fail_after;
+} allocation_counts_t;
+
+void* counting_allocate(void* user, size_t size) {
+	allocation_counts_t* counts = user;
+	if (counts->fail_after > 0 && counts->allocations >= counts->fail_after)
+		return NULL;
+	counts->allocations++;
+	return __real_malloc(size);
+}
+
+void counting_release(void* user, void* ptr) {
+	if (ptr != NULL)
+		((allocation_counts_t*) user)->releases++;
+	free(ptr);
+}
+
+void check(int condition, const char* what) {
+	if (!condition) {
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+// Compare the planned real-input FFT against the recursive reference implementation.
+void test_fft(void) {
+	int i, j, length;
+	for (length = 4; length <= 4096; length *= 2) {
+		float v[length], reference[length], out[length/2 + 1];
+		tinysr_fft_plan_t* plan = tinysr_fft_plan_create(length);
+		float max_error = 0.0, max_value = 0.0;
+		for (i = 0; i < COUNT; i++) {
+			for (j = 0; j < length; j++)
+				reference[j] = v[j] = (rand() % 20001 - 10000) + (i ? 0 : j);
+			tinysr_abs_fft(reference, length);
+			tinysr_fft_real_abs(plan, v, out);
+			for (j = 0; j <= length/2; j++) {
+				if (fabsf(out[j] - reference[j]) > max_error)
+					max_error = fabsf(out[j] - reference[j]);
+				if (reference[j] > max_value)
+					max_value = reference[j];
+			}
+		}
+		tinysr_fft_plan_free(plan);
+		char message[128];
+		snprintf(message, sizeof(message), "planned FFT of length %i matches reference (relative error %g)", length, max_error / max_value);
+		check(max_error <= 1e-5 * max_value, message);
+	}
+	check(tinysr_fft_plan_create(100) == NULL, "FFT plans reject non power of two lengths");
+}
+
+// Compare every field of two feature vectors exactly. (A memcmp would also compare padding.)
+int same_features(feature_vector_t* a, feature_vector_t* b) {
+	return a->number == b->number && a->log_energy == b->log_energy && a->noise_floor == b->noise_floor
+		&& memcmp(a->cepstrum, b->cepstrum, sizeof(a->cepstrum)) == 0;
+}
+
+// The default plan must reproduce the bins that scripts/compute_mel_bins.py computes for 16 kHz and 512 FFT bins.
+void test_frontend_plan(void) {
+	int expected_cbin[MEL_FILTER_COUNT + 2] = {2, 5, 8, 11, 14, 18, 23, 27, 33, 38, 45, 52, 60, 69, 79, 89, 101, 115, 129, 145, 163, 183, 205, 229, 256};
+	tinysr_frontend_plan_t* plan = tinysr_frontend_plan_create_default();
+	int k, same = 1;
+	for (k = 0; k < MEL_FILTER_COUNT + 2; k++)
+		same &= plan->cbin[k] == expected_cbin[k];
+	check(same, "default front-end plan has the ES 201 108 mel bins");
+	check(((uintptr_t) plan->window & 63) == 0 && ((uintptr_t) plan->mel_weights & 63) == 0 && ((uintptr_t) plan->dct & 63) == 0,
+		"front-end plan tables are aligned");
+	check(tinysr_frontend_plan_create(16000, 400, 160, 256) == NULL, "front-end plans reject an FFT shorter than the frame");
+	// Two contexts sharing one plan must produce exactly what a context with its own plan does.
+	tinysr_ctx_t* own = tinysr_allocate_context();
+	tinysr_ctx_t* shared_a = tinysr_allocate_context_with_plan(plan);
+	tinysr_ctx_t* shared_b = tinysr_allocate_context_with_plan(plan);
+	samp_t samples[4000];
+	int i;
+	for (i = 0; i < 4000; i++)
+		samples[i] = (samp_t) (3000 * sinf(i * 0.07f) + (rand() % 200));
+	tinysr_feed_input(own, samples, 4000);
+	tinysr_feed_input(shared_a, samples, 4000);
+	tinysr_feed_input(shared_b, samples, 4000);
+	check(tinysr_feature_count(own) > 0 && tinysr_feature_count(own) == tinysr_feature_count(shared_a) && tinysr_feature_count(own) == tinysr_feature_count(shared_b),
+		"contexts sharing a plan produce the same number of frames");
+	same = 1;
+	feature_vector_t a, b, c;
+	while (tinysr_pop_feature_vector(own, &a) && tinysr_pop_feature_vector(shared_a, &b) && tinysr_pop_feature_vector(shared_b, &c))
+		same &= same_features(&a, &b) && same_features(&a, &c);
+	check(same, "contexts sharing a plan produce identical features");
+	tinysr_free_context(own);
+	tinysr_free_context(shared_a);
+	tinysr_free_context(shared_b);
+	tinysr_frontend_plan_free(plan);
+}
+
+float max_difference(const float* a, const float* b, int length) {
+	float result = 0.0;
+	int i;
+	for (i = 0; i < length; i++)
+		if (fabsf(a[i] - b[i]) > result)
+			result = fabsf(a[i] - b[i]);
+	return result;
+}
+
+float random_float(float low, float high) {
+	return low + (high - low) * (rand() / (float) RAND_MAX);
+}
+
+// Check every vectorized kernel set this CPU supports against the scalar kernels.
+void test_kernels(void) {
+	const tinysr_kernels_t* scalar = tinysr_get_kernels(TINYSR_KERNELS_SCALAR);
+	tinysr_frontend_plan_t* plan = tinysr_frontend_plan_create_default();
+	char message[256];
+	int level, i, trial;
+	for (level = TINYSR_KERNELS_SSE2; level <= TINYSR_KERNELS_AVX2; level++) {
+		const tinysr_kernels_t* kernels = tinysr_get_kernels(level);
+		if (kernels == NULL) {
+			printf("Kernel set %i not supported here, skipping.\n", level);
+			continue;
+		}
+		int worst[6] = {0};
+		for (trial = 0; trial < 50; trial++) {
+			// Odd lengths exercise the scalar tails.
+			int length = 397 + trial % 8;
+			float frame_a[512], frame_b[512], window[512], spectrum_a[257], spectrum_b[257];
+			for (i = 0; i < length; i++) {
+				frame_a[i] = frame_b[i] = random_float(-30000, 30000);
+				window[i] = random_float(0, 1);
+			}
+			float energy_a = scalar->energy(frame_a, length), energy_b = kernels->energy(frame_b, length);
+			worst[0] |= fabsf(energy_a - energy_b) > 1e-5 * energy_a;
+			// Run one in place, and one out of place.
+			float frame_c[512];
+			scalar->preemphasize_window(frame_a, frame_a, window, length);
+			kernels->preemphasize_window(frame_b, frame_c, window, length);
+			worst[1] |= max_difference(frame_a, frame_c, length) > 1e-2;
+			kernels->preemphasize_window(frame_b, frame_b, window, length);
+			worst[1] |= max_difference(frame_b, frame_c, length) != 0.0;
+			scalar->magnitude(frame_a, spectrum_a, length / 2);
+			kernels->magnitude(frame_a, spectrum_b, length / 2);
+			worst[2] |= max_difference(spectrum_a, spectrum_b, length / 2) > 1e-2;
+			for (i = 0; i < 257; i++)
+				spectrum_a[i] = random_float(0, 1e5);
+			float bank_a[MEL_FILTER_COUNT], bank_b[MEL_FILTER_COUNT];
+			scalar->mel_filter(plan, spectrum_a, bank_a);
+			kernels->mel_filter(plan, spectrum_a, bank_b);
+			for (i = 0; i < MEL_FILTER_COUNT; i++)
+				worst[3] |= fabsf(bank_a[i] - bank_b[i]) > 1e-5 * bank_a[i];
+			// Logarithms over a huge dynamic range, including exact zeros.
+			for (i = 0; i < MEL_FILTER_COUNT; i++)
+				bank_a[i] = bank_b[i] = i == trial % MEL_FILTER_COUNT ? 0.0 : powf(10.0, random_float(-20, 20));
+			scalar->log_floor(bank_a, MEL_FILTER_COUNT);
+			kernels->log_floor(bank_b, MEL_FILTER_COUNT);
+			for (i = 0; i < MEL_FILTER_COUNT; i++)
+				worst[4] |= fabsf(bank_a[i] - bank_b[i]) > 1e-6 * (fabsf(bank_a[i]) > 1 ? fabsf(bank_a[i]) : 1);
+			float cepstrum_a[CEPSTRUM_LENGTH], cepstrum_b[CEPSTRUM_LENGTH];
+			scalar->dct(plan, bank_a, cepstrum_a);
+			kernels->dct(plan, bank_a, cepstrum_b);
+			worst[5] |= max_difference(cepstrum_a, cepstrum_b, CEPSTRUM_LENGTH) > 1e-3;
+		}
+		const char* stages[6] = {"energy", "preemphasize_window", "magnitude", "mel_filter", "log_floor", "dct"};
+		for (i = 0; i < 6; i++) {
+			snprintf(message, sizeof(message), "%s %s kernel matches scalar", kernels->name, stages[i]);
+			check(!worst[i], message);
+		}
+		// The fast logarithm has to be accurate near one, where the answer is near zero.
+		float x, worst_log = 0.0;
+		for (x = 0.5; x <= 2.0; x += 1.0 / 4096) {
+			float y = x - 2e-22f;
+			kernels->log_floor(&y, 1);
+			if (fabsf(y - logf(x)) > worst_log)
+				worst_log = fabsf(y - logf(x));
+		}
+		snprintf(message, sizeof(message), "%s fast log is accurate near one (error %g)", kernels->name, worst_log);
+		check(worst_log < 1e-6, message);
+		// And the whole front-end should agree.
+		tinysr_ctx_t* ctx_a = tinysr_allocate_context_with_plan(plan);
+		tinysr_ctx_t* ctx_b = tinysr_allocate_context_with_plan(plan);
+		ctx_a->kernels = scalar;
+		ctx_b->kernels = kernels;
+		samp_t samples[8000];
+		for (i = 0; i < 8000; i++)
+			samples[i] = (samp_t) ((i > 4000 ? 8000 : 100) * sinf(i * 0.05f) + rand() % 300);
+		tinysr_feed_input(ctx_a, samples, 8000);
+		tinysr_feed_input(ctx_b, samples, 8000);
+		float worst_feature = 0.0;
+		feature_vector_t a, b;
+		while (tinysr_pop_feature_vector(ctx_a, &a) && tinysr_pop_feature_vector(ctx_b, &b)) {
+			float difference = max_difference(a.cepstrum, b.cepstrum, CEPSTRUM_LENGTH);
+			if (fabsf(a.log_energy - b.log_energy) > difference)
+				difference = fabsf(a.log_energy - b.log_energy);
+			if (difference > worst_feature)
+				worst_feature = difference;
+		}
+		snprintf(message, sizeof(message), "%s front-end matches scalar front-end (error %g)", kernels->name, worst_feature);
+		check(worst_feature < 1e-3, message);
+		tinysr_free_context(ctx_a);
+		tinysr_free_context(ctx_b);
+	}
+	tinysr_frontend_plan_free(plan);
+}
+
+// Feeds samples into a fresh context in chunks of the given size, and returns the features.
+int extract_in_chunks(int sample_rate, int downmix, samp_t* samples, int length, int chunk, feature_vector_t* out, int capacity) {
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	ctx->input_sample_rate = sample_rate;
+	ctx->do_downmix = downmix;
+	int i, count = 0;
+	for (i = 0; i < length; i += chunk)
+		tinysr_feed_input(ctx, samples + (downmix ? 2 * i : i), length - i < chunk ? length - i : chunk);
+	feature_vector_t fv;
+	while (tinysr_pop_feature_vector(ctx, &fv))
+		if (count < capacity)
+			out[count++] = fv;
+	tinysr_free_context(ctx);
+	return count;
+}
+
+// The ingest path that block processing replaced, one sample at a time: linear interpolation, offset
+// compensation, and storing into the ring, processing each frame as it completes. The ring is mirrored now,
+// so each sample goes in at both of its places.
+static void feed_input_per_sample(tinysr_ctx_t* ctx, const samp_t* samples, int length) {
+	const tinysr_frontend_plan_t* plan = ctx->frontend_plan;
+	while (length--) {
+		float raw_sample = (float)*samples++;
+		ctx->processed_samples++;
+		while (ctx->resampling_time_delta <= 1.0) {
+			float sample_in = (1 - ctx->resampling_time_delta) * ctx->resampling_prev_raw_sample + ctx->resampling_time_delta * raw_sample;
+			float sample_out = sample_in - ctx->offset_comp_prev_in + 0.999 * ctx->offset_comp_prev_out;
+			ctx->offset_comp_prev_in = sample_in;
+			ctx->offset_comp_prev_out = sample_out;
+			ctx->input_buffer[ctx->input_buffer_next] = ctx->input_buffer[ctx->input_buffer_next + plan->frame_length] = sample_out;
+			ctx->input_buffer_next = (ctx->input_buffer_next + 1) % plan->frame_length;
+			if (++ctx->input_buffer_samps == plan->frame_length) {
+				tinysr_process_frame(ctx);
+				ctx->input_buffer_samps -= plan->shift_interval;
+			}
+			ctx->resampling_time_delta += ctx->input_sample_rate / (double) plan->sample_rate;
+		}
+		ctx->resampling_prev_raw_sample = raw_sample;
+		ctx->resampling_time_delta -= 1;
+	}
+}
+
+// The block based ingest path must not depend on how the input is chunked, and downmixing
+// must be exactly equivalent to summing the channels up front. At 16 kHz, it must give exactly
+// the features the per-sample path did.
+void test_ingest(void) {
+	static samp_t mono[48000], stereo[96000];
+	static feature_vector_t reference[400], features[400];
+	int rates[] = {16000, 48000, 44100, 32000, 7357};
+	int chunks[] = {1, 7, 160, 1000, 48000};
+	int i, r, c, same;
+	char message[128];
+	for (i = 0; i < 48000; i++) {
+		mono[i] = (samp_t) ((i > 20000 && i < 30000 ? 9000 : 200) * sinf(i * 0.031f) + rand() % 100);
+		stereo[2*i] = mono[i] - 50;
+		stereo[2*i+1] = 50;
+	}
+	for (r = 0; r < 5; r++) {
+		int count = extract_in_chunks(rates[r], 0, mono, 48000, 48000, reference, 400);
+		same = count > 0;
+		for (c = 0; c < 4; c++) {
+			same &= extract_in_chunks(rates[r], 0, mono, 48000, chunks[c], features, 400) == count;
+			for (i = 0; same && i < count; i++)
+				same &= same_features(&reference[i], &features[i]);
+		}
+		same &= extract_in_chunks(rates[r], 1, stereo, 48000, 333, features, 400) == count;
+		for (i = 0; same && i < count; i++)
+			same &= same_features(&reference[i], &features[i]);
+		snprintf(message, sizeof(message), "ingest at %i Hz is independent of chunking and downmixing", rates[r]);
+		check(same, message);
+	}
+	int count = extract_in_chunks(16000, 0, mono, 48000, 1000, reference, 400);
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	ctx->input_sample_rate = 16000;
+	feed_input_per_sample(ctx, mono, 48000);
+	feature_vector_t fv;
+	same = count > 0;
+	for (i = 0; tinysr_pop_feature_vector(ctx, &fv); i++)
+		same &= i < count && same_features(&reference[i], &fv);
+	check(same && i == count, "ingest at 16000 Hz matches the per-sample path exactly");
+	tinysr_free_context(ctx);
+}
+
+// Bulk extraction must give the same features as feeding the input in, for every kernel set, and
+// frames beyond the caller's capacity must queue up on the context as usual.
+void test_extract(void) {
+	static samp_t samples[44100];
+	static feature_vector_t reference[400], features[400];
+	int rates[] = {16000, 44100};
+	int i, r, level;
+	char message[128];
+	for (i = 0; i < 44100; i++)
+		samples[i] = (samp_t) ((i > 15000 && i < 25000 ? 9000 : 200) * sinf(i * 0.027f) + rand() % 100);
+	for (r = 0; r < 2; r++) {
+		int count = extract_in_chunks(rates[r], 0, samples, 44100, 44100, reference, 400);
+		for (level = TINYSR_KERNELS_SCALAR; level <= TINYSR_KERNELS_AVX2; level++) {
+			const tinysr_kernels_t* kernels = tinysr_get_kernels(level);
+			if (kernels == NULL)
+				continue;
+			tinysr_ctx_t* ctx = tinysr_allocate_context();
+			ctx->kernels = kernels;
+			ctx->input_sample_rate = rates[r];
+			int capacity = tinysr_extract_capacity(ctx, 20000);
+			int total = tinysr_extract_features(ctx, samples, 20000, features, capacity);
+			int capacity_ok = total < capacity;
+			// Leave the second call short of room, so the rest lands on the list.
+			total += tinysr_extract_features(ctx, samples + 20000, 24100, features + total, 13);
+			int queued = tinysr_feature_count(ctx);
+			while (total < 400 && tinysr_pop_feature_vector(ctx, &features[total]))
+				total++;
+			float worst = 0.0;
+			int numbered = total == count;
+			for (i = 0; numbered && i < count; i++) {
+				float difference = max_difference(reference[i].cepstrum, features[i].cepstrum, CEPSTRUM_LENGTH);
+				if (fabsf(reference[i].log_energy - features[i].log_energy) > difference)
+					difference = fabsf(reference[i].log_energy - features[i].log_energy);
+				if (difference > worst)
+					worst = difference;
+				numbered &= features[i].number == reference[i].number;
+			}
+			snprintf(message, sizeof(message), "%s bulk extraction at %i Hz matches streaming (error %g)", kernels->name, rates[r], worst);
+			check(capacity_ok && queued > 0 && numbered && worst < 1e-3, message);
+			tinysr_free_context(ctx);
+		}
+	}
+}
+
+// Resamples a tone, and returns the RMS of the output relative to the RMS of the input.
+float resampled_tone_gain(int input_rate, float frequency, int chunk) {
+	tinysr_resampler_t resampler = {0};
+	tinysr_resampler_configure(&resampler, input_rate, 16000);
+	static float in[48000], out[32000];
+	int i, total = 0;
+	for (i = 0; i < input_rate; i++)
+		in[i] = 1000 * sinf(PI2_F * frequency * i / input_rate);
+	for (i = 0; i < input_rate; ) {
+		int consumed, length = input_rate - i < chunk ? input_rate - i : chunk;
+		total += tinysr_resampler_process(&resampler, tinysr_select_kernels(), in + i, length, out + total, 32000 - total, &consumed);
+		i += consumed;
+	}
+	tinysr_resampler_free(&resampler);
+	// Skip the filter's startup transient.
+	double power = 0.0;
+	for (i = 1000; i < total; i++)
+		power += out[i] * out[i];
+	return sqrt(power / (total - 1000)) / (1000 / sqrt(2));
+}
+
+void test_resampler(void) {
+	tinysr_resampler_t resampler = {0};
+	char message[128];
+	tinysr_resampler_configure(&resampler, 48000, 16000);
+	check(resampler.mode == TINYSR_RESAMPLER_DECIMATE && resampler.down == 3, "48 kHz resamples by decimating by three");
+	tinysr_resampler_configure(&resampler, 32000, 16000);
+	check(resampler.mode == TINYSR_RESAMPLER_DECIMATE && resampler.down == 2, "32 kHz resamples by decimating by two");
+	tinysr_resampler_configure(&resampler, 44100, 16000);
+	check(resampler.mode == TINYSR_RESAMPLER_RATIONAL && resampler.up == 160 && resampler.down == 441, "44.1 kHz resamples by 160:441");
+	tinysr_resampler_configure(&resampler, 7357, 16000);
+	check(resampler.mode == TINYSR_RESAMPLER_LINEAR, "awkward rates fall back to linear interpolation");
+	tinysr_resampler_free(&resampler);
+	int rates[] = {48000, 44100, 32000, 22050, 8000};
+	int r;
+	for (r = 0; r < 5; r++) {
+		// A 1 kHz tone passes through at unity gain, whatever the chunking.
+		float gain = resampled_tone_gain(rates[r], 1000, 1000), gain_chunked = resampled_tone_gain(rates[r], 1000, 37);
+		snprintf(message, sizeof(message), "resampling from %i Hz passes 1 kHz (gain %f)", rates[r], gain);
+		check(fabsf(gain - 1.0) < 0.01 && gain == gain_chunked, message);
+		// And tones past the stopband, which would alias into the output band, are filtered away.
+		if (rates[r] > 16000) {
+			float alias = 9000 + (rates[r] / 2 - 9000) / 2;
+			gain = resampled_tone_gain(rates[r], alias, 1000);
+			snprintf(message, sizeof(message), "resampling from %i Hz rejects %.0f Hz (gain %f)", rates[r], alias, gain);
+			check(gain < 2e-3, message);
+		}
 	}
+}
+
+// Feature vectors nobody has consumed yet must survive the ring growing, in order. Free running
+// detection must keep the ring at its initial size however much input goes past.
+void test_feature_ring(void) {
+	static samp_t samples[16000];
+	feature_vector_t fv;
+	int i, pass;
+	for (i = 0; i < 16000; i++)
+		samples[i] = (samp_t) (300 * sinf(i * 0.05f) + rand() % 100);
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	ctx->input_sample_rate = 16000;
+	for (pass = 0; pass < 30; pass++)
+		tinysr_feed_input(ctx, samples, 16000);
+	int queued = tinysr_feature_count(ctx), in_order = queued > 2 * 1024;
+	for (i = 0; tinysr_pop_feature_vector(ctx, &fv); i++)
+		in_order &= fv.number == i + 1;
+	check(in_order && i == queued && tinysr_feature_count(ctx) == 0, "queued feature vectors survive ring growth in order");
+	tinysr_free_context(ctx);
+
+	ctx = tinysr_allocate_context();
+	ctx->input_sample_rate = 16000;
+	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	for (pass = 0; pass < 30; pass++) {
+		tinysr_feed_input(ctx, samples, 16000);
+		tinysr_detect_utterances(ctx);
+	}
+	check(ctx->fv_ring_mask == 1023 && tinysr_feature_count(ctx) < 1024, "free running detection doesn't grow the ring");
+	tinysr_free_context(ctx);
+}
+
+// A context with its own allocator must take everything from it, and give it all back. In pool mode,
+// once warmed up, recognition must not allocate at all, from malloc or from the context's allocator.
+void test_allocator(void) {
+	static samp_t audio[48000 * 3];
+	int i, pass;
+	for (i = 0; i < 48000 * 3; i++) {
+		int t = i % 48000;
+		float envelope = t > 24000 && t < 36000 ? sinf((t - 24000) * PI2_F / 24000) : 0.0f;
+		audio[i] = (samp_t) (8000 * envelope * (sinf(i * 0.03f) + 0.5f * sinf(i * 0.11f)) + rand() % 60);
+	}
+	tinysr_frontend_plan_t* plan = tinysr_frontend_plan_create_default();
+	allocation_counts_t counts = {0};
+	tinysr_allocator_t counting = {counting_allocate, counting_release, &counts};
+	long mallocs = malloc_calls;
+	tinysr_ctx_t* ctx = tinysr_allocate_context_with_allocator(plan, &counting, 0);
+	check(tinysr_load_model(ctx, "demos/speech_model_digits") > 0, "loading a model with a custom allocator");
+	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	tinysr_recognize(ctx, audio, 48000 * 3);
+	while (tinysr_get_result(ctx, NULL, NULL));
+	tinysr_free_context(ctx);
+	check(malloc_calls == mallocs && counts.allocations > 0 && counts.allocations == counts.releases,
+		"a context takes all its memory from its allocator, and gives it all back");
+
+	// A context that can't get all its memory comes back NULL, having given back whatever it got.
+	int clean = 1, fail_after, use_pool;
+	for (use_pool = 0; use_pool < 2; use_pool++) {
+		for (fail_after = 1; fail_after < 100; fail_after++) {
+			counts = (allocation_counts_t){0, 0, fail_after};
+			ctx = tinysr_allocate_context_with_allocator(plan, &counting, use_pool);
+			tinysr_free_context(ctx);
+			clean &= counts.allocations == counts.releases;
+			if (ctx != NULL)
+				break;
+		}
+		clean &= fail_after > 1 && fail_after < 100;
+	}
+	check(clean, "a context that runs out of memory allocating comes back NULL, and leaks nothing");
+
+	// Without memory for the resampler's filter, input is turned away, rather than resampled some other way.
+	counts = (allocation_counts_t){0};
+	ctx = tinysr_allocate_context_with_allocator(plan, &counting, 0);
+	counts.fail_after = counts.allocations;
+	int turned_away = tinysr_feed_input(ctx, audio, 48000) != 0 && tinysr_recognize(ctx, audio, 48000) == -1 &&
+		ctx->processed_samples == 0 && tinysr_feature_count(ctx) == 0;
+	counts.fail_after = 0;
+	check(turned_away && tinysr_feed_input(ctx, audio, 48000) == 0 && tinysr_feature_count(ctx) > 0,
+		"input is turned away until there's memory to resample it");
+	tinysr_free_context(ctx);
+	check(counts.allocations == counts.releases, "a context that couldn't resample gives all its memory back");
+
+	counts = (allocation_counts_t){0};
+	ctx = tinysr_allocate_context_with_allocator(plan, &counting, 1);
+	tinysr_load_model(ctx, "demos/speech_model_digits");
+	ctx->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	check(tinysr_reserve_pool(ctx, 4) == 0, "reserving pool memory");
+	// Warm up with the first second of input, which configures the resampler.
+	tinysr_recognize(ctx, audio, 48000);
+	mallocs = malloc_calls;
+	long backing_allocations = ctx->pool.backing_allocations, allocations = counts.allocations;
+	int results = 0;
+	for (pass = 0; pass < 5; pass++) {
+		for (i = 0; i < 48000 * 3; i += 480)
+			tinysr_recognize(ctx, audio + i, 480);
+		while (tinysr_get_result(ctx, NULL, NULL))
+			results++;
+	}
+	check(results >= 10 && malloc_calls == mallocs && counts.allocations == allocations && ctx->pool.backing_allocations == backing_allocations,
+		"steady state recognition in pool mode doesn't allocate");
+	tinysr_free_context(ctx);
+	check(malloc_calls == mallocs && counts.allocations == counts.releases, "a pool mode context gives all its memory back");
+	tinysr_frontend_plan_free(plan);
+}
+
+// Factored scoring must match the quadratic form with the inverse covariance, for full and diagonal
+// Gaussians, and inverse covariances that aren't positive definite must be refused.
+void test_gaussian(void) {
+	float mean[13], inverse_covariance[169], root[169];
+	int trial, i, j, k, matches = 1;
+	gaussian_t gauss;
+	for (trial = 0; trial < 20; trial++) {
+		int diagonal = trial % 2;
+		// A random positive definite matrix, as root * root^T plus a bit of the identity.
+		for (i = 0; i < 169; i++)
+			root[i] = rand() / (float) RAND_MAX - 0.5f;
+		for (i = 0; i < 13; i++) {
+			mean[i] = 10 * (rand() / (float) RAND_MAX - 0.5f);
+			for (j = 0; j < 13; j++) {
+				float sum = i == j ? 0.1f : 0.0f;
+				for (k = 0; k < 13; k++)
+					sum += root[k + i*13] * root[k + j*13];
+				inverse_covariance[j + i*13] = diagonal && i != j ? 0.0f : sum;
+			}
+		}
+		matches &= gaussian_init(&gauss, -3.5f, mean, inverse_covariance) == 0 && gauss.diagonal == diagonal;
+		feature_vector_t fv;
+		for (k = 0; k < 10; k++) {
+			for (i = 0; i < 13; i++)
+				fv.cepstrum[i] = mean[i] + 4 * (rand() / (float) RAND_MAX - 0.5f);
+			double quadratic_form = 0.0;
+			for (i = 0; i < 13; i++)
+				for (j = 0; j < 13; j++)
+					quadratic_form += (fv.cepstrum[i] - mean[i]) * inverse_covariance[j + i*13] * (fv.cepstrum[j] - mean[j]);
+			double expected = -3.5 - 0.5 * quadratic_form;
+			matches &= fabs(gaussian_log_likelihood(&gauss, &fv) - expected) < 1e-4 * (1 + fabs(expected));
+		}
+	}
+	check(matches, "factored Gaussian scoring matches the full quadratic form");
+	for (i = 0; i < 169; i++)
+		inverse_covariance[i] = i % 14 == 0 ? 1.0f : 0.0f;
+	inverse_covariance[5 + 5*13] = -0.5f;
+	check(gaussian_init(&gauss, 0.0f, mean, inverse_covariance) != 0, "an indefinite inverse covariance is refused");
+}
+
+// Batched scoring must agree with scoring each cell on its own, with every kernel set, and recognition
+// through it must pick the same word, with the same score, as the reference dynamic time warping.
+void test_scoring(void) {
+	static feature_vector_t fvs[70];
+	static tinysr_score_t scores[SCORE_BLOCK_FRAMES * 2048], dp_row[1024];
+	char message[128];
+	int level, i, j;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	check(tinysr_load_model(ctx, "demos/speech_model_digits") > 0 && ctx->state_count > 0, "loading a model builds the scoring slab");
+	if (ctx->state_stride > 2048) {
+		tinysr_free_context(ctx);
+		return;
+	}
+	// Roughly cepstral mean normalized features, long enough to need three blocks.
+	for (i = 0; i < 70; i++)
+		for (j = 0; j < 13; j++)
+			fvs[i].cepstrum[j] = random_float(-4.0f, 4.0f) * (j == 0 ? 4 : 1);
+	utterance_t utterance = {70, fvs};
+	int best_index = -1;
+	tinysr_score_t best_score = TINYSR_SCORE_MIN;
+	list_node_t* re;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		tinysr_score_t score = compute_dynamic_time_warping(re->datum, &utterance, dp_row);
+		if (score > best_score) {
+			best_index = ((recog_entry_t*) re->datum)->index;
+			best_score = score;
+		}
+	}
+	for (level = TINYSR_KERNELS_SCALAR; level <= TINYSR_KERNELS_AVX2; level++) {
+		if ((ctx->kernels = tinysr_get_kernels(level)) == NULL)
+			continue;
+		int agrees = 1;
+		tinysr_score_frames(ctx, fvs, SCORE_BLOCK_FRAMES, scores);
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			for (i = 0; i < SCORE_BLOCK_FRAMES; i++) {
+				for (j = 0; j < entry->model_template_length; j++) {
+					float expected = gaussian_log_likelihood(&entry->model_template[j], &fvs[i]);
+					agrees &= fabsf(scores[i * ctx->state_stride + entry->first_state + j] - expected) < 1e-4 * (100 + fabsf(expected));
+				}
+			}
+		}
+		int word_index;
+		tinysr_score_t score;
+		tinysr_recognize_utterance(ctx, &utterance);
+		agrees &= tinysr_get_result(ctx, &word_index, &score) && word_index == best_index && fabsf(score - best_score) < 1e-3 * (1 + fabsf(best_score));
+		snprintf(message, sizeof(message), "%s batched scoring and recognition match scoring cell by cell", ctx->kernels->name);
+		check(agrees, message);
+	}
+	tinysr_free_context(ctx);
+}
+
+// Pruned dynamic time warping with the band and beam opened all the way only abandons words that can't
+// win, so it must agree with exact mode on both word and score. With the default band and beam, it must
+// still recognize each word from a walk through its own template.
+void test_pruned_dtw(void) {
+	static feature_vector_t fvs[512];
+	int i, j, word_index, exact_index;
+	tinysr_score_t score, exact_score;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	check(tinysr_load_model(ctx, "demos/speech_model_digits") > 0, "loading a model for pruned matching");
+	int wide = 1, defaults = 1, default_band = ctx->dtw_band_percent;
+	tinysr_score_t default_beam = ctx->dtw_beam;
+	list_node_t* re;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		utterance_t utterance = {0, fvs};
+		for (i = 0; i < entry->model_template_length && utterance.length + 3 <= 512; i++) {
+			int repeats = 1 + i % 3;
+			for (; repeats > 0; repeats--) {
+				for (j = 0; j < 13; j++)
+					fvs[utterance.length].cepstrum[j] = entry->model_template[i].cepstrum_mean[j] + random_float(-1.0f, 1.0f);
+				utterance.length++;
+			}
+		}
+		ctx->dtw_mode = TINYSR_DTW_EXACT;
+		tinysr_recognize_utterance(ctx, &utterance);
+		tinysr_get_result(ctx, &exact_index, &exact_score);
+		ctx->dtw_mode = TINYSR_DTW_PRUNED;
+		ctx->dtw_band_percent = 100;
+		ctx->dtw_beam = 1e30;
+		tinysr_recognize_utterance(ctx, &utterance);
+		wide &= tinysr_get_result(ctx, &word_index, &score) && word_index == exact_index && fabsf(score - exact_score) < 1e-3 * (1 + fabsf(exact_score));
+		ctx->dtw_band_percent = default_band;
+		ctx->dtw_beam = default_beam;
+		tinysr_recognize_utterance(ctx, &utterance);
+		defaults &= tinysr_get_result(ctx, &word_index, &score) && word_index == entry->index;
+	}
+	check(wide, "pruned matching with an unlimited band and beam agrees with exact matching");
+	check(defaults, "pruned matching with the default band and beam recognizes each template");
+	tinysr_free_context(ctx);
+}
+
+// Matching on a thread pool must pick the same word with the same score as matching on the calling thread,
+// in both modes, with contexts sharing the pool from several threads at once.
+typedef struct {
+	tinysr_ctx_t* ctx;
+	utterance_t* utterances;
+	int count, agrees;
+} thread_pool_check_t;
+
+static void* thread_pool_check(void* arg) {
+	thread_pool_check_t* job = arg;
+	int i, word_index, threaded_index;
+	tinysr_score_t score, threaded_score;
+	tinysr_thread_pool_t* pool = job->ctx->thread_pool;
+	for (i = 0; i < job->count; i++) {
+		job->ctx->thread_pool = NULL;
+		tinysr_recognize_utterance(job->ctx, &job->utterances[i]);
+		tinysr_get_result(job->ctx, &word_index, &score);
+		job->ctx->thread_pool = pool;
+		tinysr_recognize_utterance(job->ctx, &job->utterances[i]);
+		tinysr_get_result(job->ctx, &threaded_index, &threaded_score);
+		job->agrees &= word_index == threaded_index && score == threaded_score;
+	}
+	return NULL;
+}
+
+void test_thread_pool(void) {
+	static feature_vector_t fvs[32][512];
+	utterance_t utterances[32];
+	int i, j, count = 0, mode;
+	tinysr_thread_pool_t* pool = tinysr_thread_pool_create(3);
+	check(pool != NULL, "thread pool creation");
+	if (pool == NULL)
+		return;
+	tinysr_ctx_t* ctxs[2] = {tinysr_allocate_context(), tinysr_allocate_context()};
+	check(tinysr_load_model(ctxs[0], "demos/speech_model_digits") > 0 && tinysr_load_model(ctxs[1], "demos/speech_model_digits") > 0, "loading a model for threaded matching");
+	check(ctxs[0]->task_count > 1, "the vocabulary is split into several tasks");
+	// Random utterances, and walks through each template.
+	for (; count < 8; count++) {
+		utterances[count].feature_vectors = fvs[count];
+		utterances[count].length = 40 + 10 * count;
+		for (i = 0; i < utterances[count].length; i++)
+			for (j = 0; j < 13; j++)
+				fvs[count][i].cepstrum[j] = random_float(-4.0f, 4.0f) * (j == 0 ? 4 : 1);
+	}
+	list_node_t* re;
+	for (re = ctxs[0]->recog_entry_list.head; re != NULL && count < 32; re = re->next, count++) {
+		recog_entry_t* entry = re->datum;
+		utterances[count].feature_vectors = fvs[count];
+		utterances[count].length = 0;
+		for (i = 0; i < entry->model_template_length && utterances[count].length + 3 <= 512; i++) {
+			int repeats = 1 + i % 3;
+			for (; repeats > 0; repeats--) {
+				for (j = 0; j < 13; j++)
+					fvs[count][utterances[count].length].cepstrum[j] = entry->model_template[i].cepstrum_mean[j] + random_float(-1.0f, 1.0f);
+				utterances[count].length++;
+			}
+		}
+	}
+	for (mode = TINYSR_DTW_EXACT; mode <= TINYSR_DTW_PRUNED; mode++) {
+		pthread_t thread;
+		thread_pool_check_t checks[2];
+		for (i = 0; i < 2; i++) {
+			thread_pool_check_t job = {ctxs[i], utterances, count, 1};
+			checks[i] = job;
+			ctxs[i]->dtw_mode = mode;
+			ctxs[i]->thread_pool = pool;
+		}
+		pthread_create(&thread, NULL, thread_pool_check, &checks[1]);
+		thread_pool_check(&checks[0]);
+		pthread_join(thread, NULL);
+		check(checks[0].agrees && checks[1].agrees, mode == TINYSR_DTW_EXACT ?
+			"exact matching on a shared thread pool agrees with one thread" :
+			"pruned matching on a shared thread pool agrees with one thread");
+	}
+	tinysr_free_context(ctxs[0]);
+	tinysr_free_context(ctxs[1]);
+	tinysr_thread_pool_free(pool);
+}
+
+// Background recognition must hand back the same results, in the same order, as recognizing on the thread
+// feeding input, whether they're polled for or delivered through the callback.
+typedef struct {
+	result_t results[64];
+	int count;
+} result_log_t;
+
+static void log_result(void* user, int word_index, tinysr_score_t score, long long first_frame, long long end_frame) {
+	result_log_t* log = user;
+	result_t result = {word_index, score, first_frame, end_frame};
+	if (log->count < 64)
+		log->results[log->count++] = result;
+}
+
+void test_async(void) {
+	static samp_t audio[48000 * 3];
+	static result_log_t expected, polled, called;
+	int i, k, pass;
+	for (i = 0; i < 48000 * 3; i++) {
+		int t = i % 48000;
+		float envelope = t > 12000 && t < 30000 ? sinf((t - 12000) * PI2_F / 36000) : 0.0f;
+		audio[i] = (samp_t) (8000 * envelope * (sinf(i * (0.02f + 0.01f * (i / 48000))) + 0.5f * sinf(i * 0.11f)) + rand() % 60);
+	}
+	tinysr_ctx_t* ctxs[3];
+	for (i = 0; i < 3; i++) {
+		ctxs[i] = tinysr_allocate_context();
+		tinysr_load_model(ctxs[i], "demos/speech_model_digits");
+		ctxs[i]->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	}
+	check(tinysr_start_async(ctxs[1], 16, NULL, NULL) == 0 && tinysr_start_async(ctxs[2], 16, log_result, &called) == 0, "starting background recognition");
+	expected.count = polled.count = called.count = 0;
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < 48000 * 3; i += 480) {
+			for (k = 0; k < 3; k++)
+				tinysr_recognize(ctxs[k], audio + i, 480);
+			result_t* r = &expected.results[expected.count];
+			while (expected.count < 64 && tinysr_get_result_span(ctxs[0], &r->word_index, &r->score, &r->first_frame, &r->end_frame))
+				r = &expected.results[++expected.count];
+			r = &polled.results[polled.count];
+			while (polled.count < 64 && tinysr_get_result_span(ctxs[1], &r->word_index, &r->score, &r->first_frame, &r->end_frame))
+				r = &polled.results[++polled.count];
+		}
+	}
+	int dropped = tinysr_async_dropped(ctxs[1]) + tinysr_async_dropped(ctxs[2]);
+	// Stopping waits for the last utterances, and leaves their results to be fetched.
+	tinysr_stop_async(ctxs[1]);
+	tinysr_stop_async(ctxs[2]);
+	result_t* r = &polled.results[polled.count];
+	while (polled.count < 64 && tinysr_get_result_span(ctxs[1], &r->word_index, &r->score, &r->first_frame, &r->end_frame))
+		r = &polled.results[++polled.count];
+	int same = expected.count >= 6 && polled.count == expected.count && called.count == expected.count;
+	for (i = 0; same && i < expected.count; i++) {
+		same &= !memcmp(&polled.results[i], &expected.results[i], sizeof(result_t));
+		same &= !memcmp(&called.results[i], &expected.results[i], sizeof(result_t));
+	}
+	check(same, "background recognition gets the same results as recognizing in the foreground");
+	check(dropped == 0 && !tinysr_get_result(ctxs[2], NULL, NULL), "no background results are dropped or duplicated");
+	for (i = 0; i < 3; i++)
+		tinysr_free_context(ctxs[i]);
+}
+
+// Contexts bound to one model must recognize exactly as a context with the model loaded into it would, all
+// at once on their own threads, and the model must live until the last of them lets go of it.
+typedef struct {
+	tinysr_ctx_t* ctx;
+	utterance_t* utterances;
+	int count, * words, agrees;
+	tinysr_score_t* scores;
+} shared_model_check_t;
+
+static void* shared_model_check(void* arg) {
+	shared_model_check_t* job = arg;
+	int i, pass, word_index;
+	tinysr_score_t score;
+	for (pass = 0; pass < 5; pass++) {
+		for (i = 0; i < job->count; i++) {
+			tinysr_recognize_utterance(job->ctx, &job->utterances[i]);
+			job->agrees &= tinysr_get_result(job->ctx, &word_index, &score) && word_index == job->words[i] && score == job->scores[i];
+		}
+	}
+	return NULL;
+}
+
+void test_shared_model(void) {
+	static feature_vector_t fvs[16][256];
+	utterance_t utterances[16];
+	int words[16], i, j;
+	tinysr_score_t scores[16];
+	allocation_counts_t counts = {0};
+	tinysr_allocator_t counting = {counting_allocate, counting_release, &counts};
+	tinysr_model_t* model = tinysr_model_create(&counting);
+	check(model != NULL && tinysr_model_load(model, "demos/speech_model_digits") > 0, "loading a shared model");
+	long releases = counts.releases;
+	tinysr_ctx_t* own = tinysr_allocate_context();
+	tinysr_load_model(own, "demos/speech_model_digits");
+	// The answers, from a context with the model loaded into it.
+	for (i = 0; i < 16; i++) {
+		utterances[i].feature_vectors = fvs[i];
+		utterances[i].length = 30 + 13 * i;
+		for (j = 0; j < utterances[i].length * 13; j++)
+			fvs[i][j / 13].cepstrum[j % 13] = random_float(-4.0f, 4.0f) * (j % 13 == 0 ? 4 : 1);
+		tinysr_recognize_utterance(own, &utterances[i]);
+		tinysr_get_result(own, &words[i], &scores[i]);
+	}
+	tinysr_ctx_t* ctxs[4];
+	int bound = 1;
+	for (i = 0; i < 4; i++) {
+		ctxs[i] = tinysr_allocate_context();
+		bound &= tinysr_bind_model(ctxs[i], model) == 0 && ctxs[i]->recog_entry_list.length == own->recog_entry_list.length;
+	}
+	check(bound, "binding contexts to a shared model");
+	// The contexts now hold the model on their own.
+	tinysr_model_release(model);
+	check(tinysr_load_model(ctxs[0], "demos/speech_model_digits") == -1 && ctxs[0]->recog_entry_list.length == own->recog_entry_list.length,
+		"a model shared between contexts can't be added to");
+	check(tinysr_set_keyword_threshold(ctxs[0], 0, 5) == 0 && ctxs[1]->keyword_thresholds[0] != 5, "keyword thresholds belong to each context");
+	pthread_t threads[4];
+	shared_model_check_t jobs[4];
+	for (i = 0; i < 4; i++) {
+		shared_model_check_t job = {ctxs[i], utterances, 16, words, 1, scores};
+		jobs[i] = job;
+		pthread_create(&threads[i], NULL, shared_model_check, &jobs[i]);
+	}
+	int agrees = 1;
+	for (i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		agrees &= jobs[i].agrees;
+	}
+	check(agrees, "contexts sharing a model recognize at the same time, the same as with their own copies");
+	for (i = 0; i < 3; i++)
+		tinysr_free_context(ctxs[i]);
+	check(counts.allocations > 0 && counts.releases == releases, "a shared model lives as long as a context is bound to it");
+	tinysr_free_context(ctxs[3]);
+	check(counts.allocations == counts.releases, "a shared model is freed with the last context bound to it");
+	tinysr_free_context(own);
+}
+
+// Makes an empty temporary file, putting its name in path, which holds at least 32 characters.
+static void temporary_path(char* path) {
+	strcpy(path, "/tmp/tinysr_test_XXXXXX");
+	int fd = mkstemp(path);
+	check(fd != -1, "making a temporary file");
+	close(fd);
+}
+
+// Writes the first length bytes of a file to another, or with a negative length, all but the last -length
+// bytes, with one byte optionally replaced.
+static void copy_prefix(const char* from, const char* to, long length, long patch_at, unsigned char patch) {
+	static unsigned char data[1 << 20];
+	FILE* fp = fopen(from, "rb");
+	long size = fread(data, 1, sizeof(data), fp);
+	fclose(fp);
+	if (patch_at >= 0)
+		data[patch_at] = patch;
+	fp = fopen(to, "wb");
+	if (length < 0)
+		length += size;
+	fwrite(data, 1, length < size ? length : size, fp);
+	fclose(fp);
+}
+
+// Recognizes random utterances with two contexts, and checks they pick the same words, with scores within
+// the given relative error.
+static int same_results(tinysr_ctx_t* a, tinysr_ctx_t* b, float tolerance) {
+	static feature_vector_t fvs[256];
+	utterance_t utterance = {0, fvs};
+	int i, j, same = 1;
+	for (i = 0; i < 16; i++) {
+		utterance.length = 30 + 13 * i;
+		for (j = 0; j < utterance.length * 13; j++)
+			fvs[j / 13].cepstrum[j % 13] = random_float(-4.0f, 4.0f) * (j % 13 == 0 ? 4 : 1);
+		int word_a, word_b;
+		tinysr_score_t score_a, score_b;
+		tinysr_recognize_utterance(a, &utterance);
+		tinysr_recognize_utterance(b, &utterance);
+		same &= tinysr_get_result(a, &word_a, &score_a) && tinysr_get_result(b, &word_b, &score_b) && word_a == word_b;
+		same &= tolerance == 0 ? score_a == score_b : fabsf(score_a - score_b) <= tolerance * fabsf(score_a);
+	}
+	return same;
+}
+
+// Models must survive the trip through each file format, and malformed files must be turned away without
+// adding any words, or leaking anything.
+void test_model_files(void) {
+	char v2_path[32], legacy_path[32], bad_path[32];
+	int i;
+	temporary_path(v2_path);
+	temporary_path(legacy_path);
+	temporary_path(bad_path);
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	tinysr_model_load(model, "demos/speech_model_digits");
+	check(tinysr_model_save(model, v2_path, TINYSR_MODEL_V2) == 0 && tinysr_model_save(model, legacy_path, TINYSR_MODEL_LEGACY) == 0,
+		"saving a model in each format");
+	tinysr_model_release(model);
+	tinysr_ctx_t* original = tinysr_allocate_context();
+	tinysr_ctx_t* from_v2 = tinysr_allocate_context();
+	tinysr_ctx_t* from_legacy = tinysr_allocate_context();
+	tinysr_load_model(original, "demos/speech_model_digits");
+	check(tinysr_load_model(from_v2, v2_path) == original->recog_entry_list.length &&
+		tinysr_load_model(from_legacy, legacy_path) == original->recog_entry_list.length, "loading a model in each format");
+	int names_match = 1;
+	for (i = 0; i < original->recog_entry_list.length; i++)
+		names_match &= strcmp(original->word_names[i], from_v2->word_names[i]) == 0 && strcmp(original->word_names[i], from_legacy->word_names[i]) == 0;
+	check(names_match, "word names survive each format");
+	check(same_results(original, from_v2, 0), "a version 2 model recognizes exactly as the model it was saved from");
+	check(same_results(original, from_legacy, 1e-4f), "a legacy model recognizes as the model it was saved from");
+	// A second file can't use the first one's slab, so the model gets rebuilt.
+	check(tinysr_load_model(original, "demos/speech_model_digits") > 0 && tinysr_load_model(from_v2, v2_path) > 0 &&
+		same_results(original, from_v2, 0), "loading a version 2 model after another");
+	tinysr_free_context(original);
+	tinysr_free_context(from_v2);
+	tinysr_free_context(from_legacy);
+
+	// Truncated files, and version 2 files with the wrong magic, version, or first state.
+	long v2_cuts[] = {3, 63, 64, 100, 1000, -1}, legacy_cuts[] = {3, 10, 100, -1};
+	int rejected = 1;
+	allocation_counts_t counts = {0};
+	tinysr_allocator_t counting = {counting_allocate, counting_release, &counts};
+	model = tinysr_model_create(&counting);
+	for (i = 0; i < 6 + 4 + 3; i++) {
+		if (i < 6)
+			copy_prefix(v2_path, bad_path, v2_cuts[i], -1, 0);
+		else if (i < 10)
+			copy_prefix(legacy_path, bad_path, legacy_cuts[i - 6], -1, 0);
+		else
+			copy_prefix(v2_path, bad_path, 1 << 20, (long[]) {0, 4, 64 + 20}[i - 10], 7);
+		rejected &= tinysr_model_load(model, bad_path) == -1;
+	}
+	check(rejected, "malformed model files are rejected");
+	// A version 2 file whose slab is laid out for one more state than it has, so not in whole panels.
+	uint32_t state_count = 0;
+	copy_prefix(v2_path, bad_path, 1 << 20, -1, 0);
+	FILE* fp = fopen(bad_path, "r+b");
+	fseek(fp, 12, SEEK_SET);
+	check(fread(&state_count, 4, 1, fp) == 1, "reading a version 2 file's state count");
+	state_count++;
+	fseek(fp, 16, SEEK_SET);
+	fwrite(&state_count, 4, 1, fp);
+	fclose(fp);
+	check(tinysr_model_load(model, bad_path) == -1, "version 2 files whose slab doesn't match their states are rejected");
+	check(tinysr_model_load(model, legacy_path) > 0, "a model that turned away malformed files still loads");
+	tinysr_model_release(model);
+	check(counts.allocations == counts.releases, "rejecting malformed model files leaks nothing");
+	remove(v2_path);
+	remove(legacy_path);
+	remove(bad_path);
+}
+
+// Utterances must come back out of a corpus exactly as they went in, with their labels, including those
+// appended after the corpus was first written, and malformed corpora must be turned away.
+void test_corpus(void) {
+	static feature_vector_t fvs[3][50];
+	char path[32], bad_path[32];
+	const char* labels[3] = {"one", "two", "one"};
+	int lengths[3] = {50, 0, 17}, i, j;
+	temporary_path(path);
+	temporary_path(bad_path);
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 50; j++) {
+			fvs[i][j].number = i * 1000 + j;
+			fvs[i][j].log_energy = random_float(0.0f, 20.0f);
+			fvs[i][j].noise_floor = random_float(0.0f, 20.0f);
+			int k;
+			for (k = 0; k < 13; k++)
+				fvs[i][j].cepstrum[k] = random_float(-4.0f, 4.0f);
+		}
+	}
+	// Two utterances go into a new corpus, and one more is appended later.
+	int written = 1;
+	for (i = 0; i < 3; i += 2) {
+		tinysr_corpus_writer_t* writer = tinysr_corpus_writer_open(path);
+		written &= writer != NULL;
+		if (writer == NULL)
+			break;
+		for (j = i; j < (i == 0 ? 2 : 3); j++) {
+			utterance_t utterance = {lengths[j], fvs[j]};
+			written &= tinysr_corpus_append(writer, labels[j], &utterance) == 0;
+		}
+		written &= tinysr_corpus_writer_close(writer) == 0;
+	}
+	check(written, "writing and appending to a corpus");
+	tinysr_corpus_t* corpus = tinysr_corpus_open(path);
+	check(corpus != NULL && tinysr_corpus_count(corpus) == 3, "reading a corpus");
+	if (corpus != NULL) {
+		int same = 1;
+		for (i = 0; i < 3 && tinysr_corpus_count(corpus) == 3; i++) {
+			utterance_t utterance;
+			same &= tinysr_corpus_utterance(corpus, i, &utterance) == 0 && utterance.length == lengths[i] && strcmp(tinysr_corpus_label(corpus, i), labels[i]) == 0;
+			for (j = 0; j < utterance.length && same; j++)
+				same &= utterance.feature_vectors[j].number == fvs[i][j].number &&
+					utterance.feature_vectors[j].log_energy == fvs[i][j].log_energy && utterance.feature_vectors[j].noise_floor == fvs[i][j].noise_floor &&
+					memcmp(utterance.feature_vectors[j].cepstrum, fvs[i][j].cepstrum, sizeof(fvs[i][j].cepstrum)) == 0;
+		}
+		check(same, "utterances and labels come back out of a corpus exactly");
+		utterance_t utterance;
+		check(tinysr_corpus_utterance(corpus, 3, &utterance) != 0 && tinysr_corpus_label(corpus, -1) == NULL, "there are no utterances past the end of a corpus");
+		tinysr_corpus_close(corpus);
+	}
+	// Truncated corpora, ones with the wrong magic, and other files, which can't be appended to either.
+	int rejected = 1;
+	for (i = 0; i < 4; i++) {
+		if (i < 3)
+			copy_prefix(path, bad_path, (long[]) {3, 30, -1}[i], -1, 0);
+		else
+			copy_prefix(path, bad_path, 1 << 20, 0, 7);
+		corpus = tinysr_corpus_open(bad_path);
+		rejected &= corpus == NULL && tinysr_corpus_writer_open(bad_path) == NULL;
+		tinysr_corpus_close(corpus);
+	}
+	check(rejected, "malformed corpora are rejected");
+	// Appending one utterance at a time mustn't leave a whole old index behind each time.
+	remove(path);
+	written = 1;
+	for (i = 0; i < 200 && written; i++) {
+		tinysr_corpus_writer_t* writer = tinysr_corpus_writer_open(path);
+		utterance_t utterance = {1, fvs[i % 3]};
+		written &= writer != NULL && tinysr_corpus_append(writer, labels[i % 3], &utterance) == 0;
+		written &= writer != NULL && tinysr_corpus_writer_close(writer) == 0;
+	}
+	corpus = tinysr_corpus_open(path);
+	check(written && corpus != NULL && tinysr_corpus_count(corpus) == 200, "appending to a corpus one utterance at a time");
+	struct stat info;
+	check(stat(path, &info) == 0 && info.st_size < 200 * 3 * (long) sizeof(feature_vector_t), "a corpus appended to one utterance at a time stays in proportion");
+	tinysr_corpus_close(corpus);
+	remove(path);
+	remove(bad_path);
+}
+
+// A word with mixture states must score each state as its best component. Scoring every component has to
+// agree with the reference cell by cell matching, whichever way it's run, while shorter shortlists can only
+// score each word lower, and no lower than scoring each state's heaviest component alone. Version 3 files
+// must bring the mixtures, and the codebook picking them, back exactly.
+void test_mixtures(void) {
+	static feature_vector_t fvs[256];
+	static float offsets[40 * 8 * 3], means[40 * 8 * 3 * 13], inverse_covariances[40 * 8 * 3 * 169];
+	static tinysr_score_t dp_row[8], scores[4][40];
+	int component_counts[8], i, j, k, word, shortlist;
+	char name[16], v3_path[32], v2_path[32];
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	int added = 1;
+	for (word = 0; word < 40; word++) {
+		int components = 0;
+		for (j = 0; j < 8; j++) {
+			component_counts[j] = 1 + (word + j) % 3;
+			// Heaviest first, so each later component is down weighted.
+			for (k = 0; k < component_counts[j]; k++, components++) {
+				offsets[components] = random_float(-3.0f, 0.0f) - k;
+				for (i = 0; i < 13; i++)
+					means[components*13 + i] = random_float(-4.0f, 4.0f);
+				for (i = 0; i < 169; i++)
+					inverse_covariances[components*169 + i] = i % 14 == 0 ? random_float(0.5f, 1.5f) : 0.0f;
+			}
+		}
+		snprintf(name, sizeof(name), "word%i", word);
+		added &= tinysr_model_add_mixture_word(model, name, 0, 1, 8, component_counts, offsets, means, inverse_covariances) == word;
+	}
+	check(added, "adding mixture words to a model");
+	temporary_path(v3_path);
+	temporary_path(v2_path);
+	check(tinysr_model_save(model, v3_path, TINYSR_MODEL_V3) == 0, "saving a mixture model in version 3 format");
+	check(tinysr_model_save(model, v2_path, TINYSR_MODEL_V2) != 0 && tinysr_model_save(model, v2_path, TINYSR_MODEL_LEGACY) != 0,
+		"only version 3 files can hold mixture states");
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	tinysr_bind_model(ctx, model);
+	tinysr_model_release(model);
+	tinysr_thread_pool_t* pool = tinysr_thread_pool_create(3);
+	int exact = 1, ordered = 1, threaded = 1, heaviest = 1;
+	for (k = 0; k < 16; k++) {
+		// Walks through a word's components, some heaviest and some not, and random utterances.
+		utterance_t utterance = {0, fvs};
+		recog_entry_t* entry = NULL;
+		list_node_t* re;
+		for (re = ctx->recog_entry_list.head, i = 0; re != NULL && i < k * 5 % 40; re = re->next, i++);
+		if (k % 2 == 0) {
+			entry = re->datum;
+			for (j = 0; j < 8; j++) {
+				gaussian_t* gauss = entry->mixture_starts[j+1] > entry->mixture_starts[j] && j % 2 ? &entry->mixture[entry->mixture_starts[j+1] - 1] : &entry->model_template[j];
+				for (i = 0; i < 3; i++, utterance.length++)
+					for (word = 0; word < 13; word++)
+						fvs[utterance.length].cepstrum[word] = gauss->cepstrum_mean[word] + random_float(-0.5f, 0.5f);
+			}
+		} else {
+			utterance.length = 30 + 7 * k;
+			for (i = 0; i < utterance.length * 13; i++)
+				fvs[i / 13].cepstrum[i % 13] = random_float(-4.0f, 4.0f);
+		}
+		// The reference scores every component of every cell.
+		int best = 0, word_index;
+		tinysr_score_t best_score = TINYSR_SCORE_MIN, score;
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			tinysr_score_t reference = compute_dynamic_time_warping(re->datum, &utterance, dp_row);
+			if (reference > best_score) {
+				best = ((recog_entry_t*) re->datum)->index;
+				best_score = reference;
+			}
+		}
+		ctx->mixture_shortlist = TINYSR_MIXTURE_EXACT;
+		for (ctx->dtw_mode = TINYSR_DTW_EXACT; ctx->dtw_mode <= TINYSR_DTW_PRUNED; ctx->dtw_mode++) {
+			ctx->dtw_band_percent = 100;
+			ctx->dtw_beam = 1e30;
+			tinysr_recognize_utterance(ctx, &utterance);
+			exact &= tinysr_get_result(ctx, &word_index, &score) && word_index == best && fabsf(score - best_score) < 1e-3 * (1 + fabsf(best_score));
+		}
+		heaviest &= entry == NULL || word_index == entry->index;
+		for (shortlist = 0; shortlist < 4; shortlist++) {
+			ctx->mixture_shortlist = shortlist < 3 ? shortlist : TINYSR_MIXTURE_EXACT;
+			tinysr_score_words(ctx, &utterance, scores[shortlist]);
+			for (word = 0; word < 40 && shortlist > 0; word++)
+				ordered &= scores[shortlist][word] >= scores[shortlist-1][word] - 1e-3 * fabsf(scores[shortlist-1][word]);
+			// The thread pool, exact and with pruning, picks the same word with the same score as one thread.
+			ctx->dtw_band_percent = 40;
+			ctx->dtw_beam = 300;
+			for (ctx->dtw_mode = TINYSR_DTW_EXACT; ctx->dtw_mode <= TINYSR_DTW_PRUNED; ctx->dtw_mode++) {
+				tinysr_score_t threaded_score;
+				int threaded_index;
+				ctx->thread_pool = NULL;
+				tinysr_recognize_utterance(ctx, &utterance);
+				tinysr_get_result(ctx, &word_index, &score);
+				ctx->thread_pool = pool;
+				tinysr_recognize_utterance(ctx, &utterance);
+				tinysr_get_result(ctx, &threaded_index, &threaded_score);
+				threaded &= pool == NULL || (word_index == threaded_index && score == threaded_score);
+				ctx->thread_pool = NULL;
+			}
+			ctx->dtw_mode = TINYSR_DTW_PRUNED;
+		}
+	}
+	check(exact, "scoring every mixture component agrees with the reference, exact and pruned");
+	check(heaviest, "walks through lighter mixture components are recognized");
+	check(ordered, "longer shortlists of mixture components only score words higher");
+	check(threaded, "mixture words on a thread pool agree with one thread");
+	ctx->mixture_shortlist = 1;
+	ctx->dtw_mode = TINYSR_DTW_EXACT;
+	tinysr_ctx_t* from_v3 = tinysr_allocate_context();
+	check(tinysr_load_model(from_v3, v3_path) == 40, "loading a version 3 mixture model");
+	check(same_results(ctx, from_v3, 0), "a version 3 model recognizes exactly as the mixture model it was saved from");
+	ctx->mixture_shortlist = from_v3->mixture_shortlist = TINYSR_MIXTURE_EXACT;
+	check(same_results(ctx, from_v3, 0), "a version 3 model scores every component as the mixture model it was saved from");
+	tinysr_free_context(from_v3);
+	// A version 3 file whose codebook was built with other settings gets it rebuilt when it's bound. If loading
+	// runs out of memory, the model is left empty, as it was, and if building does, binding fails, leaving the
+	// context with no words, but the model can still be bound once there's memory.
+	copy_prefix(v3_path, v2_path, 1 << 20, 92, 7);
+	int unchanged = 1, bound_words = 0, fail_after;
+	for (fail_after = 1; fail_after < 1000; fail_after++) {
+		allocation_counts_t counts = {0, 0, fail_after};
+		tinysr_allocator_t limited = {counting_allocate, counting_release, &counts};
+		model = tinysr_model_create(&limited);
+		if (model == NULL)
+			continue;
+		int loaded = tinysr_model_load(model, v2_path);
+		tinysr_ctx_t* bound = tinysr_allocate_context();
+		if (loaded == 40) {
+			bound_words = tinysr_bind_model(bound, model) == 0 ? bound->recog_entry_list.length : 0;
+			unchanged &= bound_words == 40 || bound->recog_entry_list.length == 0;
+			counts.fail_after = 0;
+			if (bound_words == 0)
+				unchanged &= tinysr_bind_model(bound, model) == 0 && bound->recog_entry_list.length == 40;
+		} else {
+			unchanged &= loaded == -1 && tinysr_bind_model(bound, model) == 0 && bound->recog_entry_list.length == 0;
+		}
+		tinysr_free_context(bound);
+		tinysr_model_release(model);
+		unchanged &= counts.allocations == counts.releases;
+		if (bound_words == 40)
+			break;
+	}
+	check(unchanged && fail_after < 1000, "a mixture model that runs out of memory loading or building is left as it was");
+	// Truncated version 3 files are turned away.
+	copy_prefix(v3_path, v2_path, -1, -1, 0);
+	model = tinysr_model_create(NULL);
+	check(tinysr_model_load(model, v2_path) == -1, "truncated version 3 files are rejected");
+	tinysr_model_release(model);
+	tinysr_free_context(ctx);
+	if (pool != NULL)
+		tinysr_thread_pool_free(pool);
+	remove(v3_path);
+	remove(v2_path);
+}
+
+// Words built in memory must score as their parameters say, and alignments must be valid paths that score
+// what recognition does.
+void test_training(void) {
+	float offsets[4], means[4 * 13], inverse_covariances[4 * 169] = {0}, zeros[169] = {0};
+	static feature_vector_t fvs[40];
+	int frames[40 + 4], states[40 + 4], i, j;
+	for (i = 0; i < 4; i++) {
+		offsets[i] = random_float(-3.0f, 0.0f);
+		for (j = 0; j < 13; j++) {
+			means[i*13 + j] = random_float(-2.0f, 2.0f);
+			inverse_covariances[i*169 + j*14] = 1.0f;
+		}
+	}
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	check(tinysr_model_add_word(model, "first", 0, 1, 4, offsets, means, inverse_covariances) == 0 &&
+		tinysr_model_add_word(model, "second", 0, 1, 3, offsets + 1, means + 13, inverse_covariances + 169) == 1, "adding words to a model");
+	check(tinysr_model_add_word(model, "bad", 0, 1, 1, offsets, means, zeros) == -1, "words need positive definite inverse covariances");
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	tinysr_bind_model(ctx, model);
+	tinysr_model_release(model);
+	check(ctx->recog_entry_list.length == 2 && strcmp(ctx->word_names[1], "second") == 0, "words added to a model are named in order");
+	utterance_t utterance = {40, fvs};
+	for (i = 0; i < 40 * 13; i++)
+		fvs[i / 13].cepstrum[i % 13] = random_float(-2.0f, 2.0f);
+	tinysr_score_t log_likelihood, word_scores[2];
+	int cells = tinysr_align_utterance(ctx, 0, &utterance, frames, states, &log_likelihood), valid = cells >= 40 && cells <= 43;
+	double path_score = 0;
+	for (i = 0; i < cells && valid; i++) {
+		if (i > 0) {
+			int frame_step = frames[i] - frames[i-1], state_step = states[i] - states[i-1];
+			valid &= frame_step >= 0 && frame_step <= 1 && state_step >= 0 && state_step <= 1 && frame_step + state_step > 0;
+		}
+		// With unit inverse covariances, each cell scores its offset less half its squared distance to the mean.
+		double distance = 0;
+		for (j = 0; j < 13; j++)
+			distance += (fvs[frames[i]].cepstrum[j] - means[states[i]*13 + j]) * (fvs[frames[i]].cepstrum[j] - means[states[i]*13 + j]);
+		path_score += offsets[states[i]] - 0.5 * distance;
+	}
+	valid &= frames[0] == 0 && states[0] == 0 && frames[cells-1] == 39 && states[cells-1] == 3;
+	check(valid, "alignments run from the first frame and state to the last, one step at a time");
+	check(fabs(path_score - log_likelihood) < 1e-3 * fabs(path_score), "an alignment scores the sum of the log-likelihoods along it");
+	tinysr_score_words(ctx, &utterance, word_scores);
+	check(word_scores[0] == log_likelihood, "scoring every word agrees with alignment");
+	check(tinysr_align_utterance(ctx, 2, &utterance, frames, states, &log_likelihood) == -1, "aligning to a missing word fails");
+	tinysr_free_context(ctx);
+	// Scoring every word picks out the same best word, with the same score, as recognition.
+	ctx = tinysr_allocate_context();
+	tinysr_load_model(ctx, "demos/speech_model_digits");
+	tinysr_score_t* scores = malloc(sizeof(tinysr_score_t) * ctx->recog_entry_list.length);
+	int agrees = 1;
+	for (i = 0; i < 8; i++) {
+		utterance.length = 10 + 4 * i;
+		for (j = 0; j < utterance.length * 13; j++)
+			fvs[j / 13].cepstrum[j % 13] = random_float(-4.0f, 4.0f) * (j % 13 == 0 ? 4 : 1);
+		int word, best = 0;
+		tinysr_score_t score;
+		tinysr_recognize_utterance(ctx, &utterance);
+		tinysr_get_result(ctx, &word, &score);
+		tinysr_score_words(ctx, &utterance, scores);
+		for (j = 1; j < ctx->recog_entry_list.length; j++)
+			best = scores[j] > scores[best] ? j : best;
+		agrees &= best == word && scores[best] == score;
+	}
+	check(agrees, "scoring every word agrees with recognition");
+	free(scores);
+	tinysr_free_context(ctx);
+}
+
+// Streaming recognition must go through each utterance while it's being spoken, and end up with the same
+// results as recognizing the same utterances afterwards with the same normalization.
+void test_streaming(void) {
+	static samp_t audio[48000 * 3];
+	int i, pass;
+	for (i = 0; i < 48000 * 3; i++) {
+		int t = i % 48000;
+		float envelope = t > 12000 && t < 30000 ? sinf((t - 12000) * PI2_F / 36000) : 0.0f;
+		audio[i] = (samp_t) (8000 * envelope * (sinf(i * (0.02f + 0.01f * (i / 48000))) + 0.5f * sinf(i * 0.11f)) + rand() % 60);
+	}
+	tinysr_ctx_t* batch = tinysr_allocate_context();
+	tinysr_ctx_t* streaming = tinysr_allocate_context();
+	tinysr_load_model(batch, "demos/speech_model_digits");
+	tinysr_load_model(streaming, "demos/speech_model_digits");
+	batch->utterance_mode = streaming->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	batch->cmn_mode = TINYSR_CMN_RUNNING;
+	streaming->streaming = 1;
+	int results = 0, matches = 1, advanced_early = 0, all_streamed = 1;
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < 48000 * 3; i += 480) {
+			tinysr_recognize(batch, audio + i, 480);
+			// Streamed utterances never need queueing up for recognition afterwards.
+			tinysr_feed_input(streaming, audio + i, 480);
+			tinysr_detect_utterances(streaming);
+			all_streamed &= streaming->utterance_list.length == 0;
+			advanced_early |= streaming->utterance_state == 1 && streaming->stream_frames > 0;
+			int batch_word, streaming_word;
+			tinysr_score_t batch_score, streaming_score;
+			while (tinysr_get_result(batch, &batch_word, &batch_score)) {
+				results++;
+				matches &= tinysr_get_result(streaming, &streaming_word, &streaming_score) && streaming_word == batch_word &&
+					fabsf(streaming_score - batch_score) < 1e-3 * (1 + fabsf(batch_score));
+			}
+			matches &= !tinysr_get_result(streaming, NULL, NULL);
+		}
+	}
+	check(results >= 6 && matches, "streaming recognition matches recognizing the same utterances afterwards");
+	check(advanced_early && all_streamed, "streaming recognition advances while the utterance is going on");
+	tinysr_free_context(batch);
+	tinysr_free_context(streaming);
+}
+
+// Keyword spotting must find each word in a stream of noise, where it was said, as soon as it's matched,
+// without detecting anything in the noise. It must keep up with audio input without the ring growing.
+void test_keyword_spotting(void) {
+	static feature_vector_t fvs[4096];
+	static samp_t audio[16000];
+	long long segment_start[32], segment_end[32];
+	int i, j, k, segments = 0, count = 0;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	check(tinysr_load_model(ctx, "demos/speech_model_digits") > 0, "loading a model for keyword spotting");
+	list_node_t* re;
+	for (re = ctx->recog_entry_list.head; re != NULL && segments < 32; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		for (i = 0; i < 100; i++, count++)
+			for (j = 0; j < 13; j++)
+				fvs[count].cepstrum[j] = random_float(-4.0f, 4.0f) * (j == 0 ? 3 : 1);
+		segment_start[segments] = count + 1;
+		for (i = 0; i < entry->model_template_length; i++)
+			for (k = 0; k < 1 + i % 2; k++, count++)
+				for (j = 0; j < 13; j++)
+					fvs[count].cepstrum[j] = entry->model_template[i].cepstrum_mean[j] + random_float(-1.0f, 1.0f);
+		segment_end[segments++] = count + 1;
+	}
+	for (i = 0; i < count; i++)
+		fvs[i].number = i + 1;
+	int found[32] = {0}, misplaced = 0, word_index;
+	long long first_frame, end_frame;
+	for (i = 0; i < count; i++) {
+		tinysr_spot_keywords(ctx, &fvs[i], 1);
+		while (tinysr_get_result_span(ctx, &word_index, NULL, &first_frame, &end_frame)) {
+			// Detections must come out on the frame they end at, and lie within a segment. Digits are easily
+			// confused, so other words may turn up too, but each word must turn up in its own segment.
+			int segment = -1;
+			for (j = 0; j < segments; j++)
+				if (end_frame > segment_start[j] && end_frame <= segment_end[j] && first_frame >= segment_start[j] - 5)
+					segment = j;
+			if (end_frame != fvs[i].number + 1 || segment == -1)
+				misplaced++;
+			else if (segment == word_index)
+				found[segment] = 1;
+		}
+	}
+	// A word detected twice mustn't make up for another missed.
+	int missed = 0;
+	for (j = 0; j < segments; j++)
+		missed += !found[j];
+	check(missed == 0 && misplaced == 0, "keyword spotting finds each word where it was said, and nothing in the noise");
+	tinysr_free_context(ctx);
+
+	ctx = tinysr_allocate_context();
+	tinysr_load_model(ctx, "demos/speech_model_digits");
+	ctx->input_sample_rate = 16000;
+	ctx->utterance_mode = TINYSR_MODE_KEYWORD_SPOTTING;
+	for (i = 0; i < 16000; i++)
+		audio[i] = (samp_t) (3000 * sinf(i * 0.05f) * sinf(i * 0.0004f) + rand() % 100);
+	int bounded = 1;
+	for (k = 0; k < 20; k++) {
+		for (i = 0; i < 16000; i += 160) {
+			tinysr_recognize(ctx, audio + i, 160);
+			bounded &= tinysr_feature_count(ctx) == 0;
+		}
+		while (tinysr_get_result(ctx, NULL, NULL));
+	}
+	check(bounded && ctx->fv_ring_mask == 1023, "keyword spotting keeps up with audio input in bounded memory");
+	tinysr_free_context(ctx);
+}
+
+// The stats must add up: every frame and utterance counted, every call in its stage's histogram, exact
+// matching evaluating every cell and pruned matching fewer, and background matching counted once it's back.
+void test_stats(void) {
+	static samp_t audio[48000 * 3];
+	tinysr_stats_t stats[3], zero;
+	int i, k, calls = 0;
+	long long cells = 0;
+	for (i = 0; i < 48000 * 3; i++) {
+		int t = i % 48000;
+		float envelope = t > 12000 && t < 30000 ? sinf((t - 12000) * PI2_F / 36000) : 0.0f;
+		audio[i] = (samp_t) (8000 * envelope * (sinf(i * (0.02f + 0.01f * (i / 48000))) + 0.5f * sinf(i * 0.11f)) + rand() % 60);
+	}
+	tinysr_ctx_t* ctxs[3];
+	for (k = 0; k < 3; k++) {
+		ctxs[k] = tinysr_allocate_context();
+		tinysr_load_model(ctxs[k], "demos/speech_model_digits");
+		ctxs[k]->utterance_mode = TINYSR_MODE_FREE_RUNNING;
+	}
+	ctxs[1]->dtw_mode = TINYSR_DTW_PRUNED;
+	check(tinysr_get_stats(ctxs[0], &stats[0]) == 0 && stats[0].allocations > 0 && stats[0].bytes_allocated > 0, "loading a model counts its allocations");
+	memset(&zero, 0, sizeof(tinysr_stats_t));
+	tinysr_reset_stats(ctxs[0]);
+	tinysr_get_stats(ctxs[0], &stats[0]);
+	check(memcmp(&stats[0], &zero, sizeof(tinysr_stats_t)) == 0, "resetting the stats zeroes them");
+	tinysr_start_async(ctxs[2], 16, NULL, NULL);
+	for (k = 0; k < 3; k++)
+		tinysr_reset_stats(ctxs[k]);
+	int results = 0;
+	for (i = 0; i < 48000 * 3; i += 480, calls++) {
+		for (k = 0; k < 3; k++)
+			tinysr_recognize(ctxs[k], audio + i, 480);
+		int word_index;
+		tinysr_score_t score;
+		long long first_frame, end_frame;
+		while (tinysr_get_result_span(ctxs[0], &word_index, &score, &first_frame, &end_frame)) {
+			cells += (end_frame - first_frame) * ctxs[0]->state_count;
+			results++;
+		}
+	}
+	tinysr_stop_async(ctxs[2]);
+	for (k = 0; k < 3; k++)
+		tinysr_get_stats(ctxs[k], &stats[k]);
+	int consistent = 1;
+	for (k = 0; k < 3; k++) {
+		int stage, bucket;
+		for (stage = 0; stage < TINYSR_STAGE_COUNT; stage++) {
+			tinysr_stage_stats_t* s = &stats[k].stages[stage];
+			long long counted = 0;
+			for (bucket = 0; bucket < TINYSR_STATS_BUCKETS; bucket++)
+				counted += s->histogram[bucket];
+			consistent &= counted == s->calls && s->total_ns >= s->max_ns && s->max_ns >= 0;
+		}
+		// Feature vectors are numbered from one.
+		consistent &= stats[k].frames == ctxs[k]->next_fv_number - 1 && stats[k].utterances == results;
+		consistent &= stats[k].stages[TINYSR_STAGE_FEED].calls == calls && stats[k].stages[TINYSR_STAGE_DETECT].calls == calls;
+		consistent &= stats[k].stages[TINYSR_STAGE_FRONTEND].calls == stats[k].frames;
+		consistent &= stats[k].stages[TINYSR_STAGE_MATCH].calls == results;
+	}
+	check(results >= 3 && consistent, "the stats count every call, frame and utterance, in each stage");
+	check(stats[0].dtw_cells == cells && stats[2].dtw_cells == cells, "exact matching counts every cell, in the foreground and in the background");
+	check(stats[1].dtw_cells > 0 && stats[1].dtw_cells < cells / 2, "pruned matching counts fewer cells");
+	for (k = 0; k < 3; k++)
+		tinysr_free_context(ctxs[k]);
+}
+
+int main(int argc, char** argv) {
+	int i;
+	printf("Checking planned FFTs against the reference FFT.\n");
+	test_fft();
+	printf("Checking front-end plans.\n");
+	test_frontend_plan();
+	printf("Checking vectorized kernels against the scalar kernels.\n");
+	test_kernels();
+	printf("Checking the ingest path.\n");
+	test_ingest();
+	printf("Checking bulk feature extraction.\n");
+	test_extract();
+	printf("Checking the feature vector ring.\n");
+	test_feature_ring();
+	printf("Checking Gaussian scoring.\n");
+	test_gaussian();
+	printf("Checking batched scoring.\n");
+	test_scoring();
+	printf("Checking pruned dynamic time warping.\n");
+	test_pruned_dtw();
+	printf("Checking streaming recognition.\n");
+	test_streaming();
+	printf("Checking keyword spotting.\n");
+	test_keyword_spotting();
+	printf("Checking contexts sharing a model.\n");
+	test_shared_model();
+	printf("Checking matching on a thread pool.\n");
+	test_thread_pool();
+	printf("Checking background recognition.\n");
+	test_async();
+	printf("Checking model files.\n");
+	test_model_files();
+	printf("Checking training support.\n");
+	test_training();
+	printf("Checking mixture states.\n");
+	test_mixtures();
+	printf("Checking corpus files.\n");
+	test_corpus();
+	printf("Checking hot path stats.\n");
+	test_stats();
+	printf("Checking allocator hooks and pool mode.\n");
+	test_allocator();
+	printf("Checking the resampler.\n");
+	test_resampler();
 
 	printf("Allocating context.\n");
 	tinysr_ctx_t* ctx = tinysr_allocate_context();
@@ -30,6 +1495,10 @@ int main(int argc, char** argv) {
 	printf("Freeing context.\n");
 	tinysr_free_context(ctx);
 
+	if (failures) {
+		printf("%i checks failed.\n", failures);
+		return 1;
+	}
+	printf("All checks passed.\n");
 	return 0;
 }
-
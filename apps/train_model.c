@@ -0,0 +1,753 @@
+// Trains a speech model from utterances, the same way as scripts/model_gen.py, but on every core, using the
+// library's own batched scoring and dynamic time warping, so it takes seconds rather than hours.
+// Each word starts out as a template with one state per frame of its median length utterance. Segmental
+// k-means then aligns every utterance of the word to the template, and refits each state's Gaussian to the
+// frames aligned to it, for as long as the total log-likelihood keeps going up. Finally, each word's scores
+// are scaled so that its own utterances average 0, and every other word's utterances average -100.
+// With --mixtures k, segmental EM then grows each state into a mixture of up to k Gaussians: every utterance
+// is aligned to the mixture template, and each state's mixture is refitted by EM to the frames aligned to it,
+// again for as long as the total log-likelihood keeps going up.
+// Words train in parallel, and then the utterances are scored against every word in parallel.
+// Each word's utterances come from a directory of CSV files, named after the directory, or from a corpus file,
+// which makes a word of each label, in order of the label's first utterance.
+// The model file written is the same format model_gen.py writes, or with mixtures, a version 3 file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "tinysr.h"
+
+#define MAX_ROUNDS 100
+#define MAX_THREADS 64
+// Each mixture component gets at least MIXTURE_MIN_FRAMES frames to start with, and is dropped if its share
+// falls below half that, so that no component fits only a handful of frames.
+#define MAX_MIXTURES 16
+#define MIXTURE_MIN_FRAMES 20
+#define MIXTURE_ITERATIONS 10
+
+typedef struct {
+	char* name;
+	utterance_t** utterances;
+	int count;
+	// Set if the utterances' feature vectors are in a corpus, rather than allocated.
+	int mapped;
+	// The template: for each state, its log likelihood offset, 13 means, and 13x13 inverse covariance.
+	// With mixtures, state i has component_counts[i] components, of components in all, each with its own.
+	int length, rounds, components;
+	int* component_counts;
+	float* ll_offsets;
+	float* means;
+	float* inverse_covariances;
+	double log_likelihood;
+	float ll_offset, ll_slope;
+} word_t;
+
+typedef struct {
+	word_t* words;
+	int word_count, diagonal, mixtures, failed;
+	// Every utterance of every word, in order, and the raw log-likelihood of each against each word.
+	utterance_t** utterances;
+	int* utterance_words;
+	int utterance_count;
+	tinysr_model_t* model;
+	double* log_likelihoods;
+	atomic_int next;
+	pthread_mutex_t lock;
+} trainer_t;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// Reads in every utterance in a directory, in order of file name. Returns non-zero if there are none.
+static int read_word(word_t* word, const char* path) {
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return 1;
+	}
+	// Like model_gen.py, the word is named after the directory.
+	char* name = strdup(path);
+	while (strlen(name) > 1 && name[strlen(name) - 1] == '/')
+		name[strlen(name) - 1] = '\0';
+	word->name = strrchr(name, '/') != NULL ? strdup(strrchr(name, '/') + 1) : strdup(name);
+	free(name);
+	char** files = NULL;
+	int file_count = 0, i;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		files = realloc(files, sizeof(char*) * (file_count + 1));
+		files[file_count] = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		sprintf(files[file_count++], "%s/%s", path, entry->d_name);
+	}
+	closedir(dir);
+	qsort(files, file_count, sizeof(char*), compare_names);
+	word->utterances = malloc(sizeof(utterance_t*) * (file_count > 0 ? file_count : 1));
+	word->count = 0;
+	for (i = 0; i < file_count; i++) {
+		utterance_t* utterance = read_feature_vector_csv(files[i]);
+		if (utterance != NULL && utterance->length > 0)
+			word->utterances[word->count++] = utterance;
+		else if (utterance != NULL)
+			printf("Ignoring empty utterance: %s\n", files[i]);
+		free(files[i]);
+	}
+	free(files);
+	if (word->count == 0)
+		printf("No utterances in: %s\n", path);
+	return word->count == 0;
+}
+
+// Adds a word for each label in a corpus, with each utterance going to its label's word, and keeps the corpus
+// open, for the words' utterances to point into. Returns non-zero if it can't be read, or is empty.
+static int read_corpus(trainer_t* trainer, const char* path, tinysr_corpus_t** corpus) {
+	int first_word = trainer->word_count, i, w;
+	*corpus = tinysr_corpus_open(path);
+	if (*corpus == NULL) {
+		printf("Couldn't open corpus: %s\n", path);
+		return 1;
+	}
+	int count = tinysr_corpus_count(*corpus);
+	for (i = 0; i < count; i++) {
+		const char* label = tinysr_corpus_label(*corpus, i);
+		for (w = first_word; w < trainer->word_count && strcmp(trainer->words[w].name, label) != 0; w++);
+		if (w == trainer->word_count) {
+			trainer->words = realloc(trainer->words, sizeof(word_t) * (trainer->word_count + 1));
+			memset(&trainer->words[w], 0, sizeof(word_t));
+			trainer->words[w].name = strdup(label);
+			trainer->words[w].mapped = 1;
+			trainer->words[w].utterances = malloc(sizeof(utterance_t*) * count);
+			trainer->word_count++;
+		}
+		utterance_t* utterance = malloc(sizeof(utterance_t));
+		tinysr_corpus_utterance(*corpus, i, utterance);
+		if (utterance->length > 0)
+			trainer->words[w].utterances[trainer->words[w].count++] = utterance;
+		else
+			free(utterance);
+	}
+	if (trainer->word_count == first_word)
+		printf("No utterances in: %s\n", path);
+	return trainer->word_count == first_word;
+}
+
+// Factors a symmetric matrix as L L^T, in place in the lower triangle. Returns non-zero if it isn't
+// positive definite.
+static int cholesky(double* a) {
+	int i, j, k;
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j <= i; j++) {
+			double sum = a[j + i*13];
+			for (k = 0; k < j; k++)
+				sum -= a[k + i*13] * a[k + j*13];
+			if (i == j) {
+				if (!(sum > 0.0))
+					return 1;
+				a[i + i*13] = sqrt(sum);
+			} else {
+				a[j + i*13] = sum / a[j + j*13];
+			}
+		}
+	}
+	return 0;
+}
+
+// Inverts a covariance, and finds the log likelihood offset, -log(det(covariance)) / 2, as model_gen.py does.
+// Returns non-zero if it isn't positive definite.
+static int invert_covariance(const double* covariance, float* ll_offset, float* inverse_covariance) {
+	double lower[169], inverse_lower[169] = {0};
+	int i, j, k;
+	memcpy(lower, covariance, sizeof(lower));
+	if (cholesky(lower))
+		return 1;
+	double log_determinant = 0;
+	for (i = 0; i < 13; i++) {
+		log_determinant += 2 * log(lower[i + i*13]);
+		// Forward substitution for column i of L^-1.
+		for (j = i; j < 13; j++) {
+			double sum = i == j ? 1.0 : 0.0;
+			for (k = i; k < j; k++)
+				sum -= lower[k + j*13] * inverse_lower[i + k*13];
+			inverse_lower[i + j*13] = sum / lower[j + j*13];
+		}
+	}
+	// The inverse covariance is L^-T L^-1.
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j < 13; j++) {
+			double sum = 0;
+			for (k = i > j ? i : j; k < 13; k++)
+				sum += inverse_lower[i + k*13] * inverse_lower[j + k*13];
+			inverse_covariance[j + i*13] = sum;
+		}
+	}
+	*ll_offset = -0.5 * log_determinant;
+	// The library has to be able to factor it too, after rounding to floats.
+	gaussian_t check;
+	float mean[13] = {0};
+	return gaussian_init(&check, *ll_offset, mean, inverse_covariance);
+}
+
+// Fits a state's Gaussian to the frames aligned to it, given their count, sum, and sum of outer products.
+// For a mixture component, each frame counts for its share, so the count needn't be whole.
+// Like model_gen.py, a state with just one frame gets unit covariance. A covariance that can't be inverted,
+// which happens when a state has fewer frames than dimensions, loses its correlations, and any coefficient
+// that doesn't vary at all gets unit variance.
+static void fit_gaussian(double count, const double* sum, const double* outer, int diagonal, float* ll_offset, float* mean, float* inverse_covariance) {
+	double covariance[169];
+	int i, j;
+	for (i = 0; i < 13; i++)
+		mean[i] = sum[i] / count;
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j < 13; j++) {
+			double value = outer[j + i*13] / count - (sum[i] / count) * (sum[j] / count);
+			if (count <= 1)
+				value = i == j;
+			covariance[j + i*13] = diagonal && i != j ? 0.0 : value;
+		}
+	}
+	if (invert_covariance(covariance, ll_offset, inverse_covariance) == 0)
+		return;
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j < 13; j++)
+			covariance[j + i*13] = i == j && covariance[j + i*13] > 0 ? covariance[j + i*13] : i == j;
+	}
+	invert_covariance(covariance, ll_offset, inverse_covariance);
+}
+
+// Orders utterances by length, and then by file name, as in the order they were read.
+typedef struct {
+	int length, index;
+} utterance_order_t;
+
+static int compare_lengths(const void* a, const void* b) {
+	const utterance_order_t* x = a;
+	const utterance_order_t* y = b;
+	return x->length != y->length ? x->length - y->length : x->index - y->index;
+}
+
+// Runs segmental k-means on one word, with a context of the calling thread's own. Returns non-zero on failure.
+static int train_word(word_t* word, int diagonal, tinysr_ctx_t* ctx) {
+	int i, j, k, longest = 0;
+	// Start from a median length utterance, with each frame as the mean of a state of its own.
+	utterance_order_t* sorted = malloc(sizeof(utterance_order_t) * word->count);
+	for (i = 0; i < word->count; i++) {
+		sorted[i].length = word->utterances[i]->length;
+		sorted[i].index = i;
+	}
+	qsort(sorted, word->count, sizeof(utterance_order_t), compare_lengths);
+	utterance_t* candidate = word->utterances[sorted[word->count / 2].index];
+	longest = sorted[word->count - 1].length;
+	free(sorted);
+	int length = word->length = word->components = candidate->length;
+	float* ll_offsets = malloc(sizeof(float) * length);
+	float* means = malloc(sizeof(float) * length * 13);
+	float* inverse_covariances = malloc(sizeof(float) * length * 169);
+	word->ll_offsets = malloc(sizeof(float) * length);
+	word->means = malloc(sizeof(float) * length * 13);
+	word->inverse_covariances = malloc(sizeof(float) * length * 169);
+	double* sums = malloc(sizeof(double) * length * 13);
+	double* outers = malloc(sizeof(double) * length * 169);
+	int* counts = malloc(sizeof(int) * length);
+	int* frames = malloc(sizeof(int) * (longest + length));
+	int* states = malloc(sizeof(int) * (longest + length));
+	for (i = 0; i < length; i++) {
+		ll_offsets[i] = 0;
+		for (j = 0; j < 13; j++)
+			means[j + i*13] = TINYSR_FEATURE_TO_FLOAT(candidate->feature_vectors[i].cepstrum[j]);
+		for (j = 0; j < 169; j++)
+			inverse_covariances[j + i*169] = j % 14 == 0;
+	}
+	int failed = 0;
+	word->log_likelihood = -INFINITY;
+	for (word->rounds = 0; word->rounds < MAX_ROUNDS; word->rounds++) {
+		tinysr_model_t* model = tinysr_model_create(NULL);
+		if (tinysr_model_add_word(model, word->name, 0, 1, length, ll_offsets, means, inverse_covariances) < 0 || tinysr_bind_model(ctx, model)) {
+			tinysr_model_release(model);
+			failed = 1;
+			break;
+		}
+		tinysr_model_release(model);
+		// Gather up the frames aligned to each state, along each utterance's best path.
+		memset(sums, 0, sizeof(double) * length * 13);
+		memset(outers, 0, sizeof(double) * length * 169);
+		memset(counts, 0, sizeof(int) * length);
+		double total = 0;
+		for (i = 0; i < word->count; i++) {
+			tinysr_score_t log_likelihood;
+			int cells = tinysr_align_utterance(ctx, 0, word->utterances[i], frames, states, &log_likelihood), cell;
+			total += log_likelihood;
+			for (cell = 0; cell < cells; cell++) {
+				feature_vector_t* fv = &word->utterances[i]->feature_vectors[frames[cell]];
+				double* sum = sums + states[cell] * 13;
+				double* outer = outers + states[cell] * 169;
+				counts[states[cell]]++;
+				for (j = 0; j < 13; j++) {
+					double x = TINYSR_FEATURE_TO_FLOAT(fv->cepstrum[j]);
+					sum[j] += x;
+					for (k = 0; k < 13; k++)
+						outer[k + j*13] += x * TINYSR_FEATURE_TO_FLOAT(fv->cepstrum[k]);
+				}
+			}
+		}
+		// Run to convergence. Unlike model_gen.py, keep the template that fit best, not the one after it.
+		if (!(total > word->log_likelihood))
+			break;
+		word->log_likelihood = total;
+		memcpy(word->ll_offsets, ll_offsets, sizeof(float) * length);
+		memcpy(word->means, means, sizeof(float) * length * 13);
+		memcpy(word->inverse_covariances, inverse_covariances, sizeof(float) * length * 169);
+		for (i = 0; i < length; i++)
+			fit_gaussian(counts[i], sums + i*13, outers + i*169, diagonal, &ll_offsets[i], means + i*13, inverse_covariances + i*169);
+	}
+	tinysr_bind_model(ctx, NULL);
+	free(ll_offsets);
+	free(means);
+	free(inverse_covariances);
+	free(sums);
+	free(outers);
+	free(counts);
+	free(frames);
+	free(states);
+	return failed;
+}
+
+// Orders frames by the value of one coefficient, and then by where they are.
+typedef struct {
+	float value;
+	int index;
+} frame_order_t;
+
+static int compare_values(const void* a, const void* b) {
+	const frame_order_t* x = a;
+	const frame_order_t* y = b;
+	return x->value < y->value ? -1 : x->value > y->value ? 1 : x->index - y->index;
+}
+
+// The log-likelihood of a frame under a Gaussian, as the library scores it.
+static double component_log_likelihood(const float* x, float ll_offset, const float* mean, const float* inverse_covariance) {
+	double d[13], norm = 0;
+	int i, j;
+	for (i = 0; i < 13; i++)
+		d[i] = x[i] - mean[i];
+	for (i = 0; i < 13; i++)
+		for (j = 0; j < 13; j++)
+			norm += d[i] * inverse_covariance[j + i*13] * d[j];
+	return ll_offset - 0.5 * norm;
+}
+
+// Fits a mixture of up to `mixtures` Gaussians to a state's frames, by EM, and writes out its components,
+// heaviest first, with their log weights added to their offsets. Returns how many components there are.
+static int fit_mixture(const float* x, int count, int mixtures, int diagonal, float* ll_offsets, float* means, float* inverse_covariances) {
+	int k_count = count / MIXTURE_MIN_FRAMES, i, j, k, l, iteration, widest = 0;
+	k_count = k_count < 1 ? 1 : k_count > mixtures ? mixtures : k_count;
+	double* shares = calloc((size_t) count * k_count, sizeof(double));
+	double* weights = malloc(sizeof(double) * k_count);
+	float* fitted = malloc(sizeof(float) * k_count * (1 + 13 + 169));
+	// Start by splitting the frames into equal runs, along whichever coefficient varies the most.
+	double widest_variance = -1;
+	for (j = 0; j < 13; j++) {
+		double sum = 0, square = 0;
+		for (i = 0; i < count; i++) {
+			sum += x[j + i*13];
+			square += x[j + i*13] * (double) x[j + i*13];
+		}
+		if (square / count - (sum / count) * (sum / count) > widest_variance) {
+			widest_variance = square / count - (sum / count) * (sum / count);
+			widest = j;
+		}
+	}
+	frame_order_t* order = malloc(sizeof(frame_order_t) * count);
+	for (i = 0; i < count; i++) {
+		order[i].value = x[widest + i*13];
+		order[i].index = i;
+	}
+	qsort(order, count, sizeof(frame_order_t), compare_values);
+	for (i = 0; i < count; i++)
+		shares[order[i].index * k_count + (int) ((long long) i * k_count / count)] = 1;
+	free(order);
+	for (iteration = 0;; iteration++) {
+		// Refit each component to its share of the frames.
+		int lightest = 0;
+		for (k = 0; k < k_count; k++) {
+			double sum[13] = {0}, outer[169] = {0};
+			weights[k] = 0;
+			for (i = 0; i < count; i++) {
+				double share = shares[k + i * k_count];
+				weights[k] += share;
+				for (j = 0; j < 13; j++) {
+					sum[j] += share * x[j + i*13];
+					for (l = 0; l < 13; l++)
+						outer[l + j*13] += share * x[j + i*13] * x[l + i*13];
+				}
+			}
+			float* component = fitted + k * (1 + 13 + 169);
+			fit_gaussian(weights[k], sum, outer, diagonal, component, component + 1, component + 14);
+			lightest = weights[k] < weights[lightest] ? k : lightest;
+		}
+		// Drop the lightest component if it has too little, and share its frames out between the rest.
+		int dropped = k_count > 1 && weights[lightest] < MIXTURE_MIN_FRAMES / 2;
+		if (dropped) {
+			k_count--;
+			weights[lightest] = weights[k_count];
+			memcpy(fitted + lightest * (1 + 13 + 169), fitted + k_count * (1 + 13 + 169), sizeof(float) * (1 + 13 + 169));
+		}
+		if (!dropped && (k_count == 1 || iteration >= MIXTURE_ITERATIONS))
+			break;
+		// Share each frame out between the components, by how likely each is to have produced it.
+		for (i = 0; i < count; i++) {
+			double* share = shares + i * k_count, most = -INFINITY, total = 0;
+			for (k = 0; k < k_count; k++) {
+				float* component = fitted + k * (1 + 13 + 169);
+				share[k] = log(weights[k]) + component_log_likelihood(x + i*13, component[0], component + 1, component + 14);
+				most = share[k] > most ? share[k] : most;
+			}
+			for (k = 0; k < k_count; k++)
+				total += share[k] = exp(share[k] - most);
+			for (k = 0; k < k_count; k++)
+				share[k] /= total;
+		}
+	}
+	// Write them out heaviest first, by picking the heaviest left each time.
+	for (l = 0; l < k_count; l++) {
+		int heaviest = -1;
+		for (k = 0; k < k_count; k++)
+			if (weights[k] >= 0 && (heaviest < 0 || weights[k] > weights[heaviest]))
+				heaviest = k;
+		float* component = fitted + heaviest * (1 + 13 + 169);
+		ll_offsets[l] = component[0] + log(weights[heaviest] / count);
+		memcpy(means + l*13, component + 1, sizeof(float) * 13);
+		memcpy(inverse_covariances + l*169, component + 14, sizeof(float) * 169);
+		weights[heaviest] = -1;
+	}
+	free(shares);
+	free(weights);
+	free(fitted);
+	return k_count;
+}
+
+// Grows each state of a word trained by train_word into a mixture, by segmental EM, keeping the mixtures that
+// fit best. Alignment scores every component, rather than a shortlist. Returns non-zero on failure.
+static int train_mixtures(word_t* word, int mixtures, int diagonal, tinysr_ctx_t* ctx) {
+	int length = word->length, longest = 0, i, j, failed = 0;
+	for (i = 0; i < word->count; i++)
+		longest = word->utterances[i]->length > longest ? word->utterances[i]->length : longest;
+	int* component_counts = malloc(sizeof(int) * length);
+	float* ll_offsets = malloc(sizeof(float) * length * mixtures);
+	float* means = malloc(sizeof(float) * length * mixtures * 13);
+	float* inverse_covariances = malloc(sizeof(float) * length * mixtures * 169);
+	// Start from the single Gaussians.
+	for (i = 0; i < length; i++)
+		component_counts[i] = 1;
+	memcpy(ll_offsets, word->ll_offsets, sizeof(float) * length);
+	memcpy(means, word->means, sizeof(float) * length * 13);
+	memcpy(inverse_covariances, word->inverse_covariances, sizeof(float) * length * 169);
+	word->component_counts = malloc(sizeof(int) * length);
+	word->ll_offsets = realloc(word->ll_offsets, sizeof(float) * length * mixtures);
+	word->means = realloc(word->means, sizeof(float) * length * mixtures * 13);
+	word->inverse_covariances = realloc(word->inverse_covariances, sizeof(float) * length * mixtures * 169);
+	// Every frame aligned to each state, in a run of the whole word's frames, ordered by state.
+	int total_frames = 0;
+	for (i = 0; i < word->count; i++)
+		total_frames += word->utterances[i]->length + length;
+	float* aligned = malloc(sizeof(float) * total_frames * 13);
+	int* counts = malloc(sizeof(int) * (length + 1));
+	int* frames = malloc(sizeof(int) * word->count * (longest + length));
+	int* states = malloc(sizeof(int) * word->count * (longest + length));
+	int* cells = malloc(sizeof(int) * word->count);
+	ctx->mixture_shortlist = TINYSR_MIXTURE_EXACT;
+	word->log_likelihood = -INFINITY;
+	int round;
+	for (round = 0; round < MAX_ROUNDS; round++) {
+		tinysr_model_t* model = tinysr_model_create(NULL);
+		if (tinysr_model_add_mixture_word(model, word->name, 0, 1, length, component_counts, ll_offsets, means, inverse_covariances) < 0 ||
+				tinysr_bind_model(ctx, model)) {
+			tinysr_model_release(model);
+			failed = 1;
+			break;
+		}
+		tinysr_model_release(model);
+		double total = 0;
+		memset(counts, 0, sizeof(int) * (length + 1));
+		for (i = 0; i < word->count; i++) {
+			tinysr_score_t log_likelihood;
+			int* f = frames + i * (longest + length);
+			int* s = states + i * (longest + length);
+			cells[i] = tinysr_align_utterance(ctx, 0, word->utterances[i], f, s, &log_likelihood);
+			total += log_likelihood;
+			for (j = 0; j < cells[i]; j++)
+				counts[s[j] + 1]++;
+		}
+		if (!(total > word->log_likelihood))
+			break;
+		word->log_likelihood = total;
+		int components = 0;
+		for (i = 0; i < length; i++)
+			components += component_counts[i];
+		word->components = components;
+		memcpy(word->component_counts, component_counts, sizeof(int) * length);
+		memcpy(word->ll_offsets, ll_offsets, sizeof(float) * components);
+		memcpy(word->means, means, sizeof(float) * components * 13);
+		memcpy(word->inverse_covariances, inverse_covariances, sizeof(float) * components * 169);
+		// Sort the aligned frames by state, and refit each state's mixture.
+		for (i = 0; i < length; i++)
+			counts[i + 1] += counts[i];
+		for (i = 0; i < word->count; i++) {
+			int* f = frames + i * (longest + length);
+			int* s = states + i * (longest + length);
+			for (j = 0; j < cells[i]; j++) {
+				float* to = aligned + counts[s[j]]++ * 13;
+				int k;
+				for (k = 0; k < 13; k++)
+					to[k] = TINYSR_FEATURE_TO_FLOAT(word->utterances[i]->feature_vectors[f[j]].cepstrum[k]);
+			}
+		}
+		// Each count is now where the next state's frames start.
+		components = 0;
+		for (i = 0; i < length; i++) {
+			int first = i == 0 ? 0 : counts[i - 1];
+			component_counts[i] = fit_mixture(aligned + first * 13, counts[i] - first, mixtures, diagonal,
+				ll_offsets + components, means + components * 13, inverse_covariances + components * 169);
+			components += component_counts[i];
+		}
+	}
+	word->rounds += round;
+	tinysr_bind_model(ctx, NULL);
+	free(component_counts);
+	free(ll_offsets);
+	free(means);
+	free(inverse_covariances);
+	free(aligned);
+	free(counts);
+	free(frames);
+	free(states);
+	free(cells);
+	return failed;
+}
+
+static void* train_words(void* arg) {
+	trainer_t* trainer = arg;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	int i;
+	while ((i = atomic_fetch_add(&trainer->next, 1)) < trainer->word_count) {
+		word_t* word = &trainer->words[i];
+		int failed = train_word(word, trainer->diagonal, ctx);
+		if (!failed && trainer->mixtures > 1)
+			failed = train_mixtures(word, trainer->mixtures, trainer->diagonal, ctx);
+		pthread_mutex_lock(&trainer->lock);
+		trainer->failed |= failed;
+		if (failed)
+			printf("== Couldn't train %s\n", word->name);
+		else
+			printf("== %s: %i utterances, %i states, %i components, %i rounds, log likelihood %f\n", word->name, word->count, word->length, word->components, word->rounds, word->log_likelihood);
+		pthread_mutex_unlock(&trainer->lock);
+	}
+	tinysr_free_context(ctx);
+	return NULL;
+}
+
+// Scores every utterance against every word, with the words' scores left raw.
+static void* score_utterances(void* arg) {
+	trainer_t* trainer = arg;
+	tinysr_ctx_t* ctx = tinysr_allocate_context();
+	tinysr_score_t* scores = malloc(sizeof(tinysr_score_t) * trainer->word_count);
+	int i, w;
+	tinysr_bind_model(ctx, trainer->model);
+	while ((i = atomic_fetch_add(&trainer->next, 1)) < trainer->utterance_count) {
+		tinysr_score_words(ctx, trainer->utterances[i], scores);
+		for (w = 0; w < trainer->word_count; w++)
+			trainer->log_likelihoods[i * trainer->word_count + w] = scores[w];
+	}
+	free(scores);
+	tinysr_free_context(ctx);
+	return NULL;
+}
+
+// Runs a step on every thread, and waits for them all.
+static void run_threads(trainer_t* trainer, void* (*step)(void*), int thread_count) {
+	pthread_t threads[MAX_THREADS];
+	int i;
+	atomic_store(&trainer->next, 0);
+	for (i = 0; i < thread_count; i++)
+		pthread_create(&threads[i], NULL, step, trainer);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+}
+
+// Writes a model file, the same way model_gen.py does.
+static int write_model(const char* path, trainer_t* trainer) {
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+		return 1;
+	int w, i, failed = 0;
+	for (w = 0; w < trainer->word_count; w++) {
+		word_t* word = &trainer->words[w];
+		uint32_t name_length = strlen(word->name), length = word->length;
+		failed |= fwrite(&name_length, 4, 1, fp) != 1 || fwrite(word->name, 1, name_length, fp) != name_length;
+		failed |= fwrite(&word->ll_offset, 4, 1, fp) != 1 || fwrite(&word->ll_slope, 4, 1, fp) != 1 || fwrite(&length, 4, 1, fp) != 1;
+		for (i = 0; i < word->length; i++) {
+			failed |= fwrite(&word->ll_offsets[i], 4, 1, fp) != 1 || fwrite(word->means + i*13, 4, 13, fp) != 13;
+			failed |= fwrite(word->inverse_covariances + i*169, 4, 169, fp) != 169;
+		}
+	}
+	failed |= fclose(fp) != 0;
+	return failed;
+}
+
+// Writes a model with mixture states, which only version 3 files can hold.
+static int write_mixture_model(const char* path, trainer_t* trainer) {
+	tinysr_model_t* model = tinysr_model_create(NULL);
+	int w, failed = 0;
+	for (w = 0; w < trainer->word_count && !failed; w++) {
+		word_t* word = &trainer->words[w];
+		failed = tinysr_model_add_mixture_word(model, word->name, word->ll_offset, word->ll_slope, word->length, word->component_counts,
+			word->ll_offsets, word->means, word->inverse_covariances) < 0;
+	}
+	failed = failed || tinysr_model_save(model, path, TINYSR_MODEL_V3);
+	tinysr_model_release(model);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	trainer_t trainer = {0};
+	int thread_count = sysconf(_SC_NPROCESSORS_ONLN), first = 1, w, i;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--diagonal") == 0) {
+			trainer.diagonal = 1;
+			first++;
+		} else if (strcmp(argv[first], "--threads") == 0 && first + 1 < argc) {
+			thread_count = atoi(argv[first + 1]);
+			first += 2;
+		} else if (strcmp(argv[first], "--mixtures") == 0 && first + 1 < argc) {
+			trainer.mixtures = atoi(argv[first + 1]);
+			first += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc - first < 2) {
+		printf("Usage: train_model [--diagonal] [--threads n] [--mixtures k] dir0 [dir1 ...] output_model\n");
+		printf("Each directory is expected to contain utterances in CSV format.\n");
+		printf("Corpus files can be given in place of directories, and make a word of each label.\n");
+		printf("A normalized model will be produced and written to output_model.\n");
+		printf("With --diagonal, the Gaussians get diagonal covariances, which are cheaper to score.\n");
+		printf("With --mixtures, each state gets a mixture of up to k Gaussians, and the model is written in version 3 format.\n");
+		return 1;
+	}
+	trainer.mixtures = trainer.mixtures < 1 ? 1 : trainer.mixtures > MAX_MIXTURES ? MAX_MIXTURES : trainer.mixtures;
+	thread_count = thread_count < 1 ? 1 : thread_count > MAX_THREADS ? MAX_THREADS : thread_count;
+	const char* output_path = argv[argc - 1];
+	double start = now();
+	int corpus_count = 0;
+	tinysr_corpus_t** corpora = malloc(sizeof(tinysr_corpus_t*) * (argc - 1 - first));
+	pthread_mutex_init(&trainer.lock, NULL);
+	for (i = first; i < argc - 1; i++) {
+		struct stat info;
+		if (stat(argv[i], &info) == 0 && !S_ISDIR(info.st_mode)) {
+			if (read_corpus(&trainer, argv[i], &corpora[corpus_count++]))
+				return 1;
+			continue;
+		}
+		trainer.words = realloc(trainer.words, sizeof(word_t) * (trainer.word_count + 1));
+		memset(&trainer.words[trainer.word_count], 0, sizeof(word_t));
+		if (read_word(&trainer.words[trainer.word_count++], argv[i]))
+			return 1;
+	}
+	for (w = 0; w < trainer.word_count; w++)
+		trainer.utterance_count += trainer.words[w].count;
+
+	printf("=== Building model with %i words, on %i threads.\n", trainer.word_count, thread_count);
+	run_threads(&trainer, train_words, thread_count);
+	if (trainer.failed)
+		return 1;
+
+	printf("=== Cross normalizing models.\n");
+	trainer.model = tinysr_model_create(NULL);
+	trainer.utterances = malloc(sizeof(utterance_t*) * trainer.utterance_count);
+	trainer.utterance_words = malloc(sizeof(int) * trainer.utterance_count);
+	trainer.log_likelihoods = malloc(sizeof(double) * trainer.utterance_count * trainer.word_count);
+	int u = 0;
+	for (w = 0; w < trainer.word_count; w++) {
+		word_t* word = &trainer.words[w];
+		if (tinysr_model_add_mixture_word(trainer.model, word->name, 0, 1, word->length, word->component_counts, word->ll_offsets, word->means, word->inverse_covariances) < 0) {
+			printf("Couldn't build the model.\n");
+			return 1;
+		}
+		for (i = 0; i < word->count; i++, u++) {
+			trainer.utterances[u] = word->utterances[i];
+			trainer.utterance_words[u] = w;
+		}
+	}
+	run_threads(&trainer, score_utterances, thread_count);
+	tinysr_model_release(trainer.model);
+	for (w = 0; w < trainer.word_count; w++) {
+		word_t* word = &trainer.words[w];
+		double match_ll = 0, reject_ll = 0;
+		for (u = 0; u < trainer.utterance_count; u++) {
+			if (trainer.utterance_words[u] == w)
+				match_ll += trainer.log_likelihoods[u * trainer.word_count + w];
+			else
+				reject_ll += trainer.log_likelihoods[u * trainer.word_count + w];
+		}
+		int rejects = trainer.utterance_count - word->count;
+		match_ll /= word->count;
+		printf("== %s\n", word->name);
+		printf("match  %f (%i)\n", match_ll, word->count);
+		// With only one word, there's nothing to reject, so its scores are left as they are.
+		if (rejects == 0) {
+			word->ll_offset = 0;
+			word->ll_slope = 1;
+			continue;
+		}
+		reject_ll /= rejects;
+		printf("reject %f (%i)\n", reject_ll, rejects);
+		// Compute the coefficients such that (offset + slope * ll) comes out to 0 for matches, and -100 for rejects.
+		word->ll_slope = -100.0 / (reject_ll - match_ll);
+		word->ll_offset = -match_ll * word->ll_slope;
+		printf("new = %.3f + %.3f * old\n", word->ll_offset, word->ll_slope);
+	}
+
+	printf("=== Writing output file to: %s\n", output_path);
+	if (trainer.mixtures > 1 ? write_mixture_model(output_path, &trainer) : write_model(output_path, &trainer)) {
+		printf("Couldn't write model: %s\n", output_path);
+		return 1;
+	}
+	printf("Done in %f seconds.\n", now() - start);
+	for (w = 0; w < trainer.word_count; w++) {
+		word_t* word = &trainer.words[w];
+		for (i = 0; i < word->count; i++) {
+			if (!word->mapped)
+				free(word->utterances[i]->feature_vectors);
+			free(word->utterances[i]);
+		}
+		free(word->utterances);
+		free(word->name);
+		free(word->component_counts);
+		free(word->ll_offsets);
+		free(word->means);
+		free(word->inverse_covariances);
+	}
+	free(trainer.words);
+	for (i = 0; i < corpus_count; i++)
+		tinysr_corpus_close(corpora[i]);
+	free(corpora);
+	free(trainer.utterances);
+	free(trainer.utterance_words);
+	free(trainer.log_likelihoods);
+	pthread_mutex_destroy(&trainer.lock);
+	return 0;
+}
@@ -1,6 +1,8 @@
 #! /usr/bin/python
 """
 Compute the bin indices, as required by ES 201 108 4.2.9.
+TinySR now computes these itself in tinysr_frontend_plan_create(), so this script
+only serves as a reference for checking those tables.
 """
 
 import math
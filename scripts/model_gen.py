@@ -4,7 +4,7 @@ import numpy
 import os, sys, math, random, struct, time
 
 class MultivariateGaussianModel:
-	def __init__(self, vecs):
+	def __init__(self, vecs, diagonal=False):
 		# Compute the mean vector.
 		self.mean = sum(vecs) / len(vecs)
 		# Subtract the mean from the data.
@@ -20,6 +20,9 @@ class MultivariateGaussianModel:
 			# http://en.wikipedia.org/wiki/Estimation_of_covariance_matrices#Maximum-likelihood_estimation_for_the_multivariate_normal_distribution
 			# http://en.wikipedia.org/wiki/Multivariate_normal_distribution#Estimation_of_parameters
 			self.covariance = sum(numpy.outer(v, v) for v in vecs) / len(vecs)
+		if diagonal:
+			# Diagonal models drop the correlations, which TinySR spots on loading, and scores more cheaply.
+			self.covariance = numpy.diag(numpy.diag(self.covariance))
 		# covar_inv corresponds to $\Sigma^{-1}$ from the Wikipedia article.
 		self.covar_inv = numpy.linalg.inv(self.covariance)
 		# This is the log likelihood offset, corresponding to the $\det(\Sigma)^{-1/2}$ factor from Wikipedia.
@@ -35,7 +38,7 @@ class Model:
 		self.name, self.stacks = name, stacks
 
 	def build_model(self):
-		self.template = [MultivariateGaussianModel(stack) for stack in self.stacks]
+		self.template = [MultivariateGaussianModel(stack, diagonal) for stack in self.stacks]
 
 	def dynamic_time_warping(self, utterance):
 		# Match up the utterance via dynamic programming.
@@ -131,10 +134,15 @@ def build_model_from_dir(name, utters_path):
 
 	return utters, model
 
+diagonal = len(sys.argv) > 1 and sys.argv[1] == "--diagonal"
+if diagonal:
+	sys.argv.pop(1)
+
 if len(sys.argv) == 1 or (len(sys.argv) == 2 and sys.argv[1] in ("-h", "--help")):
-	print "Usage: model_gen.py dir0 [dir1 ...] output_model"
+	print "Usage: model_gen.py [--diagonal] dir0 [dir1 ...] output_model"
 	print "Each directory is expected to contain utterances in CSV format."
 	print "A normalized model will be produced and written to output_model."
+	print "With --diagonal, the Gaussians get diagonal covariances, which are cheaper to score."
 	exit(1)
 
 input_paths = sys.argv[1:-1]
@@ -6,9 +6,25 @@
 
 #include "tinysr.h"
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#ifndef TINYSR_NO_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifndef TINYSR_NO_THREADS
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#endif
+#ifndef TINYSR_NO_STATS
+#include <time.h>
+#endif
 
 // Defined here to avoid polluting the scope of the user.
 #ifndef PI
@@ -35,11 +51,256 @@
 // Again, because of the large amount of silence required to end an utterance, this is the
 // number of frames dropped off of the end of an utterance, to avoid collecting silence.
 #define UTTERANCE_FRAMES_DROPPED_FROM_END 7
+// Keyword spotting normalizes by a moving cepstral mean over about this many frames.
+#define KEYWORD_MEAN_FRAMES 100
+// A keyword spotting path may be at most this many times as many frames long as the word has states.
+#define KEYWORD_MAX_STRETCH 3
+// The keyword threshold every word starts with.
+#define KEYWORD_DEFAULT_THRESHOLD -20.0
+// For matching on a thread pool, the vocabulary is split into tasks of whole words, about this many states each.
+#define RECOGNIZE_TASK_STATES 128
+// Input is converted, resampled and offset compensated this many samples at a time.
+#define INGEST_BLOCK_LENGTH 256
+// Initial capacity of the feature vector ring, which must be a power of two. This is about ten seconds,
+// which is plenty for free running mode. The ring only grows if one shot mode is given a longer input.
+#define FV_RING_INITIAL_CAPACITY 1024
+// One input sample's worth of time, in the units of ctx->resampling_time_delta.
+#ifdef TINYSR_FIXED_POINT
+#define LINEAR_RESAMPLER_ONE (1 << 16)
+#else
+#define LINEAR_RESAMPLER_ONE 1.0f
+#endif
+// Resampler filter design. The cutoff and transition band are fractions of the lower of the two rates,
+// so at 16 kHz out the passband is flat to about 7 kHz, and the stopband, attenuated by RESAMPLER_ATTENUATION
+// dB, starts at about 8.8 kHz. That's past the output's Nyquist frequency, to keep the passband wide, so only
+// what's above 8.8 kHz is attenuated that much: input from 8 to 8.8 kHz is only partly attenuated, and folds
+// back into 7.2 to 8 kHz, under the top mel filter.
+#define RESAMPLER_ATTENUATION 60.0
+#define RESAMPLER_CUTOFF 0.49375
+#define RESAMPLER_TRANSITION 0.1125
+// Ratios needing more polyphase banks than this fall back to linear interpolation.
+#define RESAMPLER_MAX_PHASES 640
+// Fixed point front-end parameters. The log table has 2^LOG_TABLE_BITS segments, and frames are scaled so
+// that their largest sample is just below 2^FIXED_FFT_PEAK_BITS going into the FFT, which leaves enough
+// headroom for FFTs up to 1024 points. FIXED_LOG_FLOOR is ln(2e-22) in Q16.
+#define LOG_TABLE_BITS 8
+#define FIXED_FFT_PEAK_BITS 19
+#define FIXED_LOG_FLOOR -3274423
+// Default pruned matching settings (see tinysr_dtw_mode_t).
+#define DTW_DEFAULT_BAND_PERCENT 40
+#define DTW_DEFAULT_BEAM 300.0
+// Gaussian selection for mixture states (see score_mixtures). Frames are quantized to the nearest of
+// MIXTURE_CODEWORDS codewords, and for each codeword, each mixture state picks up to MIXTURE_MAX_SHORTLIST
+// extra components worth scoring in full: those scoring, at the codeword, within MIXTURE_SELECTION_MARGIN of
+// the state's heaviest component, and within MIXTURE_SELECTION_BEAM of the best of any state's. By default,
+// just the best pick is scored.
+#define MIXTURE_CODEWORDS 128
+#define MIXTURE_CODEBOOK_ROUNDS 8
+#define MIXTURE_MAX_SHORTLIST 2
+#define MIXTURE_DEFAULT_SHORTLIST 1
+#define MIXTURE_SELECTION_MARGIN 10.0
+#define MIXTURE_SELECTION_BEAM 30.0
+// Matching finds the codeword nearest each of up to this many frames of an utterance once, for every word to use.
+#define CODEWORD_CACHE_FRAMES 2048
+// Pruned cells hold TINYSR_SCORE_MIN, and anything below this came from one.
+#define DTW_DEAD (TINYSR_SCORE_MIN / 2)
+// Pool size class k holds blocks of POOL_SMALLEST_BLOCK << k bytes, the first POOL_HEADER_SIZE of which
+// are the pool's own, which keeps what it hands out 16 byte aligned.
+#define POOL_SMALLEST_BLOCK 32
+#define POOL_HEADER_SIZE 16
 
-void list_append_back(list_t* list, void* datum) {
-	list->length++;
+static void* system_allocate(void* user, size_t size) {
+	return malloc(size);
+}
+
+static void system_release(void* user, void* ptr) {
+	free(ptr);
+}
+
+static const tinysr_allocator_t system_allocator = {system_allocate, system_release, NULL};
+
+typedef struct pool_block {
+	struct pool_block* next;
+	int size_class;
+} pool_block_t;
+
+// Takes a block from the smallest size class that fits and has one free, or else from the backing allocator.
+static void* pool_allocate(void* user, size_t size) {
+	tinysr_pool_t* pool = user;
+	int size_class = 0, k;
+	while (((size_t) POOL_SMALLEST_BLOCK << size_class) < size + POOL_HEADER_SIZE)
+		if (++size_class == TINYSR_POOL_CLASSES)
+			return NULL;
+	pool_block_t* block;
+	for (k = size_class; k < TINYSR_POOL_CLASSES; k++) {
+		if (pool->free_blocks[k] != NULL) {
+			block = pool->free_blocks[k];
+			pool->free_blocks[k] = block->next;
+			return (char*) block + POOL_HEADER_SIZE;
+		}
+	}
+	block = pool->backing.allocate(pool->backing.user, (size_t) POOL_SMALLEST_BLOCK << size_class);
+	if (block == NULL)
+		return NULL;
+	pool->backing_allocations++;
+	block->size_class = size_class;
+	return (char*) block + POOL_HEADER_SIZE;
+}
+
+static void pool_release(void* user, void* ptr) {
+	tinysr_pool_t* pool = user;
+	if (ptr == NULL)
+		return;
+	pool_block_t* block = (pool_block_t*) ((char*) ptr - POOL_HEADER_SIZE);
+	block->next = pool->free_blocks[block->size_class];
+	pool->free_blocks[block->size_class] = block;
+}
+
+// Hands every free block back to the backing allocator.
+static void pool_drain(tinysr_pool_t* pool) {
+	int k;
+	for (k = 0; k < TINYSR_POOL_CLASSES; k++) {
+		while (pool->free_blocks[k] != NULL) {
+			pool_block_t* block = pool->free_blocks[k];
+			pool->free_blocks[k] = block->next;
+			pool->backing.release(pool->backing.user, block);
+		}
+	}
+}
+
+#ifndef TINYSR_NO_STATS
+static long long stats_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Counts a call to a stage that took ns nanoseconds.
+static void stats_record(tinysr_ctx_t* ctx, tinysr_stage_t stage, long long ns) {
+	tinysr_stage_stats_t* stats = &ctx->stats.stages[stage];
+	int bucket = 0;
+	while (bucket < TINYSR_STATS_BUCKETS - 1 && (ns >> bucket) > 1)
+		bucket++;
+	stats->calls++;
+	stats->total_ns += ns;
+	stats->max_ns = ns > stats->max_ns ? ns : stats->max_ns;
+	stats->histogram[bucket]++;
+}
+
+// Counts a call to a stage that began at begin, when stats_recorded_ns stood at recorded, leaving out the
+// time that the stages it called have recorded since.
+static void stats_end(tinysr_ctx_t* ctx, tinysr_stage_t stage, long long begin, long long recorded) {
+	long long ns = stats_now() - begin - (ctx->stats_recorded_ns - recorded);
+	ns = ns > 0 ? ns : 0;
+	stats_record(ctx, stage, ns);
+	ctx->stats_recorded_ns += ns;
+}
+
+// Each stage's body goes between STATS_BEGIN and STATS_END, in one scope. With TINYSR_NO_STATS, all of
+// these are nothing at all, beyond evaluating the counts, which have no side effects.
+#define STATS_BEGIN(ctx) long long stats_begin = stats_now(), stats_recorded = (ctx)->stats_recorded_ns
+#define STATS_END(ctx, stage) stats_end(ctx, stage, stats_begin, stats_recorded)
+#define STATS_COUNT(ctx, counter, n) ((ctx)->stats.counter += (n))
+#else
+#define STATS_BEGIN(ctx)
+#define STATS_END(ctx, stage)
+#define STATS_COUNT(ctx, counter, n) ((void) (n))
+#endif
+
+static void* ctx_allocate(tinysr_ctx_t* ctx, size_t size) {
+	void* ptr = ctx->allocator.allocate(ctx->allocator.user, size);
+	STATS_COUNT(ctx, allocations, ptr != NULL);
+	STATS_COUNT(ctx, bytes_allocated, ptr != NULL ? (long long) size : 0);
+	return ptr;
+}
+
+static void ctx_release(tinysr_ctx_t* ctx, void* ptr) {
+	ctx->allocator.release(ctx->allocator.user, ptr);
+}
+
+// An extra mixture component worth scoring in full for frames near a codeword: the state it's in, its number
+// among all the model's extra components, and its rank among the state's picks for the codeword, best first.
+// Each codeword's picks are in order of state.
+typedef struct {
+	int32_t state, component, rank;
+} mixture_pick_t;
+
+struct tinysr_model {
+	// Held by whoever made the model, and by each context bound to it.
+#ifndef TINYSR_NO_THREADS
+	atomic_int references;
+#else
+	int references;
+#endif
+	tinysr_allocator_t allocator;
+	list_t recog_entry_list;
+	char** word_names;
+	int state_count, state_stride;
+#ifndef TINYSR_FIXED_POINT
+	float* score_weights;
+	// Set if score_weights is in a model file, rather than allocated.
+	int weights_mapped;
+#endif
+	// The number of extra mixture components, numbered from each word's first_component, and if there are any,
+	// the codebook for picking which to score: MIXTURE_CODEWORDS points, with each coefficient scaled by
+	// codeword_scale, coefficient by coefficient, and codeword c's picks, picks[pick_starts[c]] up to picks[pick_starts[c+1]].
+	int component_count;
+	tinysr_feature_t* codewords;
+#ifdef TINYSR_FIXED_POINT
+	// Q16.
+	int32_t codeword_scale[13];
+#else
+	float codeword_scale[13];
+#endif
+	int* pick_starts;
+	mixture_pick_t* picks;
+#ifdef TINYSR_FIXED_POINT
+	// Every extra component, by number.
+	gaussian_t** components;
+#else
+	// Each extra component's SCORE_TERMS weights, as in the weight slab, but one component after another.
+	float* mixture_weights;
+	// Set if the codebook, picks and mixture weights are in a model file, rather than allocated.
+	int mixtures_mapped;
+#endif
+	// The version 2 and 3 model files loaded, which words point into, as model_file_t.
+	list_t files;
+	// What adding words has left to build, so that however many words are added, it's built once, on the
+	// next bind or save: MODEL_STALE_MIXTURES for just the codebook, MODEL_STALE_ALL for the slab too.
+	int stale;
+#ifndef TINYSR_NO_THREADS
+	// Held while building, for contexts on different threads binding the model at once.
+	pthread_mutex_t build_lock;
+#endif
+};
+
+#define MODEL_STALE_MIXTURES 1
+#define MODEL_STALE_ALL 2
+
+static void* model_allocate(tinysr_model_t* model, size_t size) {
+	return model->allocator.allocate(model->allocator.user, size);
+}
+
+static void model_deallocate(tinysr_model_t* model, void* ptr) {
+	model->allocator.release(model->allocator.user, ptr);
+}
+
+// Adds delta to the model's references, returning how many there are now.
+static int model_add_references(tinysr_model_t* model, int delta) {
+#ifndef TINYSR_NO_THREADS
+	return atomic_fetch_add(&model->references, delta) + delta;
+#else
+	return model->references += delta;
+#endif
+}
+
+int list_append_back(list_t* list, void* datum) {
 	// Create the new list node, and fill out its entries.
-	list_node_t* tail = malloc(sizeof(list_node_t));
+	const tinysr_allocator_t* allocator = list->allocator != NULL ? list->allocator : &system_allocator;
+	list_node_t* tail = allocator->allocate(allocator->user, sizeof(list_node_t));
+	if (tail == NULL)
+		return 1;
+	list->length++;
 	tail->datum = datum;
 	tail->prev = list->tail;
 	tail->next = NULL;
@@ -49,6 +310,7 @@ void list_append_back(list_t* list, void* datum) {
 	list->tail = tail;
 	if (list->head == NULL)
 		list->head = list->tail;
+	return 0;
 }
 
 void* list_pop_front(list_t* list) {
@@ -59,555 +321,5167 @@ void* list_pop_front(list_t* list) {
 	list_node_t* head = list->head;
 	void* result = head->datum;
 	list->head = head->next;
-	free(head);
+	const tinysr_allocator_t* allocator = list->allocator != NULL ? list->allocator : &system_allocator;
+	allocator->release(allocator->user, head);
 	if (list->head != NULL) list->head->prev = NULL;
 	else list->tail = NULL;
 	return result;
 }
 
-// Allocate a context for speech recognition.
+// Moves every node of from onto the end of to, without allocating, so both must get their nodes from the same place.
+static void list_splice_back(list_t* to, list_t* from) {
+	if (from->head == NULL)
+		return;
+	from->head->prev = to->tail;
+	if (to->tail != NULL)
+		to->tail->next = from->head;
+	else
+		to->head = from->head;
+	to->tail = from->tail;
+	to->length += from->length;
+	from->head = from->tail = NULL;
+	from->length = 0;
+}
+
+static void batch_add_frame(tinysr_ctx_t* ctx);
+static feature_vector_t* fv_ring_reserve(tinysr_ctx_t* ctx);
+static void fv_ring_skip(tinysr_ctx_t* ctx);
+static void finish_feature_vector(tinysr_ctx_t* ctx, feature_vector_t* fv, tinysr_feature_t log_energy, const tinysr_feature_t* cepstrum, int stride);
+static void dtw_advance(recog_entry_t* match, const tinysr_score_t* scores, int frames, int stride, int first_frame, tinysr_score_t* dp_array);
+static tinysr_score_t dtw_normalize(recog_entry_t* match, tinysr_score_t log_likelihood);
+static tinysr_score_t dtw_finish(recog_entry_t* match, const tinysr_score_t* dp_array);
+static tinysr_score_t dtw_pruned(tinysr_ctx_t* ctx, recog_entry_t* match, utterance_t* utterance, tinysr_score_t score_to_beat, recognize_task_t* task);
+static void score_task_frames(tinysr_ctx_t* ctx, recognize_task_t* task, const feature_vector_t* fvs, const int* codewords, int frames);
+static int nearest_codeword(const tinysr_model_t* model, const feature_vector_t* fv);
+static void thread_pool_run(tinysr_thread_pool_t* pool, void (*run)(void* arg, int task), void* arg, int task_count);
+static void cmn_running_reset(tinysr_ctx_t* ctx);
+static void cmn_running_apply(tinysr_ctx_t* ctx, feature_vector_t* fv);
+static void stream_advance(tinysr_ctx_t* ctx, long long until);
+static void stream_flush(tinysr_ctx_t* ctx);
+static void stream_finish(tinysr_ctx_t* ctx);
+static void keyword_spot(tinysr_ctx_t* ctx);
+static int results_waiting(tinysr_ctx_t* ctx);
+
+// Allocate a context for speech recognition, with its own default front-end plan.
 tinysr_ctx_t* tinysr_allocate_context(void) {
-	tinysr_ctx_t* ctx = malloc(sizeof(tinysr_ctx_t));
+	return tinysr_allocate_context_with_allocator(NULL, NULL, 0);
+}
+
+// Allocate a context for speech recognition, sharing the given front-end plan.
+tinysr_ctx_t* tinysr_allocate_context_with_plan(const tinysr_frontend_plan_t* plan) {
+	return tinysr_allocate_context_with_allocator(plan, NULL, 0);
+}
+
+// Allocate a context for speech recognition, taking all of its memory from the given allocator.
+tinysr_ctx_t* tinysr_allocate_context_with_allocator(const tinysr_frontend_plan_t* plan, const tinysr_allocator_t* allocator, int use_pool) {
+	if (allocator == NULL)
+		allocator = &system_allocator;
+	tinysr_ctx_t* ctx = allocator->allocate(allocator->user, sizeof(tinysr_ctx_t));
+	if (ctx == NULL)
+		return NULL;
+#ifndef TINYSR_NO_STATS
+	// Counting starts before anything else is allocated.
+	memset(&ctx->stats, 0, sizeof(tinysr_stats_t));
+	ctx->stats_recorded_ns = 0;
+#endif
+	// In pool mode, everything but the context itself goes through the pool.
+	ctx->use_pool = use_pool;
+	ctx->pool = (tinysr_pool_t){0};
+	if (use_pool) {
+		ctx->pool.backing = *allocator;
+		ctx->allocator = (tinysr_allocator_t){pool_allocate, pool_release, &ctx->pool};
+	} else {
+		ctx->allocator = *allocator;
+	}
+	// All of the front-end sizes come from the plan.
+	ctx->owns_frontend_plan = plan == NULL;
+	if (plan == NULL)
+		plan = tinysr_frontend_plan_create_default();
+	if (plan == NULL) {
+		allocator->release(allocator->user, ctx);
+		return NULL;
+	}
+	ctx->frontend_plan = plan;
+#ifndef TINYSR_FIXED_POINT
+	// Use the fastest front-end kernels this CPU supports.
+	ctx->kernels = tinysr_select_kernels();
+	// The resampler gets configured on the first input, once we know the input rate.
+	ctx->resampler = (tinysr_resampler_t){0};
+	ctx->resampler.input_rate = -1;
+	ctx->resampler.allocator = &ctx->allocator;
+	// The bulk extraction buffer is made on first use.
+	ctx->batch_buffer = NULL;
+	ctx->batch_storage = NULL;
+	ctx->batch_pending = 0;
+#endif
+	// Bulk extraction is off until tinysr_extract_features turns it on.
+	ctx->extract_out = NULL;
+	ctx->extract_count = ctx->extract_capacity = 0;
 	ctx->processed_samples = 0;
 	// Initialize the resampling filter.
-	ctx->resampling_prev_raw_sample = 0.0;
-	ctx->resampling_time_delta = 0.0;
+	ctx->resampling_prev_raw_sample = 0;
+	ctx->resampling_time_delta = 0;
 	// By default, assume the input is at 48000 samples per second.
 	ctx->input_sample_rate = 48000;
 	// By default, run in one shot mode.
 	ctx->utterance_mode = TINYSR_MODE_ONE_SHOT;
 	// By default, assume mono input. If this flag is set, then pairs of samples will be mixed together.
 	ctx->do_downmix = 0;
+	// By default, match exactly. These pruning settings lose almost nothing on the digits demo model.
+	ctx->dtw_mode = TINYSR_DTW_EXACT;
+	ctx->dtw_band_percent = DTW_DEFAULT_BAND_PERCENT;
+	ctx->dtw_beam = TINYSR_SCORE(DTW_DEFAULT_BEAM);
+	ctx->mixture_shortlist = MIXTURE_DEFAULT_SHORTLIST;
+	// By default, normalize over whole utterances, once they're over.
+	ctx->cmn_mode = TINYSR_CMN_UTTERANCE;
+	ctx->streaming = 0;
 	// Offset compensation running values.
-	ctx->offset_comp_prev_in = 0.0;
-	ctx->offset_comp_prev_out = 0.0;
+	ctx->offset_comp_prev_in = 0;
+	ctx->offset_comp_prev_out = 0;
 	// Allocate a circular buffer for staging the input.
-	ctx->input_buffer = malloc(sizeof(float) * FRAME_LENGTH);
+	// It is mirrored: every sample is written both at its index and frame_length past it, so that
+	// the most recent frame_length samples are always contiguous, starting at input_buffer_next.
+	ctx->input_buffer = ctx_allocate(ctx, sizeof(tinysr_signal_t) * 2 * plan->frame_length);
 	// Index to write to next in input_buffer.
 	ctx->input_buffer_next = 0;
 	// How many samples are currently in input_buffer.
 	ctx->input_buffer_samps = 0;
 	// Allocate a temporary buffer for processing.
 	// The entire feature extraction takes place in ths buffer, so we make it long enough to do an FFT in.
-	ctx->temp_buffer = malloc(sizeof(float) * FFT_LENGTH);
-	// The features vector list: whenever a frame of input is processed, the resultant features go in here.
-	ctx->fv_list = (list_t){0};
-	// The feature vectors are numbered in the list, and this variable stores the next value to be assigned.
+	ctx->temp_buffer = ctx_allocate(ctx, sizeof(tinysr_signal_t) * plan->fft_length);
+	// The magnitude spectrum of the frame goes here, bins [0, fft_length/2] inclusive.
+	ctx->spectrum_buffer = ctx_allocate(ctx, sizeof(tinysr_signal_t) * (plan->fft_length/2 + 1));
+	// The feature vector ring: whenever a frame of input is processed, the resultant features go in here.
+	ctx->fv_ring = ctx_allocate(ctx, sizeof(feature_vector_t) * FV_RING_INITIAL_CAPACITY);
+	ctx->fv_ring_mask = FV_RING_INITIAL_CAPACITY - 1;
+	// The feature vectors are numbered consecutively, and this variable stores the next value to be assigned.
+	// The ring is empty, so the oldest one held is also the next one.
 	ctx->next_fv_number = 1;
-	// This points to the fv_list node that has been most recently checked.
-	// It might not be the end of fv_list if new frames have been added, but not yet processed.
-	ctx->current_fv = NULL;
-	// When an utterance is detected as beginning, this variable is set to point to the beginning FV.
-	ctx->utterance_start = NULL;
+	ctx->fv_oldest = 1;
+	// The next feature vector to be checked by utterance detection.
+	// It might not be the end of the ring if new frames have been added, but not yet processed.
+	ctx->fv_checked = 1;
+	// When an utterance is detected as beginning, this variable is set to the number of the beginning FV.
+	ctx->utterance_start = -1;
 	// The running estimate of the noise floor.
 	// Initially set it to any over-estimate, essentially infinity.
-	ctx->noise_floor_estimate = 100.0;
+	ctx->noise_floor_estimate = TINYSR_FEATURE(100.0);
 	// These values accumulate during energy and silence respectively, and reset to zero during the opposite.
-	// They're floats, but in the current implementation they accumulate at a rate of 1.0 per feature vector.
+	// They count up by one per feature vector.
 	// They are used in the utterance detection state machine to determine starting and stoping respectively.
-	ctx->excitement = 0.0;
-	ctx->boredom = 0.0;
+	ctx->excitement = 0;
+	ctx->boredom = 0;
 	// This variable holds the main state of the utterance detection state machine.
 	// If it is zero, then we are waiting for an utterance to start.
 	// If it's one, then an utterance is in progress.
 	ctx->utterance_state = 0;
 	// List of utterances, with cepstral mean normalization already applied.
 	ctx->utterance_list = (list_t){0};
-	// List of matching templates to recognize against.
+	// No model yet, and so no matching templates to recognize against, and no table of word names.
+	ctx->model = NULL;
 	ctx->recog_entry_list = (list_t){0};
-	// Table of word names, as indexed by word indices.
 	ctx->word_names = NULL;
 	// List of recognition results.
 	ctx->results_list = (list_t){0};
+	ctx->utterance_list.allocator = ctx->results_list.allocator = &ctx->allocator;
+	// Scoring and DTW scratch space is sized when the model is loaded.
+	ctx->state_count = ctx->state_stride = 0;
+#ifndef TINYSR_FIXED_POINT
+	ctx->score_weights = NULL;
+	ctx->score_expansion = NULL;
+#endif
+	ctx->score_block = NULL;
+	ctx->dp_row = NULL;
+	// No utterance has been normalized or streamed yet.
+	ctx->cmn_count = 0;
+	ctx->stream_next = -1;
+	ctx->stream_frames = ctx->stream_pending = 0;
+	ctx->stream_block = NULL;
+	ctx->stream_dp_row = NULL;
+	memset(ctx->keyword_mean, 0, sizeof(ctx->keyword_mean));
+	ctx->keyword_mean_frames = 0;
+	ctx->keyword_cells = NULL;
+	ctx->keyword_thresholds = NULL;
+	ctx->keyword_last_ends = NULL;
+	// By default, match on the calling thread. The vocabulary gets split into tasks anyway, when it's loaded.
+	ctx->thread_pool = NULL;
+	ctx->tasks = NULL;
+	ctx->task_count = 0;
+#ifndef TINYSR_FIXED_POINT
+	ctx->task_expansion = NULL;
+#endif
+	ctx->task_scores = NULL;
+	ctx->word_scores = NULL;
+	ctx->frame_codewords = NULL;
+	ctx->codewords_cached = 0;
+	ctx->async = NULL;
 
+	// Allocators can fail, so if any of the buffers couldn't be had, give back whatever could.
+	if (ctx->input_buffer == NULL || ctx->temp_buffer == NULL || ctx->spectrum_buffer == NULL || ctx->fv_ring == NULL) {
+		tinysr_free_context(ctx);
+		return NULL;
+	}
 	return ctx;
 }
 
-// Frees a context and all associated memory.
+// Frees a context and all associated memory. Does nothing given NULL.
 void tinysr_free_context(tinysr_ctx_t* ctx) {
-	free(ctx->input_buffer);
-	free(ctx->temp_buffer);
-	// Free any feature vectors that happen to be allocated at the time.
-	while (ctx->fv_list.length)
-		free(list_pop_front(&ctx->fv_list));
+	if (ctx == NULL)
+		return;
+	// Background recognition has to finish with the context before anything goes.
+	tinysr_stop_async(ctx);
+	ctx_release(ctx, ctx->input_buffer);
+	ctx_release(ctx, ctx->temp_buffer);
+	ctx_release(ctx, ctx->spectrum_buffer);
+#ifndef TINYSR_FIXED_POINT
+	tinysr_resampler_free(&ctx->resampler);
+	ctx_release(ctx, ctx->batch_storage);
+#endif
+	if (ctx->owns_frontend_plan)
+		tinysr_frontend_plan_free((tinysr_frontend_plan_t*) ctx->frontend_plan);
+	ctx_release(ctx, ctx->fv_ring);
 	// Free any utterances.
-	while (ctx->utterance_list.length) {
-		utterance_t* utterance = (utterance_t*) list_pop_front(&ctx->utterance_list);
-		free(utterance->feature_vectors);
-		free(utterance);
-	}
-	// Free any recognition entries.
-	while (ctx->recog_entry_list.length) {
-		recog_entry_t* recog_entry = (recog_entry_t*) list_pop_front(&ctx->recog_entry_list);
-		free(recog_entry->name);
-		free(recog_entry->model_template);
-		free(recog_entry);
-	}
-	// Free the word names table.
-	free(ctx->word_names);
+	while (ctx->utterance_list.length)
+		tinysr_free_utterance(ctx, list_pop_front(&ctx->utterance_list));
+	// Let go of the model, which frees it, if this was the last context using it.
+	tinysr_model_release(ctx->model);
 	// Free any results.
 	while (ctx->results_list.length)
-		free(list_pop_front(&ctx->results_list));
-	free(ctx);
+		ctx_release(ctx, list_pop_front(&ctx->results_list));
+#ifndef TINYSR_FIXED_POINT
+	ctx_release(ctx, ctx->score_expansion);
+#endif
+	ctx_release(ctx, ctx->score_block);
+	ctx_release(ctx, ctx->dp_row);
+	ctx_release(ctx, ctx->stream_block);
+	ctx_release(ctx, ctx->stream_dp_row);
+	ctx_release(ctx, ctx->keyword_cells);
+	ctx_release(ctx, ctx->keyword_thresholds);
+	ctx_release(ctx, ctx->keyword_last_ends);
+	ctx_release(ctx, ctx->tasks);
+#ifndef TINYSR_FIXED_POINT
+	ctx_release(ctx, ctx->task_expansion);
+#endif
+	ctx_release(ctx, ctx->task_scores);
+	ctx_release(ctx, ctx->word_scores);
+	ctx_release(ctx, ctx->frame_codewords);
+	// Everything is back in the pool now, so it can all be handed back at once.
+	tinysr_allocator_t allocator = ctx->allocator;
+	if (ctx->use_pool) {
+		pool_drain(&ctx->pool);
+		allocator = ctx->pool.backing;
+	}
+	allocator.release(allocator.user, ctx);
+}
+
+int tinysr_reserve_pool(tinysr_ctx_t* ctx, int max_pending) {
+	if (!ctx->use_pool)
+		return 1;
+	// Everything that goes with one pending utterance and its result.
+	size_t sizes[] = {
+		sizeof(feature_vector_t) * (ctx->fv_ring_mask + 1), sizeof(utterance_t), sizeof(list_node_t),
+		sizeof(result_t), sizeof(list_node_t)
+	};
+	// Take all the blocks at once, chained together through their first word, then put them all back.
+	void* held = NULL;
+	int failed = 0, i, k, count = sizeof(sizes) / sizeof(sizes[0]);
+	for (i = 0; i < max_pending; i++) {
+		for (k = 0; k < count; k++) {
+			void** block = ctx_allocate(ctx, sizes[k]);
+			if (block == NULL) {
+				failed = 1;
+				continue;
+			}
+			*block = held;
+			held = block;
+		}
+	}
+	while (held != NULL) {
+		void* next = *(void**) held;
+		ctx_release(ctx, held);
+		held = next;
+	}
+	return failed;
+}
+
+int tinysr_get_stats(tinysr_ctx_t* ctx, tinysr_stats_t* stats) {
+#ifndef TINYSR_NO_STATS
+	*stats = ctx->stats;
+	return 0;
+#else
+	memset(stats, 0, sizeof(tinysr_stats_t));
+	return 1;
+#endif
+}
+
+void tinysr_reset_stats(tinysr_ctx_t* ctx) {
+#ifndef TINYSR_NO_STATS
+	memset(&ctx->stats, 0, sizeof(tinysr_stats_t));
+#endif
+}
+
+void tinysr_free_utterance(tinysr_ctx_t* ctx, utterance_t* utterance) {
+	ctx_release(ctx, utterance->feature_vectors);
+	ctx_release(ctx, utterance);
 }
 
 // Convenience call, that calls tinysr_feed_input, then the rest of the recognition pipeline.
-// Returns the number of pending recognition results.
+// Returns the number of pending recognition results, or -1 if the input couldn't be taken.
 int tinysr_recognize(tinysr_ctx_t* ctx, samp_t* samples, int length) {
-	tinysr_feed_input(ctx, samples, length);
+	int failed = tinysr_feed_input(ctx, samples, length);
 	tinysr_detect_utterances(ctx);
 	tinysr_recognize_utterances(ctx);
-	return ctx->results_list.length;
+	return failed ? -1 : results_waiting(ctx);
 }
 
-// Feed in samples to the speech recognizer.
-// Performs feature extraction immediately, as frames become complete.
-void tinysr_feed_input(tinysr_ctx_t* ctx, samp_t* samples, int length) {
-	while (length--) {
-		// Read one sample in.
-		float raw_sample = (float)*samples++;
-		// If downmixing was requested, then the stereo input gets summed into mono.
-		if (ctx->do_downmix)
-			raw_sample += (float)*samples++;
-		ctx->processed_samples++;
-		// Now we apply the resampling filter, resampling from ctx->input_sample_rate to 16000 samples per second.
-		while (ctx->resampling_time_delta <= 1.0) {
+// Converts a block of input samples to the front-end's signal type, summing pairs together if downmixing.
+static void ingest_convert(tinysr_ctx_t* ctx, const samp_t* samples, int length, tinysr_signal_t* out) {
+	int i;
+#ifdef TINYSR_FIXED_POINT
+	if (ctx->do_downmix)
+		for (i = 0; i < length; i++)
+			out[i] = ((int32_t)samples[2*i] + (int32_t)samples[2*i+1]) << TINYSR_SIGNAL_FRACTION_BITS;
+	else
+		for (i = 0; i < length; i++)
+			out[i] = (int32_t)samples[i] << TINYSR_SIGNAL_FRACTION_BITS;
+#else
+	if (ctx->do_downmix)
+		for (i = 0; i < length; i++)
+			out[i] = (float)samples[2*i] + (float)samples[2*i+1];
+	else
+		for (i = 0; i < length; i++)
+			out[i] = (float)samples[i];
+#endif
+}
+
+// Linearly interpolating resampler, from ctx->input_sample_rate to the front-end's rate.
+// This is only used for rates that the polyphase resampler doesn't cover.
+// Stops when either the input runs out or the output fills up, and can resume from either,
+// even midway through interpolating between two input samples. Returns the number of samples
+// produced, and sets *consumed to the number of input samples used up.
+// In the fixed point build, time is kept in Q16, so the step is slightly rounded.
+static int ingest_resample_linear(tinysr_ctx_t* ctx, const tinysr_signal_t* in, int length, tinysr_signal_t* out, int capacity, int* consumed) {
+#ifdef TINYSR_FIXED_POINT
+	const int32_t one = 1 << 16;
+	int32_t step = (int32_t) (((int64_t) ctx->input_sample_rate << 16) / ctx->frontend_plan->sample_rate);
+	int32_t time_delta = ctx->resampling_time_delta;
+#else
+	const float one = 1.0;
+	double step = ctx->input_sample_rate / (double) ctx->frontend_plan->sample_rate;
+	float time_delta = ctx->resampling_time_delta;
+#endif
+	tinysr_signal_t prev_raw_sample = ctx->resampling_prev_raw_sample;
+	int i = 0, produced = 0;
+	while (i < length) {
+		tinysr_signal_t raw_sample = in[i];
+		while (time_delta <= one) {
+			if (produced == capacity)
+				goto ingest_resample_linear_full;
 			// Linearly interpolate the current sample.
-			float sample_in = (1 - ctx->resampling_time_delta) * ctx->resampling_prev_raw_sample + ctx->resampling_time_delta * raw_sample;
-			// Perform offset compensation (ES 201 108 4.2.3)
-			float sample_out = sample_in - ctx->offset_comp_prev_in + 0.999 * ctx->offset_comp_prev_out;
-			ctx->offset_comp_prev_in = sample_in;
-			ctx->offset_comp_prev_out = sample_out;
-			// Store the sample into the circular buffer.
-			ctx->input_buffer[ctx->input_buffer_next++] = sample_out;
-			ctx->input_buffer_next %= FRAME_LENGTH;
-			// Check if this completes a frame. (ES 201 108 4.2.4)
-			if (++ctx->input_buffer_samps == FRAME_LENGTH) {
-				tinysr_process_frame(ctx);
-				ctx->input_buffer_samps -= SHIFT_INTERVAL;
-			}
+#ifdef TINYSR_FIXED_POINT
+			out[produced++] = prev_raw_sample + (int32_t) (((int64_t) (raw_sample - prev_raw_sample) * time_delta) >> 16);
+#else
+			out[produced++] = (1 - time_delta) * prev_raw_sample + time_delta * raw_sample;
+#endif
 			// Advance our time estimate by the appropriate amount.
-			ctx->resampling_time_delta += ctx->input_sample_rate / 16000.0;
+			time_delta += step;
 		}
 		// Store the current sample, for linear interpolation next time around.
-		ctx->resampling_prev_raw_sample = raw_sample;
-		ctx->resampling_time_delta -= 1;
+		prev_raw_sample = raw_sample;
+		time_delta -= one;
+		i++;
 	}
+ingest_resample_linear_full:
+	ctx->resampling_prev_raw_sample = prev_raw_sample;
+	ctx->resampling_time_delta = time_delta;
+	*consumed = i;
+	return produced;
 }
 
-// Call to trigger utterance detection on all the accumulated frames.
-void tinysr_detect_utterances(tinysr_ctx_t* ctx) {
-	list_node_t* utterance_end;
-	// If no feature vectors have yet been produced, we can't start processing.
-	if (ctx->fv_list.length == 0)
+// Perform offset compensation (ES 201 108 4.2.3) in place.
+static void ingest_offset_compensate(tinysr_ctx_t* ctx, tinysr_signal_t* x, int length) {
+	tinysr_signal_t prev_in = ctx->offset_comp_prev_in;
+	int i;
+#ifdef TINYSR_FIXED_POINT
+	// The output is kept with 8 extra fraction bits, as rounding it to the signal's precision every
+	// sample would leave it stuck on a small offset, rather than decaying. The filter's gain is at most
+	// two, so the output stays below 2^34, and 0.999 * prev_out is computed as prev_out - 0.001 * prev_out,
+	// with 0.001 in Q30, to stay within 64 bits.
+	int64_t prev_out = ctx->offset_comp_prev_out;
+	for (i = 0; i < length; i++) {
+		tinysr_signal_t sample_in = x[i];
+		int64_t sample_out = ((int64_t) (sample_in - prev_in) << 8) + prev_out - ((prev_out * 1073742 + (1 << 29)) >> 30);
+		prev_in = sample_in;
+		prev_out = sample_out;
+		x[i] = (tinysr_signal_t) ((sample_out + (1 << 7)) >> 8);
+	}
+#else
+	float prev_out = ctx->offset_comp_prev_out;
+	for (i = 0; i < length; i++) {
+		float sample_in = x[i];
+		float sample_out = sample_in - prev_in + 0.999 * prev_out;
+		prev_in = sample_in;
+		prev_out = sample_out;
+		x[i] = sample_out;
+	}
+#endif
+	ctx->offset_comp_prev_in = prev_in;
+	ctx->offset_comp_prev_out = prev_out;
+}
+
+// Appends samples to the mirrored ring buffer, processing frames as they complete. (ES 201 108 4.2.4)
+// Samples are copied in runs that stop at either the end of the ring or the end of a frame.
+static void ingest_push(tinysr_ctx_t* ctx, const tinysr_signal_t* x, int length) {
+	int frame_length = ctx->frontend_plan->frame_length;
+	while (length > 0) {
+		int run = length;
+		if (run > frame_length - ctx->input_buffer_next)
+			run = frame_length - ctx->input_buffer_next;
+		if (run > frame_length - ctx->input_buffer_samps)
+			run = frame_length - ctx->input_buffer_samps;
+		memcpy(ctx->input_buffer + ctx->input_buffer_next, x, sizeof(tinysr_signal_t) * run);
+		memcpy(ctx->input_buffer + ctx->input_buffer_next + frame_length, x, sizeof(tinysr_signal_t) * run);
+		x += run;
+		length -= run;
+		ctx->input_buffer_next += run;
+		if (ctx->input_buffer_next == frame_length)
+			ctx->input_buffer_next = 0;
+		ctx->input_buffer_samps += run;
+		// Check if this completes a frame. During bulk extraction, frames that still fit in the output
+		// get batched up, rather than processed one at a time.
+		if (ctx->input_buffer_samps == frame_length) {
+#ifdef TINYSR_FIXED_POINT
+			int pending = 0;
+#else
+			int pending = ctx->batch_pending;
+#endif
+			// The ring's feature vectors are consecutive, so once any are waiting there, the rest queue up behind them.
+			if (ctx->extract_out != NULL && ctx->fv_oldest == ctx->next_fv_number && ctx->extract_count + pending < ctx->extract_capacity)
+				batch_add_frame(ctx);
+			else
+				tinysr_process_frame(ctx);
+			ctx->input_buffer_samps -= ctx->frontend_plan->shift_interval;
+		}
+	}
+}
+
+// Feed in samples to the speech recognizer.
+// Performs feature extraction immediately, as frames become complete.
+// The input is processed in blocks: each block is converted to the signal type, resampled to the
+// front-end's rate, offset compensated, and then pushed into the ring buffer.
+// The fixed point build always resamples with the linear interpolator.
+int tinysr_feed_input(tinysr_ctx_t* ctx, samp_t* samples, int length) {
+	tinysr_signal_t raw[INGEST_BLOCK_LENGTH], resampled[INGEST_BLOCK_LENGTH];
+#ifndef TINYSR_FIXED_POINT
+	// Pick the resampler for the current rate. Changing rates restarts the filter from silence. Without the
+	// memory for its filter, none of the input is taken, rather than being quietly interpolated linearly, and
+	// the next call tries again.
+	if (ctx->resampler.input_rate != ctx->input_sample_rate || ctx->resampler.output_rate != ctx->frontend_plan->sample_rate) {
+		if (tinysr_resampler_configure(&ctx->resampler, ctx->input_sample_rate, ctx->frontend_plan->sample_rate)) {
+			ctx->resampler.input_rate = -1;
+			return 1;
+		}
+	}
+#endif
+	STATS_BEGIN(ctx);
+	while (length > 0) {
+		int count = length < INGEST_BLOCK_LENGTH ? length : INGEST_BLOCK_LENGTH;
+		ingest_convert(ctx, samples, count, raw);
+		samples += ctx->do_downmix ? 2 * count : count;
+		length -= count;
+		ctx->processed_samples += count;
+		int used = 0;
+#ifndef TINYSR_FIXED_POINT
+		if (ctx->resampler.mode != TINYSR_RESAMPLER_LINEAR) {
+			while (used < count) {
+				int consumed;
+				int produced = tinysr_resampler_process(&ctx->resampler, ctx->kernels, raw + used, count - used, resampled, INGEST_BLOCK_LENGTH, &consumed);
+				used += consumed;
+				ingest_offset_compensate(ctx, resampled, produced);
+				ingest_push(ctx, resampled, produced);
+			}
+			continue;
+		}
+#endif
+		// Fast path: if the input is already at the front-end's rate, and the linear interpolator has
+		// settled onto exactly the input samples, then resampling is the identity.
+		if (ctx->input_sample_rate == ctx->frontend_plan->sample_rate && ctx->resampling_time_delta == LINEAR_RESAMPLER_ONE) {
+			ctx->resampling_prev_raw_sample = raw[count-1];
+			ingest_offset_compensate(ctx, raw, count);
+			ingest_push(ctx, raw, count);
+			continue;
+		}
+		while (used < count) {
+			int consumed;
+			int produced = ingest_resample_linear(ctx, raw + used, count - used, resampled, INGEST_BLOCK_LENGTH, &consumed);
+			used += consumed;
+			ingest_offset_compensate(ctx, resampled, produced);
+			ingest_push(ctx, resampled, produced);
+		}
+	}
+	STATS_END(ctx, TINYSR_STAGE_FEED);
+	return 0;
+}
+
+// The work of tinysr_detect_utterances, below.
+static void detect_utterances(tinysr_ctx_t* ctx) {
+	long long utterance_end;
+	// If no feature vectors are waiting, we can't start processing.
+	if (ctx->fv_oldest == ctx->next_fv_number)
 		return;
+	// Keyword spotting doesn't look for utterances at all.
+	if (ctx->utterance_mode == TINYSR_MODE_KEYWORD_SPOTTING) {
+		keyword_spot(ctx);
+		return;
+	}
 	// If in one shot mode, then the entire input is an utterance, and behave appropriately.
 	if (ctx->utterance_mode == TINYSR_MODE_ONE_SHOT) {
-		ctx->utterance_start = ctx->fv_list.head;
-		utterance_end = NULL;
+		ctx->utterance_start = ctx->fv_oldest;
+		utterance_end = ctx->next_fv_number;
 		goto tinysr_detect_utterances_found_one;
 	}
 	// Otherwise, we are assumed to be in TINYSR_MODE_FREE_RUNNING, and begin utterance extraction.
-	while (1) {
-		// Try to get a new feature vector to process, either by starting up, or getting the next.
-		if (ctx->current_fv == NULL)
-			ctx->current_fv = ctx->fv_list.head;
-		else if (ctx->current_fv->next != NULL)
-			ctx->current_fv = ctx->current_fv->next;
-		// If we can't get a new feature vector to process, we're done.
-		// This guarantees that we only get past this line once for each feature vector.
-		else break;
+	// This loop runs exactly once for each feature vector.
+	while (ctx->fv_checked < ctx->next_fv_number) {
 		// Now we processes this new feature vector.
-		feature_vector_t* fv = (feature_vector_t*) ctx->current_fv->datum;
+		long long current = ctx->fv_checked++;
+		feature_vector_t* fv = &ctx->fv_ring[current & ctx->fv_ring_mask];
 		// If the new FV's energy exceeds the threshold, become more excited. Otherwise, reset.
-		if (fv->log_energy > fv->noise_floor + UTTERANCE_START_ENERGY_THRESHOLD)
-			ctx->excitement += 1.0;
+		if (fv->log_energy > fv->noise_floor + TINYSR_FEATURE(UTTERANCE_START_ENERGY_THRESHOLD))
+			ctx->excitement++;
 		else
-			ctx->excitement = 0.0;
-		if (fv->log_energy < fv->noise_floor + UTTERANCE_STOP_ENERGY_THRESHOLD)
-			ctx->boredom += 1.0;
+			ctx->excitement = 0;
+		if (fv->log_energy < fv->noise_floor + TINYSR_FEATURE(UTTERANCE_STOP_ENERGY_THRESHOLD))
+			ctx->boredom++;
 		else
-			ctx->boredom = 0.0;
+			ctx->boredom = 0;
 		// Here begins the utterance detection state machine. The state is stored in ctx->utterance_state.
 		// Zero means waiting for utterance, one means waiting for utterance to end.
 		if (ctx->utterance_state == 0) {
 			// If we've become excited some number of feature vectors in a row, then we detect an utterance.
 			if (ctx->excitement >= UTTERANCE_START_LENGTH) {
 				ctx->utterance_state = 1;
-				ctx->utterance_start = ctx->current_fv;
-				// Now back up some number of FVs. (See #defs at top for explanation.)
-				int i;
-				for (i = 0; i < UTTERANCE_FRAMES_BACKED_UP; i++)
-					if (ctx->utterance_start->prev != NULL)
-						ctx->utterance_start = ctx->utterance_start->prev;
+				// Back up some number of FVs, as far as we still have them. (See #defs at top for explanation.)
+				ctx->utterance_start = current - UTTERANCE_FRAMES_BACKED_UP;
+				if (ctx->utterance_start < ctx->fv_oldest)
+					ctx->utterance_start = ctx->fv_oldest;
+				// Streaming recognition starts along with the utterance.
+				if (ctx->streaming && ctx->state_count > 0 && ctx->async == NULL) {
+					ctx->stream_next = ctx->utterance_start;
+					ctx->stream_frames = ctx->stream_pending = 0;
+					cmn_running_reset(ctx);
+				}
 			}
 		} else if (ctx->boredom >= UTTERANCE_STOP_LENGTH) {
-			// Now back up some frames from the end.
-			int i;
-			utterance_end = ctx->current_fv;
-			for (i = 0; i < UTTERANCE_FRAMES_DROPPED_FROM_END; i++)
-				// Note: Do an extra check to prevent the end from going before the start.
-				// This would result in the code segfaulting when it tried to pick out the utterance.
-				if (utterance_end->prev != NULL && utterance_end != ctx->utterance_start)
-					utterance_end = utterance_end->prev;
+			// Now back up some frames from the end, which is exclusive.
+			// Note: Make sure the end doesn't go before the start.
+			utterance_end = current - UTTERANCE_FRAMES_DROPPED_FROM_END;
+			if (utterance_end < ctx->utterance_start)
+				utterance_end = ctx->utterance_start;
 tinysr_detect_utterances_found_one:;
-			// Count the length of the utterance, by traversing the singly linked list.
-			int utterance_length = 0;
-			list_node_t* node;
-			for (node = ctx->utterance_start; node != utterance_end; node = node->next)
-				utterance_length++;
+			STATS_COUNT(ctx, utterances, 1);
+			if (ctx->stream_next == utterance_end) {
+				// Streaming has already been through the whole utterance, so its result is all but ready.
+				stream_finish(ctx);
+				goto tinysr_detect_utterances_reset;
+			}
+			ctx->stream_next = -1;
 			// Copy over the utterance into a flat array, for processing.
-			feature_vector_t* utterance_fvs = malloc(sizeof(feature_vector_t) * utterance_length);
-			i = 0;
-			for (node = ctx->utterance_start; node != utterance_end; node = node->next)
-				utterance_fvs[i++] = *(feature_vector_t*)node->datum;
+			// It's contiguous in the ring, except possibly for wrapping around the end once.
+			int utterance_length = (int) (utterance_end - ctx->utterance_start);
+			feature_vector_t* utterance_fvs = ctx_allocate(ctx, sizeof(feature_vector_t) * utterance_length);
+			int first = ctx->utterance_start & ctx->fv_ring_mask;
+			int first_run = ctx->fv_ring_mask + 1 - first;
+			if (first_run > utterance_length)
+				first_run = utterance_length;
+			memcpy(utterance_fvs, ctx->fv_ring + first, sizeof(feature_vector_t) * first_run);
+			memcpy(utterance_fvs + first_run, ctx->fv_ring, sizeof(feature_vector_t) * (utterance_length - first_run));
+			int i, j;
+			if (ctx->streaming || ctx->cmn_mode == TINYSR_CMN_RUNNING) {
+				// Normalize frame by frame, the same as streaming does.
+				cmn_running_reset(ctx);
+				for (i = 0; i < utterance_length; i++)
+					cmn_running_apply(ctx, &utterance_fvs[i]);
+				goto tinysr_detect_utterances_normalized;
+			}
 			// Do Cepstral Mean Normalization: start by averaging the cepstrum over the utterance.
-			float cepstral_mean[13] = {0};
-			int j;
+			tinysr_feature_t cepstral_mean[13] = {0};
+#ifdef TINYSR_FIXED_POINT
+			int64_t cepstral_sum[13] = {0};
+			for (i = 0; i < utterance_length; i++)
+				for (j = 0; j < 13; j++)
+					cepstral_sum[j] += utterance_fvs[i].cepstrum[j];
+			if (utterance_length > 0)
+				for (j = 0; j < 13; j++)
+					cepstral_mean[j] = (tinysr_feature_t) (cepstral_sum[j] / utterance_length);
+#else
 			for (i = 0; i < utterance_length; i++)
 				for (j = 0; j < 13; j++)
 					cepstral_mean[j] += utterance_fvs[i].cepstrum[j] / (float) utterance_length;
+#endif
 			// Then, subtract out the cepstral mean from the whole utterance.
 			for (i = 0; i < utterance_length; i++)
 				for (j = 0; j < 13; j++)
 					utterance_fvs[i].cepstrum[j] -= cepstral_mean[j];
+tinysr_detect_utterances_normalized:;
 			// Build up an utterance object.
-			utterance_t* utterance = malloc(sizeof(utterance_t));
+			utterance_t* utterance = ctx_allocate(ctx, sizeof(utterance_t));
 			utterance->length = utterance_length;
 			utterance->feature_vectors = utterance_fvs;
 			// And append it into the list of pending utterances, for further processing.
 			list_append_back(&ctx->utterance_list, utterance);
+tinysr_detect_utterances_reset:;
 			// Finally, reset our state machine.
-			ctx->utterance_start = NULL;
+			ctx->utterance_start = -1;
 			ctx->utterance_state = 0;
 			// If we jumped here from one shot mode, then make sure to clean up appropriately.
 			if (ctx->utterance_mode == TINYSR_MODE_ONE_SHOT) {
 				// Forget about every single feature vector -- they were all used up.
-				ctx->current_fv = NULL;
-				while (ctx->fv_list.length)
-					free(list_pop_front(&ctx->fv_list));
+				ctx->fv_oldest = ctx->fv_checked = ctx->next_fv_number;
 				return;
 			}
 		}
+		// Any frame this far back will be in the utterance, wherever it turns out to end, so streaming can
+		// go through it.
+		if (ctx->stream_next != -1)
+			stream_advance(ctx, ctx->fv_checked - UTTERANCE_FRAMES_DROPPED_FROM_END);
 	}
+	// Score whatever streaming has gathered, so the work keeps up with the input.
+	if (ctx->stream_next != -1 && ctx->stream_pending > 0)
+		stream_flush(ctx);
 	// Now that we're done processing FVs for the time being, forget about old ones that no longer could
 	// possibly be used in an utterance. Begin by computing the oldest possible FV number we could care about.
-	long long oldest_still_relevant = 0;
-	// We care about UTTERANCE_FRAMES_BACKED_UP frames before the current FV.
-	if (ctx->current_fv != NULL)
-		oldest_still_relevant = ((feature_vector_t*)ctx->current_fv->datum)->number - UTTERANCE_FRAMES_BACKED_UP;
+	// We care about UTTERANCE_FRAMES_BACKED_UP frames before the most recently checked FV.
+	long long oldest_still_relevant = ctx->fv_checked - 1 - UTTERANCE_FRAMES_BACKED_UP;
 	// We also care about any FVs currently in an utterance being detected.
-	if (ctx->utterance_start != NULL)
-		oldest_still_relevant = ((feature_vector_t*)ctx->utterance_start->datum)->number;
-	// While the oldest FV in the list is too old to be relevant, drop it.
-	while (ctx->fv_list.length && ((feature_vector_t*)ctx->fv_list.head->datum)->number < oldest_still_relevant)
-		free(list_pop_front(&ctx->fv_list));
+	if (ctx->utterance_start != -1)
+		oldest_still_relevant = ctx->utterance_start;
+	// Dropping FVs from the ring is just a matter of moving its start forward.
+	if (ctx->fv_oldest < oldest_still_relevant)
+		ctx->fv_oldest = oldest_still_relevant;
 }
 
-// Recognize one specific utterance.
-void tinysr_recognize_utterance(tinysr_ctx_t* ctx, utterance_t* utter) {
-	int best_index = -1;
-	// Again, I'd like to set this to negative inf, but it's hard to do that portably. :(
-	float best_score = -1e30;
-	// Match the utterance against all current recognition entries.
-	list_node_t* re = ctx->recog_entry_list.head;
-	while (re != NULL) {
-		float new_score = compute_dynamic_time_warping(re->datum, utter);
-		if (new_score > best_score) {
-			best_index = ((recog_entry_t*)re->datum)->index;
-			best_score = new_score;
-		}
-		re = re->next;
-	}
-	// We've found a winner!
-	result_t* result = malloc(sizeof(result_t));
-	result->word_index = best_index;
-	result->score = best_score;
-	list_append_back(&ctx->results_list, result);
+// Call to trigger utterance detection on all the accumulated frames.
+void tinysr_detect_utterances(tinysr_ctx_t* ctx) {
+	STATS_BEGIN(ctx);
+	detect_utterances(ctx);
+	STATS_END(ctx, TINYSR_STAGE_DETECT);
 }
 
-// Call to trigger recognition on detected utterances.
-void tinysr_recognize_utterances(tinysr_ctx_t* ctx) {
-	while (ctx->utterance_list.length) {
-		// Read in one utterance at a time.
-		utterance_t* utter = list_pop_front(&ctx->utterance_list);
-		tinysr_recognize_utterance(ctx, utter);
-		free(utter->feature_vectors);
-		free(utter);
+// Returns a slot for the next feature vector in the ring, growing the ring if it's full.
+// If it can't grow, then the oldest feature vector is dropped to make room.
+static feature_vector_t* fv_ring_reserve(tinysr_ctx_t* ctx) {
+	int capacity = ctx->fv_ring_mask + 1;
+	if (ctx->next_fv_number - ctx->fv_oldest == capacity) {
+		feature_vector_t* ring = ctx_allocate(ctx, sizeof(feature_vector_t) * 2 * capacity);
+		if (ring != NULL) {
+			long long n;
+			for (n = ctx->fv_oldest; n < ctx->next_fv_number; n++)
+				ring[n & (2 * capacity - 1)] = ctx->fv_ring[n & ctx->fv_ring_mask];
+			ctx_release(ctx, ctx->fv_ring);
+			ctx->fv_ring = ring;
+			ctx->fv_ring_mask = 2 * capacity - 1;
+		} else {
+			ctx->fv_oldest++;
+			if (ctx->fv_checked < ctx->fv_oldest)
+				ctx->fv_checked = ctx->fv_oldest;
+			if (ctx->utterance_start != -1 && ctx->utterance_start < ctx->fv_oldest)
+				ctx->utterance_start = ctx->fv_oldest;
+		}
 	}
+	return &ctx->fv_ring[ctx->next_fv_number & ctx->fv_ring_mask];
+}
+
+// Moves the empty ring along past feature vectors that were numbered, but went elsewhere.
+static void fv_ring_skip(tinysr_ctx_t* ctx) {
+	ctx->fv_oldest = ctx->fv_checked = ctx->next_fv_number;
+	if (ctx->utterance_start != -1)
+		ctx->utterance_start = ctx->next_fv_number;
+}
+
+int tinysr_feature_count(tinysr_ctx_t* ctx) {
+	return (int) (ctx->next_fv_number - ctx->fv_oldest);
 }
 
-int tinysr_get_result(tinysr_ctx_t* ctx, int* word_index, float* score) {
-	// Fail if there are no results to write out.
-	if (ctx->results_list.length == 0)
+int tinysr_pop_feature_vector(tinysr_ctx_t* ctx, feature_vector_t* fv) {
+	if (ctx->fv_oldest == ctx->next_fv_number)
 		return 0;
-	result_t* result = list_pop_front(&ctx->results_list);
-	// Copy over the data.
-	if (word_index != NULL)
-		*word_index = result->word_index;
-	if (score != NULL)
-		*score = result->score;
-	// Free, and report success.
-	free(result);
+	*fv = ctx->fv_ring[ctx->fv_oldest & ctx->fv_ring_mask];
+	ctx->fv_oldest++;
+	// Utterance detection can't look at what's been taken.
+	if (ctx->fv_checked < ctx->fv_oldest)
+		ctx->fv_checked = ctx->fv_oldest;
+	if (ctx->utterance_start != -1 && ctx->utterance_start < ctx->fv_oldest)
+		ctx->utterance_start = ctx->fv_oldest;
 	return 1;
 }
 
-// Private function: Do not call directly!
-// Initiates front-end feature extraction on the contents of ctx->input_buffer.
-void tinysr_process_frame(tinysr_ctx_t* ctx) {
-	int i;
-	// Copy over the frame from the circular buffer into temp_buffer.
-	// Currently the frame could be laid out in input_buffer like:
-	// [ 6 7 8 9 0 1 2 3 4 5 ]
-	//           ^ input_buffer_next
-	// We straighten out this circular representation into temp_buffer.
-	// Completing ES 201 108 4.2.4.
-	int index = ctx->input_buffer_next;
-	for (i = 0; i < FRAME_LENGTH; i++) {
-		ctx->temp_buffer[i] = ctx->input_buffer[index++];
-		index %= FRAME_LENGTH;
-	}
-	// Measure log energy. (ES 201 108 4.2.5)
-	// Add a noise floor, keeping the log energy above -50.
-	// (Slight deviation from spec, but makes almost no difference.)
-	float energy = 2e-22;
-	for (i = 0; i < FRAME_LENGTH; i++)
-		energy += ctx->temp_buffer[i] * ctx->temp_buffer[i];
-	float log_energy = logf(energy);
-	// Pre-emphasize. (ES 201 108 4.2.6)
-	for (i = FRAME_LENGTH-1; i > 0; i--)
-		ctx->temp_buffer[i] -= 0.97 * ctx->temp_buffer[i-1];
-	// The spec doesn't specify what happens to the first sample, so we just zero it.
-	ctx->temp_buffer[0] = 0.0;
-	// Hamming window. (ES 201 108 4.2.7)
-	for (i = 0; i < FRAME_LENGTH; i++)
-		ctx->temp_buffer[i] *= 0.54 - 0.46 * cosf((PI2 * i)/(FRAME_LENGTH-1));
-	// Absolute value (complex magnitude) of FFT of the data, zero padded out to FFT_LENGTH. (ES 201 108 4.2.8)
-	// First, zero pad.
-	for (i = FRAME_LENGTH; i < FFT_LENGTH; i++)
-		ctx->temp_buffer[i] = 0.0;
-	// Then take the abs fft.
-	tinysr_abs_fft(ctx->temp_buffer, FFT_LENGTH);
-	// We now only proceed on ctx->temp_buffer[0 ... FFT_LENGTH/2] inclusive (inclusive means one more
-	// sample than half!) because Hermitian symmetry makes the upper half data redundant.
-	// Compute the triangular filter bank, a.k.a. Mel filtering. (ES 201 108 4.2.9)
-	float filter_bank[23];
-	// This next line has data computed by scripts/compute_mel_bins.py, assuming 512 FFT bins, and 16 kHz sampling rate.
-	// If these assumptions change, rerun that script to figure out what these bins should be!
-	int cbin[25] = {2, 5, 8, 11, 14, 18, 23, 27, 33, 38, 45, 52, 60, 69, 79, 89, 101, 115, 129, 145, 163, 183, 205, 229, 256};
-	// XXX: Note! ES 201 108 has fbank (corresponding to our filter_bank) being one indexed, but I have it zero indexed.
-	// Thus, note that cbin[k+1] is the center bin index for filter_bank[k]. This is why cbin is of length 25. 
-	// The first and last bin indexes are for sizing the first and last triangular filter. Therefore, note that
-	// where in 4.2.9 it says fbank_k is based on cbin_(k-1), cbin_k and cbin_(k+1), instead for me it's based on
-	// cbin_k, cbin_(k+1), and cbin_(k+2). Just keep track off the off by oneness.
-	int k;
-	for (k = 0; k < 23; k++) {
-		filter_bank[k] = 0.0;
-		for (i = cbin[k]; i <= cbin[k+1]; i++)
-			filter_bank[k] += ((i - cbin[k] + 1) / (float)(cbin[k+1] - cbin[k] + 1)) * ctx->temp_buffer[i];
-		for (i = cbin[k+1]+1; i <= cbin[k+2]; i++)
-			filter_bank[k] += (1 - ((i - cbin[k+1]) / (float)(cbin[k+2] - cbin[k+1] + 1))) * ctx->temp_buffer[i];
-	}
-	// Non-linear transform: logarithm. (ES 201 108 4.2.10)
-	// Again note the noise floor of 2e-22 to prevent an answer less than -50.
-	for (k = 0; k < 23; k++)
-		filter_bank[k] = logf(filter_bank[k] + 2e-22);
-	// Compute the mel cepstrum. (ES 201 108 4.2.11)
-	float cepstrum[13] = {0};
-	for (i = 0; i < 13; i++) {
-		// Compute the discrete cosine transform (DCT) the naive way.
-		// XXX: Again notice that I'm zero indexing: filter_bank[j] contains what the spec calls f_(j+1).
-		// This is why it's (j + 0.5) rather than (j - 0.5) like in the spec in the upcoming expression.
-		int j;
-		for (j = 0; j < 23; j++)
-			cepstrum[i] += filter_bank[j] * cosf(PI * i * (j + 0.5) / 23.0);
+// Finds the best scoring word, given every word's dynamic time warping row after the last frame.
+static void best_word(tinysr_ctx_t* ctx, const tinysr_score_t* dp_row, int* best_index, tinysr_score_t* best_score) {
+	list_node_t* re;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		tinysr_score_t new_score = dtw_finish(entry, dp_row + entry->first_state);
+		if (new_score > *best_score) {
+			*best_index = entry->index;
+			*best_score = new_score;
+		}
 	}
-	// Do noise floor estimation. Clearly, it's impossible for there to be less energy than the true noise floor.
-	// Thus, if the energy is lower than our current floor estimate, then lower our estimate. However, if the
-	// energy is greater than our estimate, raise it slowly. This is a ``slow to rise, fast to fall'' estimator.
-	// We use 0.999 * old + 0.001 * new, which gives a ten second time constant with one frame per 10 ms. 
-	if (log_energy < ctx->noise_floor_estimate) ctx->noise_floor_estimate = log_energy;
-	else ctx->noise_floor_estimate = 0.999 * ctx->noise_floor_estimate + 0.001 * log_energy;
-	// We're now done with the entire front-end processing!
-	// Now we save the feature vector which consists of log_energy, and cepstrum into the list.
-	feature_vector_t* fv = malloc(sizeof(feature_vector_t));
-	fv->log_energy = log_energy;
-	for (i = 0; i < 13; i++)
-		fv->cepstrum[i] = cepstrum[i];
-	// Consecutively number the feature vectors.
-	fv->number = ctx->next_fv_number++;
-	// Store the noise floor, so the utterance detector can take it into account.
-	fv->noise_floor = ctx->noise_floor_estimate;
-	list_append_back(&ctx->fv_list, fv);
 }
 
-// Computes the log-likelihood of a feature vector matching a given Gaussian.
-float gaussian_log_likelihood(gaussian_t* gauss, feature_vector_t* fv) {
-	float cepstrum[13];
-	// Subtract the Gaussian's mean from the feature vector.
-	int i, j;
-	for (i = 0; i < 13; i++)
-		cepstrum[i] = fv->cepstrum[i] - gauss->cepstrum_mean[i];
-	float log_likelihood = gauss->log_likelihood_offset;
-	// Then, compute the quadratic form cepstrum^T cepstrum_inverse_covariance cepstrum.
-	for (i = 0; i < 13; i++)
-		for (j = 0; j < 13; j++)
-			log_likelihood -= 0.5 * cepstrum[i] * gauss->cepstrum_inverse_covariance[j + i*13] * cepstrum[j]; 
-	return log_likelihood;
+static void append_result(tinysr_ctx_t* ctx, int word_index, tinysr_score_t score, long long first_frame, long long end_frame) {
+	result_t* result = ctx_allocate(ctx, sizeof(result_t));
+	result->word_index = word_index;
+	result->score = score;
+	result->first_frame = first_frame;
+	result->end_frame = end_frame;
+	list_append_back(&ctx->results_list, result);
 }
 
-// Computes the cost of matching a given utterance against a given template.
-float compute_dynamic_time_warping(recog_entry_t* match, utterance_t* utterance) {
-	// Do dynamic programming to figure out the minimum path cost.
-	float* dp_array = malloc(sizeof(float) * match->model_template_length);
-	float diagonal_value = 0.0;
-	int i, j;
-	for (i = 0; i < utterance->length; i++) {
-		for (j = 0; j < match->model_template_length; j++) {
-			// I would set the log likelihood (ll) to -infinity, but that's hard to do in a portable way. :(
-			float ll = -1e30;
-			// Find our minimum cost predecessor.
-			if (i > 0)
-				ll = dp_array[j] > ll ? dp_array[j] : ll;
-			if (j > 0)
-				ll = dp_array[j-1] > ll ? dp_array[j-1] : ll;
-			if (i > 0 && j > 0)
-				ll = diagonal_value > ll ? diagonal_value : ll;
-			if (i == 0 && j == 0)
-				ll = 0.0;
-			// Then add in the cost of matching at this site.
-			ll += gaussian_log_likelihood(&match->model_template[j], &utterance->feature_vectors[i]);
-			diagonal_value = dp_array[j];
-			dp_array[j] = ll;
+typedef struct {
+	tinysr_ctx_t* ctx;
+	utterance_t* utterance;
+} recognize_job_t;
+
+// Matches an utterance against one task's share of the vocabulary, leaving each word's score in word_scores.
+// Scores come out exactly as they would matching the whole vocabulary at once: each state is scored by
+// the same kernel, over the same blocks of frames. In pruned mode, words can only be abandoned early in
+// favor of a word from the same task, but those are words that couldn't have won anyway.
+static void recognize_task(void* arg, int task_index) {
+	recognize_job_t* job = arg;
+	tinysr_ctx_t* ctx = job->ctx;
+	utterance_t* utter = job->utterance;
+	recognize_task_t* task = &ctx->tasks[task_index];
+	tinysr_score_t best_score = TINYSR_SCORE_MIN;
+	list_node_t* re;
+	int i, first;
+#ifndef TINYSR_NO_STATS
+	task->dtw_cells = 0;
+#endif
+	if (ctx->dtw_mode == TINYSR_DTW_PRUNED) {
+		for (re = task->first_entry, i = 0; i < task->entries; re = re->next, i++) {
+			recog_entry_t* entry = re->datum;
+			tinysr_score_t new_score = dtw_pruned(ctx, entry, utter, best_score, task);
+			ctx->word_scores[entry->index] = new_score;
+			best_score = new_score > best_score ? new_score : best_score;
+		}
+		return;
+	}
+	for (first = 0; first < utter->length; first += SCORE_BLOCK_FRAMES) {
+		int frames = utter->length - first < SCORE_BLOCK_FRAMES ? utter->length - first : SCORE_BLOCK_FRAMES;
+		score_task_frames(ctx, task, utter->feature_vectors + first, first + frames <= ctx->codewords_cached ? ctx->frame_codewords + first : NULL, frames);
+		for (re = task->first_entry, i = 0; i < task->entries; re = re->next, i++) {
+			recog_entry_t* entry = re->datum;
+			dtw_advance(entry, task->scores + entry->first_state - task->first_state, frames, task->width, first, ctx->dp_row + entry->first_state);
 		}
 	}
-	float log_likelihood = dp_array[match->model_template_length-1];
-	free(dp_array);
-	// Adjust for the log likelihood offset and slope.
-	log_likelihood = match->ll_offset + match->ll_slope * log_likelihood;
-	return log_likelihood;
+	for (re = task->first_entry, i = 0; i < task->entries; re = re->next, i++) {
+		recog_entry_t* entry = re->datum;
+		ctx->word_scores[entry->index] = dtw_finish(entry, ctx->dp_row + entry->first_state);
+	}
 }
 
-// Adds a entries to the recognizer, loaded from a model file, as generated by model_gen.py.
-// Returns the number of entries added, with -1 indicating an error.
-int tinysr_load_model(tinysr_ctx_t* ctx, const char* path) {
+// Where matching goes word by word, or task by task, rather than scoring each frame against every state at
+// once, finds the codeword nearest each frame up front, so that each frame's mixture components get picked
+// once, rather than once per word or per task.
+static void cache_codewords(tinysr_ctx_t* ctx, utterance_t* utter) {
 	int i;
-	FILE* fp = fopen(path, "r");
-	if (fp == NULL)
-		return -1;
-	recog_entry_t* recog_entry;
-	uint32_t name_length;
-	char* name_str;
-	int free_point;
-	#define READ_INTO(x, bytes) \
-		if (fread(x, bytes, 1, fp) != 1) \
-			goto tinysr_load_model_error;
-	int entries_read = 0;
-	// Loop while there are more entries to read in.
-	while (!feof(fp)) {
-		free_point = 0;
-		recog_entry = malloc(sizeof(recog_entry_t));
-		free_point++;
-		// Set the index to be the length of the current list -- this causes consecutive numbering, starting at 0.
-		recog_entry->index = ctx->recog_entry_list.length;
-		// Read in the length of the name of the word we're loading in a model for.
-		READ_INTO(&name_length, 4)
-		// Read in the name.
-		recog_entry->name = name_str = malloc(name_length + 1);
-		free_point++;
-		READ_INTO(name_str, name_length)
-		// Then make sure to null terminate!
-		name_str[name_length] = '\0';
-		// Read in the log likelihood offset and slope.
-		READ_INTO(&recog_entry->ll_offset, 4)
-		READ_INTO(&recog_entry->ll_slope, 4)
-		// Read in the length of model.
-		READ_INTO(&recog_entry->model_template_length, 4)
-		// Allocate memory for the model.
-		recog_entry->model_template = malloc(sizeof(gaussian_t) * recog_entry->model_template_length);
-		free_point++;
-		for (i = 0; i < recog_entry->model_template_length; i++) {
-			gaussian_t* gauss = &recog_entry->model_template[i];
-			READ_INTO(&gauss->log_likelihood_offset, sizeof(float))
-			READ_INTO(&gauss->cepstrum_mean, sizeof(float[13]))
-			READ_INTO(&gauss->cepstrum_inverse_covariance, sizeof(float[169]))
-		}
-		list_append_back(&ctx->recog_entry_list, recog_entry);
-		entries_read++;
-	}
-	// Above we keep reading until we hit EOF, which causes an error, so therefore:
-	assert(0); // This should be unreachable!
-tinysr_load_model_error:
-	fclose(fp);
-	switch (free_point) {
-		case 3: free(recog_entry->model_template);
-		case 2: free(name_str);
-		case 1: free(recog_entry);
-		default: break;
-	}
-	// Make a table containing all the word names.
-	// At this point we can't fail, so we don't need to deal with free_point anymore.
-	ctx->word_names = malloc(sizeof(char*) * entries_read);
-	// Fill in the word names.
-	i = 0;
-	list_node_t* re = ctx->recog_entry_list.head;
-	while (re != NULL) {
-		ctx->word_names[i++] = ((recog_entry_t*)re->datum)->name;
-		re = re->next;
-	}
-	return entries_read;
+	ctx->codewords_cached = 0;
+	if (ctx->frame_codewords == NULL || ctx->mixture_shortlist <= 0 || ctx->mixture_shortlist > MIXTURE_MAX_SHORTLIST)
+		return;
+	for (i = 0; i < utter->length && i < CODEWORD_CACHE_FRAMES; i++)
+		ctx->frame_codewords[i] = nearest_codeword(ctx->model, &utter->feature_vectors[i]);
+	ctx->codewords_cached = i;
 }
 
-// Write out a CSV file containing a given utterance.
-// Returns non-zero on error, but doesn't print anything or call perror, or anything like that.
-int write_feature_vector_csv(const char* path, utterance_t* utterance) {
-	FILE* fp = fopen(path, "w");
-	if (fp == NULL)
-		return 1;
-	int i;
+// Matches an utterance against the vocabulary, writing out the best word, and returning how many dynamic
+// time warping cells it evaluated. Allocates nothing, and touches nothing that's fed by input, so it can
+// run on the background thread.
+static long long match_utterance(tinysr_ctx_t* ctx, utterance_t* utter, result_t* result) {
+	int best_index = -1, first;
+	long long cells = 0;
+	tinysr_score_t best_score = TINYSR_SCORE_MIN;
+	list_node_t* re;
+	// An empty utterance doesn't match anything.
+	if (utter->length == 0 || ctx->state_count == 0)
+		goto match_utterance_done;
+	if (ctx->thread_pool != NULL && ctx->task_count > 1) {
+		cache_codewords(ctx, utter);
+		recognize_job_t job = {ctx, utter};
+		thread_pool_run(ctx->thread_pool, recognize_task, &job, ctx->task_count);
+#ifndef TINYSR_NO_STATS
+		int i;
+		for (i = 0; i < ctx->task_count; i++)
+			cells += ctx->tasks[i].dtw_cells;
+#endif
+		// Pick the winner in vocabulary order, so that ties go the same way as on one thread.
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			if (ctx->word_scores[entry->index] > best_score) {
+				best_index = entry->index;
+				best_score = ctx->word_scores[entry->index];
+			}
+		}
+		goto match_utterance_done;
+	}
+	if (ctx->dtw_mode == TINYSR_DTW_PRUNED) {
+		cache_codewords(ctx, utter);
+		// The whole vocabulary, as one task.
+		recognize_task_t everything = {ctx->recog_entry_list.head, ctx->recog_entry_list.length, 0, ctx->state_stride};
+#ifndef TINYSR_FIXED_POINT
+		everything.expansion = ctx->score_expansion;
+#endif
+		everything.scores = ctx->score_block;
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			tinysr_score_t new_score = dtw_pruned(ctx, entry, utter, best_score, &everything);
+			if (new_score > best_score) {
+				best_index = entry->index;
+				best_score = new_score;
+			}
+		}
+#ifndef TINYSR_NO_STATS
+		cells = everything.dtw_cells;
+#endif
+		goto match_utterance_done;
+	}
+	// Score a block of frames against every state of every word at once, and then advance each word's
+	// dynamic time warping through the block.
+	for (first = 0; first < utter->length; first += SCORE_BLOCK_FRAMES) {
+		int frames = utter->length - first < SCORE_BLOCK_FRAMES ? utter->length - first : SCORE_BLOCK_FRAMES;
+		tinysr_score_frames(ctx, utter->feature_vectors + first, frames, ctx->score_block);
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			dtw_advance(entry, ctx->score_block + entry->first_state, frames, ctx->state_stride, first, ctx->dp_row + entry->first_state);
+		}
+	}
+	// Then match the utterance against all current recognition entries.
+	best_word(ctx, ctx->dp_row, &best_index, &best_score);
+match_utterance_done:;
+	// We've found a winner!
+	result->word_index = best_index;
+	result->score = best_score;
+	result->first_frame = utter->length == 0 ? 0 : utter->feature_vectors[0].number;
+	result->end_frame = utter->length == 0 ? 0 : utter->feature_vectors[utter->length-1].number + 1;
+	ctx->codewords_cached = 0;
+	// Exact matching evaluates every cell.
+	if (ctx->dtw_mode == TINYSR_DTW_EXACT)
+		cells = (long long) utter->length * ctx->state_count;
+	return cells;
+}
+
+// Recognize one specific utterance.
+void tinysr_recognize_utterance(tinysr_ctx_t* ctx, utterance_t* utter) {
+	result_t result;
+	STATS_BEGIN(ctx);
+	long long cells = match_utterance(ctx, utter, &result);
+	STATS_COUNT(ctx, dtw_cells, cells);
+	STATS_END(ctx, TINYSR_STAGE_MATCH);
+	append_result(ctx, result.word_index, result.score, result.first_frame, result.end_frame);
+}
+
+void tinysr_score_words(tinysr_ctx_t* ctx, utterance_t* utter, tinysr_score_t* word_scores) {
+	list_node_t* re;
+	int first;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next)
+		word_scores[((recog_entry_t*) re->datum)->index] = TINYSR_SCORE_MIN;
+	if (utter->length == 0 || ctx->state_count == 0)
+		return;
+	STATS_BEGIN(ctx);
+	// Just like exact matching on one thread, keeping every word's score.
+	for (first = 0; first < utter->length; first += SCORE_BLOCK_FRAMES) {
+		int frames = utter->length - first < SCORE_BLOCK_FRAMES ? utter->length - first : SCORE_BLOCK_FRAMES;
+		tinysr_score_frames(ctx, utter->feature_vectors + first, frames, ctx->score_block);
+		for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			dtw_advance(entry, ctx->score_block + entry->first_state, frames, ctx->state_stride, first, ctx->dp_row + entry->first_state);
+		}
+	}
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		word_scores[entry->index] = dtw_finish(entry, ctx->dp_row + entry->first_state);
+	}
+	STATS_COUNT(ctx, dtw_cells, (long long) utter->length * ctx->state_count);
+	STATS_END(ctx, TINYSR_STAGE_MATCH);
+}
+
+// The move into each cell along the best path, for tracing it back.
+enum {
+	ALIGN_FROM_FRAME,
+	ALIGN_FROM_STATE,
+	ALIGN_FROM_BOTH
+};
+
+int tinysr_align_utterance(tinysr_ctx_t* ctx, int word_index, utterance_t* utter, int* frames, int* states, tinysr_score_t* log_likelihood) {
+	list_node_t* re;
+	recog_entry_t* entry = NULL;
+	for (re = ctx->recog_entry_list.head; re != NULL && entry == NULL; re = re->next)
+		if (((recog_entry_t*) re->datum)->index == word_index)
+			entry = re->datum;
+	if (entry == NULL || utter->length == 0 || ctx->state_count == 0)
+		return -1;
+	int length = entry->model_template_length, cells = 0, first, f, j;
+	unsigned char* moves = ctx_allocate(ctx, (size_t) utter->length * length);
+	if (moves == NULL)
+		return -1;
+	tinysr_score_t* dp_array = ctx->dp_row + entry->first_state;
+	// The same dynamic programming as dtw_advance, so the path's score is exactly the recognition score.
+	for (first = 0; first < utter->length; first += SCORE_BLOCK_FRAMES) {
+		int block = utter->length - first < SCORE_BLOCK_FRAMES ? utter->length - first : SCORE_BLOCK_FRAMES;
+		tinysr_score_frames(ctx, utter->feature_vectors + first, block, ctx->score_block);
+		for (f = first; f < first + block; f++) {
+			const tinysr_score_t* row = ctx->score_block + (f - first) * ctx->state_stride + entry->first_state;
+			unsigned char* move = moves + (size_t) f * length;
+			if (f == 0) {
+				tinysr_score_t ll = 0;
+				for (j = 0; j < length; j++) {
+					dp_array[j] = ll = ll + row[j];
+					move[j] = ALIGN_FROM_STATE;
+				}
+				continue;
+			}
+			tinysr_score_t diagonal_value = dp_array[0];
+			dp_array[0] += row[0];
+			move[0] = ALIGN_FROM_FRAME;
+			for (j = 1; j < length; j++) {
+				tinysr_score_t ll = dp_array[j];
+				move[j] = ALIGN_FROM_FRAME;
+				if (dp_array[j-1] > ll) {
+					ll = dp_array[j-1];
+					move[j] = ALIGN_FROM_STATE;
+				}
+				if (diagonal_value > ll) {
+					ll = diagonal_value;
+					move[j] = ALIGN_FROM_BOTH;
+				}
+				diagonal_value = dp_array[j];
+				dp_array[j] = ll + row[j];
+			}
+		}
+	}
+	*log_likelihood = dp_array[length-1];
+	// Trace the path back from the last cell, and then put it in order.
+	for (f = utter->length - 1, j = length - 1;; cells++) {
+		frames[cells] = f;
+		states[cells] = j;
+		if (f == 0 && j == 0)
+			break;
+		unsigned char move = moves[(size_t) f * length + j];
+		f -= move != ALIGN_FROM_STATE;
+		j -= move != ALIGN_FROM_FRAME;
+	}
+	cells++;
+	for (j = 0; j < cells / 2; j++) {
+		int frame = frames[j], state = states[j];
+		frames[j] = frames[cells-1-j];
+		states[j] = states[cells-1-j];
+		frames[cells-1-j] = frame;
+		states[cells-1-j] = state;
+	}
+	ctx_release(ctx, moves);
+	return cells;
+}
+
+#ifndef TINYSR_NO_THREADS
+// A queue with one thread pushing and one thread popping, of fixed size elements, without locks. Only the
+// producer moves the tail, and only the consumer moves the head. Each publishes the slots it's done with to
+// the other with a release store, so it's safe for an element to be read once the acquire load of the tail
+// shows it's there, and overwritten once the head has moved past it. Indices wrap, and are only ever compared
+// by difference, and the capacity is a power of two.
+typedef struct {
+	char* slots;
+	size_t element_size;
+	unsigned mask;
+	atomic_uint head, tail;
+} spsc_queue_t;
+
+// Returns non-zero on allocation failure.
+static int spsc_init(tinysr_ctx_t* ctx, spsc_queue_t* queue, size_t element_size, int capacity) {
+	unsigned size = 1;
+	while (size < (unsigned) capacity)
+		size *= 2;
+	queue->slots = ctx_allocate(ctx, element_size * size);
+	queue->element_size = element_size;
+	queue->mask = size - 1;
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	return queue->slots == NULL;
+}
+
+// Returns 1 if the element was pushed, 0 if the queue is full.
+static int spsc_push(spsc_queue_t* queue, const void* element) {
+	unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) > queue->mask)
+		return 0;
+	memcpy(queue->slots + (tail & queue->mask) * queue->element_size, element, queue->element_size);
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return 1;
+}
+
+// Returns 1 if an element was popped, 0 if the queue is empty.
+static int spsc_pop(spsc_queue_t* queue, void* element) {
+	unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&queue->tail, memory_order_acquire))
+		return 0;
+	memcpy(element, queue->slots + (head & queue->mask) * queue->element_size, queue->element_size);
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return 1;
+}
+
+// Only exact from the consumer's side; from the producer's, it may be an overestimate.
+static int spsc_length(spsc_queue_t* queue) {
+	return (int) (atomic_load_explicit(&queue->tail, memory_order_acquire) - atomic_load_explicit(&queue->head, memory_order_acquire));
+}
+
+// An utterance the background thread is done with, on its way back to be freed, along with how long
+// matching it took, and how many dynamic time warping cells it evaluated, for the stats.
+typedef struct {
+	utterance_t* utterance;
+#ifndef TINYSR_NO_STATS
+	long long ns, dtw_cells;
+#endif
+} async_finished_t;
+
+struct tinysr_async {
+	pthread_t thread;
+	// Posted once per utterance pushed, and once more to stop.
+	sem_t work;
+	// Utterances on their way to the background thread, and on their way back to be freed, so that only the
+	// thread feeding input ever touches the context's allocator. Then results, if there's no callback.
+	spsc_queue_t utterances, finished, results;
+	tinysr_result_callback_t callback;
+	void* user;
+	// Utterances handed over and not yet freed, which is never more than max_pending.
+	int in_flight, max_pending;
+	atomic_int dropped;
+};
+
+static void* async_worker(void* arg) {
+	tinysr_ctx_t* ctx = arg;
+	tinysr_async_t* async = ctx->async;
+	async_finished_t finished;
+	result_t result;
+	for (;;) {
+		while (sem_wait(&async->work) != 0);
+		// Each utterance is pushed before its post, so a wake-up with nothing queued is the signal to stop,
+		// which comes after every utterance has been gone through.
+		if (!spsc_pop(&async->utterances, &finished.utterance))
+			return NULL;
+#ifndef TINYSR_NO_STATS
+		long long begin = stats_now();
+		finished.dtw_cells = match_utterance(ctx, finished.utterance, &result);
+		finished.ns = stats_now() - begin;
+#else
+		match_utterance(ctx, finished.utterance, &result);
+#endif
+		// The finished queue is as big as the number of utterances that can be in flight, so this can't fail.
+		spsc_push(&async->finished, &finished);
+		if (async->callback != NULL)
+			async->callback(async->user, result.word_index, result.score, result.first_frame, result.end_frame);
+		else if (!spsc_push(&async->results, &result))
+			atomic_fetch_add(&async->dropped, 1);
+	}
+}
+
+// Frees whatever utterances the background thread is done with, and counts the time spent matching them.
+// That time wasn't spent on this thread, so it's not left out of the stage that's calling.
+static void async_reclaim(tinysr_ctx_t* ctx) {
+	async_finished_t finished;
+	while (spsc_pop(&ctx->async->finished, &finished)) {
+		tinysr_free_utterance(ctx, finished.utterance);
+		ctx->async->in_flight--;
+#ifndef TINYSR_NO_STATS
+		stats_record(ctx, TINYSR_STAGE_MATCH, finished.ns);
+		STATS_COUNT(ctx, dtw_cells, finished.dtw_cells);
+#endif
+	}
+}
+
+int tinysr_start_async(tinysr_ctx_t* ctx, int max_pending, tinysr_result_callback_t callback, void* user) {
+	if (ctx->async != NULL || max_pending < 1)
+		return 1;
+	tinysr_async_t* async = ctx_allocate(ctx, sizeof(tinysr_async_t));
+	if (async == NULL)
+		return 1;
+	async->callback = callback;
+	async->user = user;
+	async->in_flight = 0;
+	async->max_pending = max_pending;
+	atomic_init(&async->dropped, 0);
+	async->utterances.slots = async->finished.slots = async->results.slots = NULL;
+	if (spsc_init(ctx, &async->utterances, sizeof(utterance_t*), max_pending) ||
+			spsc_init(ctx, &async->finished, sizeof(async_finished_t), max_pending) ||
+			spsc_init(ctx, &async->results, sizeof(result_t), max_pending))
+		goto tinysr_start_async_error;
+	if (sem_init(&async->work, 0, 0) != 0)
+		goto tinysr_start_async_error;
+	// Any utterance half way through streaming gets recognized in the background once it's over.
+	ctx->stream_next = -1;
+	ctx->async = async;
+	if (pthread_create(&async->thread, NULL, async_worker, ctx) != 0) {
+		ctx->async = NULL;
+		sem_destroy(&async->work);
+		goto tinysr_start_async_error;
+	}
+	return 0;
+tinysr_start_async_error:
+	ctx_release(ctx, async->utterances.slots);
+	ctx_release(ctx, async->finished.slots);
+	ctx_release(ctx, async->results.slots);
+	ctx_release(ctx, async);
+	return 1;
+}
+
+void tinysr_stop_async(tinysr_ctx_t* ctx) {
+	tinysr_async_t* async = ctx->async;
+	result_t result;
+	if (async == NULL)
+		return;
+	sem_post(&async->work);
+	pthread_join(async->thread, NULL);
+	sem_destroy(&async->work);
+	async_reclaim(ctx);
+	// Results not yet fetched go back to the list, in order, behind any already there.
+	while (spsc_pop(&async->results, &result))
+		append_result(ctx, result.word_index, result.score, result.first_frame, result.end_frame);
+	ctx->async = NULL;
+	ctx_release(ctx, async->utterances.slots);
+	ctx_release(ctx, async->finished.slots);
+	ctx_release(ctx, async->results.slots);
+	ctx_release(ctx, async);
+}
+
+int tinysr_async_dropped(tinysr_ctx_t* ctx) {
+	return ctx->async == NULL ? 0 : atomic_load(&ctx->async->dropped);
+}
+
+// Hands detected utterances over to the background thread, or drops them if too many are in flight.
+static void async_submit(tinysr_ctx_t* ctx) {
+	tinysr_async_t* async = ctx->async;
+	async_reclaim(ctx);
+	while (ctx->utterance_list.length) {
+		utterance_t* utter = list_pop_front(&ctx->utterance_list);
+		if (async->in_flight == async->max_pending) {
+			tinysr_free_utterance(ctx, utter);
+			atomic_fetch_add(&async->dropped, 1);
+			continue;
+		}
+		spsc_push(&async->utterances, &utter);
+		async->in_flight++;
+		sem_post(&async->work);
+	}
+}
+
+// Pops a result off the background thread's queue, if it has one.
+static int async_pop_result(tinysr_ctx_t* ctx, result_t* result) {
+	return ctx->async != NULL && spsc_pop(&ctx->async->results, result);
+}
+
+static int results_waiting(tinysr_ctx_t* ctx) {
+	return ctx->results_list.length + (ctx->async != NULL ? spsc_length(&ctx->async->results) : 0);
+}
+#else
+// Without threads, there's no background recognition, and ctx->async stays NULL.
+int tinysr_start_async(tinysr_ctx_t* ctx, int max_pending, tinysr_result_callback_t callback, void* user) {
+	return 1;
+}
+
+void tinysr_stop_async(tinysr_ctx_t* ctx) {
+}
+
+int tinysr_async_dropped(tinysr_ctx_t* ctx) {
+	return 0;
+}
+
+static void async_submit(tinysr_ctx_t* ctx) {
+}
+
+static int async_pop_result(tinysr_ctx_t* ctx, result_t* result) {
+	return 0;
+}
+
+static int results_waiting(tinysr_ctx_t* ctx) {
+	return ctx->results_list.length;
+}
+#endif
+
+// Call to trigger recognition on detected utterances.
+void tinysr_recognize_utterances(tinysr_ctx_t* ctx) {
+	if (ctx->async != NULL) {
+		async_submit(ctx);
+		return;
+	}
+	while (ctx->utterance_list.length) {
+		// Read in one utterance at a time.
+		utterance_t* utter = list_pop_front(&ctx->utterance_list);
+		tinysr_recognize_utterance(ctx, utter);
+		tinysr_free_utterance(ctx, utter);
+	}
+}
+
+static void cmn_running_reset(tinysr_ctx_t* ctx) {
+	int j;
+	for (j = 0; j < 13; j++)
+		ctx->cmn_sum[j] = 0;
+	ctx->cmn_count = 0;
+}
+
+// Normalizes the next frame of the utterance in place, by the mean of the utterance up to and including it.
+static void cmn_running_apply(tinysr_ctx_t* ctx, feature_vector_t* fv) {
+	int j;
+	ctx->cmn_count++;
+	for (j = 0; j < 13; j++) {
+		ctx->cmn_sum[j] += fv->cepstrum[j];
+		fv->cepstrum[j] -= (tinysr_feature_t) (ctx->cmn_sum[j] / ctx->cmn_count);
+	}
+}
+
+// Normalizes feature vectors of the streamed utterance, up to (but not including) number until, and
+// scores them a block at a time.
+static void stream_advance(tinysr_ctx_t* ctx, long long until) {
+	while (ctx->stream_next < until) {
+		// If the ring had to drop part of the utterance, then it can't be streamed, and gets recognized
+		// once it's over instead.
+		if (ctx->stream_next < ctx->fv_oldest) {
+			ctx->stream_next = -1;
+			return;
+		}
+		feature_vector_t* fv = &ctx->stream_block[ctx->stream_pending++];
+		*fv = ctx->fv_ring[ctx->stream_next++ & ctx->fv_ring_mask];
+		cmn_running_apply(ctx, fv);
+		if (ctx->stream_pending == SCORE_BLOCK_FRAMES)
+			stream_flush(ctx);
+	}
+}
+
+// Advances every word's dynamic time warping through the frames waiting in stream_block.
+static void stream_flush(tinysr_ctx_t* ctx) {
+	list_node_t* re;
+	STATS_BEGIN(ctx);
+	tinysr_score_frames(ctx, ctx->stream_block, ctx->stream_pending, ctx->score_block);
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		dtw_advance(entry, ctx->score_block + entry->first_state, ctx->stream_pending, ctx->state_stride, ctx->stream_frames, ctx->stream_dp_row + entry->first_state);
+	}
+	ctx->stream_frames += ctx->stream_pending;
+	STATS_COUNT(ctx, dtw_cells, (long long) ctx->stream_pending * ctx->state_count);
+	ctx->stream_pending = 0;
+	STATS_END(ctx, TINYSR_STAGE_MATCH);
+}
+
+// Once the streamed utterance is over, all that's left is its last few frames, and picking the best word.
+static void stream_finish(tinysr_ctx_t* ctx) {
+	int best_index = -1;
+	tinysr_score_t best_score = TINYSR_SCORE_MIN;
+	// Results come out in order, so any utterances still waiting get recognized first.
+	tinysr_recognize_utterances(ctx);
+	if (ctx->stream_pending > 0)
+		stream_flush(ctx);
+	if (ctx->stream_frames > 0)
+		best_word(ctx, ctx->stream_dp_row, &best_index, &best_score);
+	append_result(ctx, best_index, best_score, ctx->stream_next - ctx->stream_frames, ctx->stream_next);
+	ctx->stream_next = -1;
+}
+
+// Moves the moving cepstral mean along by a frame, and subtracts it out.
+static void keyword_normalize(tinysr_ctx_t* ctx, feature_vector_t* fv) {
+	int j;
+	if (ctx->keyword_mean_frames < KEYWORD_MEAN_FRAMES)
+		ctx->keyword_mean_frames++;
+	for (j = 0; j < 13; j++) {
+		ctx->keyword_mean[j] += (fv->cepstrum[j] - ctx->keyword_mean[j]) / ctx->keyword_mean_frames;
+		fv->cepstrum[j] -= ctx->keyword_mean[j];
+	}
+}
+
+// Advances a word's subsequence dynamic time warping by a frame, whose scores against the word's states
+// are given, and reports a detection if its best complete path now reaches its threshold. A path can
+// start at the first state on any frame, and each frame either stays on a state, or moves on by one or two.
+// Left alone, the path with the highest log likelihood would always be the shortest, so each cell keeps
+// whichever path has the highest log likelihood per frame.
+static void keyword_advance(tinysr_ctx_t* ctx, recog_entry_t* entry, const tinysr_score_t* scores, long long number) {
+	keyword_cell_t* cells = ctx->keyword_cells + entry->first_state;
+	int j, step, length = entry->model_template_length, max_frames = KEYWORD_MAX_STRETCH * length;
+	// Going backwards, the cells each one comes from still hold the last frame's paths.
+	for (j = length - 1; j >= 0; j--) {
+		// The first state can always start afresh.
+		keyword_cell_t best = {0, 0, number};
+		int found = j == 0;
+		for (step = 0; step <= 2 && step <= j; step++) {
+			keyword_cell_t* from = &cells[j - step];
+			if (from->frames == 0 || from->frames >= max_frames)
+				continue;
+			// Compare (from->sum + score) / (from->frames + 1) against the same for the best so far.
+			if (!found || (from->sum + scores[j]) * (best.frames + 1) > (best.sum + scores[j]) * (from->frames + 1)) {
+				best = *from;
+				found = 1;
+			}
+		}
+		if (found) {
+			cells[j].sum = best.sum + scores[j];
+			cells[j].frames = best.frames + 1;
+			cells[j].start = best.start;
+		} else {
+			cells[j].frames = 0;
+		}
+	}
+	keyword_cell_t* last = &cells[length - 1];
+	if (last->frames == 0 || last->start <= ctx->keyword_last_ends[entry->index])
+		return;
+	// The score is for a path as long as the word has states, so it's on the scale of recognition scores.
+	tinysr_score_t score = dtw_normalize(entry, last->sum * length / last->frames);
+	if (score >= ctx->keyword_thresholds[entry->index]) {
+		append_result(ctx, entry->index, score, last->start, number + 1);
+		ctx->keyword_last_ends[entry->index] = number;
+	}
+}
+
+void tinysr_spot_keywords(tinysr_ctx_t* ctx, const feature_vector_t* fvs, int count) {
+	list_node_t* re;
+	int first, frames, f;
+	STATS_BEGIN(ctx);
+	for (first = 0; first < count && ctx->state_count > 0; first += frames) {
+		frames = count - first < SCORE_BLOCK_FRAMES ? count - first : SCORE_BLOCK_FRAMES;
+		for (f = 0; f < frames; f++) {
+			ctx->stream_block[f] = fvs[first + f];
+			keyword_normalize(ctx, &ctx->stream_block[f]);
+		}
+		tinysr_score_frames(ctx, ctx->stream_block, frames, ctx->score_block);
+		for (f = 0; f < frames; f++) {
+			for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+				recog_entry_t* entry = re->datum;
+				keyword_advance(ctx, entry, ctx->score_block + f * ctx->state_stride + entry->first_state, ctx->stream_block[f].number);
+			}
+		}
+		STATS_COUNT(ctx, dtw_cells, (long long) frames * ctx->state_count);
+	}
+	STATS_END(ctx, TINYSR_STAGE_MATCH);
+}
+
+// Runs every new feature vector through keyword spotting, and then lets them go.
+static void keyword_spot(tinysr_ctx_t* ctx) {
+	// They're contiguous in the ring, except possibly for wrapping around the end once.
+	int count = (int) (ctx->next_fv_number - ctx->fv_checked);
+	int first = ctx->fv_checked & ctx->fv_ring_mask;
+	int first_run = ctx->fv_ring_mask + 1 - first < count ? ctx->fv_ring_mask + 1 - first : count;
+	tinysr_spot_keywords(ctx, ctx->fv_ring + first, first_run);
+	tinysr_spot_keywords(ctx, ctx->fv_ring, count - first_run);
+	ctx->fv_oldest = ctx->fv_checked = ctx->next_fv_number;
+}
+
+int tinysr_set_keyword_threshold(tinysr_ctx_t* ctx, int word_index, tinysr_score_t threshold) {
+	if (word_index < 0 || word_index >= ctx->recog_entry_list.length || ctx->keyword_thresholds == NULL)
+		return 1;
+	ctx->keyword_thresholds[word_index] = threshold;
+	return 0;
+}
+
+int tinysr_get_result(tinysr_ctx_t* ctx, int* word_index, tinysr_score_t* score) {
+	return tinysr_get_result_span(ctx, word_index, score, NULL, NULL);
+}
+
+int tinysr_get_result_span(tinysr_ctx_t* ctx, int* word_index, tinysr_score_t* score, long long* first_frame, long long* end_frame) {
+	result_t queued;
+	result_t* result = &queued;
+	// Results from background recognition come off their own queue, after any already on the list.
+	if (ctx->results_list.length != 0)
+		result = list_pop_front(&ctx->results_list);
+	else if (!async_pop_result(ctx, &queued))
+		return 0;
+	// Copy over the data.
+	if (word_index != NULL)
+		*word_index = result->word_index;
+	if (score != NULL)
+		*score = result->score;
+	if (first_frame != NULL)
+		*first_frame = result->first_frame;
+	if (end_frame != NULL)
+		*end_frame = result->end_frame;
+	// Free, and report success.
+	if (result != &queued)
+		ctx_release(ctx, result);
+	return 1;
+}
+
+#ifdef TINYSR_FIXED_POINT
+// === Fixed point front-end ===
+// The same pipeline as the floating point tinysr_process_frame, in integers. Samples come in with
+// TINYSR_SIGNAL_FRACTION_BITS fraction bits, and are kept in 32 bits, with 64 bit intermediate products.
+// Each frame is scaled by a power of two going into the FFT (block floating point), so that the FFT
+// has all the headroom it needs, and the scale is then taken back out in the logarithm.
+
+// Rounds a float to a fixed point value with the given number of fraction bits, saturating at the int32_t range.
+// Only used while loading models.
+static int32_t saturate_fixed(float x, int fraction_bits) {
+	double scaled = x * (double) (1 << fraction_bits);
+	if (scaled >= 2147483647.0)
+		return INT32_MAX;
+	if (scaled <= -2147483648.0)
+		return INT32_MIN;
+	return (int32_t) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// Position of the highest set bit of a non-zero value.
+static int highest_bit(uint64_t x) {
+	int bit = 0;
+	if (x >> 32) { x >>= 32; bit += 32; }
+	if (x >> 16) { x >>= 16; bit += 16; }
+	if (x >> 8) { x >>= 8; bit += 8; }
+	if (x >> 4) { x >>= 4; bit += 4; }
+	if (x >> 2) { x >>= 2; bit += 2; }
+	if (x >> 1) bit += 1;
+	return bit;
+}
+
+// Returns ln(x / 2^fraction_bits) in Q16, or ln(2e-22) for zero, as the floating point front-end's floor gives.
+// The value is split as 2^exponent * (1 + mantissa), and log2(1 + mantissa) is linearly interpolated from the
+// plan's table, which is good to about 3e-6.
+static int32_t fixed_log(const tinysr_frontend_plan_t* plan, uint64_t x, int fraction_bits) {
+	if (x == 0)
+		return FIXED_LOG_FLOOR;
+	int exponent = highest_bit(x);
+	// The 16 bits of mantissa just below the leading one.
+	uint32_t mantissa = (uint32_t) (exponent >= 16 ? x >> (exponent - 16) : x << (16 - exponent)) & 0xffff;
+	int index = mantissa >> (16 - LOG_TABLE_BITS);
+	int32_t fraction = mantissa & ((1 << (16 - LOG_TABLE_BITS)) - 1);
+	const int32_t* table = plan->fixed_log_table;
+	int32_t log2_mantissa = table[index] + (((table[index+1] - table[index]) * fraction) >> (16 - LOG_TABLE_BITS));
+	int64_t log2_x = ((int64_t) (exponent - fraction_bits) << 16) + log2_mantissa;
+	// Multiply by ln(2) in Q30.
+	return (int32_t) ((log2_x * 744261118 + (1 << 29)) >> 30);
+}
+
+// Integer square root, rounded down, by the digit-by-digit method.
+static uint32_t integer_sqrt(uint64_t x) {
+	uint64_t result = 0, bit = (uint64_t) 1 << 62;
+	while (bit > x)
+		bit >>= 2;
+	while (bit) {
+		if (x >= result + bit) {
+			x -= result + bit;
+			result = (result >> 1) + bit;
+		} else
+			result >>= 1;
+		bit >>= 2;
+	}
+	return (uint32_t) result;
+}
+
+// Multiplies by a Q30 constant, with rounding.
+static inline int32_t multiply_q30(int32_t x, int32_t q30) {
+	return (int32_t) (((int64_t) x * q30 + (1 << 29)) >> 30);
+}
+
+// The fixed point equivalent of tinysr_fft_real, with the same packing, except that every output is doubled.
+// (The float version halves the even and odd parts in the split, which we skip to save a bit of precision.)
+// Inputs must be below 2^FIXED_FFT_PEAK_BITS in magnitude, which leaves room for the growth through the
+// transform: the outputs are then below 2^(FIXED_FFT_PEAK_BITS + 11) for a 512 point transform.
+static void fixed_fft_real(const tinysr_fft_plan_t* plan, int32_t* data) {
+	int n = plan->complex_length;
+	int i, k;
+	// Bit reversal permutation.
+	for (i = 0; i < n; i++) {
+		int j = plan->bit_reverse[i];
+		if (i < j) {
+			int32_t tr = data[2*i], ti = data[2*i+1];
+			data[2*i] = data[2*j];
+			data[2*i+1] = data[2*j+1];
+			data[2*j] = tr;
+			data[2*j+1] = ti;
+		}
+	}
+	int h = 1;
+	int log2_n = 0;
+	while ((1 << log2_n) < n)
+		log2_n++;
+	if (log2_n & 1) {
+		for (i = 0; i < n; i += 2) {
+			int32_t ar = data[2*i], ai = data[2*i+1];
+			int32_t br = data[2*i+2], bi = data[2*i+3];
+			data[2*i]   = ar + br;
+			data[2*i+1] = ai + bi;
+			data[2*i+2] = ar - br;
+			data[2*i+3] = ai - bi;
+		}
+		h = 2;
+	}
+	// Radix-4 passes, exactly as in tinysr_fft_complex. Each complex product is rounded once.
+	#define COMPLEX_MULTIPLY_REAL(wr, wi, r, i) ((int32_t) (((int64_t) (wr) * (r) - (int64_t) (wi) * (i) + (1 << 29)) >> 30))
+	#define COMPLEX_MULTIPLY_IMAG(wr, wi, r, i) ((int32_t) (((int64_t) (wr) * (i) + (int64_t) (wi) * (r) + (1 << 29)) >> 30))
+	for (; h < n; h *= 4) {
+		int stride = n / (4*h);
+		for (i = 0; i < n; i += 4*h) {
+			for (k = 0; k < h; k++) {
+				int32_t w2r = plan->fixed_twiddle_real[k * stride], w2i = plan->fixed_twiddle_imag[k * stride];
+				int32_t w1r = plan->fixed_twiddle_real[2 * k * stride], w1i = plan->fixed_twiddle_imag[2 * k * stride];
+				int32_t* a = data + 2*(i + k);
+				int32_t* b = a + 2*h;
+				int32_t* c = b + 2*h;
+				int32_t* d = c + 2*h;
+				int32_t tr = COMPLEX_MULTIPLY_REAL(w1r, w1i, b[0], b[1]), ti = COMPLEX_MULTIPLY_IMAG(w1r, w1i, b[0], b[1]);
+				int32_t a1r = a[0] + tr, a1i = a[1] + ti;
+				int32_t b1r = a[0] - tr, b1i = a[1] - ti;
+				tr = COMPLEX_MULTIPLY_REAL(w1r, w1i, d[0], d[1]);
+				ti = COMPLEX_MULTIPLY_IMAG(w1r, w1i, d[0], d[1]);
+				int32_t c1r = c[0] + tr, c1i = c[1] + ti;
+				int32_t d1r = c[0] - tr, d1i = c[1] - ti;
+				int32_t c2r = COMPLEX_MULTIPLY_REAL(w2r, w2i, c1r, c1i), c2i = COMPLEX_MULTIPLY_IMAG(w2r, w2i, c1r, c1i);
+				// -i * w2 * d1.
+				int32_t d2r = COMPLEX_MULTIPLY_IMAG(w2r, w2i, d1r, d1i), d2i = -COMPLEX_MULTIPLY_REAL(w2r, w2i, d1r, d1i);
+				a[0] = a1r + c2r;
+				a[1] = a1i + c2i;
+				c[0] = a1r - c2r;
+				c[1] = a1i - c2i;
+				b[0] = b1r + d2r;
+				b[1] = b1i + d2i;
+				d[0] = b1r - d2r;
+				d[1] = b1i - d2i;
+			}
+		}
+	}
+	// Split into the real input's spectrum. See tinysr_fft_real.
+	int32_t z0r = data[0], z0i = data[1];
+	data[0] = 2 * (z0r + z0i);
+	data[1] = 2 * (z0r - z0i);
+	for (k = 1; k <= n/2; k++) {
+		int32_t zr = data[2*k], zi = data[2*k+1];
+		int32_t mr = data[2*(n-k)], mi = data[2*(n-k)+1];
+		int32_t er = zr + mr, ei = zi - mi;
+		int32_t dr = zr - mr, di = zi + mi;
+		int32_t wr = plan->fixed_split_real[k], wi = plan->fixed_split_imag[k];
+		int32_t pr = COMPLEX_MULTIPLY_REAL(wr, wi, dr, di), pi = COMPLEX_MULTIPLY_IMAG(wr, wi, dr, di);
+		data[2*k] = er + pi;
+		data[2*k+1] = ei - pr;
+		data[2*(n-k)] = er - pi;
+		data[2*(n-k)+1] = -ei - pr;
+	}
+	#undef COMPLEX_MULTIPLY_REAL
+	#undef COMPLEX_MULTIPLY_IMAG
+}
+
+// Runs the front-end on the most recent frame, and fills in the feature vector.
+static void fixed_process_frame(tinysr_ctx_t* ctx, feature_vector_t* fv) {
+	const tinysr_frontend_plan_t* plan = ctx->frontend_plan;
+	int frame_length = plan->frame_length;
+	int32_t* frame = ctx->temp_buffer;
+	int i, k;
+	// The frame sits contiguously in the mirrored ring buffer. (ES 201 108 4.2.4)
+	const int32_t* input = ctx->input_buffer + ctx->input_buffer_next;
+	// Measure log energy. (ES 201 108 4.2.5)
+	// Signal values are below 2^26 even for downmixed input, so 400 squares still fit.
+	uint64_t energy = 0;
+	for (i = 0; i < frame_length; i++)
+		energy += (int64_t) input[i] * input[i];
+	tinysr_feature_t log_energy = fixed_log(plan, energy, 2 * TINYSR_SIGNAL_FRACTION_BITS);
+	// Pre-emphasize, and apply the Hamming window. (ES 201 108 4.2.6, 4.2.7)
+	// 0.97 in Q30 is 1041529569.
+	int32_t peak = 0;
+	frame[0] = 0;
+	for (i = 1; i < frame_length; i++) {
+		int32_t emphasized = (int32_t) ((((int64_t) input[i] << 30) - (int64_t) input[i-1] * 1041529569 + (1 << 29)) >> 30);
+		frame[i] = multiply_q30(emphasized, plan->fixed_window[i]);
+		int32_t magnitude = frame[i] < 0 ? -frame[i] : frame[i];
+		if (magnitude > peak)
+			peak = magnitude;
+	}
+	for (i = frame_length; i < plan->fft_length; i++)
+		frame[i] = 0;
+	// Scale the frame by 2^shift so that its peak is just below 2^FIXED_FFT_PEAK_BITS.
+	int shift = 0;
+	if (peak != 0)
+		shift = FIXED_FFT_PEAK_BITS - 1 - highest_bit(peak);
+	if (shift > 0)
+		for (i = 0; i < frame_length; i++)
+			frame[i] <<= shift;
+	else if (shift < 0)
+		for (i = 0; i < frame_length; i++)
+			frame[i] = (frame[i] + (1 << (-shift - 1))) >> -shift;
+	// FFT magnitude. (ES 201 108 4.2.8)
+	int half = plan->fft_length / 2;
+	uint32_t* spectrum = (uint32_t*) ctx->spectrum_buffer;
+	fixed_fft_real(plan->fft_plan, frame);
+	for (k = 1; k < half; k++)
+		spectrum[k] = integer_sqrt((uint64_t) ((int64_t) frame[2*k] * frame[2*k]) + (uint64_t) ((int64_t) frame[2*k+1] * frame[2*k+1]));
+	spectrum[0] = frame[0] < 0 ? -frame[0] : frame[0];
+	spectrum[half] = frame[1] < 0 ? -frame[1] : frame[1];
+	// Mel filtering, with Q15 weights. (ES 201 108 4.2.9)
+	// Then the logarithm, taking out the weights' fraction bits, the signal's fraction bits, the FFT's
+	// doubling, and the frame's scale. (ES 201 108 4.2.10)
+	tinysr_feature_t filter_bank[MEL_FILTER_COUNT];
+	int fraction_bits = 15 + TINYSR_SIGNAL_FRACTION_BITS + 1 + shift;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const int32_t* weights = plan->fixed_mel_weights + plan->mel_weight_offset[k];
+		const uint32_t* bins = spectrum + plan->cbin[k];
+		uint64_t sum = 0;
+		for (i = 0; i < plan->mel_bin_count[k]; i++)
+			sum += (uint64_t) weights[i] * bins[i];
+		filter_bank[k] = fixed_log(plan, sum, fraction_bits);
+	}
+	// DCT, with Q30 coefficients. (ES 201 108 4.2.11)
+	tinysr_feature_t cepstrum[CEPSTRUM_LENGTH];
+	for (i = 0; i < CEPSTRUM_LENGTH; i++) {
+		const int32_t* row = plan->fixed_dct + i * MEL_FILTER_COUNT;
+		int64_t sum = 0;
+		for (k = 0; k < MEL_FILTER_COUNT; k++)
+			sum += (int64_t) row[k] * filter_bank[k];
+		cepstrum[i] = (tinysr_feature_t) ((sum + (1 << 29)) >> 30);
+	}
+	finish_feature_vector(ctx, fv, log_energy, cepstrum, 1);
+}
+
+// Private function: Do not call directly!
+// Initiates front-end feature extraction on the contents of ctx->input_buffer.
+void tinysr_process_frame(tinysr_ctx_t* ctx) {
+	STATS_BEGIN(ctx);
+	fixed_process_frame(ctx, fv_ring_reserve(ctx));
+	STATS_END(ctx, TINYSR_STAGE_FRONTEND);
+}
+#else
+// Private function: Do not call directly!
+// Initiates front-end feature extraction on the contents of ctx->input_buffer.
+// Every table used here comes from ctx->frontend_plan, so no trig is evaluated per frame.
+void tinysr_process_frame(tinysr_ctx_t* ctx) {
+	const tinysr_frontend_plan_t* plan = ctx->frontend_plan;
+	const tinysr_kernels_t* kernels = ctx->kernels;
+	int frame_length = plan->frame_length;
+	float* frame = ctx->temp_buffer;
+	int i;
+	// The frame is sitting contiguously in the mirrored ring buffer. For example, with a ring of length
+	// ten, where the digits are the ages of the samples, the buffer could be laid out like:
+	// [ 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 ]
+	//           ^ input_buffer_next
+	// Thus we can read it in place, and the pre-emphasis below writes it out to temp_buffer.
+	// Completing ES 201 108 4.2.4.
+	const float* input = ctx->input_buffer + ctx->input_buffer_next;
+	STATS_BEGIN(ctx);
+	// Measure log energy. (ES 201 108 4.2.5)
+	// Add a noise floor, keeping the log energy above -50.
+	// (Slight deviation from spec, but makes almost no difference.)
+	float log_energy = logf(kernels->energy(input, frame_length));
+	// Pre-emphasize, and apply the Hamming window. (ES 201 108 4.2.6, 4.2.7)
+	// The spec doesn't specify what happens to the first sample, so we just zero it.
+	kernels->preemphasize_window(input, frame, plan->window, frame_length);
+	// Absolute value (complex magnitude) of FFT of the data, zero padded out to fft_length. (ES 201 108 4.2.8)
+	// First, zero pad.
+	for (i = frame_length; i < plan->fft_length; i++)
+		frame[i] = 0.0;
+	// Then take the abs fft. The DC and Nyquist bins come back packed into the first complex slot.
+	int half = plan->fft_length / 2;
+	float* spectrum = ctx->spectrum_buffer;
+	tinysr_fft_real(plan->fft_plan, frame);
+	kernels->magnitude(frame, spectrum, half);
+	spectrum[0] = fabsf(frame[0]);
+	spectrum[half] = fabsf(frame[1]);
+	// We now only proceed on spectrum[0 ... fft_length/2] inclusive (inclusive means one more
+	// sample than half!) because Hermitian symmetry makes the upper half data redundant.
+	// Compute the triangular filter bank, a.k.a. Mel filtering. (ES 201 108 4.2.9)
+	// See tinysr_frontend_plan_create for how the weights are laid out.
+	float filter_bank[MEL_FILTER_COUNT];
+	kernels->mel_filter(plan, spectrum, filter_bank);
+	// Non-linear transform: logarithm. (ES 201 108 4.2.10)
+	// Again note the noise floor of 2e-22 to prevent an answer less than -50.
+	kernels->log_floor(filter_bank, MEL_FILTER_COUNT);
+	// Compute the mel cepstrum, as a matrix-vector product with the DCT matrix. (ES 201 108 4.2.11)
+	float cepstrum[CEPSTRUM_LENGTH];
+	kernels->dct(plan, filter_bank, cepstrum);
+	// We're now done with the entire front-end processing!
+	// Now we save the feature vector which consists of log_energy, and cepstrum into the ring.
+	finish_feature_vector(ctx, fv_ring_reserve(ctx), log_energy, cepstrum, 1);
+	STATS_END(ctx, TINYSR_STAGE_FRONTEND);
+}
+#endif
+
+// Fills in a feature vector from the front-end's output, numbering it and updating the noise floor.
+// The cepstrum is read with the given stride, so batches can be read straight out of their lanes.
+static void finish_feature_vector(tinysr_ctx_t* ctx, feature_vector_t* fv, tinysr_feature_t log_energy, const tinysr_feature_t* cepstrum, int stride) {
+	// Do noise floor estimation. Clearly, it's impossible for there to be less energy than the true noise floor.
+	// Thus, if the energy is lower than our current floor estimate, then lower our estimate. However, if the
+	// energy is greater than our estimate, raise it slowly. This is a ``slow to rise, fast to fall'' estimator.
+	// We use 0.999 * old + 0.001 * new, which gives a ten second time constant with one frame per 10 ms. 
+	if (log_energy < ctx->noise_floor_estimate) ctx->noise_floor_estimate = log_energy;
+#ifdef TINYSR_FIXED_POINT
+	// Written as old + 0.001 * (new - old), with 0.001 in Q30.
+	else ctx->noise_floor_estimate += (tinysr_feature_t) (((int64_t) (log_energy - ctx->noise_floor_estimate) * 1073742 + (1 << 29)) >> 30);
+#else
+	else ctx->noise_floor_estimate = 0.999 * ctx->noise_floor_estimate + 0.001 * log_energy;
+#endif
+	fv->log_energy = log_energy;
+	int i;
+	for (i = 0; i < CEPSTRUM_LENGTH; i++)
+		fv->cepstrum[i] = cepstrum[i * stride];
+	// Consecutively number the feature vectors.
+	fv->number = ctx->next_fv_number++;
+	STATS_COUNT(ctx, frames, 1);
+	// Store the noise floor, so the utterance detector can take it into account.
+	fv->noise_floor = ctx->noise_floor_estimate;
+}
+
+#ifdef TINYSR_FIXED_POINT
+// There is no batching in the fixed point build, so frames go straight to the extraction output.
+static void batch_add_frame(tinysr_ctx_t* ctx) {
+	STATS_BEGIN(ctx);
+	fixed_process_frame(ctx, &ctx->extract_out[ctx->extract_count++]);
+	fv_ring_skip(ctx);
+	STATS_END(ctx, TINYSR_STAGE_FRONTEND);
+}
+
+static void batch_flush(tinysr_ctx_t* ctx) {
+}
+#else
+// Runs the batched front-end on the frames gathered so far, writing them to the extraction output.
+static void batch_flush(tinysr_ctx_t* ctx) {
+	if (ctx->batch_pending == 0)
+		return;
+	// The whole batch counts as one call to the front-end.
+	STATS_BEGIN(ctx);
+	float log_energy[BATCH_FRAMES], cepstrum[CEPSTRUM_LENGTH * BATCH_FRAMES];
+	// Unused lanes just compute garbage, which gets ignored.
+	ctx->kernels->frontend_batch(ctx->kernels, ctx->frontend_plan, ctx->batch_buffer, log_energy, cepstrum);
+	int l;
+	for (l = 0; l < ctx->batch_pending; l++)
+		finish_feature_vector(ctx, &ctx->extract_out[ctx->extract_count++], log_energy[l], cepstrum + l, BATCH_FRAMES);
+	ctx->batch_pending = 0;
+	fv_ring_skip(ctx);
+	STATS_END(ctx, TINYSR_STAGE_FRONTEND);
+}
+
+// Copies the latest frame out of the ring buffer into the next lane of the batch.
+static void batch_add_frame(tinysr_ctx_t* ctx) {
+	const float* frame = ctx->input_buffer + ctx->input_buffer_next;
+	float* lane = ctx->batch_buffer + ctx->batch_pending;
+	int i;
+	for (i = 0; i < ctx->frontend_plan->frame_length; i++)
+		lane[i * BATCH_FRAMES] = frame[i];
+	ctx->batch_pending++;
+	// Flush when the batch is full, or when the output will be, so that any frames
+	// after that get queued on the context in order.
+	if (ctx->batch_pending == BATCH_FRAMES || ctx->extract_count + ctx->batch_pending == ctx->extract_capacity)
+		batch_flush(ctx);
+}
+#endif
+
+int tinysr_extract_features(tinysr_ctx_t* ctx, samp_t* samples, int length, feature_vector_t* out, int capacity) {
+#ifndef TINYSR_FIXED_POINT
+	if (ctx->batch_buffer == NULL) {
+		// Allocators needn't give 64 byte alignment, so over-allocate and align within.
+		ctx->batch_storage = ctx_allocate(ctx, sizeof(float) * ctx->frontend_plan->fft_length * BATCH_FRAMES + 63);
+		if (ctx->batch_storage == NULL)
+			return 0;
+		ctx->batch_buffer = (float*) (((uintptr_t) ctx->batch_storage + 63) & ~(uintptr_t) 63);
+	}
+#endif
+	ctx->extract_out = out;
+	ctx->extract_capacity = capacity;
+	ctx->extract_count = 0;
+	if (tinysr_feed_input(ctx, samples, length)) {
+		ctx->extract_out = NULL;
+		return 0;
+	}
+	batch_flush(ctx);
+	ctx->extract_out = NULL;
+	return ctx->extract_count;
+}
+
+int tinysr_extract_capacity(tinysr_ctx_t* ctx, int length) {
+	const tinysr_frontend_plan_t* plan = ctx->frontend_plan;
+	// Resampling can produce at most one sample beyond the exact ratio, plus whatever the filter is holding.
+	long long resampled = (long long) length * plan->sample_rate / ctx->input_sample_rate + 2;
+#ifndef TINYSR_FIXED_POINT
+	resampled += ctx->resampler.taps;
+#endif
+	return (int) ((ctx->input_buffer_samps + resampled) / plan->shift_interval) + 1;
+}
+
+// Factors half the inverse covariance as L L^T (Cholesky-Banachiewicz, in double precision), and
+// stores U = L^T, so that scoring is a triangular matrix-vector product and a squared norm.
+int gaussian_init(gaussian_t* gauss, float log_likelihood_offset, const float* cepstrum_mean, const float* cepstrum_inverse_covariance) {
+	double lower[169] = {0};
+	int i, j, k;
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j <= i; j++) {
+			double sum = 0.5 * cepstrum_inverse_covariance[j + i*13];
+			for (k = 0; k < j; k++)
+				sum -= lower[k + i*13] * lower[k + j*13];
+			if (i == j) {
+				// This also catches NaNs.
+				if (!(sum > 0.0))
+					return 1;
+				lower[i + i*13] = sqrt(sum);
+			} else {
+				lower[j + i*13] = sum / lower[j + j*13];
+			}
+		}
+	}
+	gauss->diagonal = 1;
+	for (i = 0; i < 13; i++)
+		for (j = 0; j < 13; j++)
+			if (i != j && cepstrum_inverse_covariance[j + i*13] != 0.0f)
+				gauss->diagonal = 0;
+	// Row i of U is column i of L, from the diagonal on. Diagonal Gaussians keep just the diagonal.
+	double factor[91] = {0};
+	int packed = 0;
+	for (i = 0; i < 13; i++) {
+		if (gauss->diagonal)
+			factor[i] = lower[i + i*13];
+		else
+			for (j = i; j < 13; j++)
+				factor[packed++] = lower[i + j*13];
+	}
+	gauss->log_likelihood_offset = TINYSR_SCORE(log_likelihood_offset);
+	for (i = 0; i < 13; i++) {
+#ifdef TINYSR_FIXED_POINT
+		gauss->cepstrum_mean[i] = saturate_fixed(cepstrum_mean[i], TINYSR_FEATURE_FRACTION_BITS);
+#else
+		gauss->cepstrum_mean[i] = cepstrum_mean[i];
+#endif
+	}
+	for (i = 0; i < 91; i++) {
+#ifdef TINYSR_FIXED_POINT
+		gauss->cepstrum_factor[i] = saturate_fixed(factor[i], 24);
+#else
+		gauss->cepstrum_factor[i] = factor[i];
+#endif
+	}
+	return 0;
+}
+
+// Computes the log-likelihood of a feature vector matching a given Gaussian.
+// This is the innermost loop of recognition, run for every frame, template state and word.
+#ifdef TINYSR_FIXED_POINT
+// Each entry of U * cepstrum drops the factor's 24 fraction bits, leaving Q16, and each square drops
+// another 16. This fits in 64 bits as long as every term of the squared norm is below 2^31.
+tinysr_score_t gaussian_log_likelihood(gaussian_t* gauss, feature_vector_t* fv) {
+	int64_t cepstrum[13];
+	int i, j;
+	for (i = 0; i < 13; i++)
+		cepstrum[i] = fv->cepstrum[i] - gauss->cepstrum_mean[i];
+	const int32_t* factor = gauss->cepstrum_factor;
+	int64_t norm = 0;
+	if (gauss->diagonal) {
+		for (i = 0; i < 13; i++) {
+			int64_t y = (factor[i] * cepstrum[i]) >> 24;
+			norm += (y * y) >> 16;
+		}
+	} else {
+		for (i = 0; i < 13; i++) {
+			int64_t y = 0;
+			for (j = i; j < 13; j++)
+				y += *factor++ * cepstrum[j];
+			y >>= 24;
+			norm += (y * y) >> 16;
+		}
+	}
+	return gauss->log_likelihood_offset - norm;
+}
+#else
+float gaussian_log_likelihood(gaussian_t* gauss, feature_vector_t* fv) {
+	float cepstrum[13];
+	// Subtract the Gaussian's mean from the feature vector.
+	int i, j;
+	for (i = 0; i < 13; i++)
+		cepstrum[i] = fv->cepstrum[i] - gauss->cepstrum_mean[i];
+	// Then, compute |U * cepstrum|^2, walking along U's packed rows.
+	const float* factor = gauss->cepstrum_factor;
+	float norm = 0.0;
+	if (gauss->diagonal) {
+		for (i = 0; i < 13; i++) {
+			float y = factor[i] * cepstrum[i];
+			norm += y * y;
+		}
+	} else {
+		for (i = 0; i < 13; i++) {
+			float y = 0.0;
+			for (j = i; j < 13; j++)
+				y += *factor++ * cepstrum[j];
+			norm += y * y;
+		}
+	}
+	return gauss->log_likelihood_offset - norm;
+}
+#endif
+
+// The number of the codeword nearest a frame, for picking which mixture components to score. The codewords
+// are stored coefficient by coefficient, so that every codeword's distance is found at once.
+static int nearest_codeword(const tinysr_model_t* model, const feature_vector_t* fv) {
+	int c, i, nearest = 0;
+#ifdef TINYSR_FIXED_POINT
+	int64_t distances[MIXTURE_CODEWORDS] = {0};
+	for (i = 0; i < 13; i++) {
+		tinysr_feature_t scaled = (model->codeword_scale[i] * (int64_t) fv->cepstrum[i]) >> 16;
+		for (c = 0; c < MIXTURE_CODEWORDS; c++) {
+			int64_t d = scaled - model->codewords[c + i * MIXTURE_CODEWORDS];
+			distances[c] += (d * d) >> 16;
+		}
+	}
+#else
+	float distances[MIXTURE_CODEWORDS] = {0};
+	for (i = 0; i < 13; i++) {
+		float scaled = model->codeword_scale[i] * fv->cepstrum[i];
+		for (c = 0; c < MIXTURE_CODEWORDS; c++) {
+			float d = scaled - model->codewords[c + i * MIXTURE_CODEWORDS];
+			distances[c] += d * d;
+		}
+	}
+#endif
+	for (c = 1; c < MIXTURE_CODEWORDS; c++)
+		nearest = distances[c] < distances[nearest] ? c : nearest;
+	return nearest;
+}
+
+// Scores a frame against extra component number `component` of the model. In the floating point build, given
+// the frame's expansion, it's scored through the mixture weights, just as the weight slab scores every state.
+static tinysr_score_t component_log_likelihood(tinysr_ctx_t* ctx, int component, const feature_vector_t* fv, const float* expansion) {
+#ifdef TINYSR_FIXED_POINT
+	return gaussian_log_likelihood(ctx->model->components[component], (feature_vector_t*) fv);
+#else
+	return ctx->kernels->dot(ctx->model->mixture_weights + (size_t) component * SCORE_TERMS, expansion, SCORE_TERMS);
+#endif
+}
+
+// Scores a frame against every component of mixture state j of a word, given its heaviest component's score.
+// The state scores as its best component, which is close to the log of the whole mixture's likelihood
+// whenever one component dominates.
+static tinysr_score_t mixture_log_likelihood(recog_entry_t* entry, int j, feature_vector_t* fv, tinysr_score_t score) {
+	int k;
+	for (k = entry->mixture_starts[j]; k < entry->mixture_starts[j+1]; k++) {
+		tinysr_score_t ll = gaussian_log_likelihood(&entry->mixture[k], fv);
+		score = ll > score ? ll : score;
+	}
+	return score;
+}
+
+// The first of a codeword's picks at or after a state.
+static const mixture_pick_t* first_pick(const tinysr_model_t* model, int codeword, int state) {
+	int low = model->pick_starts[codeword], high = model->pick_starts[codeword+1];
+	while (low < high) {
+		int middle = low + (high - low) / 2;
+		if (model->picks[middle].state < state)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return model->picks + low;
+}
+
+// Rescores the mixture states among a run of states, whose heaviest components have already been scored:
+// frame f's score for state s is at scores[f * stride + s - first_state], for s in [first_state, end_state).
+// Each frame only has the components picked for its codeword scored, unless the shortlist is longer than
+// the codebook's, in which case every component is. Each frame's codeword is found here, unless codewords
+// gives them already.
+static void score_mixtures(tinysr_ctx_t* ctx, list_node_t* re, int entries, const feature_vector_t* fvs, const int* codewords, const float* expansion, int frames, tinysr_score_t* scores, int stride, int first_state, int end_state) {
+	int f, i, j;
+	if (ctx->model == NULL || ctx->model->component_count == 0 || ctx->mixture_shortlist <= 0)
+		return;
+	if (ctx->mixture_shortlist > MIXTURE_MAX_SHORTLIST) {
+		for (i = 0; i < entries; re = re->next, i++) {
+			recog_entry_t* entry = re->datum;
+			if (entry->mixture_starts == NULL)
+				continue;
+			for (f = 0; f < frames; f++)
+				for (j = 0; j < entry->model_template_length; j++)
+					scores[f * stride + entry->first_state - first_state + j] = mixture_log_likelihood(entry, j, (feature_vector_t*) &fvs[f], scores[f * stride + entry->first_state - first_state + j]);
+		}
+		return;
+	}
+	for (f = 0; f < frames; f++) {
+		int codeword = codewords != NULL ? codewords[f] : nearest_codeword(ctx->model, &fvs[f]);
+		const mixture_pick_t* pick = first_pick(ctx->model, codeword, first_state);
+		const mixture_pick_t* end = ctx->model->picks + ctx->model->pick_starts[codeword+1];
+		tinysr_score_t* row = scores + f * stride - first_state;
+		for (; pick < end && pick->state < end_state; pick++) {
+			if (pick->rank >= ctx->mixture_shortlist)
+				continue;
+			tinysr_score_t ll = component_log_likelihood(ctx, pick->component, &fvs[f], expansion == NULL ? NULL : expansion + f * SCORE_TERMS);
+			row[pick->state] = ll > row[pick->state] ? ll : row[pick->state];
+		}
+	}
+}
+
+// Computes the cost of matching a given utterance against a given template.
+tinysr_score_t compute_dynamic_time_warping(recog_entry_t* match, utterance_t* utterance, tinysr_score_t* dp_array) {
+	// Do dynamic programming to figure out the minimum path cost.
+	tinysr_score_t diagonal_value = 0;
+	int i, j;
+	for (i = 0; i < utterance->length; i++) {
+		for (j = 0; j < match->model_template_length; j++) {
+			tinysr_score_t ll = TINYSR_SCORE_MIN;
+			// Find our minimum cost predecessor.
+			if (i > 0)
+				ll = dp_array[j] > ll ? dp_array[j] : ll;
+			if (j > 0)
+				ll = dp_array[j-1] > ll ? dp_array[j-1] : ll;
+			if (i > 0 && j > 0)
+				ll = diagonal_value > ll ? diagonal_value : ll;
+			if (i == 0 && j == 0)
+				ll = 0;
+			// Then add in the cost of matching at this site. Mixture states have every component scored.
+			tinysr_score_t cell = gaussian_log_likelihood(&match->model_template[j], &utterance->feature_vectors[i]);
+			if (match->mixture_starts != NULL)
+				cell = mixture_log_likelihood(match, j, &utterance->feature_vectors[i], cell);
+			ll += cell;
+			diagonal_value = dp_array[j];
+			dp_array[j] = ll;
+		}
+	}
+	return dtw_finish(match, dp_array);
+}
+
+// The same dynamic programming, over a block of frames whose scores have already been computed: frame f
+// matches state j with score scores[f * stride + j]. The block starts at frame first_frame of the utterance,
+// and dp_array holds the path scores as of the frame before, so all that's left is max-plus.
+static void dtw_advance(recog_entry_t* match, const tinysr_score_t* scores, int frames, int stride, int first_frame, tinysr_score_t* dp_array) {
+	int f, j, length = match->model_template_length;
+	for (f = 0; f < frames; f++) {
+		const tinysr_score_t* row = scores + f * stride;
+		if (first_frame + f == 0) {
+			// The first frame can only be reached along the template.
+			tinysr_score_t ll = 0;
+			for (j = 0; j < length; j++)
+				dp_array[j] = ll = ll + row[j];
+			continue;
+		}
+		tinysr_score_t diagonal_value = dp_array[0];
+		dp_array[0] += row[0];
+		for (j = 1; j < length; j++) {
+			tinysr_score_t ll = dp_array[j];
+			ll = dp_array[j-1] > ll ? dp_array[j-1] : ll;
+			ll = diagonal_value > ll ? diagonal_value : ll;
+			diagonal_value = dp_array[j];
+			dp_array[j] = ll + row[j];
+		}
+	}
+}
+
+// Applies a template's log likelihood offset and slope to a raw path score.
+static tinysr_score_t dtw_normalize(recog_entry_t* match, tinysr_score_t log_likelihood) {
+#ifdef TINYSR_FIXED_POINT
+	return match->ll_offset + ((match->ll_slope * log_likelihood) >> 24);
+#else
+	return match->ll_offset + match->ll_slope * log_likelihood;
+#endif
+}
+
+// Adjusts the final path score for the template's log likelihood offset and slope.
+static tinysr_score_t dtw_finish(recog_entry_t* match, const tinysr_score_t* dp_array) {
+	return dtw_normalize(match, dp_array[match->model_template_length-1]);
+}
+
+#ifndef TINYSR_FIXED_POINT
+// Expands a feature vector into the monomials of its log-likelihood: the products of each pair of
+// cepstral coefficients (i <= j), then each coefficient, then one.
+static void expand_feature_vector(const feature_vector_t* fv, float* out) {
+	int i, j, k = 0;
+	for (i = 0; i < 13; i++)
+		for (j = i; j < 13; j++)
+			out[k++] = fv->cepstrum[i] * fv->cepstrum[j];
+	for (i = 0; i < 13; i++)
+		out[k++] = fv->cepstrum[i];
+	out[k] = 1.0;
+}
+#endif
+
+// Dynamic time warping restricted to a band around the diagonal, dropping cells that fall more than the
+// beam below their row's best, and giving up on the word as soon as it can't beat score_to_beat. Returns
+// TINYSR_SCORE_MIN if the word can't win, and otherwise the same score as exact mode, if the best path
+// survived the pruning.
+static tinysr_score_t dtw_pruned(tinysr_ctx_t* ctx, recog_entry_t* match, utterance_t* utterance, tinysr_score_t score_to_beat, recognize_task_t* task) {
+	tinysr_score_t* dp_array = ctx->dp_row + match->first_state;
+	int length = match->model_template_length, frames = utterance->length;
+	int radius = length * ctx->dtw_band_percent / 100, i, j;
+	if (radius < 1)
+		radius = 1;
+	// The row's live cells are [start, end), and everything else in dp_array is TINYSR_SCORE_MIN.
+	for (j = 0; j < length; j++)
+		dp_array[j] = TINYSR_SCORE_MIN;
+	int start = 0, end = 0;
+	for (i = 0; i < frames; i++) {
+		feature_vector_t* fv = &utterance->feature_vectors[i];
+#ifndef TINYSR_FIXED_POINT
+		// Cells get scored through the weight slab, SCORE_STATE_ALIGN states at a time, as the row reaches them.
+		// Scores go in the first row of the task's scratch.
+		expand_feature_vector(fv, task->expansion);
+		int scored_end = 0;
+#endif
+		// The band follows the diagonal from (0, 0) to (frames-1, length-1).
+		int center = frames > 1 ? (int) ((long long) i * (length - 1) / (frames - 1)) : 0;
+		int band_start = center - radius > 0 ? center - radius : 0;
+		int band_end = center + radius + 1 < length ? center + radius + 1 : length;
+		// Vertical and diagonal moves come from the last row's live cells, and horizontal moves go on
+		// from there, so nothing before the last row's start is reachable.
+		int row_start = i == 0 ? 0 : (start > band_start ? start : band_start);
+		int row_end = row_start;
+		tinysr_score_t diagonal_value = row_start > 0 ? dp_array[row_start-1] : TINYSR_SCORE_MIN;
+		tinysr_score_t row_best = TINYSR_SCORE_MIN;
+		// Found when the row first reaches a mixture state.
+		const mixture_pick_t* pick = NULL;
+		const mixture_pick_t* pick_end = NULL;
+		for (j = row_start; j < band_end; j++) {
+			tinysr_score_t ll = i == 0 && j == 0 ? 0 : dp_array[j];
+			if (j > row_start)
+				ll = dp_array[j-1] > ll ? dp_array[j-1] : ll;
+			ll = diagonal_value > ll ? diagonal_value : ll;
+			// Past the last row's live cells, only horizontal moves are left, and once those fall out of
+			// the beam, so does the rest of the row. Within them, the beam may have left holes to skip over.
+			if (ll < DTW_DEAD || (j >= end && i > 0 && ll < row_best - ctx->dtw_beam)) {
+				if (j >= end)
+					break;
+				diagonal_value = dp_array[j];
+				dp_array[j] = TINYSR_SCORE_MIN;
+				continue;
+			}
+#ifdef TINYSR_FIXED_POINT
+			tinysr_score_t cell = gaussian_log_likelihood(&match->model_template[j], fv);
+#else
+			int state = match->first_state + j;
+			if (state >= scored_end) {
+				int chunk = state & ~(SCORE_STATE_ALIGN - 1);
+				ctx->kernels->score(task->expansion, 1, ctx->score_weights + chunk / SCORE_STATE_ALIGN * SCORE_PANEL, task->width, SCORE_STATE_ALIGN, task->scores + chunk - task->first_state);
+				scored_end = chunk + SCORE_STATE_ALIGN;
+			}
+			tinysr_score_t cell = task->scores[state - task->first_state];
+#endif
+			if (match->mixture_starts != NULL && ctx->mixture_shortlist > MIXTURE_MAX_SHORTLIST) {
+				cell = mixture_log_likelihood(match, j, fv, cell);
+			} else if (match->mixture_starts != NULL && ctx->mixture_shortlist > 0) {
+				// The row's picks run in order of state, as the row does.
+				if (pick == NULL) {
+					int codeword = i < ctx->codewords_cached ? ctx->frame_codewords[i] : nearest_codeword(ctx->model, fv);
+					pick = first_pick(ctx->model, codeword, match->first_state + j);
+					pick_end = ctx->model->picks + ctx->model->pick_starts[codeword+1];
+				}
+				for (; pick < pick_end && pick->state <= match->first_state + j; pick++) {
+					if (pick->state < match->first_state + j || pick->rank >= ctx->mixture_shortlist)
+						continue;
+#ifdef TINYSR_FIXED_POINT
+					tinysr_score_t ll = component_log_likelihood(ctx, pick->component, fv, NULL);
+#else
+					tinysr_score_t ll = component_log_likelihood(ctx, pick->component, fv, task->expansion);
+#endif
+					cell = ll > cell ? ll : cell;
+				}
+			}
+			ll += cell;
+			diagonal_value = dp_array[j];
+			dp_array[j] = ll;
+			row_best = ll > row_best ? ll : row_best;
+			row_end = j + 1;
+		}
+		// Clear out whatever's left of the last row, and anything outside the beam.
+		for (j = start; j < row_start; j++)
+			dp_array[j] = TINYSR_SCORE_MIN;
+		for (j = row_end; j < end; j++)
+			dp_array[j] = TINYSR_SCORE_MIN;
+#ifndef TINYSR_NO_STATS
+		task->dtw_cells += row_end - row_start;
+#endif
+		start = row_end;
+		end = row_start;
+		for (j = row_start; j < row_end; j++) {
+			if (dp_array[j] < row_best - ctx->dtw_beam) {
+				dp_array[j] = TINYSR_SCORE_MIN;
+			} else {
+				start = start < j ? start : j;
+				end = j + 1;
+			}
+		}
+		if (start >= end)
+			return TINYSR_SCORE_MIN;
+		// Every cell left on a path scores at most best_state_offset. A path takes at least a cell per remaining
+		// frame, and at most one more per horizontal move, of which it has at most length - 1 - start left,
+		// so that bounds the final score, as long as the slope is positive (as model_gen.py makes it).
+		if (match->ll_slope > 0) {
+			tinysr_score_t bound = row_best + (frames - 1 - i) * match->best_state_offset;
+			if (match->best_state_offset > 0)
+				bound += (length - 1 - start) * match->best_state_offset;
+			if (dtw_normalize(match, bound) <= score_to_beat)
+				return TINYSR_SCORE_MIN;
+		}
+	}
+	if (end != length)
+		return TINYSR_SCORE_MIN;
+	return dtw_finish(match, dp_array);
+}
+
+#ifndef TINYSR_FIXED_POINT
+// Writes a Gaussian's column of the weight slab. Multiplying out gaussian_t's log-likelihood, with the
+// inverse covariance P = 2 U^T U, gives
+// log_likelihood_offset - 0.5 mean^T P mean + (P mean)^T cepstrum - 0.5 cepstrum^T P cepstrum,
+// where the last term is a weighted sum of the pairwise products, with the off-diagonal pairs counted twice.
+static void score_weights_column(gaussian_t* gauss, float* column, int stride) {
+	double factor[169] = {0}, inverse_covariance[169], mean[13];
+	int i, j, k, packed = 0;
+	for (i = 0; i < 13; i++) {
+		mean[i] = gauss->cepstrum_mean[i];
+		if (gauss->diagonal)
+			factor[i + i*13] = gauss->cepstrum_factor[i];
+		else
+			for (j = i; j < 13; j++)
+				factor[j + i*13] = gauss->cepstrum_factor[packed++];
+	}
+	for (i = 0; i < 13; i++) {
+		for (j = 0; j < 13; j++) {
+			double sum = 0.0;
+			for (k = 0; k < 13; k++)
+				sum += factor[i + k*13] * factor[j + k*13];
+			inverse_covariance[j + i*13] = 2.0 * sum;
+		}
+	}
+	double constant = gauss->log_likelihood_offset;
+	k = 0;
+	for (i = 0; i < 13; i++)
+		for (j = i; j < 13; j++)
+			column[(k++) * stride] = (i == j ? -0.5 : -1.0) * inverse_covariance[j + i*13];
+	for (i = 0; i < 13; i++) {
+		double linear = 0.0;
+		for (j = 0; j < 13; j++)
+			linear += inverse_covariance[j + i*13] * mean[j];
+		column[(k++) * stride] = linear;
+		constant -= 0.5 * linear * mean[i];
+	}
+	column[k * stride] = constant;
+}
+#endif
+
+// Splits the vocabulary into tasks for the thread pool, each a run of whole words, with scratch space of its own.
+// Each task scores the panels of the weight slab its words' states fall in, which means neighboring tasks can share
+// a panel, and both score it; that's cheaper than synchronizing. Returns non-zero on allocation failure.
+static int build_recognize_tasks(tinysr_ctx_t* ctx) {
+	list_node_t* re;
+	int task_count = 0, states = 0, width = 0;
+	// Count the tasks first, closing each one once it holds RECOGNIZE_TASK_STATES states.
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		states += ((recog_entry_t*) re->datum)->model_template_length;
+		if (states >= RECOGNIZE_TASK_STATES || re->next == NULL) {
+			task_count++;
+			states = 0;
+		}
+	}
+	ctx_release(ctx, ctx->tasks);
+	ctx_release(ctx, ctx->word_scores);
+	ctx->tasks = ctx_allocate(ctx, sizeof(recognize_task_t) * (task_count > 0 ? task_count : 1));
+	ctx->word_scores = ctx_allocate(ctx, sizeof(tinysr_score_t) * (ctx->recog_entry_list.length > 0 ? ctx->recog_entry_list.length : 1));
+	ctx->task_count = 0;
+	if (ctx->tasks == NULL || ctx->word_scores == NULL)
+		return 1;
+	recognize_task_t* task = NULL;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		if (task == NULL) {
+			task = &ctx->tasks[ctx->task_count++];
+			task->first_entry = re;
+			task->entries = 0;
+			task->first_state = entry->first_state / SCORE_STATE_ALIGN * SCORE_STATE_ALIGN;
+			states = 0;
+		}
+		task->entries++;
+		states += entry->model_template_length;
+		if (states >= RECOGNIZE_TASK_STATES || re->next == NULL) {
+			int end = entry->first_state + entry->model_template_length;
+			task->width = (end + SCORE_STATE_ALIGN - 1) / SCORE_STATE_ALIGN * SCORE_STATE_ALIGN - task->first_state;
+			width += task->width;
+			task = NULL;
+		}
+	}
+	// Then carve out the scratch space.
+#ifndef TINYSR_FIXED_POINT
+	ctx_release(ctx, ctx->task_expansion);
+	ctx->task_expansion = ctx_allocate(ctx, sizeof(float) * SCORE_TERMS * SCORE_BLOCK_FRAMES * (task_count > 0 ? task_count : 1));
+	if (ctx->task_expansion == NULL)
+		goto build_recognize_tasks_error;
+#endif
+	ctx_release(ctx, ctx->task_scores);
+	ctx->task_scores = ctx_allocate(ctx, sizeof(tinysr_score_t) * SCORE_BLOCK_FRAMES * (width > 0 ? width : 1));
+	if (ctx->task_scores == NULL)
+		goto build_recognize_tasks_error;
+	width = 0;
+	int i;
+	for (i = 0; i < ctx->task_count; i++) {
+#ifndef TINYSR_FIXED_POINT
+		ctx->tasks[i].expansion = ctx->task_expansion + i * SCORE_TERMS * SCORE_BLOCK_FRAMES;
+#endif
+		ctx->tasks[i].scores = ctx->task_scores + SCORE_BLOCK_FRAMES * width;
+		width += ctx->tasks[i].width;
+	}
+	return 0;
+build_recognize_tasks_error:
+	ctx->task_count = 0;
+	return 1;
+}
+
+// Finds the diagonal of a Gaussian's U^T U, half the precision of each coefficient, taken on its own.
+static void gaussian_precisions(const gaussian_t* gauss, double* squares) {
+	double factor[91];
+	int i, k, packed = 0;
+	for (i = 0; i < 91; i++) {
+#ifdef TINYSR_FIXED_POINT
+		factor[i] = gauss->cepstrum_factor[i] / (double) (1 << 24);
+#else
+		factor[i] = gauss->cepstrum_factor[i];
+#endif
+	}
+	for (i = 0; i < 13; i++)
+		squares[i] = 0;
+	// Row k of U, packed, holds columns [k, 13).
+	for (k = 0; k < 13; k++) {
+		if (gauss->diagonal)
+			squares[k] = factor[k] * factor[k];
+		else
+			for (i = k; i < 13; i++, packed++)
+				squares[i] += factor[packed] * factor[packed];
+	}
+}
+
+// Gaussian number g of a word, counting its states' heaviest components, and then its extra components.
+static gaussian_t* entry_gaussian(recog_entry_t* entry, int g) {
+	if (g < entry->model_template_length)
+		return &entry->model_template[g];
+	return &entry->mixture[entry->mixture_starts[0] + g - entry->model_template_length];
+}
+
+static void model_free_mixtures(tinysr_model_t* model) {
+#ifdef TINYSR_FIXED_POINT
+	int mapped = 0;
+	model_deallocate(model, model->components);
+	model->components = NULL;
+#else
+	int mapped = model->mixtures_mapped;
+	if (!mapped)
+		model_deallocate(model, model->mixture_weights);
+	model->mixture_weights = NULL;
+	model->mixtures_mapped = 0;
+#endif
+	if (!mapped) {
+		model_deallocate(model, model->codewords);
+		model_deallocate(model, model->pick_starts);
+		model_deallocate(model, model->picks);
+	}
+	model->codewords = NULL;
+	model->pick_starts = NULL;
+	model->picks = NULL;
+	model->component_count = 0;
+}
+
+// Numbers the extra mixture components of all the model's words, and if there are any, builds the codebook
+// for picking which to score. The codewords come from k-means on every Gaussian's mean, each coefficient
+// scaled by the Gaussians' average precision, so that distances are roughly in standard deviations. Then
+// every component of every mixture state is scored at every codeword, for its picks.
+// Returns non-zero on allocation failure.
+static int model_build_mixtures(tinysr_model_t* model) {
+	list_node_t* re;
+	int component_count = 0, gaussian_count = 0, pick_count = 0, capacity = 0, c, g, i, j, k, round;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		entry->first_component = component_count;
+		gaussian_count += entry->model_template_length;
+		if (entry->mixture_starts != NULL) {
+			component_count += entry->mixture_starts[entry->model_template_length] - entry->mixture_starts[0];
+			gaussian_count += entry->mixture_starts[entry->model_template_length] - entry->mixture_starts[0];
+			capacity += entry->model_template_length;
+		}
+	}
+	model_free_mixtures(model);
+	if (component_count == 0)
+		return 0;
+	double* points = model_allocate(model, sizeof(double) * 13 * gaussian_count);
+	// Each codeword's coefficients, and then how many points are nearest it.
+	double* centroids = model_allocate(model, sizeof(double) * 14 * MIXTURE_CODEWORDS);
+	double* sums = model_allocate(model, sizeof(double) * 14 * MIXTURE_CODEWORDS);
+	model->codewords = model_allocate(model, sizeof(tinysr_feature_t) * 13 * MIXTURE_CODEWORDS);
+	model->pick_starts = model_allocate(model, sizeof(int) * (MIXTURE_CODEWORDS + 1));
+	// To start with, room for one pick per mixture state per codeword, which grows as needed.
+	model->picks = model_allocate(model, sizeof(mixture_pick_t) * capacity);
+#ifdef TINYSR_FIXED_POINT
+	model->components = model_allocate(model, sizeof(gaussian_t*) * component_count);
+	int failed = model->components == NULL;
+#else
+	model->mixture_weights = model_allocate(model, sizeof(float) * SCORE_TERMS * component_count);
+	int failed = model->mixture_weights == NULL;
+#endif
+	failed |= points == NULL || centroids == NULL || sums == NULL || model->codewords == NULL || model->pick_starts == NULL || model->picks == NULL;
+	double scale[13] = {0}, squares[13];
+	for (re = model->recog_entry_list.head, g = 0; re != NULL && !failed; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		int count = entry->model_template_length + (entry->mixture_starts != NULL ? entry->mixture_starts[entry->model_template_length] - entry->mixture_starts[0] : 0);
+		for (j = 0; j < count; j++, g++) {
+			gaussian_t* gauss = entry_gaussian(entry, j);
+			gaussian_precisions(gauss, squares);
+			for (i = 0; i < 13; i++) {
+				scale[i] += squares[i];
+				points[i + g*13] = TINYSR_FEATURE_TO_FLOAT(gauss->cepstrum_mean[i]);
+			}
+			if (j < entry->model_template_length)
+				continue;
+#ifdef TINYSR_FIXED_POINT
+			model->components[entry->first_component + j - entry->model_template_length] = gauss;
+#else
+			score_weights_column(gauss, model->mixture_weights + (size_t) (entry->first_component + j - entry->model_template_length) * SCORE_TERMS, 1);
+#endif
+		}
+	}
+	if (failed) {
+		model_deallocate(model, points);
+		model_deallocate(model, centroids);
+		model_deallocate(model, sums);
+		model_free_mixtures(model);
+		return 1;
+	}
+	for (i = 0; i < 13; i++) {
+		scale[i] = sqrt(scale[i] / gaussian_count);
+#ifdef TINYSR_FIXED_POINT
+		model->codeword_scale[i] = saturate_fixed(scale[i], 16);
+#else
+		model->codeword_scale[i] = scale[i];
+#endif
+	}
+	for (g = 0; g < gaussian_count; g++)
+		for (i = 0; i < 13; i++)
+			points[i + g*13] *= scale[i];
+	// Start from points spread through the model, and move each codeword to the middle of the points nearest it.
+	for (c = 0; c < MIXTURE_CODEWORDS; c++)
+		memcpy(centroids + c*14, points + (long long) c * gaussian_count / MIXTURE_CODEWORDS * 13, sizeof(double) * 13);
+	for (round = 0; round < MIXTURE_CODEBOOK_ROUNDS; round++) {
+		memset(sums, 0, sizeof(double) * 14 * MIXTURE_CODEWORDS);
+		for (g = 0; g < gaussian_count; g++) {
+			int nearest = 0;
+			double nearest_distance = INFINITY;
+			for (c = 0; c < MIXTURE_CODEWORDS; c++) {
+				double distance = 0;
+				for (i = 0; i < 13; i++)
+					distance += (points[i + g*13] - centroids[i + c*14]) * (points[i + g*13] - centroids[i + c*14]);
+				if (distance < nearest_distance) {
+					nearest_distance = distance;
+					nearest = c;
+				}
+			}
+			for (i = 0; i < 13; i++)
+				sums[i + nearest*14] += points[i + g*13];
+			sums[13 + nearest*14]++;
+		}
+		for (c = 0; c < MIXTURE_CODEWORDS; c++)
+			if (sums[13 + c*14] > 0)
+				for (i = 0; i < 13; i++)
+					centroids[i + c*14] = sums[i + c*14] / sums[13 + c*14];
+	}
+	// Score every mixture state's components at each codeword, picking the best few extra components that come
+	// close enough to its heaviest, and to the best of all.
+	for (c = 0; c < MIXTURE_CODEWORDS && !failed; c++) {
+		feature_vector_t fv = {0};
+		for (i = 0; i < 13; i++) {
+			model->codewords[c + i * MIXTURE_CODEWORDS] = TINYSR_FEATURE(centroids[i + c*14]);
+			fv.cepstrum[i] = TINYSR_FEATURE(centroids[i + c*14] / scale[i]);
+		}
+		tinysr_score_t best = TINYSR_SCORE_MIN;
+		for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			int count = entry->model_template_length + (entry->mixture_starts != NULL ? entry->mixture_starts[entry->model_template_length] - entry->mixture_starts[0] : 0);
+			for (g = 0; g < count; g++) {
+				tinysr_score_t ll = gaussian_log_likelihood(entry_gaussian(entry, g), &fv);
+				best = ll > best ? ll : best;
+			}
+		}
+		model->pick_starts[c] = pick_count;
+		for (re = model->recog_entry_list.head; re != NULL && !failed; re = re->next) {
+			recog_entry_t* entry = re->datum;
+			if (entry->mixture_starts == NULL)
+				continue;
+			for (j = 0; j < entry->model_template_length; j++) {
+				mixture_pick_t picked[MIXTURE_MAX_SHORTLIST];
+				tinysr_score_t picked_scores[MIXTURE_MAX_SHORTLIST];
+				tinysr_score_t threshold = gaussian_log_likelihood(&entry->model_template[j], &fv) - TINYSR_SCORE(MIXTURE_SELECTION_MARGIN);
+				threshold = threshold > best - TINYSR_SCORE(MIXTURE_SELECTION_BEAM) ? threshold : best - TINYSR_SCORE(MIXTURE_SELECTION_BEAM);
+				int n = 0, first = entry->mixture_starts[j];
+				// Keep the best so far in order, by insertion.
+				for (k = first; k < entry->mixture_starts[j+1]; k++) {
+					tinysr_score_t ll = gaussian_log_likelihood(&entry->mixture[k], &fv);
+					if (ll < threshold || (n == MIXTURE_MAX_SHORTLIST && ll <= picked_scores[n-1]))
+						continue;
+					int at = n < MIXTURE_MAX_SHORTLIST ? n++ : n - 1;
+					for (; at > 0 && picked_scores[at-1] < ll; at--) {
+						picked_scores[at] = picked_scores[at-1];
+						picked[at] = picked[at-1];
+					}
+					picked_scores[at] = ll;
+					picked[at].component = entry->first_component + k - entry->mixture_starts[0];
+				}
+				if (pick_count + n > capacity) {
+					mixture_pick_t* grown = model_allocate(model, sizeof(mixture_pick_t) * 2 * (pick_count + n));
+					if (grown == NULL) {
+						failed = 1;
+						break;
+					}
+					memcpy(grown, model->picks, sizeof(mixture_pick_t) * pick_count);
+					model_deallocate(model, model->picks);
+					model->picks = grown;
+					capacity = 2 * (pick_count + n);
+				}
+				for (k = 0; k < n; k++) {
+					picked[k].state = entry->first_state + j;
+					picked[k].rank = k;
+					model->picks[pick_count++] = picked[k];
+				}
+			}
+		}
+	}
+	model->pick_starts[MIXTURE_CODEWORDS] = pick_count;
+	model_deallocate(model, points);
+	model_deallocate(model, centroids);
+	model_deallocate(model, sums);
+	if (failed) {
+		model_free_mixtures(model);
+		return 1;
+	}
+	model->component_count = component_count;
+	return 0;
+}
+
+// Numbers the states of all the model's words, and gathers their Gaussians into one slab, for batched scoring.
+// Returns non-zero on allocation failure, leaving no states to recognize against.
+static int model_build(tinysr_model_t* model) {
+	list_node_t* re;
+	int state_count = 0;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		entry->first_state = state_count;
+		state_count += entry->model_template_length;
+		int j;
+		entry->best_state_offset = TINYSR_SCORE_MIN;
+		for (j = 0; j < entry->model_template_length; j++)
+			if (entry->model_template[j].log_likelihood_offset > entry->best_state_offset)
+				entry->best_state_offset = entry->model_template[j].log_likelihood_offset;
+		// No mixture component can score above its offset either.
+		if (entry->mixture_starts != NULL) {
+			for (j = entry->mixture_starts[0]; j < entry->mixture_starts[entry->model_template_length]; j++)
+				if (entry->mixture[j].log_likelihood_offset > entry->best_state_offset)
+					entry->best_state_offset = entry->mixture[j].log_likelihood_offset;
+		}
+	}
+	int stride = (state_count + SCORE_STATE_ALIGN - 1) / SCORE_STATE_ALIGN * SCORE_STATE_ALIGN;
+	model->state_count = model->state_stride = 0;
+#ifndef TINYSR_FIXED_POINT
+	if (!model->weights_mapped)
+		model_deallocate(model, model->score_weights);
+	model->weights_mapped = 0;
+	model->score_weights = model_allocate(model, sizeof(float) * SCORE_TERMS * stride);
+	if (model->score_weights == NULL)
+		return 1;
+	// The padding states score zero.
+	memset(model->score_weights, 0, sizeof(float) * SCORE_TERMS * stride);
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		int j;
+		for (j = 0; j < entry->model_template_length; j++) {
+			int state = entry->first_state + j;
+			score_weights_column(&entry->model_template[j], model->score_weights + state / SCORE_STATE_ALIGN * SCORE_PANEL + state % SCORE_STATE_ALIGN, SCORE_STATE_ALIGN);
+		}
+	}
+#endif
+	model->state_count = state_count;
+	model->state_stride = stride;
+	return model_build_mixtures(model);
+}
+
+// Builds whatever adding words left stale. Returns non-zero on allocation failure, leaving it stale, and
+// no states to recognize against.
+static int model_finish(tinysr_model_t* model) {
+	int failed = 0;
+#ifndef TINYSR_NO_THREADS
+	pthread_mutex_lock(&model->build_lock);
+#endif
+	if (model->stale == MODEL_STALE_ALL)
+		failed = model_build(model);
+	else if (model->stale == MODEL_STALE_MIXTURES)
+		failed = model_build_mixtures(model);
+	if (!failed)
+		model->stale = 0;
+#ifndef TINYSR_NO_THREADS
+	pthread_mutex_unlock(&model->build_lock);
+#endif
+	return failed;
+}
+
+// Makes the scoring, DTW and keyword spotting scratch space for the words of the context's model. The first
+// kept_words words keep their keyword thresholds. Returns non-zero on allocation failure, leaving no states
+// to recognize against.
+static int build_scratch(tinysr_ctx_t* ctx, int kept_words) {
+	int stride = ctx->model != NULL ? ctx->model->state_stride : 0, words = ctx->recog_entry_list.length, i;
+	// An utterance streaming against the old words gets recognized once it's over instead.
+	ctx->stream_next = -1;
+	ctx->state_count = ctx->state_stride = 0;
+	if (stride == 0)
+		return 0;
+#ifndef TINYSR_FIXED_POINT
+	ctx_release(ctx, ctx->score_expansion);
+	ctx->score_expansion = ctx_allocate(ctx, sizeof(float) * SCORE_TERMS * SCORE_BLOCK_FRAMES);
+	if (ctx->score_expansion == NULL)
+		return 1;
+#endif
+	ctx_release(ctx, ctx->score_block);
+	ctx_release(ctx, ctx->dp_row);
+	ctx_release(ctx, ctx->stream_dp_row);
+	ctx->score_block = ctx_allocate(ctx, sizeof(tinysr_score_t) * SCORE_BLOCK_FRAMES * stride);
+	ctx->dp_row = ctx_allocate(ctx, sizeof(tinysr_score_t) * stride);
+	ctx->stream_dp_row = ctx_allocate(ctx, sizeof(tinysr_score_t) * stride);
+	if (ctx->stream_block == NULL)
+		ctx->stream_block = ctx_allocate(ctx, sizeof(feature_vector_t) * SCORE_BLOCK_FRAMES);
+	ctx_release(ctx, ctx->keyword_cells);
+	ctx->keyword_cells = ctx_allocate(ctx, sizeof(keyword_cell_t) * stride);
+	tinysr_score_t* thresholds = ctx_allocate(ctx, sizeof(tinysr_score_t) * words);
+	if (thresholds != NULL) {
+		for (i = 0; i < words; i++)
+			thresholds[i] = i < kept_words && ctx->keyword_thresholds != NULL ? ctx->keyword_thresholds[i] : TINYSR_SCORE(KEYWORD_DEFAULT_THRESHOLD);
+	}
+	ctx_release(ctx, ctx->keyword_thresholds);
+	ctx->keyword_thresholds = thresholds;
+	ctx_release(ctx, ctx->keyword_last_ends);
+	ctx->keyword_last_ends = ctx_allocate(ctx, sizeof(long long) * words);
+	ctx_release(ctx, ctx->frame_codewords);
+	ctx->frame_codewords = ctx->model->component_count > 0 ? ctx_allocate(ctx, sizeof(int) * CODEWORD_CACHE_FRAMES) : NULL;
+	if (ctx->model->component_count > 0 && ctx->frame_codewords == NULL)
+		return 1;
+	if (ctx->score_block == NULL || ctx->dp_row == NULL || ctx->stream_dp_row == NULL || ctx->stream_block == NULL ||
+			ctx->keyword_cells == NULL || ctx->keyword_thresholds == NULL || ctx->keyword_last_ends == NULL)
+		return 1;
+	// Keyword spotting starts over, with no paths, and a fresh cepstral mean.
+	memset(ctx->keyword_cells, 0, sizeof(keyword_cell_t) * stride);
+	memset(ctx->keyword_mean, 0, sizeof(ctx->keyword_mean));
+	ctx->keyword_mean_frames = 0;
+	for (i = 0; i < words; i++)
+		ctx->keyword_last_ends[i] = -1;
+	if (build_recognize_tasks(ctx))
+		return 1;
+	ctx->state_count = ctx->model->state_count;
+	ctx->state_stride = stride;
+	return 0;
+}
+
+void tinysr_score_frames(tinysr_ctx_t* ctx, const feature_vector_t* fvs, int frames, tinysr_score_t* scores) {
+#ifdef TINYSR_FIXED_POINT
+	// Without floating point, there's no expanding out the quadratic form, so each cell is scored on its own.
+	list_node_t* re;
+	int f, j;
+	for (re = ctx->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		for (f = 0; f < frames; f++)
+			for (j = 0; j < entry->model_template_length; j++)
+				scores[f * ctx->state_stride + entry->first_state + j] = gaussian_log_likelihood(&entry->model_template[j], (feature_vector_t*) &fvs[f]);
+	}
+#else
+	int f;
+	for (f = 0; f < frames; f++)
+		expand_feature_vector(&fvs[f], ctx->score_expansion + f * SCORE_TERMS);
+	ctx->kernels->score(ctx->score_expansion, frames, ctx->score_weights, ctx->state_stride, ctx->state_stride, scores);
+#endif
+	// The slab only holds each state's heaviest component.
+#ifdef TINYSR_FIXED_POINT
+	score_mixtures(ctx, ctx->recog_entry_list.head, ctx->recog_entry_list.length, fvs, NULL, NULL, frames, scores, ctx->state_stride, 0, ctx->state_count);
+#else
+	score_mixtures(ctx, ctx->recog_entry_list.head, ctx->recog_entry_list.length, fvs, NULL, ctx->score_expansion, frames, scores, ctx->state_stride, 0, ctx->state_count);
+#endif
+}
+
+// Scores a block of frames against just the states of one task, into the task's scratch, task->width scores per frame.
+// The frames' codewords, if given, save finding them again for each task.
+static void score_task_frames(tinysr_ctx_t* ctx, recognize_task_t* task, const feature_vector_t* fvs, const int* codewords, int frames) {
+#ifdef TINYSR_FIXED_POINT
+	list_node_t* re;
+	int f, i, j;
+	for (re = task->first_entry, i = 0; i < task->entries; re = re->next, i++) {
+		recog_entry_t* entry = re->datum;
+		for (f = 0; f < frames; f++)
+			for (j = 0; j < entry->model_template_length; j++)
+				task->scores[f * task->width + entry->first_state - task->first_state + j] = gaussian_log_likelihood(&entry->model_template[j], (feature_vector_t*) &fvs[f]);
+	}
+#else
+	int f;
+	for (f = 0; f < frames; f++)
+		expand_feature_vector(&fvs[f], task->expansion + f * SCORE_TERMS);
+	ctx->kernels->score(task->expansion, frames, ctx->score_weights + task->first_state / SCORE_STATE_ALIGN * SCORE_PANEL, task->width, task->width, task->scores);
+#endif
+#ifdef TINYSR_FIXED_POINT
+	score_mixtures(ctx, task->first_entry, task->entries, fvs, codewords, NULL, frames, task->scores, task->width, task->first_state, task->first_state + task->width);
+#else
+	score_mixtures(ctx, task->first_entry, task->entries, fvs, codewords, task->expansion, frames, task->scores, task->width, task->first_state, task->first_state + task->width);
+#endif
+}
+
+#ifndef TINYSR_NO_THREADS
+// A job is a batch of numbered tasks, which the workers (and the thread that submitted it) claim one at a time,
+// so that whoever is free takes the next task, and a slow task doesn't hold up the rest.
+typedef struct thread_pool_job {
+	void (*run)(void* arg, int task);
+	void* arg;
+	int task_count, next_task, finished;
+	struct thread_pool_job* next;
+} thread_pool_job_t;
+
+struct tinysr_thread_pool {
+	pthread_t* threads;
+	int thread_count;
+	pthread_mutex_t lock;
+	// Signaled when a job is submitted, or the pool is shutting down, and when a job's last task finishes.
+	pthread_cond_t work_ready, work_done;
+	// Jobs with tasks left to claim, or left to finish, oldest first.
+	thread_pool_job_t* jobs;
+	int shutting_down;
+};
+
+// Claims and runs tasks from the queue, until there are none left to claim. Called and returns with the lock held.
+static void thread_pool_work(tinysr_thread_pool_t* pool, thread_pool_job_t* only) {
+	for (;;) {
+		thread_pool_job_t* job = only;
+		if (job == NULL)
+			for (job = pool->jobs; job != NULL && job->next_task == job->task_count; job = job->next);
+		if (job == NULL || job->next_task == job->task_count)
+			return;
+		int task = job->next_task++;
+		pthread_mutex_unlock(&pool->lock);
+		job->run(job->arg, task);
+		pthread_mutex_lock(&pool->lock);
+		if (++job->finished == job->task_count)
+			pthread_cond_broadcast(&pool->work_done);
+	}
+}
+
+static void* thread_pool_worker(void* arg) {
+	tinysr_thread_pool_t* pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->shutting_down) {
+		thread_pool_work(pool, NULL);
+		pthread_cond_wait(&pool->work_ready, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+// Runs run(arg, 0) through run(arg, task_count - 1) across the pool, returning once they've all finished.
+// The calling thread works on its own job too, so it's never left idle, and several contexts can share a pool.
+static void thread_pool_run(tinysr_thread_pool_t* pool, void (*run)(void* arg, int task), void* arg, int task_count) {
+	thread_pool_job_t job = {run, arg, task_count, 0, 0, NULL};
+	thread_pool_job_t** tail;
+	pthread_mutex_lock(&pool->lock);
+	for (tail = &pool->jobs; *tail != NULL; tail = &(*tail)->next);
+	*tail = &job;
+	pthread_cond_broadcast(&pool->work_ready);
+	thread_pool_work(pool, &job);
+	while (job.finished < job.task_count)
+		pthread_cond_wait(&pool->work_done, &pool->lock);
+	for (tail = &pool->jobs; *tail != &job; tail = &(*tail)->next);
+	*tail = job.next;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+tinysr_thread_pool_t* tinysr_thread_pool_create(int threads) {
+	tinysr_thread_pool_t* pool = malloc(sizeof(tinysr_thread_pool_t));
+	if (pool == NULL)
+		return NULL;
+	pool->threads = malloc(sizeof(pthread_t) * (threads > 0 ? threads : 1));
+	pool->thread_count = 0;
+	pool->jobs = NULL;
+	pool->shutting_down = 0;
+	if (pool->threads == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_ready, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+	for (; pool->thread_count < threads; pool->thread_count++) {
+		if (pthread_create(&pool->threads[pool->thread_count], NULL, thread_pool_worker, pool) != 0) {
+			tinysr_thread_pool_free(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void tinysr_thread_pool_free(tinysr_thread_pool_t* pool) {
+	int i;
+	if (pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutting_down = 1;
+	pthread_cond_broadcast(&pool->work_ready);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_cond_destroy(&pool->work_done);
+	free(pool->threads);
+	free(pool);
+}
+#else
+// Without threads, there are no pools, and contexts always match on the calling thread.
+static void thread_pool_run(tinysr_thread_pool_t* pool, void (*run)(void* arg, int task), void* arg, int task_count) {
+	int i;
+	for (i = 0; i < task_count; i++)
+		run(arg, i);
+}
+
+tinysr_thread_pool_t* tinysr_thread_pool_create(int threads) {
+	return NULL;
+}
+
+void tinysr_thread_pool_free(tinysr_thread_pool_t* pool) {
+}
+#endif
+
+// === Model files ===
+// Legacy model files, as written by model_gen.py, are just a run of words, each of which is:
+//   uint32_t name length, the name, float ll_offset, float ll_slope, uint32_t template length,
+//   and then for each state: float log_likelihood_offset, float cepstrum_mean[13], float cepstrum_inverse_covariance[169]
+// Version 2 files start with a model_file_header_t, and then hold the word table, the names (each null
+// terminated), every state's Gaussian, already factored, and the weight slab for batched scoring. The
+// Gaussians and the slab are laid out exactly as the floating point build holds them, and start on 64 byte
+// boundaries, so it can use them straight out of a read-only mapping of the file, which the page cache
+// shares between processes. Version 3 files go on to hold mixture states: a table of where each state's
+// extra components start, and then the components, laid out like the other Gaussians, and if there are any,
+// the codebook for picking which to score, as the floating point build holds it. Both formats are little
+// endian.
+#define MODEL_FILE_MAGIC 0x4d525354
+#define MODEL_FILE_VERSION 3
+#define MODEL_FILE_ALIGN 64
+#define LEGACY_GAUSSIAN_SIZE (sizeof(float) * (1 + 13 + 169))
+
+typedef struct {
+	// "TSRM", and MODEL_FILE_VERSION, or 2.
+	uint32_t magic, version;
+	uint32_t word_count, state_count, state_stride;
+	// The weight slab's terms per state and states per panel, and the size of each Gaussian.
+	uint32_t score_terms, state_align, gaussian_size;
+	// From the start of the file. weights_offset is zero if there's no slab.
+	uint64_t words_offset, names_offset, gaussians_offset, weights_offset;
+	// Only in version 3 files, whose words' states may have extra mixture components: state i's are
+	// component_count's entries starts[i] up to starts[i+1], where starts holds state_count + 1 int32_ts.
+	uint32_t component_count, codeword_count;
+	uint64_t mixture_starts_offset, components_offset;
+	// The codebook, if codeword_count isn't zero: the 13 coefficient scales, padded to 16 floats, then the
+	// codewords, coefficient by coefficient, and codeword_count + 1 int32_t pick starts, pick_count picks of
+	// no more than pick_limit per state, and each component's SCORE_TERMS weights.
+	uint32_t pick_count, pick_limit;
+	uint64_t codebook_offset, pick_starts_offset, picks_offset, mixture_weights_offset;
+} model_file_header_t;
+
+// Version 2 files end their header before component_count.
+#define MODEL_FILE_V2_HEADER_SIZE offsetof(model_file_header_t, component_count)
+
+typedef struct {
+	// From names_offset, and not counting the null terminator.
+	uint32_t name_offset, name_length;
+	float ll_offset, ll_slope;
+	uint32_t template_length, first_state;
+	float best_state_offset;
+	uint32_t reserved;
+} model_file_word_t;
+
+// A factored Gaussian, as gaussian_t is in the floating point build.
+typedef struct {
+	float log_likelihood_offset;
+	float cepstrum_mean[13];
+	int32_t diagonal;
+	float cepstrum_factor[91];
+} model_file_gaussian_t;
+
+#ifndef TINYSR_FIXED_POINT
+_Static_assert(sizeof(gaussian_t) == sizeof(model_file_gaussian_t), "gaussian_t must match the model file's Gaussians");
+#endif
+
+// A whole file in memory, and for version 2 files, the block holding their words' entries.
+typedef struct model_file {
+	unsigned char* data;
+	size_t size;
+	recog_entry_t* entries;
+	int entry_count;
+} model_file_t;
+
+// Brings a whole file into memory: mapped read-only, or without mmap, read into one block from the allocator.
+// Returns non-zero on failure.
+static int file_map(const tinysr_allocator_t* allocator, const char* path, unsigned char** data, size_t* size) {
+#ifndef TINYSR_NO_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return 1;
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return 1;
+	}
+	*size = info.st_size;
+	*data = *size == 0 ? NULL : mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return *data == MAP_FAILED;
+#else
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL)
+		return 1;
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	*size = length < 0 ? 0 : length;
+	*data = allocator->allocate(allocator->user, *size + 1);
+	int failed = length < 0 || *data == NULL || fread(*data, 1, *size, fp) != *size;
+	fclose(fp);
+	if (failed)
+		allocator->release(allocator->user, *data);
+	return failed;
+#endif
+}
+
+static void file_unmap(const tinysr_allocator_t* allocator, unsigned char* data, size_t size) {
+#ifndef TINYSR_NO_MMAP
+	if (data != NULL)
+		munmap(data, size);
+#else
+	allocator->release(allocator->user, data);
+#endif
+}
+
+static int model_file_open(tinysr_model_t* model, const char* path, model_file_t* file) {
+	file->entries = NULL;
+	file->entry_count = 0;
+	return file_map(&model->allocator, path, &file->data, &file->size);
+}
+
+static void model_file_close(tinysr_model_t* model, model_file_t* file) {
+	file_unmap(&model->allocator, file->data, file->size);
+}
+
+// Whether a pointer is into one of the model's version 2 files, or their blocks of entries.
+static int model_file_holds(tinysr_model_t* model, const void* ptr) {
+	list_node_t* node;
+	for (node = model->files.head; node != NULL; node = node->next) {
+		model_file_t* file = node->datum;
+		if ((const unsigned char*) ptr >= file->data && (const unsigned char*) ptr < file->data + file->size)
+			return 1;
+		if ((const recog_entry_t*) ptr >= file->entries && (const recog_entry_t*) ptr < file->entries + file->entry_count)
+			return 1;
+	}
+	return 0;
+}
+
+// Whether count items of the given size, from offset, are all inside a file of the given size.
+static int model_file_fits(size_t size, uint64_t offset, uint64_t count, size_t item) {
+	return offset <= size && count <= (size - offset) / item;
+}
+
+// Frees words that were loaded, but not yet added to the model.
+static void model_free_loaded(tinysr_model_t* model, list_t* loaded, model_file_t* file) {
+	while (loaded->length) {
+		recog_entry_t* recog_entry = list_pop_front(loaded);
+		if (file == NULL || (unsigned char*) recog_entry->name < file->data || (unsigned char*) recog_entry->name >= file->data + file->size)
+			model_deallocate(model, recog_entry->name);
+		if (file == NULL || (unsigned char*) recog_entry->model_template < file->data || (unsigned char*) recog_entry->model_template >= file->data + file->size)
+			model_deallocate(model, recog_entry->model_template);
+		if (file == NULL || (unsigned char*) recog_entry->mixture_starts < file->data || (unsigned char*) recog_entry->mixture_starts >= file->data + file->size)
+			model_deallocate(model, recog_entry->mixture_starts);
+		if (file == NULL || (unsigned char*) recog_entry->mixture < file->data || (unsigned char*) recog_entry->mixture >= file->data + file->size)
+			model_deallocate(model, recog_entry->mixture);
+		if (file == NULL)
+			model_deallocate(model, recog_entry);
+	}
+	if (file != NULL)
+		model_deallocate(model, file->entries);
+}
+
+// Parses a legacy model file, checking that it's all there before allocating anything. Words go on loaded,
+// numbered from first_index. Returns non-zero if the file is malformed, or a Gaussian can't be factored.
+static int model_parse_legacy(tinysr_model_t* model, const unsigned char* data, size_t size, list_t* loaded, int first_index) {
+	size_t at = 0;
+	uint32_t name_length, template_length, i;
+	while (at < size) {
+		if (size - at < 4)
+			return 1;
+		memcpy(&name_length, data + at, 4);
+		if (size - at - 4 < (uint64_t) name_length + 12)
+			return 1;
+		at += 4 + name_length + 8;
+		memcpy(&template_length, data + at, 4);
+		at += 4;
+		if (template_length > (size - at) / LEGACY_GAUSSIAN_SIZE)
+			return 1;
+		at += template_length * LEGACY_GAUSSIAN_SIZE;
+	}
+	for (at = 0; at < size;) {
+		recog_entry_t* recog_entry = model_allocate(model, sizeof(recog_entry_t));
+		if (recog_entry == NULL)
+			return 1;
+		memcpy(&name_length, data + at, 4);
+		recog_entry->index = first_index + loaded->length;
+		recog_entry->name = model_allocate(model, name_length + 1);
+		recog_entry->model_template_length = 0;
+		recog_entry->model_template = NULL;
+		recog_entry->mixture_starts = NULL;
+		recog_entry->mixture = NULL;
+		if (list_append_back(loaded, recog_entry)) {
+			model_deallocate(model, recog_entry->name);
+			model_deallocate(model, recog_entry);
+			return 1;
+		}
+		if (recog_entry->name == NULL)
+			return 1;
+		memcpy(recog_entry->name, data + at + 4, name_length);
+		recog_entry->name[name_length] = '\0';
+		at += 4 + name_length;
+		float ll_offset, ll_slope;
+		memcpy(&ll_offset, data + at, 4);
+		memcpy(&ll_slope, data + at + 4, 4);
+		memcpy(&template_length, data + at + 8, 4);
+		at += 12;
+		recog_entry->ll_offset = TINYSR_SCORE(ll_offset);
+#ifdef TINYSR_FIXED_POINT
+		recog_entry->ll_slope = saturate_fixed(ll_slope, 24);
+#else
+		recog_entry->ll_slope = ll_slope;
+#endif
+		recog_entry->model_template = model_allocate(model, sizeof(gaussian_t) * (template_length > 0 ? template_length : 1));
+		if (recog_entry->model_template == NULL)
+			return 1;
+		recog_entry->model_template_length = template_length;
+		for (i = 0; i < template_length; i++, at += LEGACY_GAUSSIAN_SIZE) {
+			float values[1 + 13 + 169];
+			memcpy(values, data + at, sizeof(values));
+			if (gaussian_init(&recog_entry->model_template[i], values[0], values + 1, values + 14))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef TINYSR_FIXED_POINT
+// Without floating point, the file's Gaussians have to be converted.
+static void model_file_gaussian_convert(gaussian_t* to, const model_file_gaussian_t* from) {
+	int k;
+	to->log_likelihood_offset = TINYSR_SCORE(from->log_likelihood_offset);
+	to->diagonal = from->diagonal;
+	for (k = 0; k < 13; k++)
+		to->cepstrum_mean[k] = saturate_fixed(from->cepstrum_mean[k], TINYSR_FEATURE_FRACTION_BITS);
+	for (k = 0; k < 91; k++)
+		to->cepstrum_factor[k] = saturate_fixed(from->cepstrum_factor[k], 24);
+}
+#endif
+
+// Checks a version 3 file's codebook is all inside it, and that its picks, codeword by codeword, are in
+// order of state, and name real states, components and ranks. Returns non-zero if not.
+static int model_file_check_codebook(const model_file_t* file, const model_file_header_t* header) {
+	uint32_t c, p;
+	if (header->codebook_offset % MODEL_FILE_ALIGN != 0 || header->pick_starts_offset % sizeof(int32_t) != 0 ||
+			header->picks_offset % MODEL_FILE_ALIGN != 0 || header->mixture_weights_offset % MODEL_FILE_ALIGN != 0 ||
+			!model_file_fits(file->size, header->codebook_offset, 16 + 13ull * header->codeword_count, sizeof(float)) ||
+			!model_file_fits(file->size, header->pick_starts_offset, header->codeword_count + 1ull, sizeof(int32_t)) ||
+			!model_file_fits(file->size, header->picks_offset, header->pick_count, sizeof(mixture_pick_t)) ||
+			!model_file_fits(file->size, header->mixture_weights_offset, (uint64_t) header->component_count * header->score_terms, sizeof(float)))
+		return 1;
+	const int32_t* pick_starts = (const int32_t*) (file->data + header->pick_starts_offset);
+	const mixture_pick_t* picks = (const mixture_pick_t*) (file->data + header->picks_offset);
+	if (pick_starts[0] != 0 || (uint32_t) pick_starts[header->codeword_count] != header->pick_count)
+		return 1;
+	for (c = 0; c < header->codeword_count; c++) {
+		if (pick_starts[c+1] < pick_starts[c])
+			return 1;
+		for (p = pick_starts[c]; p < (uint32_t) pick_starts[c+1]; p++)
+			if (picks[p].state < 0 || (uint32_t) picks[p].state >= header->state_count || (p > (uint32_t) pick_starts[c] && picks[p].state < picks[p-1].state) ||
+					picks[p].component < 0 || (uint32_t) picks[p].component >= header->component_count || picks[p].rank < 0 || (uint32_t) picks[p].rank >= header->pick_limit)
+				return 1;
+	}
+	return 0;
+}
+
+// Parses a version 2 or 3 model file, checking its header and word table before allocating anything. Words go
+// on loaded, numbered from first_index. In the floating point build, their names and Gaussians stay in the file.
+// Returns non-zero if the file is malformed.
+static int model_parse_v2(tinysr_model_t* model, model_file_t* file, list_t* loaded, int first_index) {
+	model_file_header_t header = {0};
+	model_file_word_t word;
+	uint32_t i, state = 0;
+	if (file->size < MODEL_FILE_V2_HEADER_SIZE)
+		return 1;
+	memcpy(&header, file->data, MODEL_FILE_V2_HEADER_SIZE);
+	if (header.version == MODEL_FILE_VERSION) {
+		if (file->size < sizeof(header))
+			return 1;
+		memcpy(&header, file->data, sizeof(header));
+	}
+	if (header.magic != MODEL_FILE_MAGIC || (header.version != 2 && header.version != MODEL_FILE_VERSION) || header.gaussian_size != sizeof(model_file_gaussian_t) ||
+			header.state_count > header.state_stride || header.word_count > INT32_MAX || header.state_stride > INT32_MAX ||
+			!model_file_fits(file->size, header.words_offset, header.word_count, sizeof(model_file_word_t)) ||
+			!model_file_fits(file->size, header.names_offset, 0, 1) ||
+			!model_file_fits(file->size, header.gaussians_offset, header.state_count, sizeof(model_file_gaussian_t)) ||
+			header.gaussians_offset % MODEL_FILE_ALIGN != 0 ||
+			(header.weights_offset != 0 && (header.weights_offset % MODEL_FILE_ALIGN != 0 ||
+				header.state_align == 0 || header.state_stride % header.state_align != 0 ||
+				header.score_terms == 0 || header.score_terms > INT32_MAX / header.state_align ||
+				!model_file_fits(file->size, header.weights_offset, header.state_stride / header.state_align, sizeof(float) * header.score_terms * header.state_align))))
+		return 1;
+	// The mixture components have to be inside the file, and each state's run of them has to be too.
+	const int32_t* starts = NULL;
+	if (header.version == MODEL_FILE_VERSION) {
+		if (header.component_count > INT32_MAX ||
+				header.mixture_starts_offset % MODEL_FILE_ALIGN != 0 || header.components_offset % MODEL_FILE_ALIGN != 0 ||
+				!model_file_fits(file->size, header.mixture_starts_offset, (uint64_t) header.state_count + 1, sizeof(int32_t)) ||
+				!model_file_fits(file->size, header.components_offset, header.component_count, sizeof(model_file_gaussian_t)))
+			return 1;
+		starts = (const int32_t*) (file->data + header.mixture_starts_offset);
+		if (starts[0] != 0 || (uint32_t) starts[header.state_count] != header.component_count)
+			return 1;
+		for (i = 0; i < header.state_count; i++)
+			if (starts[i+1] < starts[i])
+				return 1;
+		if (header.codeword_count != 0 && model_file_check_codebook(file, &header))
+			return 1;
+	}
+	// Every name has to be inside the file, and terminated, and the words' states have to be numbered in order.
+	for (i = 0; i < header.word_count; i++) {
+		memcpy(&word, file->data + header.words_offset + i * sizeof(word), sizeof(word));
+		if (!model_file_fits(file->size, header.names_offset + word.name_offset, (uint64_t) word.name_length + 1, 1) ||
+				file->data[header.names_offset + word.name_offset + word.name_length] != '\0' ||
+				word.first_state != state || word.template_length > header.state_count - state)
+			return 1;
+		state += word.template_length;
+	}
+	if (state != header.state_count)
+		return 1;
+	file->entries = model_allocate(model, sizeof(recog_entry_t) * (header.word_count > 0 ? header.word_count : 1));
+	if (file->entries == NULL)
+		return 1;
+	const model_file_gaussian_t* gaussians = (const model_file_gaussian_t*) (file->data + header.gaussians_offset);
+	const model_file_gaussian_t* components = (const model_file_gaussian_t*) (file->data + header.components_offset);
+	for (i = 0; i < header.word_count; i++) {
+		recog_entry_t* recog_entry = &file->entries[i];
+		memcpy(&word, file->data + header.words_offset + i * sizeof(word), sizeof(word));
+		recog_entry->index = first_index + i;
+		recog_entry->name = (char*) file->data + header.names_offset + word.name_offset;
+		recog_entry->ll_offset = TINYSR_SCORE(word.ll_offset);
+		recog_entry->model_template_length = word.template_length;
+		recog_entry->first_state = word.first_state;
+		recog_entry->best_state_offset = TINYSR_SCORE(word.best_state_offset);
+		recog_entry->mixture_starts = NULL;
+		recog_entry->mixture = NULL;
+		// Only words with extra components get a mixture.
+		int has_mixture = starts != NULL && starts[word.first_state + word.template_length] > starts[word.first_state];
+#ifdef TINYSR_FIXED_POINT
+		recog_entry->ll_slope = saturate_fixed(word.ll_slope, 24);
+		recog_entry->model_template = model_allocate(model, sizeof(gaussian_t) * (word.template_length > 0 ? word.template_length : 1));
+		if (list_append_back(loaded, recog_entry)) {
+			model_deallocate(model, recog_entry->model_template);
+			return 1;
+		}
+		if (recog_entry->model_template == NULL)
+			return 1;
+		uint32_t j;
+		for (j = 0; j < word.template_length; j++)
+			model_file_gaussian_convert(&recog_entry->model_template[j], &gaussians[word.first_state + j]);
+		if (has_mixture) {
+			int first = starts[word.first_state], count = starts[word.first_state + word.template_length] - first;
+			recog_entry->mixture_starts = model_allocate(model, sizeof(int) * (word.template_length + 1));
+			recog_entry->mixture = model_allocate(model, sizeof(gaussian_t) * count);
+			if (recog_entry->mixture_starts == NULL || recog_entry->mixture == NULL)
+				return 1;
+			for (j = 0; j <= word.template_length; j++)
+				recog_entry->mixture_starts[j] = starts[word.first_state + j] - first;
+			for (j = 0; j < (uint32_t) count; j++)
+				model_file_gaussian_convert(&recog_entry->mixture[j], &components[first + j]);
+		}
+#else
+		recog_entry->ll_slope = word.ll_slope;
+		recog_entry->model_template = (gaussian_t*) &gaussians[word.first_state];
+		// The starts are for the whole file, so index straight into all its components.
+		if (has_mixture) {
+			recog_entry->mixture_starts = (int*) &starts[word.first_state];
+			recog_entry->mixture = (gaussian_t*) components;
+		}
+		if (list_append_back(loaded, recog_entry))
+			return 1;
+#endif
+	}
+	file->entry_count = header.word_count;
+	return 0;
+}
+
+#ifndef TINYSR_FIXED_POINT
+// Points a model loaded from one version 3 file at the file's codebook, picks and mixture weights. Returns
+// non-zero if the file has none, or they were built with different settings, leaving the model for
+// model_build_mixtures to build them.
+static int model_map_mixtures(tinysr_model_t* model, const model_file_t* file, const model_file_header_t* header) {
+	list_node_t* re;
+	if (header->version != MODEL_FILE_VERSION || header->component_count == 0 || header->codeword_count != MIXTURE_CODEWORDS ||
+			header->pick_limit != MIXTURE_MAX_SHORTLIST)
+		return 1;
+	const float* codebook = (const float*) (file->data + header->codebook_offset);
+	const int32_t* starts = (const int32_t*) (file->data + header->mixture_starts_offset);
+	model_free_mixtures(model);
+	memcpy(model->codeword_scale, codebook, sizeof(model->codeword_scale));
+	model->codewords = (float*) codebook + 16;
+	model->pick_starts = (int*) (file->data + header->pick_starts_offset);
+	model->picks = (mixture_pick_t*) (file->data + header->picks_offset);
+	model->mixture_weights = (float*) (file->data + header->mixture_weights_offset);
+	model->mixtures_mapped = 1;
+	model->component_count = header->component_count;
+	// The file numbers the components across all its words already.
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		entry->first_component = starts[entry->first_state];
+	}
+	return 0;
+}
+#endif
+
+// Adds entries to a model, loaded from a model file, of either format.
+// Returns the number of entries added, with -1 indicating an error, in which case the model is unchanged.
+static int model_load(tinysr_model_t* model, const char* path) {
+	model_file_t file;
+	list_t loaded = {0};
+	loaded.allocator = &model->allocator;
+	if (model_file_open(model, path, &file))
+		return -1;
+	uint32_t magic = 0;
+	if (file.size >= 4)
+		memcpy(&magic, file.data, 4);
+	int v2 = magic == MODEL_FILE_MAGIC;
+#ifndef TINYSR_FIXED_POINT
+	int was_empty = model->recog_entry_list.length == 0;
+#endif
+	if (v2 ? model_parse_v2(model, &file, &loaded, model->recog_entry_list.length) : model_parse_legacy(model, file.data, file.size, &loaded, model->recog_entry_list.length)) {
+		model_free_loaded(model, &loaded, v2 ? &file : NULL);
+		model_file_close(model, &file);
+		return -1;
+	}
+	// Version 2 files stay in memory, for their words to point into; legacy files are all copied out.
+	model_file_t* kept = NULL;
+	char** word_names = model_allocate(model, sizeof(char*) * (model->recog_entry_list.length + loaded.length));
+	if (v2 && word_names != NULL && (kept = model_allocate(model, sizeof(model_file_t))) != NULL)
+		*kept = file;
+	if (word_names == NULL || (v2 && (kept == NULL || list_append_back(&model->files, kept)))) {
+		model_deallocate(model, word_names);
+		model_deallocate(model, kept);
+		model_free_loaded(model, &loaded, v2 ? &file : NULL);
+		model_file_close(model, &file);
+		return -1;
+	}
+	if (!v2)
+		model_file_close(model, &file);
+	// Move the words over, and remake the table of all the word names.
+	int entries_read = loaded.length, i = 0;
+	list_splice_back(&model->recog_entry_list, &loaded);
+	model_deallocate(model, model->word_names);
+	model->word_names = word_names;
+	list_node_t* re;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next)
+		model->word_names[i++] = ((recog_entry_t*) re->datum)->name;
+#ifndef TINYSR_FIXED_POINT
+	// A version 2 or 3 file loaded on its own brings its slab along, if it was laid out for this build.
+	if (v2 && was_empty) {
+		model_file_header_t header = {0};
+		memcpy(&header, file.data, MODEL_FILE_V2_HEADER_SIZE);
+		if (header.version == MODEL_FILE_VERSION)
+			memcpy(&header, file.data, sizeof(header));
+		// Scoring reads it a panel at a time, so it has to have exactly as many as this build would make.
+		if (header.weights_offset != 0 && header.score_terms == SCORE_TERMS && header.state_align == SCORE_STATE_ALIGN &&
+				header.state_stride == (header.state_count + SCORE_STATE_ALIGN - 1) / SCORE_STATE_ALIGN * SCORE_STATE_ALIGN) {
+			model->score_weights = (float*) (file.data + header.weights_offset);
+			model->weights_mapped = 1;
+			model->state_count = header.state_count;
+			model->state_stride = header.state_stride;
+			// Its codebook comes along too, if it has one, and it was built with the same settings, or else
+			// it's built later.
+			model->stale = model_map_mixtures(model, &file, &header) ? MODEL_STALE_MIXTURES : 0;
+			return entries_read;
+		}
+	}
+#endif
+	// Otherwise, every word's Gaussians get gathered into one slab, for batched scoring, once they're all in.
+	model->stale = MODEL_STALE_ALL;
+	return entries_read;
+}
+
+#ifndef TINYSR_FIXED_POINT
+static int write_padding(FILE* fp, long alignment) {
+	static const char zeros[MODEL_FILE_ALIGN] = {0};
+	long at = ftell(fp);
+	return at < 0 || fwrite(zeros, 1, (alignment - at % alignment) % alignment, fp) != (size_t) ((alignment - at % alignment) % alignment);
+}
+
+// Writes out a model in the legacy format, recovering each inverse covariance as twice U^T U.
+static int model_save_legacy(tinysr_model_t* model, FILE* fp) {
+	list_node_t* re;
+	int failed = 0, i, j, k, l;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		uint32_t name_length = strlen(entry->name), template_length = entry->model_template_length;
+		float ll_offset = entry->ll_offset, ll_slope = entry->ll_slope;
+		failed |= fwrite(&name_length, 4, 1, fp) != 1 || fwrite(entry->name, 1, name_length, fp) != name_length;
+		failed |= fwrite(&ll_offset, 4, 1, fp) != 1 || fwrite(&ll_slope, 4, 1, fp) != 1 || fwrite(&template_length, 4, 1, fp) != 1;
+		for (i = 0; i < entry->model_template_length; i++) {
+			gaussian_t* gauss = &entry->model_template[i];
+			double factor[169] = {0};
+			float inverse_covariance[169];
+			// Unpack U, row by row from the diagonal on, as gaussian_init packed it.
+			for (j = 0, l = 0; j < 13; j++) {
+				if (gauss->diagonal)
+					factor[j + j*13] = gauss->cepstrum_factor[j];
+				else
+					for (k = j; k < 13; k++)
+						factor[k + j*13] = gauss->cepstrum_factor[l++];
+			}
+			for (j = 0; j < 13; j++) {
+				for (k = 0; k < 13; k++) {
+					double sum = 0;
+					for (l = 0; l <= j && l <= k; l++)
+						sum += factor[j + l*13] * factor[k + l*13];
+					inverse_covariance[k + j*13] = 2 * sum;
+				}
+			}
+			failed |= fwrite(&gauss->log_likelihood_offset, 4, 1, fp) != 1 || fwrite(gauss->cepstrum_mean, 4, 13, fp) != 13 ||
+				fwrite(inverse_covariance, 4, 169, fp) != 169;
+		}
+	}
+	return failed;
+}
+
+// Writes out a model in version 2 or 3 format.
+static int model_save_v2(tinysr_model_t* model, FILE* fp, int version) {
+	list_node_t* re;
+	model_file_header_t header = {MODEL_FILE_MAGIC, version, model->recog_entry_list.length, model->state_count,
+		model->state_stride, SCORE_TERMS, SCORE_STATE_ALIGN, sizeof(model_file_gaussian_t)};
+	uint64_t names_length = 0;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next)
+		names_length += strlen(((recog_entry_t*) re->datum)->name) + 1;
+	header.words_offset = version == 3 ? sizeof(header) : MODEL_FILE_V2_HEADER_SIZE;
+	header.names_offset = header.words_offset + sizeof(model_file_word_t) * header.word_count;
+	header.gaussians_offset = (header.names_offset + names_length + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+	header.weights_offset = (header.gaussians_offset + sizeof(model_file_gaussian_t) * header.state_count + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+	header.component_count = model->component_count;
+	header.mixture_starts_offset = (header.weights_offset + sizeof(float) * SCORE_TERMS * header.state_stride + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+	header.components_offset = (header.mixture_starts_offset + sizeof(int32_t) * (header.state_count + 1) + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+	if (model->component_count != 0) {
+		header.codeword_count = MIXTURE_CODEWORDS;
+		header.pick_count = model->pick_starts[MIXTURE_CODEWORDS];
+		header.pick_limit = MIXTURE_MAX_SHORTLIST;
+		header.codebook_offset = (header.components_offset + sizeof(model_file_gaussian_t) * header.component_count + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+		header.pick_starts_offset = header.codebook_offset + sizeof(float) * (16 + 13 * MIXTURE_CODEWORDS);
+		header.picks_offset = (header.pick_starts_offset + sizeof(int32_t) * (MIXTURE_CODEWORDS + 1) + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+		header.mixture_weights_offset = (header.picks_offset + sizeof(mixture_pick_t) * header.pick_count + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+	}
+	if (version == 2)
+		header.component_count = header.mixture_starts_offset = header.components_offset = 0;
+	int failed = fwrite(&header, header.words_offset, 1, fp) != 1;
+	uint32_t name_offset = 0;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		model_file_word_t word = {name_offset, strlen(entry->name), entry->ll_offset, entry->ll_slope,
+			entry->model_template_length, entry->first_state, entry->best_state_offset, 0};
+		failed |= fwrite(&word, sizeof(word), 1, fp) != 1;
+		name_offset += word.name_length + 1;
+	}
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		const char* name = ((recog_entry_t*) re->datum)->name;
+		failed |= fwrite(name, 1, strlen(name) + 1, fp) != strlen(name) + 1;
+	}
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		failed |= fwrite(entry->model_template, sizeof(gaussian_t), entry->model_template_length, fp) != (size_t) entry->model_template_length;
+	}
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	failed |= fwrite(model->score_weights, sizeof(float) * SCORE_TERMS, model->state_stride, fp) != (size_t) model->state_stride;
+	if (version == 2)
+		return failed;
+	// The starts, renumbered across all the words, and then the components themselves.
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	int32_t start = 0;
+	int j;
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		for (j = 0; j < entry->model_template_length; j++) {
+			failed |= fwrite(&start, sizeof(start), 1, fp) != 1;
+			if (entry->mixture_starts != NULL)
+				start += entry->mixture_starts[j+1] - entry->mixture_starts[j];
+		}
+	}
+	failed |= fwrite(&start, sizeof(start), 1, fp) != 1;
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	for (re = model->recog_entry_list.head; re != NULL; re = re->next) {
+		recog_entry_t* entry = re->datum;
+		if (entry->mixture_starts == NULL)
+			continue;
+		size_t count = entry->mixture_starts[entry->model_template_length] - entry->mixture_starts[0];
+		failed |= fwrite(entry->mixture + entry->mixture_starts[0], sizeof(gaussian_t), count, fp) != count;
+	}
+	if (model->component_count == 0)
+		return failed;
+	float scale[16] = {0};
+	memcpy(scale, model->codeword_scale, sizeof(model->codeword_scale));
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	failed |= fwrite(scale, sizeof(scale), 1, fp) != 1;
+	failed |= fwrite(model->codewords, sizeof(float) * 13, MIXTURE_CODEWORDS, fp) != MIXTURE_CODEWORDS;
+	failed |= fwrite(model->pick_starts, sizeof(int32_t), MIXTURE_CODEWORDS + 1, fp) != MIXTURE_CODEWORDS + 1;
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	failed |= fwrite(model->picks, sizeof(mixture_pick_t), header.pick_count, fp) != header.pick_count;
+	failed |= write_padding(fp, MODEL_FILE_ALIGN);
+	failed |= fwrite(model->mixture_weights, sizeof(float) * SCORE_TERMS, model->component_count, fp) != (size_t) model->component_count;
+	return failed;
+}
+
+int tinysr_model_save(tinysr_model_t* model, const char* path, tinysr_model_format_t format) {
+	if (format != TINYSR_MODEL_LEGACY && format != TINYSR_MODEL_V2 && format != TINYSR_MODEL_V3)
+		return 1;
+	// The words' states are numbered, and their mixture components counted, only once the model's built.
+	if (model_finish(model))
+		return 1;
+	// Only version 3 files can hold mixture states.
+	if (format != TINYSR_MODEL_V3 && model->component_count != 0)
+		return 1;
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+		return 1;
+	int failed = format == TINYSR_MODEL_LEGACY ? model_save_legacy(model, fp) : model_save_v2(model, fp, format);
+	failed |= fclose(fp) != 0;
+	return failed;
+}
+#endif
+
+tinysr_model_t* tinysr_model_create(const tinysr_allocator_t* allocator) {
+	if (allocator == NULL)
+		allocator = &system_allocator;
+	tinysr_model_t* model = allocator->allocate(allocator->user, sizeof(tinysr_model_t));
+	if (model == NULL)
+		return NULL;
+	model->allocator = *allocator;
+#ifndef TINYSR_NO_THREADS
+	atomic_init(&model->references, 1);
+#else
+	model->references = 1;
+#endif
+	model->recog_entry_list = (list_t){0};
+	model->files = (list_t){0};
+	model->recog_entry_list.allocator = model->files.allocator = &model->allocator;
+	model->word_names = NULL;
+	model->state_count = model->state_stride = 0;
+#ifndef TINYSR_FIXED_POINT
+	model->score_weights = NULL;
+	model->weights_mapped = 0;
+#endif
+	model->component_count = 0;
+	model->codewords = NULL;
+	model->pick_starts = NULL;
+	model->picks = NULL;
+#ifdef TINYSR_FIXED_POINT
+	model->components = NULL;
+#else
+	model->mixture_weights = NULL;
+	model->mixtures_mapped = 0;
+#endif
+	model->stale = 0;
+#ifndef TINYSR_NO_THREADS
+	pthread_mutex_init(&model->build_lock, NULL);
+#endif
+	return model;
+}
+
+int tinysr_model_load(tinysr_model_t* model, const char* path) {
+	// With the only reference, the caller knows no context can be reading the model.
+	if (model_add_references(model, 0) != 1)
+		return -1;
+	return model_load(model, path);
+}
+
+int tinysr_model_add_word(tinysr_model_t* model, const char* name, float ll_offset, float ll_slope, int template_length,
+		const float* log_likelihood_offsets, const float* means, const float* inverse_covariances) {
+	return tinysr_model_add_mixture_word(model, name, ll_offset, ll_slope, template_length, NULL, log_likelihood_offsets, means, inverse_covariances);
+}
+
+int tinysr_model_add_mixture_word(tinysr_model_t* model, const char* name, float ll_offset, float ll_slope, int template_length,
+		const int* component_counts, const float* log_likelihood_offsets, const float* means, const float* inverse_covariances) {
+	if (model_add_references(model, 0) != 1 || template_length <= 0)
+		return -1;
+	int words = model->recog_entry_list.length, components = 0, i, j;
+	for (i = 0; component_counts != NULL && i < template_length; i++) {
+		if (component_counts[i] <= 0)
+			return -1;
+		components += component_counts[i] - 1;
+	}
+	recog_entry_t* recog_entry = model_allocate(model, sizeof(recog_entry_t));
+	char** word_names = model_allocate(model, sizeof(char*) * (words + 1));
+	if (recog_entry == NULL || word_names == NULL) {
+		model_deallocate(model, recog_entry);
+		model_deallocate(model, word_names);
+		return -1;
+	}
+	recog_entry->index = words;
+	recog_entry->name = model_allocate(model, strlen(name) + 1);
+	recog_entry->ll_offset = TINYSR_SCORE(ll_offset);
+#ifdef TINYSR_FIXED_POINT
+	recog_entry->ll_slope = saturate_fixed(ll_slope, 24);
+#else
+	recog_entry->ll_slope = ll_slope;
+#endif
+	recog_entry->model_template_length = template_length;
+	recog_entry->model_template = model_allocate(model, sizeof(gaussian_t) * template_length);
+	recog_entry->mixture_starts = NULL;
+	recog_entry->mixture = NULL;
+	int failed = recog_entry->name == NULL || recog_entry->model_template == NULL;
+	if (components > 0) {
+		recog_entry->mixture_starts = model_allocate(model, sizeof(int) * (template_length + 1));
+		recog_entry->mixture = model_allocate(model, sizeof(gaussian_t) * components);
+		failed |= recog_entry->mixture_starts == NULL || recog_entry->mixture == NULL;
+	}
+	// Each state's first component goes in the template, and the rest in the mixture.
+	int component = 0, extra = 0;
+	for (i = 0; i < template_length && !failed; i++) {
+		if (recog_entry->mixture_starts != NULL)
+			recog_entry->mixture_starts[i] = extra;
+		int count = component_counts != NULL ? component_counts[i] : 1;
+		for (j = 0; j < count && !failed; j++, component++) {
+			gaussian_t* gauss = j == 0 ? &recog_entry->model_template[i] : &recog_entry->mixture[extra++];
+			failed = gaussian_init(gauss, log_likelihood_offsets[component], means + component*13, inverse_covariances + component*169);
+		}
+	}
+	if (recog_entry->mixture_starts != NULL && !failed)
+		recog_entry->mixture_starts[template_length] = extra;
+	if (!failed) {
+		strcpy(recog_entry->name, name);
+		failed = list_append_back(&model->recog_entry_list, recog_entry);
+	}
+	if (failed) {
+		model_deallocate(model, recog_entry->name);
+		model_deallocate(model, recog_entry->model_template);
+		model_deallocate(model, recog_entry->mixture_starts);
+		model_deallocate(model, recog_entry->mixture);
+		model_deallocate(model, recog_entry);
+		model_deallocate(model, word_names);
+		return -1;
+	}
+	if (words > 0)
+		memcpy(word_names, model->word_names, sizeof(char*) * words);
+	word_names[words] = recog_entry->name;
+	model_deallocate(model, model->word_names);
+	model->word_names = word_names;
+	// The slab is built once all the words are in.
+	model->stale = MODEL_STALE_ALL;
+	return words;
+}
+
+void tinysr_model_retain(tinysr_model_t* model) {
+	model_add_references(model, 1);
+}
+
+void tinysr_model_release(tinysr_model_t* model) {
+	if (model == NULL || model_add_references(model, -1) > 0)
+		return;
+	while (model->recog_entry_list.length) {
+		recog_entry_t* recog_entry = (recog_entry_t*) list_pop_front(&model->recog_entry_list);
+		// Words from version 2 files keep their names and Gaussians in the file, and share one block of entries.
+		if (!model_file_holds(model, recog_entry->name))
+			model_deallocate(model, recog_entry->name);
+		if (!model_file_holds(model, recog_entry->model_template))
+			model_deallocate(model, recog_entry->model_template);
+		if (recog_entry->mixture_starts != NULL && !model_file_holds(model, recog_entry->mixture_starts))
+			model_deallocate(model, recog_entry->mixture_starts);
+		if (recog_entry->mixture != NULL && !model_file_holds(model, recog_entry->mixture))
+			model_deallocate(model, recog_entry->mixture);
+		if (!model_file_holds(model, recog_entry))
+			model_deallocate(model, recog_entry);
+	}
+	model_deallocate(model, model->word_names);
+	model_free_mixtures(model);
+#ifndef TINYSR_FIXED_POINT
+	if (!model->weights_mapped)
+		model_deallocate(model, model->score_weights);
+#endif
+	while (model->files.length) {
+		model_file_t* file = list_pop_front(&model->files);
+		model_file_close(model, file);
+		model_deallocate(model, file->entries);
+		model_deallocate(model, file);
+	}
+#ifndef TINYSR_NO_THREADS
+	pthread_mutex_destroy(&model->build_lock);
+#endif
+	tinysr_allocator_t allocator = model->allocator;
+	allocator.release(allocator.user, model);
+}
+
+int tinysr_bind_model(tinysr_ctx_t* ctx, tinysr_model_t* model) {
+	// Rebinding the same model, after loading more words into it, keeps the thresholds of the words it had.
+	int kept_words = model == ctx->model ? ctx->recog_entry_list.length : 0;
+	// A model that can't be built leaves the context with no words at all.
+	if (model != NULL && model_finish(model)) {
+		tinysr_bind_model(ctx, NULL);
+		return 1;
+	}
+	if (model != NULL)
+		tinysr_model_retain(model);
+	tinysr_model_release(ctx->model);
+	ctx->model = model;
+	ctx->recog_entry_list = model != NULL ? model->recog_entry_list : (list_t){0};
+	ctx->word_names = model != NULL ? model->word_names : NULL;
+#ifndef TINYSR_FIXED_POINT
+	ctx->score_weights = model != NULL ? model->score_weights : NULL;
+#endif
+	return build_scratch(ctx, kept_words);
+}
+
+int tinysr_load_model(tinysr_ctx_t* ctx, const char* path) {
+	tinysr_model_t* model = ctx->model;
+	if (model == NULL) {
+		// The context's own model lives as long as the context, so it takes the memory a context's model
+		// would, but in pool mode, not from the pool, which only the context may use.
+		model = tinysr_model_create(ctx->use_pool ? &ctx->pool.backing : &ctx->allocator);
+		if (model == NULL)
+			return -1;
+	} else if (model_add_references(model, 0) != 1) {
+		// Other contexts are using the model, so it can't change.
+		return -1;
+	} else {
+		tinysr_model_retain(model);
+	}
+	int entries_read = model_load(model, path);
+	// Rebind, to pick up the new words, then drop the reference taken above.
+	if (tinysr_bind_model(ctx, model))
+		entries_read = -1;
+	tinysr_model_release(model);
+	return entries_read;
+}
+
+// Write out a CSV file containing a given utterance.
+// Returns non-zero on error, but doesn't print anything or call perror, or anything like that.
+int write_feature_vector_csv(const char* path, utterance_t* utterance) {
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL)
+		return 1;
+	int i;
 	for (i = 0; i < utterance->length; i++) {
 		feature_vector_t* fv = &utterance->feature_vectors[i];
 		// Write out the log energy.
-		fprintf(fp, "%f", fv->log_energy);
+		fprintf(fp, "%f", TINYSR_FEATURE_TO_FLOAT(fv->log_energy));
 		// Write out the 13 cepstral components.
 		int j;
 		for (j = 0; j < 13; j++)
-			fprintf(fp, ",%f", fv->cepstrum[j]);
+			fprintf(fp, ",%f", TINYSR_FEATURE_TO_FLOAT(fv->cepstrum[j]));
 		fprintf(fp, "\n");
 	}
-	fclose(fp);
+	fclose(fp);
+	return 0;
+}
+
+// Reads in an input CSV file, and returns a constructed utterance_t object.
+utterance_t* read_feature_vector_csv(const char* path) {
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	// Count the number of lines in the input file.
+	int lines = 0;
+	while (!feof(fp))
+		if (fgetc(fp) == '\n')
+			lines++;
+	rewind(fp);
+	// Now slurp up the CSV file, reading in one feature vector per line.
+	utterance_t* result = malloc(sizeof(utterance_t));
+	result->length = lines;
+	result->feature_vectors = malloc(sizeof(feature_vector_t) * lines);
+	int i;
+	for (i = 0; i < lines; i++) {
+		feature_vector_t* fv = &result->feature_vectors[i];
+		// Read in the log energy, and the 13 cepstral components.
+		float value;
+		fscanf(fp, "%f", &value);
+		fv->log_energy = TINYSR_FEATURE(value);
+		int j;
+		for (j = 0; j < 13; j++) {
+			fscanf(fp, ",%f", &value);
+			fv->cepstrum[j] = TINYSR_FEATURE(value);
+		}
+		fscanf(fp, "\n");
+	}
+	fclose(fp);
+	return result;
+}
+
+// Corpus files hold any number of labeled utterances, ready to use without parsing anything. They start
+// with a corpus_file_header_t, followed by each utterance's frames, laid out as feature_vector_t is in the
+// floating point build, so that it can use them straight out of a read-only mapping of the file, and the
+// index, one corpus_file_entry_t per utterance, and the labels, each null terminated, each with room kept
+// after it to grow into (index_room and labels_room). Appending writes new frames at the end of the file.
+// If the new entries and labels fit in the room kept for them, the index and labels are rewritten in place,
+// the old entries and labels over themselves with identical bytes, and the new ones into the room after
+// them. Otherwise they move to the end of the file, after the new frames, with room for twice as many. In
+// either case, nothing the old header points at changes, and the header is written last, so an interrupted
+// append leaves the corpus as it was. Little endian.
+#define CORPUS_FILE_MAGIC 0x43525354
+#define CORPUS_FILE_VERSION 2
+#define CORPUS_FILE_ALIGN 8
+
+typedef struct {
+	// "TSRC", and CORPUS_FILE_VERSION.
+	uint32_t magic, version;
+	uint32_t frame_size, utterance_count;
+	// From the start of the file.
+	uint64_t index_offset, labels_offset, labels_size;
+	// The room kept for the index, in entries, and for the labels, in bytes, for writers to add to in place.
+	uint64_t index_room, labels_room;
+} corpus_file_header_t;
+
+typedef struct {
+	// From the start of the file, and in frames.
+	uint64_t frames_offset;
+	uint32_t length;
+	// From labels_offset, and not counting the null terminator.
+	uint32_t label_offset, label_length, reserved;
+} corpus_file_entry_t;
+
+// A frame, as feature_vector_t is in the floating point build.
+typedef struct {
+	int64_t number;
+	float log_energy;
+	float cepstrum[13];
+	float noise_floor;
+	uint32_t reserved;
+} corpus_file_frame_t;
+
+#ifndef TINYSR_FIXED_POINT
+_Static_assert(sizeof(feature_vector_t) == sizeof(corpus_file_frame_t) && offsetof(feature_vector_t, cepstrum) == offsetof(corpus_file_frame_t, cepstrum) &&
+	offsetof(feature_vector_t, noise_floor) == offsetof(corpus_file_frame_t, noise_floor), "feature_vector_t must match the corpus file's frames");
+#endif
+
+struct tinysr_corpus {
+	unsigned char* data;
+	size_t size;
+	int count;
+	const corpus_file_entry_t* index;
+	const char* labels;
+#ifdef TINYSR_FIXED_POINT
+	// Without floating point, the frames have to be converted: utterance i's start at frames + starts[i].
+	feature_vector_t* frames;
+	size_t* starts;
+#endif
+};
+
+struct tinysr_corpus_writer {
+	FILE* fp;
+	corpus_file_entry_t* index;
+	int count, capacity;
+	char* labels;
+	size_t labels_size, labels_capacity;
+	// Where the index and labels are in the file, and the room kept for them there, as in the header.
+	uint64_t index_offset, labels_offset, index_room, labels_room;
+	int failed;
+};
+
+tinysr_corpus_t* tinysr_corpus_open(const char* path) {
+	corpus_file_header_t header;
+	uint32_t i;
+	tinysr_corpus_t* corpus = malloc(sizeof(tinysr_corpus_t));
+	if (corpus == NULL)
+		return NULL;
+	if (file_map(&system_allocator, path, &corpus->data, &corpus->size)) {
+		free(corpus);
+		return NULL;
+	}
+	// The index and labels have to be inside the file, and so does every utterance's frames and label.
+	int failed = corpus->size < sizeof(header);
+	if (!failed) {
+		memcpy(&header, corpus->data, sizeof(header));
+		failed = header.magic != CORPUS_FILE_MAGIC || header.version != CORPUS_FILE_VERSION || header.frame_size != sizeof(corpus_file_frame_t) ||
+			header.utterance_count > INT32_MAX || header.index_offset % CORPUS_FILE_ALIGN != 0 ||
+			!model_file_fits(corpus->size, header.index_offset, header.utterance_count, sizeof(corpus_file_entry_t)) ||
+			!model_file_fits(corpus->size, header.labels_offset, header.labels_size, 1);
+	}
+	if (!failed) {
+		corpus->count = header.utterance_count;
+		corpus->index = (const corpus_file_entry_t*) (corpus->data + header.index_offset);
+		corpus->labels = (const char*) corpus->data + header.labels_offset;
+		for (i = 0; i < header.utterance_count && !failed; i++) {
+			const corpus_file_entry_t* entry = &corpus->index[i];
+			failed = entry->frames_offset % CORPUS_FILE_ALIGN != 0 || !model_file_fits(corpus->size, entry->frames_offset, entry->length, sizeof(corpus_file_frame_t)) ||
+				(uint64_t) entry->label_offset + entry->label_length >= header.labels_size || corpus->labels[entry->label_offset + entry->label_length] != '\0';
+		}
+	}
+#ifdef TINYSR_FIXED_POINT
+	corpus->frames = NULL;
+	corpus->starts = NULL;
+	if (!failed) {
+		size_t total = 0, f;
+		int k;
+		corpus->starts = malloc(sizeof(size_t) * (corpus->count + 1));
+		failed = corpus->starts == NULL;
+		for (i = 0; i < header.utterance_count && !failed; i++) {
+			corpus->starts[i] = total;
+			total += corpus->index[i].length;
+		}
+		corpus->frames = failed ? NULL : malloc(sizeof(feature_vector_t) * (total > 0 ? total : 1));
+		failed |= corpus->frames == NULL;
+		for (i = 0; i < header.utterance_count && !failed; i++) {
+			const corpus_file_frame_t* from = (const corpus_file_frame_t*) (corpus->data + corpus->index[i].frames_offset);
+			for (f = 0; f < corpus->index[i].length; f++) {
+				feature_vector_t* fv = &corpus->frames[corpus->starts[i] + f];
+				fv->number = from[f].number;
+				fv->log_energy = saturate_fixed(from[f].log_energy, TINYSR_FEATURE_FRACTION_BITS);
+				for (k = 0; k < 13; k++)
+					fv->cepstrum[k] = saturate_fixed(from[f].cepstrum[k], TINYSR_FEATURE_FRACTION_BITS);
+				fv->noise_floor = saturate_fixed(from[f].noise_floor, TINYSR_FEATURE_FRACTION_BITS);
+			}
+		}
+	}
+#endif
+	if (failed) {
+		tinysr_corpus_close(corpus);
+		return NULL;
+	}
+	return corpus;
+}
+
+int tinysr_corpus_count(const tinysr_corpus_t* corpus) {
+	return corpus->count;
+}
+
+const char* tinysr_corpus_label(const tinysr_corpus_t* corpus, int index) {
+	if (index < 0 || index >= corpus->count)
+		return NULL;
+	return corpus->labels + corpus->index[index].label_offset;
+}
+
+int tinysr_corpus_utterance(const tinysr_corpus_t* corpus, int index, utterance_t* utterance) {
+	if (index < 0 || index >= corpus->count)
+		return 1;
+	utterance->length = corpus->index[index].length;
+#ifdef TINYSR_FIXED_POINT
+	utterance->feature_vectors = corpus->frames + corpus->starts[index];
+#else
+	utterance->feature_vectors = (feature_vector_t*) (corpus->data + corpus->index[index].frames_offset);
+#endif
+	return 0;
+}
+
+void tinysr_corpus_close(tinysr_corpus_t* corpus) {
+	if (corpus == NULL)
+		return;
+	file_unmap(&system_allocator, corpus->data, corpus->size);
+#ifdef TINYSR_FIXED_POINT
+	free(corpus->frames);
+	free(corpus->starts);
+#endif
+	free(corpus);
+}
+
+// Pads the file out to the next multiple of CORPUS_FILE_ALIGN, for the next utterance's frames, or the index.
+static int corpus_pad(FILE* fp) {
+	static const char zeros[CORPUS_FILE_ALIGN] = {0};
+	long at = ftell(fp);
+	size_t padding = at < 0 ? 0 : (CORPUS_FILE_ALIGN - at % CORPUS_FILE_ALIGN) % CORPUS_FILE_ALIGN;
+	return at < 0 || fwrite(zeros, 1, padding, fp) != padding;
+}
+
+tinysr_corpus_writer_t* tinysr_corpus_writer_open(const char* path) {
+	tinysr_corpus_writer_t* writer = calloc(1, sizeof(tinysr_corpus_writer_t));
+	if (writer == NULL)
+		return NULL;
+	writer->fp = fopen(path, "r+b");
+	long size = 0;
+	if (writer->fp != NULL && fseek(writer->fp, 0, SEEK_END) == 0)
+		size = ftell(writer->fp);
+	if (writer->fp != NULL && size > 0) {
+		// Carry over the index and labels of what's there, which has to be a corpus.
+		tinysr_corpus_t* corpus = tinysr_corpus_open(path);
+		writer->failed = corpus == NULL;
+		if (corpus != NULL) {
+			writer->capacity = corpus->count;
+			writer->index = malloc(sizeof(corpus_file_entry_t) * (writer->capacity > 0 ? writer->capacity : 1));
+			corpus_file_header_t header;
+			memcpy(&header, corpus->data, sizeof(header));
+			writer->labels_size = writer->labels_capacity = header.labels_size;
+			writer->labels = malloc(writer->labels_capacity > 0 ? writer->labels_capacity : 1);
+			writer->failed = writer->index == NULL || writer->labels == NULL;
+			if (!writer->failed) {
+				writer->count = corpus->count;
+				memcpy(writer->index, corpus->index, sizeof(corpus_file_entry_t) * writer->count);
+				memcpy(writer->labels, corpus->labels, writer->labels_size);
+			}
+			// The index and labels can only grow in place if the room the header claims for them is really there.
+			if (header.index_room >= header.utterance_count && header.labels_room >= header.labels_size &&
+					model_file_fits(corpus->size, header.index_offset, header.index_room, sizeof(corpus_file_entry_t)) &&
+					model_file_fits(corpus->size, header.labels_offset, header.labels_room, 1)) {
+				writer->index_offset = header.index_offset;
+				writer->labels_offset = header.labels_offset;
+				writer->index_room = header.index_room;
+				writer->labels_room = header.labels_room;
+			}
+			tinysr_corpus_close(corpus);
+		}
+		writer->failed = writer->failed || fseek(writer->fp, 0, SEEK_END) != 0 || corpus_pad(writer->fp);
+	} else {
+		// A new corpus starts out empty, but readable.
+		if (writer->fp == NULL)
+			writer->fp = fopen(path, "w+b");
+		corpus_file_header_t header = {CORPUS_FILE_MAGIC, CORPUS_FILE_VERSION, sizeof(corpus_file_frame_t), 0,
+			sizeof(header), sizeof(header), 0, 0, 0};
+		writer->failed = writer->fp == NULL || fseek(writer->fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, writer->fp) != 1;
+	}
+	if (writer->failed) {
+		if (writer->fp != NULL)
+			fclose(writer->fp);
+		free(writer->index);
+		free(writer->labels);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+int tinysr_corpus_append(tinysr_corpus_writer_t* writer, const char* label, const utterance_t* utterance) {
+	size_t label_length = strlen(label);
+	int f, k;
+	if (writer->count == INT32_MAX || utterance->length < 0 || label_length > UINT32_MAX - writer->labels_size - 1)
+		return 1;
+	if (writer->count == writer->capacity) {
+		int capacity = writer->capacity < 16 ? 16 : writer->capacity * 2;
+		corpus_file_entry_t* index = realloc(writer->index, sizeof(corpus_file_entry_t) * capacity);
+		if (index == NULL)
+			return 1;
+		writer->index = index;
+		writer->capacity = capacity;
+	}
+	if (writer->labels_size + label_length + 1 > writer->labels_capacity) {
+		size_t capacity = (writer->labels_size + label_length + 1) * 2;
+		char* labels = realloc(writer->labels, capacity);
+		if (labels == NULL)
+			return 1;
+		writer->labels = labels;
+		writer->labels_capacity = capacity;
+	}
+	long at = ftell(writer->fp);
+	if (at < 0)
+		return writer->failed = 1;
+	corpus_file_entry_t entry = {at, utterance->length, writer->labels_size, label_length, 0};
+	for (f = 0; f < utterance->length; f++) {
+		const feature_vector_t* fv = &utterance->feature_vectors[f];
+		corpus_file_frame_t frame = {fv->number, TINYSR_FEATURE_TO_FLOAT(fv->log_energy), {0}, TINYSR_FEATURE_TO_FLOAT(fv->noise_floor), 0};
+		for (k = 0; k < 13; k++)
+			frame.cepstrum[k] = TINYSR_FEATURE_TO_FLOAT(fv->cepstrum[k]);
+		if (fwrite(&frame, sizeof(frame), 1, writer->fp) != 1)
+			return writer->failed = 1;
+	}
+	memcpy(writer->labels + writer->labels_size, label, label_length + 1);
+	writer->labels_size += label_length + 1;
+	writer->index[writer->count++] = entry;
 	return 0;
 }
 
-// Reads in an input CSV file, and returns a constructed utterance_t object.
-utterance_t* read_feature_vector_csv(const char* path) {
-	FILE* fp = fopen(path, "r");
-	if (fp == NULL) {
-		perror(path);
+// Writes size bytes of data, followed by zeros, to fill room bytes.
+static int corpus_write_room(FILE* fp, const void* data, size_t size, uint64_t room) {
+	static const char zeros[4096] = {0};
+	int failed = fwrite(data, 1, size, fp) != size;
+	for (room -= size; room > 0 && !failed; ) {
+		size_t chunk = room < sizeof(zeros) ? room : sizeof(zeros);
+		failed = fwrite(zeros, 1, chunk, fp) != chunk;
+		room -= chunk;
+	}
+	return failed;
+}
+
+int tinysr_corpus_writer_close(tinysr_corpus_writer_t* writer) {
+	int failed = writer->failed;
+	if (writer->count > writer->index_room || writer->labels_size > writer->labels_room) {
+		// Once the index or labels outgrow their room, they move to the end of the file, with room for twice as
+		// many, so however few utterances each writer appends, the room left behind adds up to less than the
+		// room in use. Until the new header is out, the old index and labels are left as they were.
+		failed |= fseek(writer->fp, 0, SEEK_END) != 0 || corpus_pad(writer->fp);
+		long at = ftell(writer->fp);
+		failed |= at < 0;
+		writer->index_room = writer->count < 8 ? 16 : (uint64_t) writer->count * 2;
+		writer->labels_room = writer->labels_size < 64 ? 128 : (uint64_t) writer->labels_size * 2;
+		writer->index_offset = at;
+		writer->labels_offset = at + sizeof(corpus_file_entry_t) * writer->index_room;
+	}
+	// Otherwise the new entries and labels go in after the old ones, which are written over with themselves.
+	failed |= fseek(writer->fp, writer->index_offset, SEEK_SET) != 0 ||
+		corpus_write_room(writer->fp, writer->index, sizeof(corpus_file_entry_t) * writer->count, sizeof(corpus_file_entry_t) * writer->index_room);
+	failed |= fseek(writer->fp, writer->labels_offset, SEEK_SET) != 0 ||
+		corpus_write_room(writer->fp, writer->labels, writer->labels_size, writer->labels_room);
+	corpus_file_header_t header = {CORPUS_FILE_MAGIC, CORPUS_FILE_VERSION, sizeof(corpus_file_frame_t), writer->count,
+		writer->index_offset, writer->labels_offset, writer->labels_size, writer->index_room, writer->labels_room};
+	// Only once everything the new header points at is out does it replace the old one.
+	failed |= fflush(writer->fp) != 0;
+	if (!failed)
+		failed = fseek(writer->fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, writer->fp) != 1;
+	failed |= fclose(writer->fp) != 0;
+	free(writer->index);
+	free(writer->labels);
+	free(writer);
+	return failed;
+}
+
+// Mel scale conversions, as defined in ES 201 108 4.2.9.
+static double mel_scale(double frequency) {
+	return 2595.0 * log10(1.0 + frequency / 700.0);
+}
+
+static double mel_scale_inverse(double mel) {
+	return (pow(10.0, mel / 2595.0) - 1.0) * 700.0;
+}
+
+// Rounds a table size up so the next table stays 64 byte aligned.
+static size_t align_table_size(size_t bytes) {
+	return (bytes + 63) & ~(size_t)63;
+}
+
+// Builds all the front-end tables for the given parameters.
+// This is where the sample rate, frame length and FFT length assumptions of the front-end live.
+tinysr_frontend_plan_t* tinysr_frontend_plan_create(int sample_rate, int frame_length, int shift_interval, int fft_length) {
+	if (sample_rate <= 0 || frame_length < 2 || shift_interval <= 0 || shift_interval > frame_length || fft_length < frame_length)
 		return NULL;
+	tinysr_frontend_plan_t* plan = malloc(sizeof(tinysr_frontend_plan_t));
+	if (plan == NULL)
+		return NULL;
+	plan->sample_rate = sample_rate;
+	plan->frame_length = frame_length;
+	plan->shift_interval = shift_interval;
+	plan->fft_length = fft_length;
+	plan->table_storage = NULL;
+	plan->fft_plan = tinysr_fft_plan_create(fft_length);
+	if (plan->fft_plan == NULL)
+		goto tinysr_frontend_plan_create_error;
+	// Compute the mel filter center bins. (ES 201 108 4.2.9)
+	// The centers are equally spaced on the mel scale from MEL_START_FREQUENCY to the Nyquist frequency,
+	// and then the edges of the bank at those two frequencies are added on either side.
+	int i, k;
+	double mel_low = mel_scale(MEL_START_FREQUENCY), mel_high = mel_scale(sample_rate / 2.0);
+	plan->cbin[0] = (int) round(MEL_START_FREQUENCY * fft_length / sample_rate);
+	for (k = 1; k <= MEL_FILTER_COUNT; k++) {
+		double center = mel_scale_inverse(mel_low + k * (mel_high - mel_low) / (MEL_FILTER_COUNT + 1));
+		plan->cbin[k] = (int) round(center * fft_length / sample_rate);
 	}
-	// Count the number of lines in the input file.
-	int lines = 0;
-	while (!feof(fp))
-		if (fgetc(fp) == '\n')
-			lines++;
-	rewind(fp);
-	// Now slurp up the CSV file, reading in one feature vector per line.
-	utterance_t* result = malloc(sizeof(utterance_t));
-	result->length = lines;
-	result->feature_vectors = malloc(sizeof(feature_vector_t) * lines);
+	plan->cbin[MEL_FILTER_COUNT + 1] = fft_length / 2;
+	// If the FFT is too short for the bank, then some filters would be degenerate.
+	for (k = 0; k <= MEL_FILTER_COUNT; k++)
+		if (plan->cbin[k+1] <= plan->cbin[k])
+			goto tinysr_frontend_plan_create_error;
+	// Lay out the sparse mel weights, one contiguous run per filter.
+	int total_weights = 0;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		plan->mel_bin_count[k] = plan->cbin[k+2] - plan->cbin[k] + 1;
+		plan->mel_weight_offset[k] = total_weights;
+		total_weights += plan->mel_bin_count[k];
+	}
+	// Allocate all the tables in one aligned block.
+	size_t window_bytes = align_table_size(sizeof(float) * frame_length);
+	size_t mel_bytes = align_table_size(sizeof(float) * total_weights);
+	size_t dct_bytes = align_table_size(sizeof(float) * CEPSTRUM_LENGTH * MEL_FILTER_COUNT);
+	size_t dct_transposed_bytes = align_table_size(sizeof(float) * MEL_FILTER_COUNT * CEPSTRUM_STRIDE);
+	size_t float_bytes = window_bytes + mel_bytes + dct_bytes + dct_transposed_bytes;
+#ifdef TINYSR_FIXED_POINT
+	// The fixed point tables are the same sizes as the float ones, plus the log table.
+	size_t log_table_bytes = align_table_size(sizeof(int32_t) * ((1 << LOG_TABLE_BITS) + 1));
+	plan->table_storage = aligned_alloc(64, float_bytes + window_bytes + mel_bytes + dct_bytes + log_table_bytes);
+#else
+	plan->table_storage = aligned_alloc(64, float_bytes);
+#endif
+	if (plan->table_storage == NULL)
+		goto tinysr_frontend_plan_create_error;
+	plan->window = (float*) plan->table_storage;
+	plan->mel_weights = (float*) ((char*) plan->table_storage + window_bytes);
+	plan->dct = (float*) ((char*) plan->table_storage + window_bytes + mel_bytes);
+	plan->dct_transposed = (float*) ((char*) plan->dct + dct_bytes);
+#ifdef TINYSR_FIXED_POINT
+	plan->fixed_window = (int32_t*) ((char*) plan->table_storage + float_bytes);
+	plan->fixed_mel_weights = (int32_t*) ((char*) plan->fixed_window + window_bytes);
+	plan->fixed_dct = (int32_t*) ((char*) plan->fixed_mel_weights + mel_bytes);
+	plan->fixed_log_table = (int32_t*) ((char*) plan->fixed_dct + dct_bytes);
+#endif
+	// Hamming window. (ES 201 108 4.2.7)
+	for (i = 0; i < frame_length; i++)
+		plan->window[i] = 0.54 - 0.46 * cos((PI2 * i) / (frame_length - 1));
+	// Triangular filter weights. (ES 201 108 4.2.9)
+	// XXX: Note! ES 201 108 has fbank being one indexed, but I have it zero indexed.
+	// Thus, note that cbin[k+1] is the center bin index for filter k. This is why cbin is of length MEL_FILTER_COUNT+2.
+	// The first and last bin indexes are for sizing the first and last triangular filter. Therefore, note that
+	// where in 4.2.9 it says fbank_k is based on cbin_(k-1), cbin_k and cbin_(k+1), instead for me it's based on
+	// cbin_k, cbin_(k+1), and cbin_(k+2). Just keep track off the off by oneness.
+	const int* cbin = plan->cbin;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		// Filter k's weights start at bin cbin[k].
+		float* weights = plan->mel_weights + plan->mel_weight_offset[k];
+		for (i = cbin[k]; i <= cbin[k+1]; i++)
+			weights[i - cbin[k]] = (i - cbin[k] + 1) / (float)(cbin[k+1] - cbin[k] + 1);
+		for (i = cbin[k+1]+1; i <= cbin[k+2]; i++)
+			weights[i - cbin[k]] = 1 - ((i - cbin[k+1]) / (float)(cbin[k+2] - cbin[k+1] + 1));
+	}
+	// DCT matrix. (ES 201 108 4.2.11)
+	// XXX: Again notice that I'm zero indexing: filter k is what the spec calls f_(k+1).
+	// This is why it's (k + 0.5) rather than (k - 0.5) like in the spec in the upcoming expression.
+	for (i = 0; i < CEPSTRUM_LENGTH; i++)
+		for (k = 0; k < MEL_FILTER_COUNT; k++)
+			plan->dct[i * MEL_FILTER_COUNT + k] = cos(PI * i * (k + 0.5) / MEL_FILTER_COUNT);
+	// The transposed copy lets the vectorized kernels accumulate every cepstral coefficient at once.
+	for (k = 0; k < MEL_FILTER_COUNT; k++)
+		for (i = 0; i < CEPSTRUM_STRIDE; i++)
+			plan->dct_transposed[k * CEPSTRUM_STRIDE + i] = i < CEPSTRUM_LENGTH ? plan->dct[i * MEL_FILTER_COUNT + k] : 0.0;
+#ifdef TINYSR_FIXED_POINT
+	// Quantize everything for the fixed point front-end. The window and DCT are recomputed in
+	// double precision, so they aren't limited to what a float holds.
+	for (i = 0; i < frame_length; i++)
+		plan->fixed_window[i] = (int32_t) round((0.54 - 0.46 * cos((PI2 * i) / (frame_length - 1))) * (1 << 30));
+	for (i = 0; i < total_weights; i++)
+		plan->fixed_mel_weights[i] = (int32_t) round(plan->mel_weights[i] * (1 << 15));
+	for (i = 0; i < CEPSTRUM_LENGTH; i++)
+		for (k = 0; k < MEL_FILTER_COUNT; k++)
+			plan->fixed_dct[i * MEL_FILTER_COUNT + k] = (int32_t) round(cos(PI * i * (k + 0.5) / MEL_FILTER_COUNT) * (1 << 30));
+	for (i = 0; i <= 1 << LOG_TABLE_BITS; i++)
+		plan->fixed_log_table[i] = (int32_t) round(log2(1.0 + i / (double) (1 << LOG_TABLE_BITS)) * 65536.0);
+#endif
+	return plan;
+tinysr_frontend_plan_create_error:
+	tinysr_frontend_plan_free(plan);
+	return NULL;
+}
+
+// Builds a plan for the standard 16 kHz ES 201 108 front-end.
+tinysr_frontend_plan_t* tinysr_frontend_plan_create_default(void) {
+	return tinysr_frontend_plan_create(FRONTEND_SAMPLE_RATE, FRAME_LENGTH, SHIFT_INTERVAL, FFT_LENGTH);
+}
+
+void tinysr_frontend_plan_free(tinysr_frontend_plan_t* plan) {
+	if (plan == NULL)
+		return;
+	tinysr_fft_plan_free(plan->fft_plan);
+	free(plan->table_storage);
+	free(plan);
+}
+
+#ifndef TINYSR_FIXED_POINT
+// === Front-end kernels ===
+// Each stage of tinysr_process_frame has a portable scalar implementation, and vectorized SSE2 and AVX2
+// implementations on x86, one of which is chosen at runtime from the CPU's features.
+
+static float scalar_energy(const float* x, int length) {
+	float energy = 2e-22;
 	int i;
-	for (i = 0; i < lines; i++) {
-		feature_vector_t* fv = &result->feature_vectors[i];
-		// Read in the log energy.
-		fscanf(fp, "%f", &fv->log_energy);
-		// Read in the 13 cepstral components.
+	for (i = 0; i < length; i++)
+		energy += x[i] * x[i];
+	return energy;
+}
+
+static void scalar_preemphasize_window(const float* x, float* out, const float* window, int length) {
+	int i;
+	for (i = length-1; i > 0; i--)
+		out[i] = (x[i] - 0.97f * x[i-1]) * window[i];
+	out[0] = 0.0;
+}
+
+static void scalar_magnitude(const float* x, float* out, int length) {
+	int k;
+	for (k = 0; k < length; k++)
+		out[k] = sqrtf(x[2*k]*x[2*k] + x[2*k+1]*x[2*k+1]);
+}
+
+static void scalar_mel_filter(const tinysr_frontend_plan_t* plan, const float* spectrum, float* filter_bank) {
+	int i, k;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* weights = plan->mel_weights + plan->mel_weight_offset[k];
+		const float* bins = spectrum + plan->cbin[k];
+		float sum = 0.0;
+		for (i = 0; i < plan->mel_bin_count[k]; i++)
+			sum += weights[i] * bins[i];
+		filter_bank[k] = sum;
+	}
+}
+
+static void scalar_log_floor(float* x, int length) {
+	int i;
+	for (i = 0; i < length; i++)
+		x[i] = logf(x[i] + 2e-22);
+}
+
+static void scalar_dct(const tinysr_frontend_plan_t* plan, const float* filter_bank, float* cepstrum) {
+	int i, k;
+	for (i = 0; i < CEPSTRUM_LENGTH; i++) {
+		const float* row = plan->dct + i * MEL_FILTER_COUNT;
+		float sum = 0.0;
+		for (k = 0; k < MEL_FILTER_COUNT; k++)
+			sum += filter_bank[k] * row[k];
+		cepstrum[i] = sum;
+	}
+}
+
+static float scalar_dot(const float* a, const float* b, int length) {
+	float sum = 0.0;
+	int i;
+	for (i = 0; i < length; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+// The batched front-end, with frames side by side in SIMD lanes. This mirrors tinysr_process_frame
+// and the planned FFT stage by stage, except that every scalar becomes BATCH_FRAMES lanes, so each
+// inner loop over the lanes vectorizes. The body is compiled once for the baseline instruction set,
+// and once more for AVX2, where a whole batch of lanes fits in one register.
+static inline __attribute__((always_inline)) void frontend_batch_body(const tinysr_kernels_t* kernels, const tinysr_frontend_plan_t* plan, float* batch, float* log_energy, float* cepstrum) {
+	const int lanes = BATCH_FRAMES;
+	const tinysr_fft_plan_t* fft = plan->fft_plan;
+	int frame_length = plan->frame_length, n = fft->complex_length;
+	int i, k, l;
+	// Measure log energy. (ES 201 108 4.2.5)
+	float energy[BATCH_FRAMES];
+	for (l = 0; l < lanes; l++)
+		energy[l] = 2e-22;
+	for (i = 0; i < frame_length; i++)
+		for (l = 0; l < lanes; l++)
+			energy[l] += batch[i*lanes + l] * batch[i*lanes + l];
+	for (l = 0; l < lanes; l++)
+		log_energy[l] = logf(energy[l]);
+	// Pre-emphasize and window, in place, walking backwards. (ES 201 108 4.2.6, 4.2.7)
+	for (i = frame_length - 1; i > 0; i--) {
+		float w = plan->window[i];
+		for (l = 0; l < lanes; l++)
+			batch[i*lanes + l] = (batch[i*lanes + l] - 0.97f * batch[(i-1)*lanes + l]) * w;
+	}
+	for (l = 0; l < lanes; l++)
+		batch[l] = 0.0;
+	for (i = frame_length * lanes; i < plan->fft_length * lanes; i++)
+		batch[i] = 0.0;
+	// The FFT, on the real input packed as complex. (ES 201 108 4.2.8)
+	// Complex element m of lane l has its real part at batch[2m * lanes + l], and imaginary part one row later.
+	for (i = 0; i < n; i++) {
+		int j = fft->bit_reverse[i];
+		if (i < j)
+			for (l = 0; l < 2*lanes; l++) {
+				float t = batch[2*i*lanes + l];
+				batch[2*i*lanes + l] = batch[2*j*lanes + l];
+				batch[2*j*lanes + l] = t;
+			}
+	}
+	int h = 1, log2_n = 0;
+	while ((1 << log2_n) < n)
+		log2_n++;
+	if (log2_n & 1) {
+		for (i = 0; i < n; i += 2) {
+			float* a = batch + 2*i*lanes;
+			float* b = a + 2*lanes;
+			for (l = 0; l < lanes; l++) {
+				float ar = a[l], ai = a[lanes + l], br = b[l], bi = b[lanes + l];
+				a[l] = ar + br;
+				a[lanes + l] = ai + bi;
+				b[l] = ar - br;
+				b[lanes + l] = ai - bi;
+			}
+		}
+		h = 2;
+	}
+	for (; h < n; h *= 4) {
+		int stride = n / (4*h);
+		for (i = 0; i < n; i += 4*h) {
+			for (k = 0; k < h; k++) {
+				float w2r = fft->twiddle_real[k * stride], w2i = fft->twiddle_imag[k * stride];
+				float w1r = fft->twiddle_real[2 * k * stride], w1i = fft->twiddle_imag[2 * k * stride];
+				float* a = batch + 2*lanes*(i + k);
+				float* b = a + 2*lanes*h;
+				float* c = b + 2*lanes*h;
+				float* d = c + 2*lanes*h;
+				for (l = 0; l < lanes; l++) {
+					float tr = w1r * b[l] - w1i * b[lanes + l], ti = w1r * b[lanes + l] + w1i * b[l];
+					float a1r = a[l] + tr, a1i = a[lanes + l] + ti;
+					float b1r = a[l] - tr, b1i = a[lanes + l] - ti;
+					tr = w1r * d[l] - w1i * d[lanes + l];
+					ti = w1r * d[lanes + l] + w1i * d[l];
+					float c1r = c[l] + tr, c1i = c[lanes + l] + ti;
+					float d1r = c[l] - tr, d1i = c[lanes + l] - ti;
+					float c2r = w2r * c1r - w2i * c1i, c2i = w2r * c1i + w2i * c1r;
+					float d2r = w2r * d1i + w2i * d1r, d2i = w2i * d1i - w2r * d1r;
+					a[l] = a1r + c2r;
+					a[lanes + l] = a1i + c2i;
+					c[l] = a1r - c2r;
+					c[lanes + l] = a1i - c2i;
+					b[l] = b1r + d2r;
+					b[lanes + l] = b1i + d2i;
+					d[l] = b1r - d2r;
+					d[lanes + l] = b1i - d2i;
+				}
+			}
+		}
+	}
+	// Split the packed transform into the real input's spectrum, as in tinysr_fft_real.
+	float dc[BATCH_FRAMES], nyquist[BATCH_FRAMES];
+	for (l = 0; l < lanes; l++) {
+		dc[l] = fabsf(batch[l] + batch[lanes + l]);
+		nyquist[l] = fabsf(batch[l] - batch[lanes + l]);
+	}
+	for (k = 1; k <= n/2; k++) {
+		float* z = batch + 2*k*lanes;
+		float* m = batch + 2*(n-k)*lanes;
+		float wr = fft->split_real[k], wi = fft->split_imag[k];
+		for (l = 0; l < lanes; l++) {
+			float zr = z[l], zi = z[lanes + l], mr = m[l], mi = m[lanes + l];
+			float er = 0.5f * (zr + mr), ei = 0.5f * (zi - mi);
+			float dr = 0.5f * (zr - mr), di = 0.5f * (zi + mi);
+			float pr = wr * dr - wi * di, pi = wr * di + wi * dr;
+			z[l] = er + pi;
+			z[lanes + l] = ei - pr;
+			m[l] = er - pi;
+			m[lanes + l] = -ei - pr;
+		}
+	}
+	// Magnitudes, in place: bin k goes to row k, which only ever held parts of bins below k.
+	for (k = 1; k < n; k++)
+		for (l = 0; l < lanes; l++) {
+			float re = batch[2*k*lanes + l], im = batch[(2*k+1)*lanes + l];
+			batch[k*lanes + l] = sqrtf(re*re + im*im);
+		}
+	for (l = 0; l < lanes; l++) {
+		batch[l] = dc[l];
+		batch[n*lanes + l] = nyquist[l];
+	}
+	// Mel filtering. (ES 201 108 4.2.9)
+	float filter_bank[MEL_FILTER_COUNT * BATCH_FRAMES];
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* weights = plan->mel_weights + plan->mel_weight_offset[k];
+		const float* spectrum = batch + plan->cbin[k] * lanes;
+		float sum[BATCH_FRAMES] = {0};
+		for (i = 0; i < plan->mel_bin_count[k]; i++)
+			for (l = 0; l < lanes; l++)
+				sum[l] += weights[i] * spectrum[i*lanes + l];
+		for (l = 0; l < lanes; l++)
+			filter_bank[k*lanes + l] = sum[l];
+	}
+	// Logarithm, over every lane at once. (ES 201 108 4.2.10)
+	kernels->log_floor(filter_bank, MEL_FILTER_COUNT * lanes);
+	// DCT. (ES 201 108 4.2.11)
+	for (i = 0; i < CEPSTRUM_LENGTH; i++) {
+		const float* row = plan->dct + i * MEL_FILTER_COUNT;
+		float sum[BATCH_FRAMES] = {0};
+		for (k = 0; k < MEL_FILTER_COUNT; k++)
+			for (l = 0; l < lanes; l++)
+				sum[l] += row[k] * filter_bank[k*lanes + l];
+		for (l = 0; l < lanes; l++)
+			cepstrum[i*lanes + l] = sum[l];
+	}
+}
+
+static void generic_frontend_batch(const tinysr_kernels_t* kernels, const tinysr_frontend_plan_t* plan, float* batch, float* log_energy, float* cepstrum) {
+	frontend_batch_body(kernels, plan, batch, log_energy, cepstrum);
+}
+
+static void scalar_score(const float* expansion, int frames, const float* weights, int stride, int columns, float* scores) {
+	int f, k, s;
+	for (f = 0; f < frames; f++) {
+		const float* x = expansion + f * SCORE_TERMS;
+		float* out = scores + f * stride;
+		for (s = 0; s < columns; s++)
+			out[s] = 0.0;
+		for (k = 0; k < SCORE_TERMS; k++)
+			for (s = 0; s < columns; s++)
+				out[s] += x[k] * weights[s / SCORE_STATE_ALIGN * SCORE_PANEL + k * SCORE_STATE_ALIGN + s % SCORE_STATE_ALIGN];
+	}
+}
+
+static const tinysr_kernels_t scalar_kernels = {
+	TINYSR_KERNELS_SCALAR, "scalar",
+	scalar_energy, scalar_preemphasize_window, scalar_magnitude,
+	scalar_mel_filter, scalar_log_floor, scalar_dct,
+	scalar_dot, generic_frontend_batch, scalar_score,
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TINYSR_X86_KERNELS
+#include <immintrin.h>
+
+// The fast logarithm used by the vectorized kernels: the Cephes logf polynomial.
+// Split x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then log(x) = e log(2) + log(m), where log(m)
+// comes from a degree nine polynomial in (m - 1). The error is a few ulp over all positive normal floats.
+#define LOG_SQRT_HALF 0.707106781186547524f
+#define LOG_P0 7.0376836292e-2f
+#define LOG_P1 -1.1514610310e-1f
+#define LOG_P2 1.1676998740e-1f
+#define LOG_P3 -1.2420140846e-1f
+#define LOG_P4 1.4249322787e-1f
+#define LOG_P5 -1.6668057665e-1f
+#define LOG_P6 2.0000714765e-1f
+#define LOG_P7 -2.4999993993e-1f
+#define LOG_P8 3.3333331174e-1f
+#define LOG_Q1 -2.12194440e-4f
+#define LOG_Q2 0.693359375f
+
+__attribute__((target("sse2")))
+static inline __m128 log_sse2(__m128 x) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128i bits = _mm_castps_si128(x);
+	// Pull out the exponent, and replace it to get a mantissa in [0.5, 1).
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+	x = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f000000)));
+	// Shift the mantissa into [sqrt(1/2), sqrt(2)), and subtract one.
+	__m128 small = _mm_cmplt_ps(x, _mm_set1_ps(LOG_SQRT_HALF));
+	e = _mm_sub_ps(e, _mm_and_ps(one, small));
+	x = _mm_add_ps(_mm_sub_ps(x, one), _mm_and_ps(x, small));
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 y = _mm_set1_ps(LOG_P0);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P1));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P2));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P3));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P4));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P5));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P6));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P7));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P8));
+	y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+	y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LOG_Q1)));
+	y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	return _mm_add_ps(_mm_add_ps(x, y), _mm_mul_ps(e, _mm_set1_ps(LOG_Q2)));
+}
+
+__attribute__((target("sse2")))
+static inline float horizontal_sum_sse2(__m128 v) {
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse2")))
+static float sse2_energy(const float* x, int length) {
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= length; i += 8) {
+		__m128 a = _mm_loadu_ps(x + i), b = _mm_loadu_ps(x + i + 4);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+	}
+	float energy = 2e-22 + horizontal_sum_sse2(_mm_add_ps(acc0, acc1));
+	for (; i < length; i++)
+		energy += x[i] * x[i];
+	return energy;
+}
+
+__attribute__((target("sse2")))
+static void sse2_preemphasize_window(const float* x, float* out, const float* window, int length) {
+	const __m128 coef = _mm_set1_ps(0.97f);
+	// Walk backwards, so that when working in place x[i-1] is always read before it gets overwritten.
+	int i;
+	for (i = length - 4; i >= 1; i -= 4) {
+		__m128 current = _mm_loadu_ps(x + i), previous = _mm_loadu_ps(x + i - 1);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_sub_ps(current, _mm_mul_ps(coef, previous)), _mm_loadu_ps(window + i)));
+	}
+	for (i += 3; i > 0; i--)
+		out[i] = (x[i] - 0.97f * x[i-1]) * window[i];
+	out[0] = 0.0;
+}
+
+__attribute__((target("sse2")))
+static void sse2_magnitude(const float* x, float* out, int length) {
+	int k = 0;
+	for (; k + 4 <= length; k += 4) {
+		__m128 a = _mm_loadu_ps(x + 2*k), b = _mm_loadu_ps(x + 2*k + 4);
+		__m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(out + k, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im))));
+	}
+	for (; k < length; k++)
+		out[k] = sqrtf(x[2*k]*x[2*k] + x[2*k+1]*x[2*k+1]);
+}
+
+__attribute__((target("sse2")))
+static void sse2_mel_filter(const tinysr_frontend_plan_t* plan, const float* spectrum, float* filter_bank) {
+	int i, k;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* weights = plan->mel_weights + plan->mel_weight_offset[k];
+		const float* bins = spectrum + plan->cbin[k];
+		int count = plan->mel_bin_count[k];
+		__m128 acc = _mm_setzero_ps();
+		for (i = 0; i + 4 <= count; i += 4)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(weights + i), _mm_loadu_ps(bins + i)));
+		float sum = horizontal_sum_sse2(acc);
+		for (; i < count; i++)
+			sum += weights[i] * bins[i];
+		filter_bank[k] = sum;
+	}
+}
+
+__attribute__((target("sse2")))
+static void sse2_log_floor(float* x, int length) {
+	const __m128 floor = _mm_set1_ps(2e-22f);
+	int i = 0;
+	for (; i + 4 <= length; i += 4)
+		_mm_storeu_ps(x + i, log_sse2(_mm_add_ps(_mm_loadu_ps(x + i), floor)));
+	if (i < length) {
+		// Pad the tail out to a whole vector with ones, whose logarithm is harmless.
+		float tail[4] = {1.0f, 1.0f, 1.0f, 1.0f};
 		int j;
-		for (j = 0; j < 13; j++)
-			fscanf(fp, ",%f", &fv->cepstrum[j]);
-		fscanf(fp, "\n");
+		for (j = 0; i + j < length; j++)
+			tail[j] = x[i + j];
+		_mm_storeu_ps(tail, log_sse2(_mm_add_ps(_mm_loadu_ps(tail), floor)));
+		for (j = 0; i + j < length; j++)
+			x[i + j] = tail[j];
 	}
-	return result;
+}
+
+__attribute__((target("sse2")))
+static void sse2_dct(const tinysr_frontend_plan_t* plan, const float* filter_bank, float* cepstrum) {
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+	int i, k;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* column = plan->dct_transposed + k * CEPSTRUM_STRIDE;
+		__m128 f = _mm_set1_ps(filter_bank[k]);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(f, _mm_load_ps(column)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(f, _mm_load_ps(column + 4)));
+		acc2 = _mm_add_ps(acc2, _mm_mul_ps(f, _mm_load_ps(column + 8)));
+		acc3 = _mm_add_ps(acc3, _mm_mul_ps(f, _mm_load_ps(column + 12)));
+	}
+	float result[CEPSTRUM_STRIDE];
+	_mm_storeu_ps(result, acc0);
+	_mm_storeu_ps(result + 4, acc1);
+	_mm_storeu_ps(result + 8, acc2);
+	_mm_storeu_ps(result + 12, acc3);
+	for (i = 0; i < CEPSTRUM_LENGTH; i++)
+		cepstrum[i] = result[i];
+}
+
+__attribute__((target("sse2")))
+static float sse2_dot(const float* a, const float* b, int length) {
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= length; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float sum = horizontal_sum_sse2(_mm_add_ps(acc0, acc1));
+	for (; i < length; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+// Works through the weights in columns of 8 states, scoring 4 frames at a time, so that each weight
+// loaded gets used 4 times, and the 8 accumulators stay in registers. Each column's weights are
+// contiguous within its panel.
+__attribute__((target("sse2")))
+static void sse2_score(const float* expansion, int frames, const float* weights, int stride, int columns, float* scores) {
+	int f, k, s;
+	for (s = 0; s < columns; s += 8) {
+		const float* w = weights + s / SCORE_STATE_ALIGN * SCORE_PANEL + s % SCORE_STATE_ALIGN;
+		for (f = 0; f + 4 <= frames; f += 4) {
+			const float* x = expansion + f * SCORE_TERMS;
+			__m128 a00 = _mm_setzero_ps(), a01 = _mm_setzero_ps(), a10 = _mm_setzero_ps(), a11 = _mm_setzero_ps();
+			__m128 a20 = _mm_setzero_ps(), a21 = _mm_setzero_ps(), a30 = _mm_setzero_ps(), a31 = _mm_setzero_ps();
+			for (k = 0; k < SCORE_TERMS; k++) {
+				__m128 w0 = _mm_loadu_ps(w + k * SCORE_STATE_ALIGN), w1 = _mm_loadu_ps(w + k * SCORE_STATE_ALIGN + 4);
+				__m128 x0 = _mm_set1_ps(x[k]), x1 = _mm_set1_ps(x[SCORE_TERMS + k]);
+				__m128 x2 = _mm_set1_ps(x[2 * SCORE_TERMS + k]), x3 = _mm_set1_ps(x[3 * SCORE_TERMS + k]);
+				a00 = _mm_add_ps(a00, _mm_mul_ps(x0, w0));
+				a01 = _mm_add_ps(a01, _mm_mul_ps(x0, w1));
+				a10 = _mm_add_ps(a10, _mm_mul_ps(x1, w0));
+				a11 = _mm_add_ps(a11, _mm_mul_ps(x1, w1));
+				a20 = _mm_add_ps(a20, _mm_mul_ps(x2, w0));
+				a21 = _mm_add_ps(a21, _mm_mul_ps(x2, w1));
+				a30 = _mm_add_ps(a30, _mm_mul_ps(x3, w0));
+				a31 = _mm_add_ps(a31, _mm_mul_ps(x3, w1));
+			}
+			float* out = scores + f * stride + s;
+			_mm_storeu_ps(out, a00);
+			_mm_storeu_ps(out + 4, a01);
+			_mm_storeu_ps(out + stride, a10);
+			_mm_storeu_ps(out + stride + 4, a11);
+			_mm_storeu_ps(out + 2 * stride, a20);
+			_mm_storeu_ps(out + 2 * stride + 4, a21);
+			_mm_storeu_ps(out + 3 * stride, a30);
+			_mm_storeu_ps(out + 3 * stride + 4, a31);
+		}
+		// Single frames split the sum over alternate terms, to keep four independent chains of adds going.
+		for (; f < frames; f++) {
+			const float* x = expansion + f * SCORE_TERMS;
+			__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), b0 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+			for (k = 0; k + 2 <= SCORE_TERMS; k += 2) {
+				__m128 x0 = _mm_set1_ps(x[k]), x1 = _mm_set1_ps(x[k+1]);
+				a0 = _mm_add_ps(a0, _mm_mul_ps(x0, _mm_loadu_ps(w + k * SCORE_STATE_ALIGN)));
+				a1 = _mm_add_ps(a1, _mm_mul_ps(x0, _mm_loadu_ps(w + k * SCORE_STATE_ALIGN + 4)));
+				b0 = _mm_add_ps(b0, _mm_mul_ps(x1, _mm_loadu_ps(w + (k+1) * SCORE_STATE_ALIGN)));
+				b1 = _mm_add_ps(b1, _mm_mul_ps(x1, _mm_loadu_ps(w + (k+1) * SCORE_STATE_ALIGN + 4)));
+			}
+			for (; k < SCORE_TERMS; k++) {
+				__m128 x0 = _mm_set1_ps(x[k]);
+				a0 = _mm_add_ps(a0, _mm_mul_ps(x0, _mm_loadu_ps(w + k * SCORE_STATE_ALIGN)));
+				a1 = _mm_add_ps(a1, _mm_mul_ps(x0, _mm_loadu_ps(w + k * SCORE_STATE_ALIGN + 4)));
+			}
+			_mm_storeu_ps(scores + f * stride + s, _mm_add_ps(a0, b0));
+			_mm_storeu_ps(scores + f * stride + s + 4, _mm_add_ps(a1, b1));
+		}
+	}
+}
+
+static const tinysr_kernels_t sse2_kernels = {
+	TINYSR_KERNELS_SSE2, "sse2",
+	sse2_energy, sse2_preemphasize_window, sse2_magnitude,
+	sse2_mel_filter, sse2_log_floor, sse2_dct,
+	sse2_dot, generic_frontend_batch, sse2_score,
+};
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static inline __m256 log_avx2(__m256 x) {
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f000000)));
+	__m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(LOG_SQRT_HALF), _CMP_LT_OQ);
+	e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+	x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(x, small));
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(LOG_P0);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P1));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P2));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P3));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P4));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P5));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P6));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P7));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(LOG_P8));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(LOG_Q1), y);
+	y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+	return _mm256_fmadd_ps(e, _mm256_set1_ps(LOG_Q2), _mm256_add_ps(x, y));
+}
+
+AVX2 static inline float horizontal_sum_avx2(__m256 v) {
+	return horizontal_sum_sse2(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+AVX2 static float avx2_energy(const float* x, int length) {
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m256 a = _mm256_loadu_ps(x + i), b = _mm256_loadu_ps(x + i + 8);
+		acc0 = _mm256_fmadd_ps(a, a, acc0);
+		acc1 = _mm256_fmadd_ps(b, b, acc1);
+	}
+	float energy = 2e-22 + horizontal_sum_avx2(_mm256_add_ps(acc0, acc1));
+	for (; i < length; i++)
+		energy += x[i] * x[i];
+	return energy;
+}
+
+AVX2 static void avx2_preemphasize_window(const float* x, float* out, const float* window, int length) {
+	const __m256 coef = _mm256_set1_ps(0.97f);
+	int i;
+	for (i = length - 8; i >= 1; i -= 8) {
+		__m256 current = _mm256_loadu_ps(x + i), previous = _mm256_loadu_ps(x + i - 1);
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_fnmadd_ps(coef, previous, current), _mm256_loadu_ps(window + i)));
+	}
+	for (i += 7; i > 0; i--)
+		out[i] = (x[i] - 0.97f * x[i-1]) * window[i];
+	out[0] = 0.0;
+}
+
+AVX2 static void avx2_magnitude(const float* x, float* out, int length) {
+	int k = 0;
+	for (; k + 8 <= length; k += 8) {
+		__m256 a = _mm256_loadu_ps(x + 2*k), b = _mm256_loadu_ps(x + 2*k + 8);
+		// The in-lane shuffles leave the bins in the order 0 1 4 5 2 3 6 7, which one permute fixes.
+		__m256 re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		__m256 magnitude = _mm256_sqrt_ps(_mm256_fmadd_ps(re, re, _mm256_mul_ps(im, im)));
+		magnitude = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(magnitude), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_ps(out + k, magnitude);
+	}
+	for (; k < length; k++)
+		out[k] = sqrtf(x[2*k]*x[2*k] + x[2*k+1]*x[2*k+1]);
+}
+
+AVX2 static void avx2_mel_filter(const tinysr_frontend_plan_t* plan, const float* spectrum, float* filter_bank) {
+	int i, k;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* weights = plan->mel_weights + plan->mel_weight_offset[k];
+		const float* bins = spectrum + plan->cbin[k];
+		int count = plan->mel_bin_count[k];
+		__m256 acc = _mm256_setzero_ps();
+		for (i = 0; i + 8 <= count; i += 8)
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(weights + i), _mm256_loadu_ps(bins + i), acc);
+		__m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		if (i + 4 <= count) {
+			acc4 = _mm_add_ps(acc4, _mm_mul_ps(_mm_loadu_ps(weights + i), _mm_loadu_ps(bins + i)));
+			i += 4;
+		}
+		float sum = horizontal_sum_sse2(acc4);
+		for (; i < count; i++)
+			sum += weights[i] * bins[i];
+		filter_bank[k] = sum;
+	}
+}
+
+AVX2 static void avx2_log_floor(float* x, int length) {
+	const __m256 floor = _mm256_set1_ps(2e-22f);
+	int i = 0;
+	for (; i + 8 <= length; i += 8)
+		_mm256_storeu_ps(x + i, log_avx2(_mm256_add_ps(_mm256_loadu_ps(x + i), floor)));
+	if (i < length) {
+		float tail[8] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+		int j;
+		for (j = 0; i + j < length; j++)
+			tail[j] = x[i + j];
+		_mm256_storeu_ps(tail, log_avx2(_mm256_add_ps(_mm256_loadu_ps(tail), floor)));
+		for (j = 0; i + j < length; j++)
+			x[i + j] = tail[j];
+	}
+}
+
+AVX2 static void avx2_dct(const tinysr_frontend_plan_t* plan, const float* filter_bank, float* cepstrum) {
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	int i, k;
+	for (k = 0; k < MEL_FILTER_COUNT; k++) {
+		const float* column = plan->dct_transposed + k * CEPSTRUM_STRIDE;
+		__m256 f = _mm256_set1_ps(filter_bank[k]);
+		acc0 = _mm256_fmadd_ps(f, _mm256_load_ps(column), acc0);
+		acc1 = _mm256_fmadd_ps(f, _mm256_load_ps(column + 8), acc1);
+	}
+	float result[CEPSTRUM_STRIDE];
+	_mm256_storeu_ps(result, acc0);
+	_mm256_storeu_ps(result + 8, acc1);
+	for (i = 0; i < CEPSTRUM_LENGTH; i++)
+		cepstrum[i] = result[i];
+}
+
+AVX2 static float avx2_dot(const float* a, const float* b, int length) {
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= length; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+	if (i + 8 <= length) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		i += 8;
+	}
+	float sum = horizontal_sum_avx2(_mm256_add_ps(acc0, acc1));
+	for (; i < length; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+AVX2 static void avx2_frontend_batch(const tinysr_kernels_t* kernels, const tinysr_frontend_plan_t* plan, float* batch, float* log_energy, float* cepstrum) {
+	frontend_batch_body(kernels, plan, batch, log_energy, cepstrum);
+}
+
+// The same blocking as sse2_score, with columns of 16 states.
+AVX2 static void avx2_score(const float* expansion, int frames, const float* weights, int stride, int columns, float* scores) {
+	int f, k, s;
+	for (s = 0; s < columns; s += 16) {
+		const float* w = weights + s / SCORE_STATE_ALIGN * SCORE_PANEL;
+		for (f = 0; f + 4 <= frames; f += 4) {
+			const float* x = expansion + f * SCORE_TERMS;
+			__m256 a00 = _mm256_setzero_ps(), a01 = _mm256_setzero_ps(), a10 = _mm256_setzero_ps(), a11 = _mm256_setzero_ps();
+			__m256 a20 = _mm256_setzero_ps(), a21 = _mm256_setzero_ps(), a30 = _mm256_setzero_ps(), a31 = _mm256_setzero_ps();
+			for (k = 0; k < SCORE_TERMS; k++) {
+				__m256 w0 = _mm256_loadu_ps(w + k * SCORE_STATE_ALIGN), w1 = _mm256_loadu_ps(w + k * SCORE_STATE_ALIGN + 8);
+				__m256 x0 = _mm256_broadcast_ss(x + k), x1 = _mm256_broadcast_ss(x + SCORE_TERMS + k);
+				a00 = _mm256_fmadd_ps(x0, w0, a00);
+				a01 = _mm256_fmadd_ps(x0, w1, a01);
+				a10 = _mm256_fmadd_ps(x1, w0, a10);
+				a11 = _mm256_fmadd_ps(x1, w1, a11);
+				__m256 x2 = _mm256_broadcast_ss(x + 2 * SCORE_TERMS + k), x3 = _mm256_broadcast_ss(x + 3 * SCORE_TERMS + k);
+				a20 = _mm256_fmadd_ps(x2, w0, a20);
+				a21 = _mm256_fmadd_ps(x2, w1, a21);
+				a30 = _mm256_fmadd_ps(x3, w0, a30);
+				a31 = _mm256_fmadd_ps(x3, w1, a31);
+			}
+			float* out = scores + f * stride + s;
+			_mm256_storeu_ps(out, a00);
+			_mm256_storeu_ps(out + 8, a01);
+			_mm256_storeu_ps(out + stride, a10);
+			_mm256_storeu_ps(out + stride + 8, a11);
+			_mm256_storeu_ps(out + 2 * stride, a20);
+			_mm256_storeu_ps(out + 2 * stride + 8, a21);
+			_mm256_storeu_ps(out + 3 * stride, a30);
+			_mm256_storeu_ps(out + 3 * stride + 8, a31);
+		}
+		// Single frames split the sum four ways over the terms, to keep eight independent chains of FMAs going.
+		for (; f < frames; f++) {
+			const float* x = expansion + f * SCORE_TERMS;
+			__m256 a[8];
+			int chain;
+			for (chain = 0; chain < 8; chain++)
+				a[chain] = _mm256_setzero_ps();
+			for (k = 0; k + 4 <= SCORE_TERMS; k += 4) {
+				for (chain = 0; chain < 4; chain++) {
+					__m256 x0 = _mm256_broadcast_ss(x + k + chain);
+					a[2*chain] = _mm256_fmadd_ps(x0, _mm256_loadu_ps(w + (k + chain) * SCORE_STATE_ALIGN), a[2*chain]);
+					a[2*chain+1] = _mm256_fmadd_ps(x0, _mm256_loadu_ps(w + (k + chain) * SCORE_STATE_ALIGN + 8), a[2*chain+1]);
+				}
+			}
+			for (; k < SCORE_TERMS; k++) {
+				__m256 x0 = _mm256_broadcast_ss(x + k);
+				a[0] = _mm256_fmadd_ps(x0, _mm256_loadu_ps(w + k * SCORE_STATE_ALIGN), a[0]);
+				a[1] = _mm256_fmadd_ps(x0, _mm256_loadu_ps(w + k * SCORE_STATE_ALIGN + 8), a[1]);
+			}
+			_mm256_storeu_ps(scores + f * stride + s, _mm256_add_ps(_mm256_add_ps(a[0], a[2]), _mm256_add_ps(a[4], a[6])));
+			_mm256_storeu_ps(scores + f * stride + s + 8, _mm256_add_ps(_mm256_add_ps(a[1], a[3]), _mm256_add_ps(a[5], a[7])));
+		}
+	}
+}
+
+static const tinysr_kernels_t avx2_kernels = {
+	TINYSR_KERNELS_AVX2, "avx2",
+	avx2_energy, avx2_preemphasize_window, avx2_magnitude,
+	avx2_mel_filter, avx2_log_floor, avx2_dct,
+	avx2_dot, avx2_frontend_batch, avx2_score,
+};
+#endif
+
+const tinysr_kernels_t* tinysr_get_kernels(tinysr_kernel_level_t level) {
+	switch (level) {
+		case TINYSR_KERNELS_SCALAR:
+			return &scalar_kernels;
+#ifdef TINYSR_X86_KERNELS
+		case TINYSR_KERNELS_SSE2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2") ? &sse2_kernels : NULL;
+		case TINYSR_KERNELS_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? &avx2_kernels : NULL;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+const tinysr_kernels_t* tinysr_select_kernels(void) {
+	const tinysr_kernels_t* kernels;
+	if ((kernels = tinysr_get_kernels(TINYSR_KERNELS_AVX2)) != NULL)
+		return kernels;
+	if ((kernels = tinysr_get_kernels(TINYSR_KERNELS_SSE2)) != NULL)
+		return kernels;
+	return &scalar_kernels;
+}
+
+// === Resampler ===
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+static double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+	int k;
+	for (k = 1; k < 50 && term > 1e-12 * sum; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static int greatest_common_divisor(int a, int b) {
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static void resampler_release(tinysr_resampler_t* r) {
+	const tinysr_allocator_t* allocator = r->allocator != NULL ? r->allocator : &system_allocator;
+	allocator->release(allocator->user, r->banks);
+	allocator->release(allocator->user, r->next_phase);
+	allocator->release(allocator->user, r->advance);
+	allocator->release(allocator->user, r->history);
+	r->banks = r->history = NULL;
+	r->next_phase = r->advance = NULL;
+}
+
+// Designs a Kaiser windowed sinc lowpass at the upsampled rate input_rate * up, and splits it into
+// up polyphase banks. The passband and transition band are set as fractions of the lower of the
+// two rates. The stopband starts a little past half the lower rate, so input above that is attenuated by
+// RESAMPLER_ATTENUATION dB, but the part of the transition band above half the lower rate is only partly
+// attenuated, and aliases back below it.
+int tinysr_resampler_configure(tinysr_resampler_t* r, int input_rate, int output_rate) {
+	resampler_release(r);
+	r->input_rate = input_rate;
+	r->output_rate = output_rate;
+	r->mode = TINYSR_RESAMPLER_LINEAR;
+	if (input_rate <= 0 || output_rate <= 0 || input_rate == output_rate)
+		return 0;
+	int divisor = greatest_common_divisor(input_rate, output_rate);
+	int up = output_rate / divisor, down = input_rate / divisor;
+	// Ratios like 7357 Hz into 16 kHz would need thousands of banks, so they stay linear.
+	if (up > RESAMPLER_MAX_PHASES)
+		return 0;
+	r->up = up;
+	r->down = down;
+	r->mode = up == 1 ? TINYSR_RESAMPLER_DECIMATE : TINYSR_RESAMPLER_RATIONAL;
+	// Filter specification, in cycles per sample at the upsampled rate.
+	double lower_rate = input_rate < output_rate ? input_rate : output_rate;
+	double upsampled_rate = (double) input_rate * up;
+	double cutoff = RESAMPLER_CUTOFF * lower_rate / upsampled_rate;
+	double transition = RESAMPLER_TRANSITION * lower_rate / upsampled_rate;
+	// Kaiser's formulas for the window parameter and filter length.
+	double beta = 0.1102 * (RESAMPLER_ATTENUATION - 8.7);
+	int length = (int) ceil((RESAMPLER_ATTENUATION - 8.0) / (2.285 * PI2 * transition)) + 1;
+	// Round the taps per bank up to a whole number of SIMD vectors.
+	int taps = (length + up - 1) / up;
+	taps = (taps + 7) & ~7;
+	length = taps * up;
+	r->taps = taps;
+	const tinysr_allocator_t* allocator = r->allocator != NULL ? r->allocator : &system_allocator;
+	r->banks = allocator->allocate(allocator->user, sizeof(float) * length);
+	r->next_phase = allocator->allocate(allocator->user, sizeof(int) * up);
+	r->advance = allocator->allocate(allocator->user, sizeof(int) * up);
+	r->history_capacity = taps - 1 + INGEST_BLOCK_LENGTH;
+	r->history = allocator->allocate(allocator->user, sizeof(float) * r->history_capacity);
+	if (r->banks == NULL || r->next_phase == NULL || r->advance == NULL || r->history == NULL) {
+		resampler_release(r);
+		r->mode = TINYSR_RESAMPLER_LINEAR;
+		return 1;
+	}
+	// The prototype filter h[k], scaled to a DC gain of up to make up for the zeros upsampling stuffs in.
+	// Output n lands on upsampled sample n * down = i * up + p, and then:
+	//     out[n] = sum over t of h[p + t * up] * in[i - t]
+	// so bank p holds h[p + t * up] at position taps-1-t, to line up with the input in order.
+	double center = (length - 1) / 2.0, total = 0.0;
+	int k;
+	for (k = 0; k < length; k++) {
+		double x = k - center;
+		double sinc = x == 0.0 ? 2.0 * cutoff : sin(PI2 * cutoff * x) / (PI * x);
+		double ratio = 2.0 * k / (length - 1) - 1.0;
+		double window = bessel_i0(beta * sqrt(1.0 - ratio * ratio)) / bessel_i0(beta);
+		total += sinc * window;
+	}
+	for (k = 0; k < length; k++) {
+		double x = k - center;
+		double sinc = x == 0.0 ? 2.0 * cutoff : sin(PI2 * cutoff * x) / (PI * x);
+		double ratio = 2.0 * k / (length - 1) - 1.0;
+		double window = bessel_i0(beta * sqrt(1.0 - ratio * ratio)) / bessel_i0(beta);
+		int p = k % up, t = k / up;
+		r->banks[p * taps + (taps - 1 - t)] = sinc * window * up / total;
+	}
+	int p;
+	for (p = 0; p < up; p++) {
+		r->next_phase[p] = (p + down) % up;
+		r->advance[p] = (p + down) / up;
+	}
+	// Start out with a history of silence, with the first output lined up on the first input.
+	for (k = 0; k < taps - 1; k++)
+		r->history[k] = 0.0;
+	r->history_length = taps - 1;
+	r->position = taps - 1;
+	r->phase = 0;
+	return 0;
+}
+
+void tinysr_resampler_free(tinysr_resampler_t* r) {
+	resampler_release(r);
+	r->mode = TINYSR_RESAMPLER_LINEAR;
+}
+
+int tinysr_resampler_process(tinysr_resampler_t* r, const tinysr_kernels_t* kernels, const float* in, int length, float* out, int capacity, int* consumed) {
+	int taps = r->taps;
+	// Take in as much input as fits.
+	int take = r->history_capacity - r->history_length;
+	if (take > length)
+		take = length;
+	memcpy(r->history + r->history_length, in, sizeof(float) * take);
+	r->history_length += take;
+	*consumed = take;
+	int produced = 0;
+	if (r->mode == TINYSR_RESAMPLER_DECIMATE) {
+		// Integer ratios, like 48 kHz (3:1) and 32 kHz (2:1): a single bank, and a fixed stride.
+		int position = r->position, down = r->down;
+		while (produced < capacity && position < r->history_length) {
+			out[produced++] = kernels->dot(r->banks, r->history + position - (taps - 1), taps);
+			position += down;
+		}
+		r->position = position;
+	} else {
+		// Rational ratios, like 44.1 kHz (160:441): step through the banks.
+		int position = r->position, phase = r->phase;
+		while (produced < capacity && position < r->history_length) {
+			out[produced++] = kernels->dot(r->banks + phase * taps, r->history + position - (taps - 1), taps);
+			position += r->advance[phase];
+			phase = r->next_phase[phase];
+		}
+		r->position = position;
+		r->phase = phase;
+	}
+	// Drop the history that no future output can reach.
+	int drop = r->position - (taps - 1);
+	if (drop > r->history_length)
+		drop = r->history_length;
+	if (drop > 0) {
+		memmove(r->history, r->history + drop, sizeof(float) * (r->history_length - drop));
+		r->history_length -= drop;
+		r->position -= drop;
+	}
+	return produced;
+}
+
+#endif
+
+// Builds the tables for an FFT of real_length real samples.
+// The plan is one allocation, with the tables laid out after the struct.
+tinysr_fft_plan_t* tinysr_fft_plan_create(int real_length) {
+	if (real_length < 4 || (real_length & (real_length - 1)))
+		return NULL;
+	int n = real_length / 2;
+	size_t bytes = sizeof(tinysr_fft_plan_t) + sizeof(float) * (n + 2*n) + sizeof(int) * n;
+#ifdef TINYSR_FIXED_POINT
+	bytes += sizeof(int32_t) * (n + 2*n);
+#endif
+	tinysr_fft_plan_t* plan = malloc(bytes);
+	if (plan == NULL)
+		return NULL;
+	plan->real_length = real_length;
+	plan->complex_length = n;
+	plan->twiddle_real = (float*)(plan + 1);
+	plan->twiddle_imag = plan->twiddle_real + n/2;
+	plan->split_real = plan->twiddle_imag + n/2;
+	plan->split_imag = plan->split_real + n;
+	plan->bit_reverse = (int*)(plan->split_imag + n);
+#ifdef TINYSR_FIXED_POINT
+	plan->fixed_twiddle_real = (int32_t*)(plan->bit_reverse + n);
+	plan->fixed_twiddle_imag = plan->fixed_twiddle_real + n/2;
+	plan->fixed_split_real = plan->fixed_twiddle_imag + n/2;
+	plan->fixed_split_imag = plan->fixed_split_real + n;
+#endif
+	// These are the only trig calls in the entire FFT; compute the angles in double precision
+	// so the tables are as accurate as a float can hold.
+	int k;
+	for (k = 0; k < n/2; k++) {
+		plan->twiddle_real[k] = cos(-PI2 * k / n);
+		plan->twiddle_imag[k] = sin(-PI2 * k / n);
+	}
+	for (k = 0; k < n; k++) {
+		plan->split_real[k] = cos(-PI2 * k / real_length);
+		plan->split_imag[k] = sin(-PI2 * k / real_length);
+	}
+#ifdef TINYSR_FIXED_POINT
+	// And again in Q30, for the fixed point FFT.
+	for (k = 0; k < n/2; k++) {
+		plan->fixed_twiddle_real[k] = (int32_t) round(cos(-PI2 * k / n) * (1 << 30));
+		plan->fixed_twiddle_imag[k] = (int32_t) round(sin(-PI2 * k / n) * (1 << 30));
+	}
+	for (k = 0; k < n; k++) {
+		plan->fixed_split_real[k] = (int32_t) round(cos(-PI2 * k / real_length) * (1 << 30));
+		plan->fixed_split_imag[k] = (int32_t) round(sin(-PI2 * k / real_length) * (1 << 30));
+	}
+#endif
+	// Compute the bit reversal permutation.
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (k = 0; k < n; k++) {
+		int b, reversed = 0;
+		for (b = 0; b < bits; b++)
+			if (k & (1 << b))
+				reversed |= 1 << (bits - 1 - b);
+		plan->bit_reverse[k] = reversed;
+	}
+	return plan;
+}
+
+void tinysr_fft_plan_free(tinysr_fft_plan_t* plan) {
+	free(plan);
+}
+
+// In-place iterative decimation in time FFT on interleaved complex data.
+// After the bit reversal permutation we run radix-4 passes, each of which does the work of two radix-2
+// passes in one sweep over the data. If the length is an odd power of two, one radix-2 pass goes first.
+// Within a radix-4 pass with quarter size h, the four inputs a, b, c, d = x[k], x[k+h], x[k+2h], x[k+3h]
+// are first combined pairwise with w1 = W_2h^k, and then the pairs are combined with w2 = W_4h^k and -i * w2.
+void tinysr_fft_complex(const tinysr_fft_plan_t* plan, float* data) {
+	int n = plan->complex_length;
+	int i, k;
+	// Bit reversal permutation.
+	for (i = 0; i < n; i++) {
+		int j = plan->bit_reverse[i];
+		if (i < j) {
+			float tr = data[2*i], ti = data[2*i+1];
+			data[2*i] = data[2*j];
+			data[2*i+1] = data[2*j+1];
+			data[2*j] = tr;
+			data[2*j+1] = ti;
+		}
+	}
+	int h = 1;
+	// Radix-2 pass for odd powers of two, where every twiddle is 1.
+	int log2_n = 0;
+	while ((1 << log2_n) < n)
+		log2_n++;
+	if (log2_n & 1) {
+		for (i = 0; i < n; i += 2) {
+			float ar = data[2*i], ai = data[2*i+1];
+			float br = data[2*i+2], bi = data[2*i+3];
+			data[2*i]   = ar + br;
+			data[2*i+1] = ai + bi;
+			data[2*i+2] = ar - br;
+			data[2*i+3] = ai - bi;
+		}
+		h = 2;
+	}
+	// Radix-4 passes.
+	for (; h < n; h *= 4) {
+		// The twiddle table holds W_n^j, so W_4h^k = W_n^(k * n/(4h)).
+		int stride = n / (4*h);
+		for (i = 0; i < n; i += 4*h) {
+			for (k = 0; k < h; k++) {
+				float w2r = plan->twiddle_real[k * stride], w2i = plan->twiddle_imag[k * stride];
+				float w1r = plan->twiddle_real[2 * k * stride], w1i = plan->twiddle_imag[2 * k * stride];
+				float* a = data + 2*(i + k);
+				float* b = a + 2*h;
+				float* c = b + 2*h;
+				float* d = c + 2*h;
+				// First radix-2 layer: (a, b) and (c, d) with twiddle w1.
+				float tr = w1r * b[0] - w1i * b[1], ti = w1r * b[1] + w1i * b[0];
+				float a1r = a[0] + tr, a1i = a[1] + ti;
+				float b1r = a[0] - tr, b1i = a[1] - ti;
+				tr = w1r * d[0] - w1i * d[1];
+				ti = w1r * d[1] + w1i * d[0];
+				float c1r = c[0] + tr, c1i = c[1] + ti;
+				float d1r = c[0] - tr, d1i = c[1] - ti;
+				// Second radix-2 layer: (a, c) with twiddle w2, and (b, d) with twiddle -i * w2.
+				float c2r = w2r * c1r - w2i * c1i, c2i = w2r * c1i + w2i * c1r;
+				float d2r = w2r * d1i + w2i * d1r, d2i = w2i * d1i - w2r * d1r;
+				a[0] = a1r + c2r;
+				a[1] = a1i + c2i;
+				c[0] = a1r - c2r;
+				c[1] = a1i - c2i;
+				b[0] = b1r + d2r;
+				b[1] = b1i + d2i;
+				d[0] = b1r - d2r;
+				d[1] = b1i - d2i;
+			}
+		}
+	}
+}
+
+// Computes the FFT of real input by packing it as a half length complex signal.
+// Reading the real array as interleaved complex data gives z[m] = x[2m] + i x[2m+1], and then
+// with Z = FFT(z), the spectrum of x is recovered as:
+//     X[k] = (Z[k] + conj(Z[n-k]))/2 - i/2 * W_2n^k * (Z[k] - conj(Z[n-k]))
+// where Z[n] is understood to mean Z[0]. Bins k and n-k only depend on Z[k] and Z[n-k], so we
+// compute them in pairs and write them back in place.
+void tinysr_fft_real(const tinysr_fft_plan_t* plan, float* array) {
+	int n = plan->complex_length;
+	tinysr_fft_complex(plan, array);
+	// The DC and Nyquist bins are purely real, so pack them into the first slot.
+	float z0r = array[0], z0i = array[1];
+	array[0] = z0r + z0i;
+	array[1] = z0r - z0i;
+	int k;
+	for (k = 1; k <= n/2; k++) {
+		float zr = array[2*k], zi = array[2*k+1];
+		float mr = array[2*(n-k)], mi = array[2*(n-k)+1];
+		// Even part E, and odd part D, such that X[k] = E - i * W^k * D.
+		float er = 0.5f * (zr + mr), ei = 0.5f * (zi - mi);
+		float dr = 0.5f * (zr - mr), di = 0.5f * (zi + mi);
+		// P = W^k * D.
+		float wr = plan->split_real[k], wi = plan->split_imag[k];
+		float pr = wr * dr - wi * di, pi = wr * di + wi * dr;
+		// X[k] = E - i P, and by symmetry X[n-k] = conj(E) - i conj(P).
+		array[2*k] = er + pi;
+		array[2*k+1] = ei - pr;
+		array[2*(n-k)] = er - pi;
+		array[2*(n-k)+1] = -ei - pr;
+	}
+}
+
+// Computes the magnitude spectrum of real input.
+void tinysr_fft_real_abs(const tinysr_fft_plan_t* plan, float* array, float* out) {
+	int n = plan->complex_length;
+	tinysr_fft_real(plan, array);
+	out[0] = fabsf(array[0]);
+	out[n] = fabsf(array[1]);
+	int k;
+	for (k = 1; k < n; k++)
+		out[k] = sqrtf(array[2*k]*array[2*k] + array[2*k+1]*array[2*k+1]);
 }
 
 // Computes the FFT on strided data recursively via decimation in time.
@@ -9,19 +9,120 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Default front-end parameters, as used by tinysr_frontend_plan_create_default().
+// To change any of these, build a plan with tinysr_frontend_plan_create() instead.
+#define FRONTEND_SAMPLE_RATE 16000
 #define FFT_LENGTH 512
 #define FRAME_LENGTH 400
 #define SHIFT_INTERVAL 160
+#define MEL_START_FREQUENCY 64.0
+// These two are fixed by the layout of feature_vector_t.
+#define MEL_FILTER_COUNT 23
+#define CEPSTRUM_LENGTH 13
+// Row length of the transposed DCT matrix, padded out to a whole number of SIMD vectors.
+#define CEPSTRUM_STRIDE 16
+// Bulk feature extraction runs this many frames side by side, one per SIMD lane.
+#define BATCH_FRAMES 8
+// Recognition scores this many frames at a time against every state of every word. In the floating
+// point build, each feature vector is expanded into the SCORE_TERMS monomials of the log-likelihood
+// (see gaussian_t), so scoring is one matrix product with the model's weight slab.
+#define SCORE_BLOCK_FRAMES 32
+#define SCORE_TERMS 105
+// Rows of scores are padded out to a multiple of this many states. The weight slab is stored as panels
+// of this many states, each holding all SCORE_TERMS weights for its states, term by term.
+#define SCORE_STATE_ALIGN 16
+#define SCORE_PANEL (SCORE_TERMS * SCORE_STATE_ALIGN)
+// Any mixture_shortlist longer than the codebook keeps (two components) scores every component of every
+// mixture state, as compute_dynamic_time_warping does.
+#define TINYSR_MIXTURE_EXACT 1000
 
 typedef int16_t samp_t;
 
+// Numeric types. By default the whole pipeline is single precision floating point.
+// Defining TINYSR_FIXED_POINT when building tinysr.c (and anything including this header) switches
+// the per-frame front-end, Gaussian scoring, and DTW to integer arithmetic, for processors without
+// an FPU. Floating point is then only used while building plans, loading models, and doing CSV I/O.
+// In the fixed point build:
+//  * tinysr_signal_t holds front-end samples with TINYSR_SIGNAL_FRACTION_BITS fraction bits.
+//  * tinysr_feature_t is Q16.16, so features have a range of +/- 32768.
+//  * tinysr_score_t is Q16.16 in 64 bits, for log likelihoods and DTW path scores.
+// The SIMD kernels, bulk batching, and polyphase resampler are floating point only, and are left out.
+#ifdef TINYSR_FIXED_POINT
+typedef int32_t tinysr_signal_t;
+typedef int32_t tinysr_feature_t;
+typedef int64_t tinysr_score_t;
+#define TINYSR_SIGNAL_FRACTION_BITS 8
+#define TINYSR_FEATURE_FRACTION_BITS 16
+// Converts a constant or a float to a feature or score. Constants fold at compile time.
+// The argument is evaluated twice.
+#define TINYSR_FEATURE(x) ((tinysr_feature_t) ((x) * 65536.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define TINYSR_SCORE(x) ((tinysr_score_t) ((x) * 65536.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define TINYSR_FEATURE_TO_FLOAT(x) ((x) / 65536.0f)
+#define TINYSR_SCORE_TO_FLOAT(x) ((x) / 65536.0f)
+#define TINYSR_SCORE_MIN (INT64_MIN / 4)
+#else
+typedef float tinysr_signal_t;
+typedef float tinysr_feature_t;
+typedef float tinysr_score_t;
+#define TINYSR_FEATURE(x) (x)
+#define TINYSR_SCORE(x) (x)
+#define TINYSR_FEATURE_TO_FLOAT(x) (x)
+#define TINYSR_SCORE_TO_FLOAT(x) (x)
+// I'd set this to negative infinity, but it's hard to do that portably. :(
+#define TINYSR_SCORE_MIN -1e30
+#endif
+
+// One shot mode treats all the input as one utterance. Free running mode finds utterances in the input
+// by their energy. Keyword spotting mode does no segmentation at all: every word is matched against every
+// stretch of the input as it arrives, and detected as soon as its score reaches its keyword threshold.
 typedef enum {
 	TINYSR_MODE_ONE_SHOT,
-	TINYSR_MODE_FREE_RUNNING
+	TINYSR_MODE_FREE_RUNNING,
+	TINYSR_MODE_KEYWORD_SPOTTING
 } tinysr_mode_t;
 
+// How utterances get matched against words. Exact mode runs full dynamic time warping against every word.
+// Pruned mode matches one word at a time, only within a Sakoe-Chiba band around the diagonal, only
+// following cells within a beam of their row's best, and gives up on a word as soon as even its best
+// conceivable finish couldn't beat the best word so far. It may occasionally pick a different word.
+typedef enum {
+	TINYSR_DTW_EXACT,
+	TINYSR_DTW_PRUNED
+} tinysr_dtw_mode_t;
+
+// How each utterance's cepstrum gets normalized. Utterance mode subtracts the mean over the whole utterance,
+// so it can't be applied until the utterance is over. Running mode subtracts, from each frame, the mean of
+// the utterance up to and including it, which is known as soon as the frame arrives. Models are trained
+// with whole utterance normalization, so running mode costs some accuracy, most of all early on in utterances.
+typedef enum {
+	TINYSR_CMN_UTTERANCE,
+	TINYSR_CMN_RUNNING
+} tinysr_cmn_mode_t;
+
+// Memory hooks. Everything a context allocates goes through its allocator, which is chosen when the
+// context is created, and defaults to malloc and free. Front-end and FFT plans can be shared between
+// contexts, so they always use malloc, as do read_feature_vector_csv and corpus files. Blocks must be
+// aligned for any type.
+typedef struct {
+	void* (*allocate)(void* user, size_t size);
+	void (*release)(void* user, void* ptr);
+	void* user;
+} tinysr_allocator_t;
+
+// Pool mode, for calling into a context from a real-time thread. Freed blocks are kept on the context,
+// on a free list per power of two size class, rather than handed back to the allocator, so once the
+// context has warmed up (or tinysr_reserve_pool has run), recognition stops calling the allocator at all.
+#define TINYSR_POOL_CLASSES 40
+typedef struct {
+	tinysr_allocator_t backing;
+	void* free_blocks[TINYSR_POOL_CLASSES];
+	// How many blocks have been taken from the backing allocator.
+	long backing_allocations;
+} tinysr_pool_t;
+
 // Generic singly linked list based stack.
 typedef struct _list_node_t {
 	void* datum;
@@ -35,11 +136,239 @@ typedef struct {
 	int length;
 	list_node_t* head;
 	list_node_t* tail;
+	// Where nodes come from. NULL means malloc and free.
+	const tinysr_allocator_t* allocator;
 } list_t;
 
-void list_append_back(list_t* list, void* datum);
+// Returns non-zero, leaving the list as it was, if there's no memory for the node.
+int list_append_back(list_t* list, void* datum);
 void* list_pop_front(list_t* list);
 
+// Precomputed tables for the iterative FFT.
+// A plan for a real input of length N runs an N/2 point complex transform, so every
+// table here is sized for the half-length transform. Plans are never modified after
+// creation, and thus may be shared between any number of contexts.
+typedef struct {
+	// Length of the real input, and of the complex transform used to compute it.
+	int real_length;
+	int complex_length;
+	// Twiddle factors e^(-2 pi i k / complex_length) for k in [0, complex_length/2).
+	float* twiddle_real;
+	float* twiddle_imag;
+	// Twiddle factors e^(-2 pi i k / real_length) for k in [0, complex_length), used to
+	// split the packed complex transform back into the spectrum of the real input.
+	float* split_real;
+	float* split_imag;
+	// Bit reversal permutation of [0, complex_length).
+	int* bit_reverse;
+#ifdef TINYSR_FIXED_POINT
+	// The same twiddle factors, in Q30.
+	int32_t* fixed_twiddle_real;
+	int32_t* fixed_twiddle_imag;
+	int32_t* fixed_split_real;
+	int32_t* fixed_split_imag;
+#endif
+} tinysr_fft_plan_t;
+
+// Everything about the front-end that can be computed ahead of time.
+// A plan is immutable once created, so any number of contexts may share one copy, as long
+// as it outlives all of them. All tables are 64 byte aligned.
+typedef struct {
+	// The rate the front-end runs at, which input gets resampled to.
+	int sample_rate;
+	int frame_length;
+	int shift_interval;
+	int fft_length;
+	// Mel filter bank center bins, as in ES 201 108 4.2.9, but zero indexed: cbin[k+1] is the center
+	// of filter k, and cbin[0] and cbin[MEL_FILTER_COUNT+1] are the outer edges of the bank.
+	int cbin[MEL_FILTER_COUNT + 2];
+	// Sparse mel weight matrix: filter k covers mel_bin_count[k] spectrum bins starting from
+	// cbin[k], with weights stored contiguously from mel_weights + mel_weight_offset[k].
+	int mel_bin_count[MEL_FILTER_COUNT];
+	int mel_weight_offset[MEL_FILTER_COUNT];
+	float* mel_weights;
+	// The Hamming window, frame_length entries.
+	float* window;
+	// The DCT matrix, row major, CEPSTRUM_LENGTH x MEL_FILTER_COUNT.
+	float* dct;
+	// The same matrix transposed, MEL_FILTER_COUNT x CEPSTRUM_STRIDE, with zeros past CEPSTRUM_LENGTH.
+	float* dct_transposed;
+#ifdef TINYSR_FIXED_POINT
+	// The window and DCT matrix in Q30, and the mel weights in Q15.
+	int32_t* fixed_window;
+	int32_t* fixed_dct;
+	int32_t* fixed_mel_weights;
+	// log2(1 + i / 2^LOG_TABLE_BITS) in Q16, for i in [0, 2^LOG_TABLE_BITS] inclusive.
+	int32_t* fixed_log_table;
+#endif
+	tinysr_fft_plan_t* fft_plan;
+	void* table_storage;
+} tinysr_frontend_plan_t;
+
+#ifndef TINYSR_FIXED_POINT
+// The per-frame front-end kernels. There is a portable scalar set, and vectorized sets chosen
+// at runtime from the features of the CPU. Contexts use tinysr_select_kernels() by default.
+typedef enum {
+	TINYSR_KERNELS_SCALAR,
+	TINYSR_KERNELS_SSE2,
+	TINYSR_KERNELS_AVX2
+} tinysr_kernel_level_t;
+
+typedef struct tinysr_kernels {
+	tinysr_kernel_level_t level;
+	const char* name;
+	// Returns 2e-22 + sum of x[i]^2.
+	float (*energy)(const float* x, int length);
+	// Pre-emphasis followed by windowing: out[i] = (x[i] - 0.97 x[i-1]) * window[i], and out[0] = 0.
+	// The output may be the same array as the input.
+	void (*preemphasize_window)(const float* x, float* out, const float* window, int length);
+	// out[k] = |(x[2k], x[2k+1])| for k in [0, length).
+	void (*magnitude)(const float* x, float* out, int length);
+	// Applies the sparse mel weights of the plan to a magnitude spectrum.
+	void (*mel_filter)(const tinysr_frontend_plan_t* plan, const float* spectrum, float* filter_bank);
+	// x[i] = log(x[i] + 2e-22). The vectorized sets use a polynomial approximation, with error
+	// below 1e-6 absolute for arguments in [0.5, 2], and below 1e-6 relative elsewhere.
+	void (*log_floor)(float* x, int length);
+	// cepstrum = DCT * filter_bank.
+	void (*dct)(const tinysr_frontend_plan_t* plan, const float* filter_bank, float* cepstrum);
+	// Returns sum of a[i] * b[i]. Used by the resampler's FIR filters, and to score mixture components.
+	float (*dot)(const float* a, const float* b, int length);
+	// Runs the whole front-end on BATCH_FRAMES frames at once, in structure of arrays form: sample i of
+	// frame l is batch[i * BATCH_FRAMES + l], for i in [0, fft_length). The batch is destroyed. Writes
+	// log_energy[l], and cepstrum[c * BATCH_FRAMES + l] for each cepstral coefficient c.
+	void (*frontend_batch)(const struct tinysr_kernels* kernels, const tinysr_frontend_plan_t* plan, float* batch, float* log_energy, float* cepstrum);
+	// Batched Gaussian scoring, as a matrix product: scores[f * stride + s] is the sum over k of
+	// expansion[f * SCORE_TERMS + k] times weight (k, s), for f in [0, frames) and s in [0, columns).
+	// The weights are in panels (see SCORE_PANEL), so weight (k, s) is
+	// weights[s / SCORE_STATE_ALIGN * SCORE_PANEL + k * SCORE_STATE_ALIGN + s % SCORE_STATE_ALIGN].
+	// The column count is a multiple of SCORE_STATE_ALIGN.
+	void (*score)(const float* expansion, int frames, const float* weights, int stride, int columns, float* scores);
+} tinysr_kernels_t;
+
+// Returns the fastest kernel set the running CPU supports.
+const tinysr_kernels_t* tinysr_select_kernels(void);
+// Returns a specific kernel set, or NULL if this build or CPU doesn't support it.
+const tinysr_kernels_t* tinysr_get_kernels(tinysr_kernel_level_t level);
+
+// Band-limited polyphase resampler, bringing input to the front-end's rate.
+// The rate ratio is reduced to up/down: an integer ratio (up == 1) runs as a plain decimating FIR,
+// and anything else runs one of up precomputed polyphase coefficient banks per output sample.
+// Rates whose reduced ratio needs too many banks, or which already match the front-end, are left to
+// the linear interpolator in tinysr_feed_input, and have mode TINYSR_RESAMPLER_LINEAR.
+typedef enum {
+	TINYSR_RESAMPLER_LINEAR,
+	TINYSR_RESAMPLER_DECIMATE,
+	TINYSR_RESAMPLER_RATIONAL
+} tinysr_resampler_mode_t;
+
+typedef struct {
+	// The rates this resampler was configured for.
+	int input_rate, output_rate;
+	tinysr_resampler_mode_t mode;
+	int up, down;
+	// Taps per bank. Each bank is stored reversed, so an output is a dot product with the most recent
+	// taps input samples, in order.
+	int taps;
+	float* banks;
+	// For each phase, the next phase, and how many input samples to advance when moving to it.
+	int* next_phase;
+	int* advance;
+	// Input history. The next output's window ends at history[position].
+	float* history;
+	int history_length, history_capacity;
+	int position, phase;
+	// Where the tables and history come from. NULL means malloc and free.
+	const tinysr_allocator_t* allocator;
+} tinysr_resampler_t;
+#endif
+
+typedef struct {
+	long long number;
+	tinysr_feature_t log_energy;
+	tinysr_feature_t cepstrum[13];
+	tinysr_feature_t noise_floor;
+} feature_vector_t;
+
+// A vocabulary, loaded once, that any number of contexts can be bound to, and recognize against at the same
+// time, on any threads. It's never written once bound, and it's freed when the last reference to it goes.
+typedef struct tinysr_model tinysr_model_t;
+
+// Model file formats. Legacy files are what model_gen.py writes: each Gaussian as its full inverse covariance,
+// which has to be factored when loading. Version 2 files hold everything already in the layout recognition
+// uses, behind a header, so that loading them is mapping the file into memory and checking the word table.
+typedef enum {
+	TINYSR_MODEL_LEGACY = 1,
+	TINYSR_MODEL_V2 = 2,
+	// Version 3 adds mixture states. Legacy and version 2 files can't hold them.
+	TINYSR_MODEL_V3 = 3
+} tinysr_model_format_t;
+
+// A pool of worker threads for matching utterances against the vocabulary in parallel. One pool can be
+// shared by any number of contexts, on any number of threads.
+typedef struct tinysr_thread_pool tinysr_thread_pool_t;
+
+// A context's background recognition thread, along with the queues between it and the thread feeding input.
+typedef struct tinysr_async tinysr_async_t;
+
+// Receives each result of background recognition, on the background thread.
+typedef void (*tinysr_result_callback_t)(void* user, int word_index, tinysr_score_t score, long long first_frame, long long end_frame);
+
+// A share of the vocabulary for one thread to match: some consecutive words, and scratch space for scoring
+// up to SCORE_BLOCK_FRAMES frames against the width states from first_state, which cover all of the
+// words' states, and start at a multiple of SCORE_STATE_ALIGN.
+typedef struct {
+	list_node_t* first_entry;
+	int entries;
+	int first_state, width;
+#ifndef TINYSR_FIXED_POINT
+	float* expansion;
+#endif
+	tinysr_score_t* scores;
+#ifndef TINYSR_NO_STATS
+	// Dynamic time warping cells pruned matching has evaluated for this task, for the stats.
+	long long dtw_cells;
+#endif
+} recognize_task_t;
+
+// A keyword spotting path, ending at one state of one word: its log likelihood, how many frames long it
+// is (zero if there's no path here), and the number of the feature vector it started at.
+typedef struct {
+	tinysr_score_t sum;
+	int frames;
+	long long start;
+} keyword_cell_t;
+
+// Where a context's time goes, stage by stage: resampling and the rest of the input path in tinysr_feed_input,
+// the front-end (FFT, mel filter bank and DCT) for each frame, utterance detection in tinysr_detect_utterances,
+// and matching, which is dynamic time warping along with scoring its states, once per utterance (or block of
+// streamed or spotted frames). Each stage's time leaves out the stages it calls, so the four add up to the
+// time spent in TinySR. Build with -DTINYSR_NO_STATS to compile all of this out.
+typedef enum {
+	TINYSR_STAGE_FEED,
+	TINYSR_STAGE_FRONTEND,
+	TINYSR_STAGE_DETECT,
+	TINYSR_STAGE_MATCH,
+	TINYSR_STAGE_COUNT
+} tinysr_stage_t;
+
+// Each stage's calls, their total and longest times in nanoseconds, and a histogram of their times, where
+// bucket k counts calls taking under 2^(k+1) ns, but at least 2^k (or anything under 2 ns, for bucket 0).
+#define TINYSR_STATS_BUCKETS 32
+typedef struct {
+	long long calls;
+	long long total_ns, max_ns;
+	long long histogram[TINYSR_STATS_BUCKETS];
+} tinysr_stage_stats_t;
+
+// Along with the stages, how many feature vectors the front-end made, how many utterances were detected,
+// how many dynamic time warping cells were evaluated (pruned matching skips most of them), and how many
+// allocations the context made, and of how many bytes in all, not counting the resampler's filter tables.
+typedef struct {
+	tinysr_stage_stats_t stages[TINYSR_STAGE_COUNT];
+	long long frames, utterances, dtw_cells;
+	long long allocations, bytes_allocated;
+} tinysr_stats_t;
+
 // TinySR context, and associated functions.
 typedef struct {
 	// Public configuration:
@@ -48,39 +377,147 @@ typedef struct {
 	int input_sample_rate;
 	tinysr_mode_t utterance_mode;
 	int do_downmix;
+	// The matching mode, and for pruned mode, the band's half width as a percentage of each template's
+	// length, and the beam width in (unnormalized) log likelihood.
+	tinysr_dtw_mode_t dtw_mode;
+	int dtw_band_percent;
+	tinysr_score_t dtw_beam;
+	// For models with mixture states, how many components, besides each state's heaviest, get scored in full
+	// for each frame: the best few the model's codebook picked for the nearest codeword, up to two. Zero
+	// scores only the heaviest, and TINYSR_MIXTURE_EXACT every component. Defaults to one.
+	int mixture_shortlist;
+	tinysr_cmn_mode_t cmn_mode;
+	// In free running mode, set this to recognize each utterance while it's still being spoken, so that its
+	// result is ready as soon as its end is detected. Streaming always uses running cepstral mean
+	// normalization and exact matching, and gets the same results as recognizing the same utterances
+	// afterwards with TINYSR_CMN_RUNNING, up to rounding.
+	int streaming;
+	// Set this to match utterances against the vocabulary on a thread pool, which must outlive the context,
+	// or leave it NULL to match on the calling thread. The results are identical either way. Streaming and
+	// keyword spotting always run on the calling thread.
+	tinysr_thread_pool_t* thread_pool;
 
 	// Private:
 	int processed_samples;
-	float resampling_prev_raw_sample;
+	tinysr_signal_t resampling_prev_raw_sample;
+	tinysr_signal_t offset_comp_prev_in;
+#ifdef TINYSR_FIXED_POINT
+	// Q16, in input samples.
+	int32_t resampling_time_delta;
+	// The compensator's output, with 8 more fraction bits than the signal, so it can decay smoothly.
+	int64_t offset_comp_prev_out;
+#else
 	float resampling_time_delta;
-	float offset_comp_prev_in;
 	float offset_comp_prev_out;
-	float* input_buffer;
+#endif
+	tinysr_signal_t* input_buffer;
 	int input_buffer_next;
 	int input_buffer_samps;
-	float* temp_buffer;
-	// Feature vector list.
-	list_t fv_list;
+	tinysr_signal_t* temp_buffer;
+	tinysr_signal_t* spectrum_buffer;
+	const tinysr_frontend_plan_t* frontend_plan;
+	int owns_frontend_plan;
+	// Where all of this context's memory comes from. In pool mode, this allocates from pool, which in
+	// turn allocates from the allocator the context was created with.
+	tinysr_allocator_t allocator;
+	int use_pool;
+	tinysr_pool_t pool;
+#ifndef TINYSR_FIXED_POINT
+	// It is safe to point this at any other kernel set between calls.
+	const tinysr_kernels_t* kernels;
+	// Reconfigured whenever input_sample_rate changes.
+	tinysr_resampler_t resampler;
+#endif
+	// Bulk extraction state, only used inside tinysr_extract_features.
+	feature_vector_t* extract_out;
+	int extract_count, extract_capacity;
+#ifndef TINYSR_FIXED_POINT
+	float* batch_buffer;
+	// The allocation batch_buffer is aligned within.
+	void* batch_storage;
+	int batch_pending;
+#endif
+	// Feature vectors waiting for utterance detection, in a ring whose capacity is a power of two.
+	// Feature vector number n lives at fv_ring[n & fv_ring_mask], and numbers [fv_oldest, next_fv_number) are held.
+	feature_vector_t* fv_ring;
+	int fv_ring_mask;
+	long long fv_oldest;
 	long long next_fv_number;
-	list_node_t* current_fv;
-	list_node_t* utterance_start;
-	float noise_floor_estimate;
-	float excitement;
-	float boredom;
+	// The number of the next feature vector for utterance detection to look at.
+	long long fv_checked;
+	// The number of the first feature vector of the utterance being detected, or -1 if there isn't one.
+	long long utterance_start;
+	tinysr_feature_t noise_floor_estimate;
+	int excitement;
+	int boredom;
 	int utterance_state;
 	list_t utterance_list;
+	// The model the context is bound to, if any. The words, their names, their states and the weight slab
+	// are the model's, copied here for convenience, and read-only.
+	tinysr_model_t* model;
 	list_t recog_entry_list;
 	char** word_names;
 	list_t results_list;
+	// The states of all the words loaded, numbered consecutively across words, and padded out to state_stride.
+	int state_count, state_stride;
+#ifndef TINYSR_FIXED_POINT
+	// The weight slab for batched scoring: one column of SCORE_TERMS weights per state, in panels.
+	float* score_weights;
+	// Scratch for SCORE_BLOCK_FRAMES expanded feature vectors.
+	float* score_expansion;
+#endif
+	// Scratch for scoring SCORE_BLOCK_FRAMES frames, state_stride scores each.
+	tinysr_score_t* score_block;
+	// Dynamic time warping rows for all of the words, one entry per state.
+	tinysr_score_t* dp_row;
+	// Running cepstral mean normalization: the sum and count of the frames of the utterance so far.
+#ifdef TINYSR_FIXED_POINT
+	int64_t cmn_sum[13];
+#else
+	float cmn_sum[13];
+#endif
+	int cmn_count;
+	// Streaming recognition of the utterance being detected: the number of the next feature vector to go
+	// through it (or -1 if the utterance isn't being streamed), the frames gone through the dynamic time
+	// warping so far, and the normalized frames waiting to be scored.
+	long long stream_next;
+	int stream_frames, stream_pending;
+	feature_vector_t* stream_block;
+	// The streamed utterance's own dynamic time warping rows, laid out like dp_row.
+	tinysr_score_t* stream_dp_row;
+	// Keyword spotting: the moving cepstral mean, and how many frames it averages, which climbs to a limit.
+	tinysr_feature_t keyword_mean[13];
+	int keyword_mean_frames;
+	// The best path ending at each state of each word, laid out like dp_row.
+	keyword_cell_t* keyword_cells;
+	// By word index: the score at which each word gets detected, and the number of the last feature vector
+	// of its last detection, which the next one must start after.
+	tinysr_score_t* keyword_thresholds;
+	long long* keyword_last_ends;
+	// The vocabulary split up for matching on a thread pool, along with the tasks' scratch space, and each
+	// word's score, by word index.
+	recognize_task_t* tasks;
+	int task_count;
+#ifndef TINYSR_FIXED_POINT
+	float* task_expansion;
+#endif
+	tinysr_score_t* task_scores;
+	tinysr_score_t* word_scores;
+	// For models with mixture states, the codeword nearest each frame of the utterance being matched, for the
+	// first codewords_cached frames, found once for every word and task to share.
+	int* frame_codewords;
+	int codewords_cached;
+	// Background recognition, if started.
+	tinysr_async_t* async;
+#ifndef TINYSR_NO_STATS
+	// Only ever touched by the thread feeding input; the background thread's matching gets counted once
+	// it hands each utterance back. stats_recorded_ns is every stage's time so far, which isn't reset, so
+	// that each stage can tell how much time the stages it called took.
+	tinysr_stats_t stats;
+	long long stats_recorded_ns;
+#endif
 } tinysr_ctx_t;
 
-typedef struct {
-	long long number;
-	float log_energy;
-	float cepstrum[13];
-	float noise_floor;
-} feature_vector_t;
-
 typedef struct {
 	int length;
 	feature_vector_t* feature_vectors;
@@ -90,39 +527,127 @@ typedef struct {
 	// The log-likelihood of data matching this model is:
 	// log_likelihood_offset - 0.5 * (cepstrum - cepstrum_mean)^T * cepstrum_inverse_covariance * (cepstrum - cepstrum_mean)
 	// Where cepstrum is an input 13-column vector and cepstrum_inverse_covariance is a 13x13 matrix.
-	// Also note that covariance matrices are symmetric, so there is no row/column major order issue
-	// to worry about with the cepstrum_inverse_covariance.
-	float log_likelihood_offset;
-	float cepstrum_mean[13];
-	float cepstrum_inverse_covariance[169];
+	// The inverse covariance is symmetric positive definite, so on loading it gets Cholesky factored as
+	// 0.5 * cepstrum_inverse_covariance = U^T U, with U upper triangular, and then the log-likelihood is just:
+	// log_likelihood_offset - |U * (cepstrum - cepstrum_mean)|^2
+	tinysr_score_t log_likelihood_offset;
+	tinysr_feature_t cepstrum_mean[13];
+	// Models with a diagonal inverse covariance (see model_gen.py --diagonal) are scored with just the diagonal.
+	int diagonal;
+	// The rows of U, packed: row i holds columns [i, 13). For diagonal Gaussians, just the first 13 entries
+	// are used, and hold U's diagonal.
+#ifdef TINYSR_FIXED_POINT
+	// In Q24, so entries must be below 128 in magnitude. Larger entries saturate on loading.
+	int32_t cepstrum_factor[91];
+#else
+	float cepstrum_factor[91];
+#endif
 } gaussian_t;
 
 typedef struct {
 	int index;
 	char* name;
-	float ll_offset, ll_slope;
+	tinysr_score_t ll_offset;
+#ifdef TINYSR_FIXED_POINT
+	// Q24.
+	int32_t ll_slope;
+#else
+	float ll_slope;
+#endif
 	int model_template_length;
 	gaussian_t* model_template; 
+	// A state with several mixture components scores as the best of model_template[j], its heaviest component,
+	// and its other components, mixture[mixture_starts[j]] up to mixture[mixture_starts[j+1]]. Each component's
+	// log weight is folded into its log_likelihood_offset. Both are NULL if every state has just one Gaussian.
+	int* mixture_starts;
+	gaussian_t* mixture;
+	// The number of this word's first state, and first extra mixture component, across all the words loaded.
+	int first_state;
+	int first_component;
+	// The largest log_likelihood_offset of any of its states, which no frame can score above.
+	tinysr_score_t best_state_offset;
 } recog_entry_t;
 
 typedef struct {
 	int word_index;
-	float score;
+	tinysr_score_t score;
+	// The numbers of the first feature vector matched, and one past the last.
+	long long first_frame, end_frame;
 } result_t;
 
 // === Public API ===
 
 // Call to get/free a context.
 tinysr_ctx_t* tinysr_allocate_context(void);
+// Like tinysr_allocate_context, but runs the front-end from a given plan, which is not
+// copied, and must outlive the context. This lets many contexts share one plan.
+tinysr_ctx_t* tinysr_allocate_context_with_plan(const tinysr_frontend_plan_t* plan);
+// The general form of both of the above: a NULL plan makes the context its own default plan, and a
+// NULL allocator means malloc and free. If use_pool is set, the context runs in pool mode. All three
+// return NULL, having given back anything they took, if an allocation fails.
+tinysr_ctx_t* tinysr_allocate_context_with_allocator(const tinysr_frontend_plan_t* plan, const tinysr_allocator_t* allocator, int use_pool);
 void tinysr_free_context(tinysr_ctx_t* ctx);
 
+// Starts a thread pool with the given number of worker threads. Threads using the pool also work on
+// their own jobs, so to use four cores from one thread, start three workers. Returns NULL on failure, or
+// if TinySR was built with TINYSR_NO_THREADS.
+tinysr_thread_pool_t* tinysr_thread_pool_create(int threads);
+// Stops and frees a thread pool. No context may be using it.
+void tinysr_thread_pool_free(tinysr_thread_pool_t* pool);
+
+// Moves recognition onto a background thread, after loading the model. From then on, tinysr_recognize and
+// tinysr_recognize_utterances only hand detected utterances over to the background thread through a
+// lock-free queue, so the thread feeding input only ever pays for the front-end and utterance detection.
+// Up to max_pending utterances can be waiting or in recognition; any more are dropped. Each result goes
+// to the callback, on the background thread, or if the callback is NULL, to another lock-free queue, for
+// tinysr_get_result (dropped if more than max_pending results wait there). Streaming is off while running
+// in the background. Until stopped, don't load models or change the matching settings. Returns non-zero
+// on failure, including if TinySR was built with TINYSR_NO_THREADS.
+int tinysr_start_async(tinysr_ctx_t* ctx, int max_pending, tinysr_result_callback_t callback, void* user);
+// Waits for every utterance handed over to be recognized, then stops the background thread. Results that
+// haven't been fetched yet stay available to tinysr_get_result. tinysr_free_context does this too.
+void tinysr_stop_async(tinysr_ctx_t* ctx);
+// How many utterances and results background recognition has dropped because its queues were full.
+int tinysr_async_dropped(tinysr_ctx_t* ctx);
+
+// Copies out the context's counters since it was made or last reset. Cheap enough to call often, on the
+// thread feeding input. Returns non-zero, and zeroes stats, if TinySR was built with TINYSR_NO_STATS.
+int tinysr_get_stats(tinysr_ctx_t* ctx, tinysr_stats_t* stats);
+void tinysr_reset_stats(tinysr_ctx_t* ctx);
+
+// For pool mode contexts, after loading the model: preallocates the worst case storage for up to
+// max_pending utterances waiting for recognition, each as long as the feature vector ring holds, and
+// their results waiting to be fetched. The scoring and DTW scratch space is made by tinysr_load_model.
+// Returns non-zero if the context isn't in pool mode, or an allocation failed.
+int tinysr_reserve_pool(tinysr_ctx_t* ctx, int max_pending);
+
+// Frees an utterance taken off ctx->utterance_list by hand.
+void tinysr_free_utterance(tinysr_ctx_t* ctx, utterance_t* utterance);
+
 // Convenience function call, equivalent to tinysr_feed_input(), but then runs
 // tinysr_detect_utterances() and tinysr_recognize_utterances(), and then returns
-// the number of pending recognition results.
+// the number of pending recognition results, or -1 if tinysr_feed_input() failed.
 int tinysr_recognize(tinysr_ctx_t* ctx, samp_t* samples, int length);
 
-// Call to pass input samples.
-void tinysr_feed_input(tinysr_ctx_t* ctx, samp_t* samples, int length);
+// Call to pass input samples. Returns non-zero, taking none of them, if there's no memory for the resampler
+// a new input_sample_rate needs.
+int tinysr_feed_input(tinysr_ctx_t* ctx, samp_t* samples, int length);
+
+// Feature vectors wait on the context until utterance detection is done with them. If you aren't
+// doing utterance detection, you can take them out yourself instead, oldest first.
+// tinysr_pop_feature_vector returns 1 if a feature vector was copied into fv, 0 if there are none.
+int tinysr_feature_count(tinysr_ctx_t* ctx);
+int tinysr_pop_feature_vector(tinysr_ctx_t* ctx, feature_vector_t* fv);
+
+// Runs the front-end over a whole buffer of input, writing feature vectors straight into out, rather
+// than queueing them on the context. Internally, frames are processed BATCH_FRAMES at a time. Returns
+// the number of feature vectors written, which is 0, with none of the input taken, on allocation failure.
+// If out fills up, any further frames are queued on the context exactly as tinysr_feed_input would. Likewise, if feature vectors are already waiting on
+// the context, new ones queue up behind them, so pop those off first. Partial frames carry over to the next call, so a long
+// input may be extracted in pieces.
+int tinysr_extract_features(tinysr_ctx_t* ctx, samp_t* samples, int length, feature_vector_t* out, int capacity);
+// An upper bound on how many feature vectors the next length input samples can produce.
+int tinysr_extract_capacity(tinysr_ctx_t* ctx, int length);
 
 // Call to trigger utterance detection.
 void tinysr_detect_utterances(tinysr_ctx_t* ctx);
@@ -133,30 +658,156 @@ void tinysr_recognize_utterances(tinysr_ctx_t* ctx);
 // Call to get one recognition result.
 // Returns 1 if a result was gotten, 0 otherwise.
 // It's safe to set either or both pointers to NULL.
-int tinysr_get_result(tinysr_ctx_t* ctx, int* word_index, float* score);
+int tinysr_get_result(tinysr_ctx_t* ctx, int* word_index, tinysr_score_t* score);
+// The same, but also gets the span of feature vector numbers matched, from first_frame up to (but not
+// including) end_frame. Feature vectors are numbered from 1, and come 10 ms apart by default.
+int tinysr_get_result_span(tinysr_ctx_t* ctx, int* word_index, tinysr_score_t* score, long long* first_frame, long long* end_frame);
+
+// Sets the score at which keyword spotting detects a word. Scores are on the same scale as recognition
+// scores, so a typical match scores around 0, and a typical mismatch around -100.
+// Returns non-zero if there's no such word.
+int tinysr_set_keyword_threshold(tinysr_ctx_t* ctx, int word_index, tinysr_score_t threshold);
 
 // Add some recognition entries.
-// Call this to add a word to the vocabulary of the given context.
+// Call this to add a word to the vocabulary of the given context. The words go into a model of the
+// context's own, made with its allocator (or in pool mode, its backing allocator) the first time. Returns
+// -1 if the context is bound to a model that's shared with anyone else.
 int tinysr_load_model(tinysr_ctx_t* ctx, const char* path);
 
+// Makes an empty model, holding one reference, for its caller. A NULL allocator means malloc and free.
+tinysr_model_t* tinysr_model_create(const tinysr_allocator_t* allocator);
+// Adds the words in a model file, of either format, to a model, returning the number added, or -1 if the file
+// can't be read or is malformed, in which case none are added. Only allowed while the caller holds the only
+// reference to the model, so before it's bound to any contexts. Version 2 files are mapped read-only, and
+// stay mapped until the model is freed; the floating point build recognizes straight out of the mapping.
+// Compile with -DTINYSR_NO_MMAP where there's no mmap, to read them into memory instead.
+int tinysr_model_load(tinysr_model_t* model, const char* path);
+// Adds a word to a model, from the parameters a model file holds for it: for each of its template_length
+// states, a log likelihood offset, 13 means, and a 13x13 inverse covariance, one state after another. Returns
+// the word's index, or -1 on allocation failure, if an inverse covariance isn't positive definite, or if the
+// caller doesn't hold the only reference to the model. Adding and loading words only takes note of them:
+// the model's scoring slab and mixture codebook are built once, when it's next bound or saved.
+int tinysr_model_add_word(tinysr_model_t* model, const char* name, float ll_offset, float ll_slope, int template_length,
+	const float* log_likelihood_offsets, const float* means, const float* inverse_covariances);
+// The same, for a word with mixture states: state j has component_counts[j] components, and the parameters
+// run through every component of every state in turn, heaviest component first within each state, with each
+// component's log weight added to its log likelihood offset.
+int tinysr_model_add_mixture_word(tinysr_model_t* model, const char* name, float ll_offset, float ll_slope, int template_length,
+	const int* component_counts, const float* log_likelihood_offsets, const float* means, const float* inverse_covariances);
+#ifndef TINYSR_FIXED_POINT
+// Writes out all the words in a model, in the given format. Returns non-zero on error, or if the format
+// can't hold the model's mixture states.
+int tinysr_model_save(tinysr_model_t* model, const char* path, tinysr_model_format_t format);
+#endif
+// Takes and drops references to a model. Both are safe from any thread, at any time.
+void tinysr_model_retain(tinysr_model_t* model);
+void tinysr_model_release(tinysr_model_t* model);
+// Binds a context to a model, in place of any it was bound to, taking a reference to it for as long as
+// it stays bound, and making the context's scratch space for its words. Binding NULL leaves the context
+// with no words. Builds the model first, if words have been added since it was last built. Returns non-zero
+// on allocation failure, leaving the context with no states to recognize against, or if the model couldn't
+// be built, with no words. Each context holds its own front-end, utterance detection and scratch state, so contexts bound
+// to the same model can recognize at the same time on different threads, without any locking.
+int tinysr_bind_model(tinysr_ctx_t* ctx, tinysr_model_t* model);
+
 // Read and write CSV files containing an utterance.
 // The write function returns non-zero on error, but doesn't print anything.
 int write_feature_vector_csv(const char* path, utterance_t* utterance);
 utterance_t* read_feature_vector_csv(const char* path);
 
+// Corpus files, which hold any number of utterances, each with a label, such as the word spoken, in one
+// indexed binary file, so that reading a whole corpus is mapping it into memory and checking the index.
+// Opening returns NULL if the file is missing or malformed. Each utterance's feature vectors stay in the
+// corpus, read-only, until it's closed. Getting an utterance returns non-zero if there's no such utterance.
+typedef struct tinysr_corpus tinysr_corpus_t;
+tinysr_corpus_t* tinysr_corpus_open(const char* path);
+int tinysr_corpus_count(const tinysr_corpus_t* corpus);
+const char* tinysr_corpus_label(const tinysr_corpus_t* corpus, int index);
+int tinysr_corpus_utterance(const tinysr_corpus_t* corpus, int index, utterance_t* utterance);
+void tinysr_corpus_close(tinysr_corpus_t* corpus);
+// Writes utterances to the end of a corpus file, creating it if it doesn't exist, or is empty. Opening
+// returns NULL if the file can't be written, or isn't a corpus. Appended utterances are written out as
+// they come, but only become part of the corpus once the writer is closed, so a corpus whose writer never
+// closes is left as it was. The index and labels keep room to grow in place, so a corpus built up a few
+// utterances per writer stays in proportion to what it holds, though appending many per writer is still
+// cheaper. Appending and closing return non-zero on error; closing always frees the writer.
+typedef struct tinysr_corpus_writer tinysr_corpus_writer_t;
+tinysr_corpus_writer_t* tinysr_corpus_writer_open(const char* path);
+int tinysr_corpus_append(tinysr_corpus_writer_t* writer, const char* label, const utterance_t* utterance);
+int tinysr_corpus_writer_close(tinysr_corpus_writer_t* writer);
+
 // === Private functions ===
 
-// Initiates a feature extraction run on the contents of input_buffer.
+// Initiates a feature extraction run on the most recent frame in input_buffer.
 // This function is called automatically by tinysr_feed_input whenever the
 // buffer is full, so you should never have to call it yourself.
 void tinysr_process_frame(tinysr_ctx_t* ctx);
 
 void tinysr_recognize_utterance(tinysr_ctx_t* ctx, utterance_t* utterance);
+// Matches one utterance against every word, exactly, on the calling thread, and writes each word's score
+// to word_scores[word index], rather than picking a result. Scores come out exactly as recognition's do.
+// A word with ll_offset 0 and ll_slope 1 scores its path's raw log-likelihood. Not while running async.
+void tinysr_score_words(tinysr_ctx_t* ctx, utterance_t* utterance, tinysr_score_t* word_scores);
+// Matches one utterance against one word, exactly, and traces back the best path, as used to train models.
+// Writes the frame and state of each cell along it, from the first frame and state to the last, to frames
+// and states, which must each have room for utterance->length + model_template_length - 1 entries, and
+// the path's log-likelihood, before the word's ll_offset and ll_slope, to log_likelihood. Returns the number
+// of cells, or -1 if there's no such word, the utterance is empty, or on allocation failure. Not while
+// running async.
+int tinysr_align_utterance(tinysr_ctx_t* ctx, int word_index, utterance_t* utterance, int* frames, int* states, tinysr_score_t* log_likelihood);
+// Runs feature vectors, as they come out of the front-end, through keyword spotting, numbered as they are.
+void tinysr_spot_keywords(tinysr_ctx_t* ctx, const feature_vector_t* fvs, int count);
+
+// Sets up a Gaussian from its parameters, as stored in a model file. Returns non-zero if the inverse
+// covariance isn't positive definite.
+int gaussian_init(gaussian_t* gauss, float log_likelihood_offset, const float* cepstrum_mean, const float* cepstrum_inverse_covariance);
+tinysr_score_t gaussian_log_likelihood(gaussian_t* gauss, feature_vector_t* fv);
+// Scores up to SCORE_BLOCK_FRAMES feature vectors against every state loaded into the context, writing
+// the log-likelihood of frame f matching state s to scores[f * ctx->state_stride + s].
+void tinysr_score_frames(tinysr_ctx_t* ctx, const feature_vector_t* fvs, int frames, tinysr_score_t* scores);
+// A reference implementation of matching one word, scoring each cell as it goes. Recognition scores
+// frames in blocks with tinysr_score_frames instead. The dp_row must hold model_template_length scores.
+tinysr_score_t compute_dynamic_time_warping(recog_entry_t* match, utterance_t* utterance, tinysr_score_t* dp_row);
+
+// Build and free front-end plans. Returns NULL if the parameters are unusable: fft_length must be a
+// power of two no smaller than frame_length, and the mel filters must all get distinct center bins.
+tinysr_frontend_plan_t* tinysr_frontend_plan_create(int sample_rate, int frame_length, int shift_interval, int fft_length);
+tinysr_frontend_plan_t* tinysr_frontend_plan_create_default(void);
+void tinysr_frontend_plan_free(tinysr_frontend_plan_t* plan);
+
+#ifndef TINYSR_FIXED_POINT
+// Set up a resampler between the given rates. Any previous configuration is freed, and the
+// filter history starts out as silence. Returns non-zero on allocation failure.
+// Start from a zeroed tinysr_resampler_t the first time.
+int tinysr_resampler_configure(tinysr_resampler_t* resampler, int input_rate, int output_rate);
+void tinysr_resampler_free(tinysr_resampler_t* resampler);
+
+// Runs a configured (non-linear mode) resampler. Takes in as much of the input as fits, and produces
+// as many outputs as are ready, up to capacity. Returns the number of outputs, and sets *consumed to
+// the number of input samples taken. Call again with the remaining input until it is all consumed.
+int tinysr_resampler_process(tinysr_resampler_t* resampler, const tinysr_kernels_t* kernels, const float* in, int length, float* out, int capacity, int* consumed);
+#endif
+
+// Build and free FFT plans. The length is the real input length, and must be a power of two, at least 4.
+// Returns NULL if the length is unsupported.
+tinysr_fft_plan_t* tinysr_fft_plan_create(int real_length);
+void tinysr_fft_plan_free(tinysr_fft_plan_t* plan);
+
+// In-place iterative complex FFT of plan->complex_length points, on interleaved (real, imag) data.
+void tinysr_fft_complex(const tinysr_fft_plan_t* plan, float* data);
+
+// In-place FFT of plan->real_length real samples. On return the array holds bins [0, real_length/2)
+// as interleaved (real, imag) pairs, except that array[1] holds the purely real bin real_length/2,
+// in place of the imaginary part of bin 0, which is always zero.
+void tinysr_fft_real(const tinysr_fft_plan_t* plan, float* array);
 
-float gaussian_log_likelihood(gaussian_t* gauss, feature_vector_t* fv);
-float compute_dynamic_time_warping(recog_entry_t* match, utterance_t* utterance);
+// Computes the magnitude of the FFT of plan->real_length real samples.
+// The input array is destroyed. Only bins [0, real_length/2] inclusive are written to out, as
+// the rest are redundant by Hermitian symmetry. The two arrays must not overlap.
+void tinysr_fft_real_abs(const tinysr_fft_plan_t* plan, float* array, float* out);
 
-// This function is used internally for the FFT computation.
+// Reference implementation of the FFT, recursive and unplanned. It is slow, and only kept
+// around so that the tests can check the planned FFT against it.
 void tinysr_fft_dit(float* in_real, float* in_imag, int length, int stride, float* out_real, float* out_imag);
 void tinysr_abs_fft(float* array, int length);
 